@@ -904,7 +904,6 @@ TEST_P(JSITest, ExceptionStackTraceTest) {
   }
   EXPECT_NE(stack.find("world"), std::string::npos);
 }
-#if 0
 TEST_P(JSITest, PreparedJavaScriptSourceTest) {
   rt.evaluateJavaScript(std::make_unique<StringBuffer>("var q = 0;"), "");
   auto prep = rt.prepareJavaScript(std::make_unique<StringBuffer>("q++;"), "");
@@ -925,12 +924,11 @@ TEST_P(JSITest, PreparedJavaScriptURLInBacktrace) {
   try {
     rt.evaluatePreparedJavaScript(prep);
     FAIL() << "prepareJavaScript should have thrown an exception";
-  } catch (facebook::jsi::JSError err) {
+  } catch (const facebook::jsi::JSError& err) {
     EXPECT_NE(std::string::npos, err.getStack().find(sourceURL))
         << "Backtrace should contain source URL";
   }
 }
-#endif
 namespace {
 
 unsigned countOccurences(const std::string& of, const std::string& in) {
@@ -128,7 +128,7 @@ static inline int clz32(unsigned int a)
 #if defined(_MSC_VER)
     unsigned long ret = 0;
     _BitScanReverse(&ret, a);
-    return (int)ret;
+    return 31 - (int)ret;
 #else
     return __builtin_clz(a);
 #endif
@@ -140,7 +140,7 @@ static inline int clz64(uint64_t a)
 #if defined(_MSC_VER)
     unsigned long ret = 0;
     _BitScanReverse64(&ret, a);
-    return (int)ret;
+    return 63 - (int)ret;
 #else
     return __builtin_clzll(a);
 #endif
@@ -54,5 +54,6 @@ DEF(bne_char_pos, 5) /* pop one stack element and jump if equal to the character
  position */
 DEF(prev, 1) /* go to the previous char */
 DEF(simple_greedy_quant, 17)
+DEF(prefilter, 3) /* variable length, only at the start, see re_emit_prefilter() */
 
 #endif /* DEF */
@@ -106,6 +106,23 @@ static const REOpCode reopcode_info[REOP_COUNT] = {
 
 #define RE_HEADER_LEN 7
 
+/* implicit '.*?' loop emitted before the body of non sticky regexps */
+#define RE_IMPLICIT_LOOP_LEN (5 + 1 + 5)
+
+/* prefilter flags */
+#define RE_PREFILTER_ANCHORED      (1 << 0) /* can only match at position 0 */
+
+#define RE_PREFIX_LEN_MAX 16
+
+/* maximum number of instructions of the linear time engine program */
+#define RE_NFA_LEN_MAX 4096
+/* maximum nesting of the loops checking for empty iterations */
+#define RE_NFA_LOOP_DEPTH_MAX 4
+/* backtracking steps allowed per character, in addition to 1/16 of
+   the bytecode length. A step saves the whole state, so it costs
+   about as much as advancing all the threads of the linear engine. */
+#define RE_BACKTRACK_BUDGET_MIN 16
+
 static inline int is_digit(int c) {
     return c >= '0' && c <= '9';
 }
@@ -380,6 +397,19 @@ static __maybe_unused void lre_dump_bytecode(const uint8_t *buf,
                 }
             }
             break;
+        case REOP_prefilter:
+            {
+                int n, i;
+                n = get_u16(buf + pos + 1);
+                len += n;
+                printf(" flags=0x%x", buf[pos + 3]);
+                for(i = 0; i < buf[pos + 4] + buf[pos + 5]; i++) {
+                    if (i == 0 || i == buf[pos + 4])
+                        printf(i < buf[pos + 4] ? " prefix:" : " required:");
+                    printf(" 0x%04x", get_u16(buf + pos + 7 + i * 2));
+                }
+            }
+            break;
         default:
             break;
         }
@@ -1792,6 +1822,232 @@ static int compute_stack_size(const uint8_t *bc_buf, int bc_buf_len)
     return stack_size_max;
 }
 
+/* Extract match hints from the compiled body of a non sticky regexp
+   and insert them as a REOP_prefilter instruction before the implicit
+   loop:
+   - the literal characters every match starts with,
+   - the longest literal string every match contains (only used when
+     there is no prefix),
+   - the regexp can only match at position 0 ('^' without 'm' flag).
+   A body position is on every path if no jump located before it goes
+   past it, so the analysis is a linear scan. Return -1 if memory
+   error. */
+static int re_emit_prefilter(REParseState *s)
+{
+    const uint8_t *bc_buf;
+    uint16_t prefix[RE_PREFIX_LEN_MAX], required[RE_PREFIX_LEN_MAX];
+    uint16_t run[RE_PREFIX_LEN_MAX];
+    int pos, bc_len, len, opcode, prefix_len, required_len, run_len;
+    int flags, target, max_target, n, i;
+    uint32_t c;
+    BOOL in_prefix;
+    uint8_t *p;
+
+    bc_buf = s->byte_code.buf;
+    bc_len = s->byte_code.size;
+    flags = 0;
+    prefix_len = 0;
+    required_len = 0;
+    run_len = 0;
+    max_target = 0;
+    in_prefix = TRUE;
+    pos = RE_HEADER_LEN + RE_IMPLICIT_LOOP_LEN;
+    while (pos < bc_len) {
+        opcode = bc_buf[pos];
+        len = reopcode_info[opcode].size;
+        c = UINT32_MAX;
+        switch(opcode) {
+        case REOP_char:
+            c = get_u16(bc_buf + pos + 1);
+            break;
+        case REOP_char32:
+            c = get_u32(bc_buf + pos + 1);
+            break;
+        case REOP_line_start:
+            if (in_prefix && prefix_len == 0 &&
+                !(s->re_flags & LRE_FLAG_MULTILINE))
+                flags |= RE_PREFILTER_ANCHORED;
+            run_len = 0;
+            break;
+        case REOP_save_start:
+        case REOP_save_end:
+        case REOP_save_reset:
+            /* no effect on the consumed characters */
+            break;
+        case REOP_range:
+            len += get_u16(bc_buf + pos + 1) * 4;
+            goto other;
+        case REOP_range32:
+            len += get_u16(bc_buf + pos + 1) * 8;
+            goto other;
+        case REOP_goto:
+        case REOP_split_goto_first:
+        case REOP_split_next_first:
+        case REOP_loop:
+        case REOP_lookahead:
+        case REOP_negative_lookahead:
+        case REOP_bne_char_pos:
+            target = pos + 5 + (int)get_u32(bc_buf + pos + 1);
+            max_target = max_int(max_target, target);
+            goto other;
+        case REOP_simple_greedy_quant:
+            target = pos + 17 + (int)get_u32(bc_buf + pos + 1);
+            max_target = max_int(max_target, target);
+            goto other;
+        default:
+        other:
+            in_prefix = FALSE;
+            run_len = 0;
+            break;
+        }
+        if (c != UINT32_MAX) {
+            /* with ignore case, the input characters are canonicalized
+               before the comparison. In unicode mode, a surrogate may
+               be the second half of a pair. */
+            if (s->ignore_case || c > 0xffff ||
+                (s->is_utf16 && c >= 0xd800 && c <= 0xdfff)) {
+                in_prefix = FALSE;
+                run_len = 0;
+            } else if (in_prefix && prefix_len < RE_PREFIX_LEN_MAX) {
+                prefix[prefix_len++] = c;
+            } else {
+                in_prefix = FALSE;
+                if (max_target <= pos) {
+                    if (run_len < RE_PREFIX_LEN_MAX)
+                        run[run_len++] = c;
+                    if (run_len > required_len) {
+                        memcpy(required, run, run_len * sizeof(run[0]));
+                        required_len = run_len;
+                    }
+                } else {
+                    run_len = 0;
+                }
+            }
+        }
+        pos += len;
+    }
+    if (prefix_len != 0)
+        required_len = 0;
+    if (flags == 0 && prefix_len == 0 && required_len == 0)
+        return 0;
+
+    /* flags, prefix length, required string length, reserved, prefix,
+       required string */
+    n = 4 + (prefix_len + required_len) * 2;
+    if (dbuf_realloc(&s->byte_code, s->byte_code.size + 3 + n))
+        return -1;
+    dbuf_insert(&s->byte_code, RE_HEADER_LEN, 3 + n);
+    p = s->byte_code.buf + RE_HEADER_LEN;
+    p[0] = REOP_prefilter;
+    put_u16(p + 1, n);
+    p[3] = flags;
+    p[4] = prefix_len;
+    p[5] = required_len;
+    p[6] = 0;
+    p += 7;
+    for(i = 0; i < prefix_len; i++, p += 2)
+        put_u16(p, prefix[i]);
+    for(i = 0; i < required_len; i++, p += 2)
+        put_u16(p, required[i]);
+    return 0;
+}
+
+/* return the position of the regexp body in the bytecode, after the
+   prefilter and the implicit loop */
+static int re_get_body_start(const uint8_t *bc_buf, int re_flags)
+{
+    int pos = RE_HEADER_LEN;
+    if (bc_buf[pos] == REOP_prefilter)
+        pos += 3 + get_u16(bc_buf + pos + 1);
+    if (!(re_flags & LRE_FLAG_STICKY))
+        pos += RE_IMPLICIT_LOOP_LEN;
+    return pos;
+}
+
+/* Return the number of linear time engine instructions for the body
+   starting at 'pos' or -1 if the regexp cannot be run by it: back
+   references and lookarounds need the backtracking, and so do the
+   counted loops which keep a stack. */
+static int re_nfa_size(const uint8_t *bc_buf, int pos, int bc_len)
+{
+    int opcode, len, size, body_size, pos1, end, depth;
+    uint32_t quant_min, quant_max;
+
+    size = 0;
+    depth = 0;
+    while (pos < bc_len) {
+        opcode = bc_buf[pos];
+        len = reopcode_info[opcode].size;
+        switch(opcode) {
+        case REOP_range:
+            len += get_u16(bc_buf + pos + 1) * 4;
+            break;
+        case REOP_range32:
+            len += get_u16(bc_buf + pos + 1) * 8;
+            break;
+        case REOP_char:
+        case REOP_char32:
+        case REOP_dot:
+        case REOP_any:
+        case REOP_line_start:
+        case REOP_line_end:
+        case REOP_word_boundary:
+        case REOP_not_word_boundary:
+        case REOP_goto:
+        case REOP_split_goto_first:
+        case REOP_split_next_first:
+        case REOP_save_start:
+        case REOP_save_end:
+        case REOP_save_reset:
+        case REOP_match:
+            break;
+        case REOP_push_char_pos:
+            if (++depth > RE_NFA_LOOP_DEPTH_MAX)
+                return -1;
+            break;
+        case REOP_bne_char_pos:
+            depth--;
+            break;
+        case REOP_simple_greedy_quant:
+            /* the body only contains single character matches and
+               assertions, followed by REOP_match */
+            end = pos + 17 + get_u32(bc_buf + pos + 1);
+            quant_min = get_u32(bc_buf + pos + 5);
+            quant_max = get_u32(bc_buf + pos + 9);
+            body_size = 0;
+            for(pos1 = pos + 17; pos1 < end - 1; body_size++) {
+                len = reopcode_info[bc_buf[pos1]].size;
+                if (bc_buf[pos1] == REOP_range)
+                    len += get_u16(bc_buf + pos1 + 1) * 4;
+                else if (bc_buf[pos1] == REOP_range32)
+                    len += get_u16(bc_buf + pos1 + 1) * 8;
+                pos1 += len;
+            }
+            /* 'min' copies of the body, then a loop or 'max - min'
+               optional copies */
+            if (quant_min > RE_NFA_LEN_MAX ||
+                (quant_max != INT32_MAX && quant_max - quant_min > RE_NFA_LEN_MAX))
+                return -1;
+            size += quant_min * body_size;
+            if (quant_max == INT32_MAX)
+                size += body_size + 2;
+            else
+                size += (quant_max - quant_min) * (body_size + 1);
+            if (size > RE_NFA_LEN_MAX)
+                return -1;
+            pos = end;
+            continue;
+        default:
+            return -1;
+        }
+        size++;
+        if (size > RE_NFA_LEN_MAX)
+            return -1;
+        pos += len;
+    }
+    return size;
+}
+
 /* 'buf' must be a zero terminated UTF-8 string of length buf_len.
    Return NULL if error and allocate an error message in *perror_msg,
    otherwise the compiled bytecode and its length in plen.
@@ -1866,6 +2122,16 @@ uint8_t *lre_compile(int *plen, char *error_msg, int error_msg_size,
         goto error;
     }
     
+    /* relative jumps are not affected by the insertion at the start */
+    if (!is_sticky && re_emit_prefilter(s)) {
+        re_parse_error(s, "out of memory");
+        goto error;
+    }
+
+    if (re_nfa_size(s->byte_code.buf, re_get_body_start(s->byte_code.buf, re_flags),
+                    s->byte_code.size) >= 0)
+        s->byte_code.buf[RE_HEADER_FLAGS] |= LRE_FLAG_LINEAR;
+
     s->byte_code.buf[RE_HEADER_CAPTURE_COUNT] = s->capture_count;
     s->byte_code.buf[RE_HEADER_STACK_SIZE] = stack_size;
     put_u32(s->byte_code.buf + 3, s->byte_code.size - RE_HEADER_LEN);
@@ -2019,6 +2285,10 @@ typedef struct {
     BOOL is_utf16;
     void *opaque; /* used for stack overflow check */
 
+    /* remaining backtracking steps before switching to the linear
+       time engine */
+    int64_t budget;
+
     size_t state_size;
     uint8_t *state_stack;
     size_t state_stack_size;
@@ -2036,6 +2306,8 @@ static int push_state(REExecContext *s,
     size_t new_size, i, n;
     StackInt *stack_buf;
 
+    if (unlikely(--s->budget < 0))
+        return -1;
     if (unlikely((s->state_stack_len + 1) > s->state_stack_size)) {
         /* reallocate the stack */
         new_size = s->state_stack_size * 3 / 2;
@@ -2115,6 +2387,8 @@ static intptr_t lre_exec_backtrack(REExecContext *s, uint8_t **capture,
                     } else if (rs->type == RE_EXEC_STATE_GREEDY_QUANT) {
                         if (!ret) {
                             uint32_t char_count, i;
+                            if (unlikely(--s->budget < 0))
+                                return -1;
                             memcpy(capture, rs->buf,
                                    sizeof(capture[0]) * 2 * s->capture_count);
                             stack_len = rs->stack_len;
@@ -2449,6 +2723,8 @@ static intptr_t lre_exec_backtrack(REExecContext *s, uint8_t **capture,
                         break;
                     cptr = (uint8_t *)res;
                     q++;
+                    if (unlikely(--s->budget < 0))
+                        return -1;
                     if (q >= quant_max && quant_max != INT32_MAX)
                         break;
                 }
@@ -2471,6 +2747,712 @@ static intptr_t lre_exec_backtrack(REExecContext *s, uint8_t **capture,
     }
 }
 
+/* Return the first position >= cindex where the 'len' characters of
+   'str' are found or -1 if none. */
+static int lre_find_string(const uint8_t *cbuf, int shift, int cindex, int clen,
+                           const uint16_t *str, int len)
+{
+    int i, last;
+    uint16_t c0;
+
+    last = clen - len;
+    if (cindex > last)
+        return -1;
+    c0 = str[0];
+    if (shift == 0) {
+        const uint8_t *p, *end;
+        for(i = 0; i < len; i++) {
+            if (str[i] > 0xff)
+                return -1;
+        }
+        p = cbuf + cindex;
+        end = cbuf + last + 1;
+        for(;;) {
+            p = memchr(p, c0, end - p);
+            if (!p)
+                return -1;
+            for(i = 1; i < len && p[i] == str[i]; i++)
+                continue;
+            if (i == len)
+                return p - cbuf;
+            p++;
+        }
+    } else {
+        const uint16_t *p, *end;
+        p = (const uint16_t *)cbuf + cindex;
+        end = (const uint16_t *)cbuf + last + 1;
+        for(; p < end; p++) {
+            if (*p != c0)
+                continue;
+            for(i = 1; i < len && p[i] == str[i]; i++)
+                continue;
+            if (i == len)
+                return p - (const uint16_t *)cbuf;
+        }
+        return -1;
+    }
+}
+
+typedef struct {
+    int flags;
+    int prefix_len;
+    int required_len;
+    uint16_t prefix[RE_PREFIX_LEN_MAX];
+    uint16_t required[RE_PREFIX_LEN_MAX];
+} REPrefilter;
+
+/* 'pc' points to a REOP_prefilter instruction */
+static void re_get_prefilter(REPrefilter *pf, const uint8_t *pc)
+{
+    const uint8_t *p;
+    int i;
+
+    pf->flags = pc[3];
+    pf->prefix_len = pc[4];
+    pf->required_len = pc[5];
+    p = pc + 7;
+    for(i = 0; i < pf->prefix_len; i++, p += 2)
+        pf->prefix[i] = get_u16(p);
+    for(i = 0; i < pf->required_len; i++, p += 2)
+        pf->required[i] = get_u16(p);
+}
+
+/* execute a regexp starting with a REOP_prefilter instruction: the
+   backtracking interpreter only runs at the candidate positions */
+static intptr_t lre_exec_prefilter(REExecContext *s, uint8_t **capture,
+                                   StackInt *stack_buf, const uint8_t *pc,
+                                   const REPrefilter *pf,
+                                   int cindex, int clen, int shift)
+{
+    const uint8_t *body;
+    intptr_t ret;
+    int i;
+
+    /* 'body' points to the implicit loop */
+    body = pc + 3 + get_u16(pc + 1);
+    if (pf->flags & RE_PREFILTER_ANCHORED) {
+        if (cindex != 0)
+            return 0;
+        return lre_exec_backtrack(s, capture, stack_buf, 0,
+                                  body + RE_IMPLICIT_LOOP_LEN, s->cbuf, FALSE);
+    }
+    if (pf->prefix_len == 0) {
+        return lre_exec_backtrack(s, capture, stack_buf, 0, body,
+                                  s->cbuf + (cindex << shift), FALSE);
+    }
+    for(;;) {
+        cindex = lre_find_string(s->cbuf, shift, cindex, clen,
+                                 pf->prefix, pf->prefix_len);
+        if (cindex < 0)
+            return 0;
+        /* a failed attempt may leave partial captures */
+        for(i = 0; i < s->capture_count * 2; i++)
+            capture[i] = NULL;
+        ret = lre_exec_backtrack(s, capture, stack_buf, 0,
+                                 body + RE_IMPLICIT_LOOP_LEN,
+                                 s->cbuf + (cindex << shift), FALSE);
+        if (ret != 0)
+            return ret;
+        cindex++;
+    }
+}
+
+/* Linear time engine (Pike VM): the body is translated into a program
+   whose threads all advance one character at a time. A thread only
+   carries its program counter and its captures, so threads reaching
+   the same instruction at the same position are merged, keeping the
+   one with the highest priority. The matches are the same as the
+   backtracking ones. */
+
+typedef struct {
+    uint8_t op; /* REOP_x */
+    uint8_t val2; /* last capture for REOP_save_reset */
+    uint32_t val; /* character or capture index */
+    int next;
+    int alt; /* second choice of REOP_split_x */
+    const uint8_t *ranges; /* REOP_range and REOP_range32: count followed by the ranges */
+    /* innermost REOP_push_char_pos whose loop contains the
+       instruction or -1. The state of these loops is part of the
+       state of the instructions which do not match characters. */
+    int outer;
+    int mark; /* index of the first visit mark */
+} RENFAInst;
+
+typedef struct {
+    /* >= 0: explore 'pc', in [-ncap, -1]: restore the capture slot
+       -pc - 1, < -ncap: leave the REOP_push_char_pos instruction -pc - 1 - ncap */
+    int pc;
+    uint8_t *ptr;
+} RENFAStackEntry;
+
+typedef struct {
+    RENFAInst *prog;
+    int prog_len;
+    int ncap;
+    int *mark; /* generation of the last visit of each instruction state */
+    int gen;
+    /* REOP_push_char_pos instructions on the current path: their loop
+       iteration has not advanced yet */
+    uint8_t *on_path;
+    uint8_t **cur; /* captures of the thread being added */
+    RENFAStackEntry *stack;
+    int stack_len;
+    int stack_size;
+} RENFAContext;
+
+typedef struct {
+    int count;
+    int *pc;
+    uint8_t **capture; /* 'ncap' slots per thread */
+} RENFAThreadList;
+
+/* translate one single character match or assertion, return its bytecode length */
+static int re_nfa_emit_simple(RENFAInst *inst, const uint8_t *bc)
+{
+    int len = reopcode_info[bc[0]].size;
+
+    inst->op = bc[0];
+    switch(bc[0]) {
+    case REOP_char:
+        inst->val = get_u16(bc + 1);
+        break;
+    case REOP_char32:
+        inst->op = REOP_char;
+        inst->val = get_u32(bc + 1);
+        break;
+    case REOP_range:
+        inst->ranges = bc + 1;
+        len += get_u16(bc + 1) * 4;
+        break;
+    case REOP_range32:
+        inst->ranges = bc + 1;
+        len += get_u16(bc + 1) * 8;
+        break;
+    default:
+        break;
+    }
+    return len;
+}
+
+/* translate the body starting at 'start'. 'map' gives the instruction
+   index of each bytecode position. */
+static void re_nfa_translate(RENFAInst *prog, int *map, const uint8_t *bc_buf,
+                             int start, int bc_len)
+{
+    int pos, opcode, len, n, pass, end, body_pos, k, j, loop, exit_pos, outer;
+    int push_stack[STACK_SIZE_MAX], push_count;
+    uint32_t quant_min, quant_max, q;
+    RENFAInst *inst;
+
+    /* the first pass computes the map, the second one emits the
+       instructions with the resolved jumps */
+    for(pass = 0; pass < 2; pass++) {
+        n = 0;
+        push_count = 0;
+        pos = start;
+        while (pos < bc_len) {
+            opcode = bc_buf[pos];
+            len = reopcode_info[opcode].size;
+            if (pass == 0)
+                map[pos - start] = n;
+            inst = &prog[n];
+            outer = push_count > 0 ? push_stack[push_count - 1] : -1;
+            if (pass == 1)
+                inst->outer = outer;
+            switch(opcode) {
+            case REOP_simple_greedy_quant:
+                end = pos + 17 + get_u32(bc_buf + pos + 1);
+                quant_min = get_u32(bc_buf + pos + 5);
+                quant_max = get_u32(bc_buf + pos + 9);
+                /* count the body instructions */
+                k = 0;
+                for(body_pos = pos + 17; body_pos < end - 1; k++) {
+                    RENFAInst tmp;
+                    body_pos += re_nfa_emit_simple(&tmp, bc_buf + body_pos);
+                }
+                if (quant_max == INT32_MAX)
+                    exit_pos = n + quant_min * k + k + 2;
+                else
+                    exit_pos = n + quant_min * k + (quant_max - quant_min) * (k + 1);
+                for(q = 0; q < quant_min; q++) {
+                    body_pos = pos + 17;
+                    for(j = 0; j < k; j++, n++) {
+                        if (pass == 1) {
+                            body_pos += re_nfa_emit_simple(&prog[n], bc_buf + body_pos);
+                            prog[n].next = n + 1;
+                            prog[n].outer = outer;
+                        }
+                    }
+                }
+                if (quant_max == INT32_MAX) {
+                    /* greedy loop: prefer one more iteration */
+                    loop = n;
+                    if (pass == 1) {
+                        prog[n].op = REOP_split_next_first;
+                        prog[n].next = n + 1;
+                        prog[n].alt = exit_pos;
+                        prog[n].outer = outer;
+                    }
+                    n++;
+                    body_pos = pos + 17;
+                    for(j = 0; j < k; j++, n++) {
+                        if (pass == 1) {
+                            body_pos += re_nfa_emit_simple(&prog[n], bc_buf + body_pos);
+                            prog[n].next = n + 1;
+                            prog[n].outer = outer;
+                        }
+                    }
+                    if (pass == 1) {
+                        prog[n].op = REOP_goto;
+                        prog[n].next = loop;
+                        prog[n].outer = outer;
+                    }
+                    n++;
+                } else {
+                    for(q = quant_min; q < quant_max; q++) {
+                        if (pass == 1) {
+                            prog[n].op = REOP_split_next_first;
+                            prog[n].next = n + 1;
+                            prog[n].alt = exit_pos;
+                            prog[n].outer = outer;
+                        }
+                        n++;
+                        body_pos = pos + 17;
+                        for(j = 0; j < k; j++, n++) {
+                            if (pass == 1) {
+                                body_pos += re_nfa_emit_simple(&prog[n], bc_buf + body_pos);
+                                prog[n].next = n + 1;
+                                prog[n].outer = outer;
+                            }
+                        }
+                    }
+                }
+                pos = end;
+                continue;
+            case REOP_goto:
+                if (pass == 1) {
+                    inst->op = opcode;
+                    inst->next = map[pos + 5 + (int)get_u32(bc_buf + pos + 1) - start];
+                }
+                break;
+            case REOP_split_goto_first:
+            case REOP_split_next_first:
+                if (pass == 1) {
+                    int target = map[pos + 5 + (int)get_u32(bc_buf + pos + 1) - start];
+                    /* 'next' is always the first choice */
+                    inst->op = REOP_split_next_first;
+                    if (opcode == REOP_split_next_first) {
+                        inst->next = n + 1;
+                        inst->alt = target;
+                    } else {
+                        inst->next = target;
+                        inst->alt = n + 1;
+                    }
+                }
+                break;
+            case REOP_save_start:
+            case REOP_save_end:
+                if (pass == 1) {
+                    inst->op = opcode;
+                    inst->val = bc_buf[pos + 1];
+                    inst->next = n + 1;
+                }
+                break;
+            case REOP_save_reset:
+                if (pass == 1) {
+                    inst->op = opcode;
+                    inst->val = bc_buf[pos + 1];
+                    inst->val2 = bc_buf[pos + 2];
+                    inst->next = n + 1;
+                }
+                break;
+            case REOP_push_char_pos:
+                /* the empty iteration checks are properly nested */
+                push_stack[push_count++] = n;
+                if (pass == 1) {
+                    inst->op = opcode;
+                    inst->next = n + 1;
+                }
+                break;
+            case REOP_bne_char_pos:
+                push_count--;
+                if (pass == 1) {
+                    inst->op = opcode;
+                    inst->val = push_stack[push_count];
+                    inst->next = map[pos + 5 + (int)get_u32(bc_buf + pos + 1) - start];
+                    inst->alt = n + 1;
+                }
+                break;
+            default:
+                len = re_nfa_emit_simple(inst, bc_buf + pos);
+                inst->next = n + 1;
+                break;
+            }
+            n++;
+            pos += len;
+        }
+        if (pass == 0)
+            map[bc_len - start] = n;
+    }
+}
+
+static BOOL re_nfa_range_match(const uint8_t *ranges, BOOL is_range32, uint32_t c)
+{
+    int idx_min, idx_max, idx, n;
+    uint32_t low, high;
+
+    n = get_u16(ranges);
+    ranges += 2;
+    idx_min = 0;
+    idx_max = n - 1;
+    /* 0xffff in for last value means +infinity */
+    if (!is_range32 && c >= 0xffff && get_u16(ranges + idx_max * 4 + 2) == 0xffff)
+        return TRUE;
+    while (idx_min <= idx_max) {
+        idx = (idx_min + idx_max) / 2;
+        if (is_range32) {
+            low = get_u32(ranges + idx * 8);
+            high = get_u32(ranges + idx * 8 + 4);
+        } else {
+            low = get_u16(ranges + idx * 4);
+            high = get_u16(ranges + idx * 4 + 2);
+        }
+        if (c < low)
+            idx_max = idx - 1;
+        else if (c > high)
+            idx_min = idx + 1;
+        else
+            return TRUE;
+    }
+    return FALSE;
+}
+
+static int re_nfa_push(REExecContext *s, RENFAContext *nc, int pc, uint8_t *ptr)
+{
+    if (unlikely(nc->stack_len >= nc->stack_size)) {
+        int new_size = max_int(nc->stack_size * 3 / 2, 16);
+        RENFAStackEntry *new_stack;
+        new_stack = lre_realloc(s->opaque, nc->stack,
+                                new_size * sizeof(nc->stack[0]));
+        if (!new_stack)
+            return -1;
+        nc->stack = new_stack;
+        nc->stack_size = new_size;
+    }
+    nc->stack[nc->stack_len].pc = pc;
+    nc->stack[nc->stack_len].ptr = ptr;
+    nc->stack_len++;
+    return 0;
+}
+
+/* evaluate an assertion at 'cptr' */
+static BOOL re_nfa_check(REExecContext *s, int op, const uint8_t *cptr)
+{
+    int cbuf_type = s->cbuf_type;
+    uint32_t c;
+    BOOL v1, v2;
+
+    switch(op) {
+    case REOP_line_start:
+        if (cptr == s->cbuf)
+            return TRUE;
+        if (!s->multi_line)
+            return FALSE;
+        PEEK_PREV_CHAR(c, cptr, s->cbuf);
+        return is_line_terminator(c);
+    case REOP_line_end:
+        if (cptr == s->cbuf_end)
+            return TRUE;
+        if (!s->multi_line)
+            return FALSE;
+        PEEK_CHAR(c, cptr, s->cbuf_end);
+        return is_line_terminator(c);
+    default:
+        if (cptr == s->cbuf) {
+            v1 = FALSE;
+        } else {
+            PEEK_PREV_CHAR(c, cptr, s->cbuf);
+            v1 = is_word_char(c);
+        }
+        if (cptr >= s->cbuf_end) {
+            v2 = FALSE;
+        } else {
+            PEEK_CHAR(c, cptr, s->cbuf_end);
+            v2 = is_word_char(c);
+        }
+        return v1 ^ v2 ^ (op == REOP_not_word_boundary);
+    }
+}
+
+/* add the thread starting at 'pc0' with the captures 'capture' at
+   position 'cptr' to 'list': follow the jumps, captures and
+   assertions up to the character matches. Return -1 if memory error. */
+static int re_nfa_add_thread(REExecContext *s, RENFAContext *nc,
+                             RENFAThreadList *list, int pc0,
+                             uint8_t **capture, const uint8_t *cptr)
+{
+    RENFAInst *inst;
+    RENFAStackEntry *e;
+    int pc, i, m, l, bit;
+
+    memcpy(nc->cur, capture, nc->ncap * sizeof(nc->cur[0]));
+    nc->stack_len = 0;
+    if (re_nfa_push(s, nc, pc0, NULL))
+        return -1;
+    while (nc->stack_len > 0) {
+        e = &nc->stack[--nc->stack_len];
+        if (e->pc < 0) {
+            if (e->pc >= -nc->ncap)
+                nc->cur[-e->pc - 1] = e->ptr;
+            else
+                nc->on_path[-e->pc - 1 - nc->ncap] = FALSE;
+            continue;
+        }
+        pc = e->pc;
+        for(;;) {
+            inst = &nc->prog[pc];
+            /* the instructions in loops checking for empty iterations
+               may be visited once per state of these checks */
+            m = inst->mark;
+            bit = 1;
+            for(l = inst->outer; l >= 0; l = nc->prog[l].outer) {
+                if (nc->on_path[l])
+                    m += bit;
+                bit <<= 1;
+            }
+            if (nc->mark[m] == nc->gen)
+                break;
+            nc->mark[m] = nc->gen;
+            switch(inst->op) {
+            case REOP_goto:
+                pc = inst->next;
+                continue;
+            case REOP_split_next_first:
+                if (re_nfa_push(s, nc, inst->alt, NULL))
+                    return -1;
+                pc = inst->next;
+                continue;
+            case REOP_save_start:
+            case REOP_save_end:
+                i = 2 * inst->val + inst->op - REOP_save_start;
+                if (re_nfa_push(s, nc, -i - 1, nc->cur[i]))
+                    return -1;
+                nc->cur[i] = (uint8_t *)cptr;
+                pc = inst->next;
+                continue;
+            case REOP_save_reset:
+                for(i = 2 * inst->val; i < 2 * inst->val2 + 2; i++) {
+                    if (re_nfa_push(s, nc, -i - 1, nc->cur[i]))
+                        return -1;
+                    nc->cur[i] = NULL;
+                }
+                pc = inst->next;
+                continue;
+            case REOP_push_char_pos:
+                if (re_nfa_push(s, nc, -pc - 1 - nc->ncap, NULL))
+                    return -1;
+                nc->on_path[pc] = TRUE;
+                pc = inst->next;
+                continue;
+            case REOP_bne_char_pos:
+                /* stop the loop if the iteration did not advance */
+                if (nc->on_path[inst->val])
+                    pc = inst->alt;
+                else
+                    pc = inst->next;
+                continue;
+            case REOP_line_start:
+            case REOP_line_end:
+            case REOP_word_boundary:
+            case REOP_not_word_boundary:
+                if (!re_nfa_check(s, inst->op, cptr))
+                    break;
+                pc = inst->next;
+                continue;
+            default:
+                /* character match or REOP_match */
+                list->pc[list->count] = pc;
+                memcpy(list->capture + list->count * nc->ncap, nc->cur,
+                       nc->ncap * sizeof(nc->cur[0]));
+                list->count++;
+                break;
+            }
+            break;
+        }
+    }
+    return 0;
+}
+
+/* run the linear time engine. Return 1 if match, 0 if no match or -1
+   if memory error. */
+static int lre_exec_linear(REExecContext *s, uint8_t **capture,
+                           const uint8_t *bc_buf, int cindex, int clen,
+                           int shift)
+{
+    RENFAContext nc_s, *nc = &nc_s;
+    RENFAThreadList lists[2], *clist, *nlist, *tmp;
+    REPrefilter pf;
+    RENFAInst *inst;
+    const uint8_t *cptr, *cptr1, *cbuf_end;
+    uint8_t *mem, **null_capture;
+    int re_flags, start, bc_len, prog_len, ncap, cbuf_type, i, ret, *map;
+    int mark_len, l;
+    BOOL matched, start_once, started;
+    uint32_t c, c_canon;
+    size_t mem_size;
+
+    re_flags = bc_buf[RE_HEADER_FLAGS];
+    bc_len = RE_HEADER_LEN + get_u32(bc_buf + 3);
+    start = re_get_body_start(bc_buf, re_flags);
+    prog_len = re_nfa_size(bc_buf, start, bc_len);
+    if (prog_len < 0)
+        return -1;
+    pf.flags = 0;
+    pf.prefix_len = 0;
+    pf.required_len = 0;
+    if (bc_buf[RE_HEADER_LEN] == REOP_prefilter)
+        re_get_prefilter(&pf, bc_buf + RE_HEADER_LEN);
+    start_once = (re_flags & LRE_FLAG_STICKY) || (pf.flags & RE_PREFILTER_ANCHORED);
+    if ((pf.flags & RE_PREFILTER_ANCHORED) && cindex != 0)
+        return 0;
+
+    /* program, captures of the current thread, of the unset captures
+       and of the two thread lists, bytecode map, thread list
+       instructions, path flags */
+    ncap = s->capture_count * 2;
+    mem_size = prog_len * sizeof(RENFAInst) +
+        ((2 * prog_len + 2) * ncap) * sizeof(uint8_t *) +
+        (bc_len - start + 1) * sizeof(int) +
+        prog_len * sizeof(int) * 2 +
+        prog_len;
+    mem = lre_realloc(s->opaque, NULL, mem_size);
+    if (!mem)
+        return -1;
+    memset(mem, 0, mem_size);
+    nc->prog = (RENFAInst *)mem;
+    nc->cur = (uint8_t **)(nc->prog + prog_len);
+    null_capture = nc->cur + ncap;
+    lists[0].capture = null_capture + ncap;
+    lists[1].capture = lists[0].capture + prog_len * ncap;
+    map = (int *)(lists[1].capture + prog_len * ncap);
+    lists[0].pc = map + (bc_len - start + 1);
+    lists[1].pc = lists[0].pc + prog_len;
+    nc->on_path = (uint8_t *)(lists[1].pc + prog_len);
+    nc->prog_len = prog_len;
+    nc->ncap = ncap;
+    nc->gen = 1;
+    nc->stack = NULL;
+    nc->stack_len = 0;
+    nc->stack_size = 0;
+    re_nfa_translate(nc->prog, map, bc_buf, start, bc_len);
+
+    /* one mark per state of the enclosing loops. The character
+       matches are left in the same state whatever the loops. */
+    mark_len = 0;
+    for(i = 0; i < prog_len; i++) {
+        inst = &nc->prog[i];
+        switch(inst->op) {
+        case REOP_char:
+        case REOP_dot:
+        case REOP_any:
+        case REOP_range:
+        case REOP_range32:
+        case REOP_match:
+            inst->outer = -1;
+            break;
+        }
+        inst->mark = mark_len;
+        mark_len++;
+        for(l = inst->outer; l >= 0; l = nc->prog[l].outer)
+            mark_len += mark_len - inst->mark;
+    }
+    nc->mark = lre_realloc(s->opaque, NULL, mark_len * sizeof(nc->mark[0]));
+    if (!nc->mark)
+        goto fail;
+    memset(nc->mark, 0, mark_len * sizeof(nc->mark[0]));
+
+    cbuf_type = s->cbuf_type;
+    cbuf_end = s->cbuf_end;
+    clist = &lists[0];
+    nlist = &lists[1];
+    clist->count = 0;
+    matched = FALSE;
+    started = FALSE;
+    ret = 0;
+    cptr = s->cbuf + (cindex << shift);
+    for(;;) {
+        if (!matched && (!start_once || !started)) {
+            if (clist->count == 0 && pf.prefix_len != 0) {
+                /* no thread in progress: skip to the next candidate */
+                cindex = lre_find_string(s->cbuf, shift, (cptr - s->cbuf) >> shift,
+                                         clen, pf.prefix, pf.prefix_len);
+                if (cindex < 0)
+                    break;
+                cptr = s->cbuf + (cindex << shift);
+            }
+            /* the new thread has the lowest priority */
+            if (re_nfa_add_thread(s, nc, clist, 0, null_capture, cptr))
+                goto fail;
+            started = TRUE;
+        }
+        if (clist->count == 0 && (matched || start_once))
+            break;
+
+        c = 0;
+        cptr1 = cptr;
+        if (cptr < cbuf_end)
+            GET_CHAR(c, cptr1, cbuf_end);
+        c_canon = s->ignore_case ? lre_canonicalize(c, s->is_utf16) : c;
+        nc->gen++;
+        nlist->count = 0;
+        for(i = 0; i < clist->count; i++) {
+            BOOL res;
+            inst = &nc->prog[clist->pc[i]];
+            if (inst->op == REOP_match) {
+                /* the lower priority threads are discarded */
+                memcpy(capture, clist->capture + i * ncap, ncap * sizeof(capture[0]));
+                matched = TRUE;
+                ret = 1;
+                break;
+            }
+            if (cptr >= cbuf_end)
+                continue;
+            switch(inst->op) {
+            case REOP_char:
+                res = (inst->val == c_canon);
+                break;
+            case REOP_dot:
+                res = !is_line_terminator(c);
+                break;
+            case REOP_any:
+                res = TRUE;
+                break;
+            default:
+                res = re_nfa_range_match(inst->ranges, inst->op == REOP_range32,
+                                         c_canon);
+                break;
+            }
+            if (res && re_nfa_add_thread(s, nc, nlist, inst->next,
+                                         clist->capture + i * ncap, cptr1))
+                goto fail;
+        }
+        if (cptr >= cbuf_end)
+            break;
+        tmp = clist;
+        clist = nlist;
+        nlist = tmp;
+        cptr = cptr1;
+    }
+ done:
+    lre_realloc(s->opaque, nc->mark, 0);
+    lre_realloc(s->opaque, nc->stack, 0);
+    lre_realloc(s->opaque, mem, 0);
+    return ret;
+ fail:
+    ret = -1;
+    goto done;
+}
+
 /* Return 1 if match, 0 if not match or -1 if error. cindex is the
    starting position of the match and must be such as 0 <= cindex <=
    clen. */
@@ -2479,6 +3461,7 @@ int lre_exec(uint8_t **capture,
              int cbuf_type, void *opaque)
 {
     REExecContext s_s, *s = &s_s;
+    REPrefilter pf;
     int re_flags, i, alloca_size, ret;
     StackInt *stack_buf;
     
@@ -2494,6 +3477,16 @@ int lre_exec(uint8_t **capture,
     if (s->cbuf_type == 1 && s->is_utf16)
         s->cbuf_type = 2;
     s->opaque = opaque;
+    /* the backtracking is fast for most regexps but may take an
+       exponential time. When the linear time engine can run the
+       regexp, the backtracking stops after about as many steps as it
+       would need and the linear time engine takes over. */
+    if (re_flags & LRE_FLAG_LINEAR) {
+        s->budget = (int64_t)(clen - cindex + 1) *
+            ((get_u32(bc_buf + 3) >> 4) + RE_BACKTRACK_BUDGET_MIN);
+    } else {
+        s->budget = INT64_MAX;
+    }
 
     s->state_size = sizeof(REExecState) +
         s->capture_count * sizeof(capture[0]) * 2 +
@@ -2506,9 +3499,26 @@ int lre_exec(uint8_t **capture,
         capture[i] = NULL;
     alloca_size = s->stack_size_max * sizeof(stack_buf[0]);
     stack_buf = alloca(alloca_size);
-    ret = lre_exec_backtrack(s, capture, stack_buf, 0, bc_buf + RE_HEADER_LEN,
-                             cbuf + (cindex << cbuf_type), FALSE);
+    if (bc_buf[RE_HEADER_LEN] == REOP_prefilter) {
+        re_get_prefilter(&pf, bc_buf + RE_HEADER_LEN);
+        if (pf.required_len != 0 &&
+            lre_find_string(cbuf, cbuf_type, cindex, clen,
+                            pf.required, pf.required_len) < 0) {
+            ret = 0;
+        } else {
+            ret = lre_exec_prefilter(s, capture, stack_buf, bc_buf + RE_HEADER_LEN,
+                                     &pf, cindex, clen, cbuf_type);
+        }
+    } else {
+        ret = lre_exec_backtrack(s, capture, stack_buf, 0, bc_buf + RE_HEADER_LEN,
+                                 cbuf + (cindex << cbuf_type), FALSE);
+    }
     lre_realloc(s->opaque, s->state_stack, 0);
+    if (ret < 0 && s->budget < 0) {
+        for(i = 0; i < s->capture_count * 2; i++)
+            capture[i] = NULL;
+        ret = lre_exec_linear(s, capture, bc_buf, cindex, clen, cbuf_type);
+    }
     return ret;
 }
 
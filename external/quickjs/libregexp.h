@@ -37,6 +37,7 @@
 #define LRE_FLAG_UTF16      (1 << 4)
 #define LRE_FLAG_STICKY     (1 << 5)
 
+#define LRE_FLAG_LINEAR       (1 << 6) /* no back reference or lookaround: can run in linear time */
 #define LRE_FLAG_NAMED_GROUPS (1 << 7) /* named groups are present in the regexp */
 
 uint8_t *lre_compile(int *plen, char *error_msg, int error_msg_size,
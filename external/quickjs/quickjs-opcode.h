@@ -76,6 +76,7 @@ DEF(      push_this, 1, 0, 1, none) /* only used at the start of a function */
 DEF(     push_false, 1, 0, 1, none)
 DEF(      push_true, 1, 0, 1, none)
 DEF(         object, 1, 0, 1, none)
+DEF( object_literal, 3, 1, 1, npop) /* values... template -> obj */
 DEF( special_object, 2, 0, 1, u8) /* only used at the start of a function */
 DEF(           rest, 3, 0, 1, u16) /* only used at the start of a function */
 
@@ -261,6 +262,12 @@ DEF(is_undefined_or_null, 1, 1, 1, none)
 DEF(      mul_pow10, 1, 2, 1, none)
 DEF(       math_mod, 1, 2, 1, none)
 #endif
+/* get_field, get_field2 and put_field with an inline cache index instead
+   of the atom. Only created at run time, never serialized. Must be in the
+   same order as the uncached opcodes. */
+DEF(   get_field_ic, 5, 1, 1, u32)
+DEF(  get_field2_ic, 5, 1, 2, u32)
+DEF(   put_field_ic, 5, 2, 0, u32)
 /* must be the last non short and non temporary opcode */
 DEF(            nop, 1, 0, 0, none) 
 
@@ -360,6 +367,13 @@ DEF(          call3, 1, 1, 1, npopx)
 DEF(   is_undefined, 1, 1, 1, none)
 DEF(        is_null, 1, 1, 1, none)
 DEF(    is_function, 1, 1, 1, none)
+
+/* superinstructions chosen from CONFIG_OPCODE_HISTOGRAM runs, only
+   emitted by resolve_labels */
+DEF(      if_not_lt, 5, 2, 0, label) /* lt if_false */
+DEF(     if_not_lt8, 2, 2, 0, label8) /* lt if_false8 */
+DEF(  inc_loc_check, 3, 0, 0, loc) /* get_loc_check inc dup put_loc_check drop */
+DEF(  dec_loc_check, 3, 0, 0, loc) /* get_loc_check dec dup put_loc_check drop */
 #endif
 
 #undef DEF
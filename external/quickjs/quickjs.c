@@ -48,6 +48,15 @@
 #include "libbf.h"
 #endif
 
+/* vector width used by the tokenizer to skip runs of plain ASCII */
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SCAN_VEC_SIZE    32
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SCAN_VEC_SIZE    16
+#endif
+
 #define OPTIMIZE         1
 #define SHORT_OPCODES    1
 #if defined(EMSCRIPTEN)
@@ -101,6 +110,9 @@
 //#define DUMP_MODULE_RESOLVE
 //#define DUMP_PROMISE
 //#define DUMP_READ_OBJECT
+/* count the executed opcodes, opcode pairs and opcode triples, dumped
+   by JS_FreeRuntime(). Used to choose the superinstructions. */
+//#define CONFIG_OPCODE_HISTOGRAM
 
 /* test the GC by forcing it before each object allocation */
 //#define FORCE_GC_AT_MALLOC
@@ -201,6 +213,12 @@ typedef enum JSErrorEnum {
 #define JS_MAX_LOCAL_VARS 65536
 #define JS_STACK_SIZE_MAX 65536
 #define JS_STRING_LEN_MAX ((1 << 30) - 1)
+/* concatenations shorter than this are copied to a flat string */
+#define JS_STRING_ROPE_SHORT_LEN 256
+#define JS_STRING_ROPE_MAX_DEPTH 48
+/* compiled RegExp bytecode cache, longer patterns are not cached */
+#define JS_REGEXP_CACHE_SIZE 64
+#define JS_REGEXP_CACHE_PATTERN_MAX 1024
 
 #if defined(_WIN32)
 #define __exception /* */
@@ -212,6 +230,7 @@ typedef int64_t ssize_t;
 typedef struct JSShape JSShape;
 typedef struct JSString JSString;
 typedef struct JSString JSAtomStruct;
+typedef struct JSBacktrace JSBacktrace;
 
 typedef enum {
     JS_GC_PHASE_NONE,
@@ -241,6 +260,14 @@ typedef struct {
 } JSNumericOperations;
 #endif
 
+typedef struct JSRegExpCacheEntry {
+    JSString *pattern; /* NULL if free entry */
+    JSString *bytecode;
+    uint32_t hash;
+    int re_flags;
+    uint32_t last_use; /* for the LRU eviction */
+} JSRegExpCacheEntry;
+
 struct JSRuntime {
     JSMallocFunctions mf;
     JSMallocState malloc_state;
@@ -266,6 +293,8 @@ struct JSRuntime {
     struct list_head tmp_obj_list; /* used during GC */
     JSGCPhaseEnum gc_phase : 8;
     size_t malloc_gc_threshold;
+    /* memory owned by host objects, counted toward malloc_gc_threshold */
+    size_t external_memory_size;
 #ifdef DUMP_LEAKS
     struct list_head string_list; /* list of JSString.link */
 #endif
@@ -298,6 +327,14 @@ struct JSRuntime {
     int shape_hash_size;
     int shape_hash_count; /* number of hashed shapes */
     JSShape **shape_hash;
+    uint32_t last_shape_id; /* see JSShape.id */
+    JSInlineCacheStats ic_stats;
+    struct list_head property_plan_list; /* list of JSPropertyPlan.link */
+    JSRegExpCacheEntry regexp_cache[JS_REGEXP_CACHE_SIZE];
+    uint32_t regexp_cache_clock;
+#ifdef CONFIG_OPCODE_HISTOGRAM
+    struct JSOpcodeHistogram *opcode_histogram;
+#endif
 #ifdef CONFIG_BIGNUM
     bf_context_t bf_ctx;
     JSNumericOperations bigint_ops;
@@ -321,6 +358,7 @@ struct JSClass {
 #define JS_MODE_STRICT (1 << 0)
 #define JS_MODE_STRIP  (1 << 1)
 #define JS_MODE_MATH   (1 << 2)
+#define JS_MODE_STRIP_SOURCE (1 << 3) /* keep the debug info but not the source */
 
 typedef struct JSStackFrame {
     struct JSStackFrame *prev_frame; /* NULL if first stack frame */
@@ -403,6 +441,7 @@ typedef struct JSBigDecimal {
 typedef enum {
     JS_AUTOINIT_ID_PROTOTYPE,
     JS_AUTOINIT_ID_MODULE_NS,
+    JS_AUTOINIT_ID_BACKTRACE,
     JS_AUTOINIT_ID_PROP, /* must be last */
 } JSAutoInitIDEnum;
 
@@ -504,6 +543,21 @@ struct JSString {
     } u;
 };
 
+/* Concatenation tree of strings (JS_TAG_STRING_ROPE). It is created
+   by JS_ConcatString() for long results so that repeated
+   concatenations do not copy the whole string each time. The
+   characters are only needed when the rope is indexed, compared,
+   converted to an atom or passed to native code: the rope is then
+   flattened in place, keeping the flat string in 'left'. */
+typedef struct JSStringRope {
+    JSRefCountHeader header; /* must come first, 32-bit */
+    uint32_t len : 31;
+    uint8_t is_wide_char : 1;
+    uint8_t depth; /* <= JS_STRING_ROPE_MAX_DEPTH, 0 once flattened */
+    JSValue left; /* JS_TAG_STRING or JS_TAG_STRING_ROPE */
+    JSValue right; /* JS_UNDEFINED once flattened */
+} JSStringRope;
+
 typedef struct JSClosureVar {
     uint8_t is_local : 1;
     uint8_t is_arg : 1;
@@ -567,6 +621,47 @@ typedef enum JSFunctionKindEnum {
     JS_FUNC_ASYNC_GENERATOR = (JS_FUNC_GENERATOR | JS_FUNC_ASYNC),
 } JSFunctionKindEnum;
 
+/* Property access inline cache of a get_field/get_field2/put_field
+   site. Each entry maps a receiver shape to the index of the property,
+   either in the receiver or in its prototype. */
+#define JS_IC_ENTRY_COUNT 4
+
+typedef struct JSInlineCacheEntry {
+    uint32_t shape_id; /* receiver shape, 0 if the entry is unused */
+    uint32_t holder_shape_id; /* 0 if own property, else prototype shape */
+    uint32_t prop_index;
+} JSInlineCacheEntry;
+
+typedef struct JSInlineCache {
+    JSAtom atom;
+    uint32_t next_entry; /* entry replaced by the next miss */
+    JSInlineCacheEntry entries[JS_IC_ENTRY_COUNT];
+} JSInlineCache;
+
+/* Property plan: a list of properties that native code reads or
+   writes together. Like an inline cache, it maps the last receiver
+   shapes to the index of each property in objects of that shape. */
+#define JS_PROPERTY_PLAN_ENTRY_COUNT 4
+/* not an own data property: use a full lookup */
+#define JS_PROPERTY_PLAN_LOOKUP    0xffffffff
+/* flag of an own data property that cannot be written directly */
+#define JS_PROPERTY_PLAN_READ_ONLY 0x80000000
+
+typedef struct JSPropertyPlanEntry {
+    uint32_t shape_id; /* receiver shape, 0 if the entry is unused */
+    uint32_t *prop_index; /* one per property of the plan */
+} JSPropertyPlanEntry;
+
+struct JSPropertyPlan {
+    struct list_head link; /* in rt->property_plan_list */
+    uint32_t count;
+    uint32_t next_entry; /* entry replaced by the next miss */
+    JSPropertyPlanEntry entries[JS_PROPERTY_PLAN_ENTRY_COUNT];
+    /* shape of the objects built by JS_NewObjectFromPlan(), or NULL */
+    JSShape *object_shape;
+    JSAtom atoms[0];
+};
+
 typedef struct JSFunctionBytecode {
     JSGCObjectHeader header; /* must come first */
     uint8_t js_mode;
@@ -583,7 +678,12 @@ typedef struct JSFunctionBytecode {
     uint8_t has_debug : 1;
     uint8_t backtrace_barrier : 1; /* stop backtrace on this function */
     uint8_t read_only_bytecode : 1;
-    /* XXX: 4 bits available */
+    uint8_t ic_initialized : 1; /* js_init_inline_caches() was called */
+    /* lazy function: no bytecode yet, it is compiled from debug.source
+       on the first call and stored in cpool[0] */
+    uint8_t is_lazy : 1;
+    uint8_t is_func_expr : 1; /* lazy function defined by an expression */
+    /* XXX: 1 bit available */
     uint8_t *byte_code_buf; /* (self pointer) */
     int byte_code_len;
     JSAtom func_name;
@@ -597,6 +697,8 @@ typedef struct JSFunctionBytecode {
     JSValue *cpool; /* constant pool (self pointer) */
     int cpool_count;
     int closure_var_count;
+    JSInlineCache *ic; /* indexed by the operand of the *_ic opcodes */
+    uint32_t ic_count;
     struct {
         /* debug info, move to separate structure to save memory? */
         JSAtom filename;
@@ -846,6 +948,10 @@ struct JSShape {
     uint32_t prop_hash_mask;
     int prop_size; /* allocated properties */
     int prop_count;
+    /* Never 0. Changes whenever the properties, their flags or the
+       prototype change, so that an inline cache keyed by the id stays
+       valid as long as the id matches. */
+    uint32_t id;
     JSShape *shape_hash_next; /* in JSRuntime.shape_hash[h] list */
     JSObject *proto;
     JSShapeProperty prop[0]; /* prop_size elements */
@@ -872,7 +978,7 @@ struct JSObject {
     JSShape *shape; /* prototype and property names + flag */
     JSProperty *prop; /* array of properties */
     /* byte offsets: 24/40 */
-    struct JSMapRecord *first_weak_ref; /* XXX: use a bit and an external hash table? */
+    struct JSMapWeakRef *first_weak_ref; /* XXX: use a bit and an external hash table? */
     /* byte offsets: 28/48 */
     union {
         void *opaque;
@@ -987,6 +1093,11 @@ static JSAtom __JS_NewAtomInit(JSRuntime *rt, const char *str, int len,
                                int atom_type);
 static void JS_FreeAtomStruct(JSRuntime *rt, JSAtomStruct *p);
 static void free_function_bytecode(JSRuntime *rt, JSFunctionBytecode *b);
+static void js_init_inline_caches(JSRuntime *rt, JSFunctionBytecode *b);
+static JSFunctionBytecode *js_compile_lazy_function(JSContext *ctx, JSObject *p);
+#ifdef CONFIG_OPCODE_HISTOGRAM
+static void js_dump_opcode_histogram(JSRuntime *rt, FILE *fp);
+#endif
 static JSValue js_call_c_function(JSContext *ctx, JSValueConst func_obj,
                                   JSValueConst this_obj,
                                   int argc, JSValueConst *argv, int flags);
@@ -1087,6 +1198,7 @@ static int JS_ToFloat64Free(JSContext *ctx, double *pres, JSValue val);
 static int JS_ToUint8ClampFree(JSContext *ctx, int32_t *pres, JSValue val);
 static JSValue js_compile_regexp(JSContext *ctx, JSValueConst pattern,
                                  JSValueConst flags);
+static void js_regexp_cache_clear(JSRuntime *rt);
 static JSValue js_regexp_constructor_internal(JSContext *ctx, JSValueConst ctor,
                                               JSValue pattern, JSValue bc);
 static void gc_decref(JSRuntime *rt);
@@ -1225,6 +1337,14 @@ static void add_gc_object(JSRuntime *rt, JSGCObjectHeader *h,
 static void remove_gc_object(JSGCObjectHeader *h);
 static void js_async_function_free0(JSRuntime *rt, JSAsyncFunctionData *s);
 static int js_instantiate_prototype(JSContext *ctx, JSObject *p, JSAtom atom, void *opaque);
+static int JS_DefineAutoInitProperty(JSContext *ctx, JSValueConst this_obj,
+                                     JSAtom prop, JSAutoInitIDEnum id,
+                                     void *opaque, int flags);
+static int js_backtrace_autoinit(JSContext *ctx, JSObject *p, JSAtom atom,
+                                 void *opaque);
+static void js_backtrace_free(JSRuntime *rt, JSBacktrace *bt);
+static void js_backtrace_mark(JSRuntime *rt, JSBacktrace *bt,
+                              JS_MarkFunc *mark_func);
 static int js_module_ns_autoinit(JSContext *ctx, JSObject *p, JSAtom atom,
                                  void *opaque);
 static int JS_InstantiateFunctionListItem(JSContext *ctx, JSObject *p,
@@ -1242,17 +1362,19 @@ static void js_trigger_gc(JSRuntime *rt, size_t size)
 #ifdef FORCE_GC_AT_MALLOC
     force_gc = TRUE;
 #else
-    force_gc = ((rt->malloc_state.malloc_size + size) >
+    force_gc = ((rt->malloc_state.malloc_size + rt->external_memory_size + size) >
                 rt->malloc_gc_threshold);
 #endif
     if (force_gc) {
+        size_t total_size;
 #ifdef DUMP_GC
-        printf("GC: size=%" PRIu64 "\n",
-               (uint64_t)rt->malloc_state.malloc_size);
+        printf("GC: size=%" PRIu64 " external=%" PRIu64 "\n",
+               (uint64_t)rt->malloc_state.malloc_size,
+               (uint64_t)rt->external_memory_size);
 #endif
         JS_RunGC(rt);
-        rt->malloc_gc_threshold = rt->malloc_state.malloc_size +
-            (rt->malloc_state.malloc_size >> 1);
+        total_size = rt->malloc_state.malloc_size + rt->external_memory_size;
+        rt->malloc_gc_threshold = total_size + (total_size >> 1);
     }
 }
 
@@ -1595,6 +1717,7 @@ JSRuntime *JS_NewRuntime2(const JSMallocFunctions *mf, void *opaque)
     init_list_head(&rt->string_list);
 #endif
     init_list_head(&rt->job_list);
+    init_list_head(&rt->property_plan_list);
 
     if (JS_InitAtoms(rt))
         goto fail;
@@ -1741,6 +1864,32 @@ void JS_SetGCThreshold(JSRuntime *rt, size_t gc_threshold)
     rt->malloc_gc_threshold = gc_threshold;
 }
 
+/* Account for memory held outside of the JS heap by objects of this
+   runtime (e.g. native buffers owned by class opaques). It is added to
+   the JS heap size when deciding whether to run the GC. */
+void JS_AdjustExternalMemory(JSRuntime *rt, int64_t delta)
+{
+    if (delta < 0 && (uint64_t)-delta > rt->external_memory_size)
+        rt->external_memory_size = 0;
+    else
+        rt->external_memory_size += delta;
+}
+
+size_t JS_GetExternalMemory(JSRuntime *rt)
+{
+    return rt->external_memory_size;
+}
+
+void JS_GetInlineCacheStats(JSRuntime *rt, JSInlineCacheStats *s)
+{
+    *s = rt->ic_stats;
+}
+
+void JS_ResetInlineCacheStats(JSRuntime *rt)
+{
+    memset(&rt->ic_stats, 0, sizeof(rt->ic_stats));
+}
+
 #define malloc(s) malloc_is_forbidden(s)
 #define free(p) free_is_forbidden(p)
 #define realloc(p,s) realloc_is_forbidden(p,s)
@@ -1894,8 +2043,15 @@ void JS_FreeRuntime(JSRuntime *rt)
     }
     init_list_head(&rt->job_list);
 
+    js_regexp_cache_clear(rt);
+
     JS_RunGC(rt);
 
+#ifdef CONFIG_OPCODE_HISTOGRAM
+    js_dump_opcode_histogram(rt, stdout);
+    js_free_rt(rt, rt->opcode_histogram);
+#endif
+
 #ifdef DUMP_LEAKS
     /* leaking objects */
     {
@@ -2424,6 +2580,69 @@ static uint32_t hash_string(const JSString *str, uint32_t h)
     return h;
 }
 
+/* Atom hash. It consumes 4 code units per multiplication instead of
+   one. 8 bit characters are widened to 16 bits so that a string has
+   the same hash in both representations. Unlike hash_string(), it
+   cannot be computed piecewise. */
+#define ATOM_HASH_MUL 0x9e3779b97f4a7c15ULL
+
+static inline uint64_t hash_atom_step(uint64_t h, uint64_t w)
+{
+    return (((h << 5) | (h >> 59)) ^ w) * ATOM_HASH_MUL;
+}
+
+static inline uint32_t hash_atom_end(uint64_t h)
+{
+    /* the low bits select the bucket, fold the well mixed high bits into them */
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+static uint32_t hash_atom8(const uint8_t *str, size_t len, uint32_t h0)
+{
+    uint64_t h, w;
+    size_t i;
+
+    h = hash_atom_step(h0, len);
+    for(i = 0; i + 4 <= len; i += 4) {
+        w = str[i] | ((uint64_t)str[i + 1] << 16) |
+            ((uint64_t)str[i + 2] << 32) | ((uint64_t)str[i + 3] << 48);
+        h = hash_atom_step(h, w);
+    }
+    if (i < len) {
+        for(w = 0; i < len; i++)
+            w = (w << 16) | str[i];
+        h = hash_atom_step(h, w);
+    }
+    return hash_atom_end(h);
+}
+
+static uint32_t hash_atom16(const uint16_t *str, size_t len, uint32_t h0)
+{
+    uint64_t h, w;
+    size_t i;
+
+    h = hash_atom_step(h0, len);
+    for(i = 0; i + 4 <= len; i += 4) {
+        w = str[i] | ((uint64_t)str[i + 1] << 16) |
+            ((uint64_t)str[i + 2] << 32) | ((uint64_t)str[i + 3] << 48);
+        h = hash_atom_step(h, w);
+    }
+    if (i < len) {
+        for(w = 0; i < len; i++)
+            w = (w << 16) | str[i];
+        h = hash_atom_step(h, w);
+    }
+    return hash_atom_end(h);
+}
+
+static uint32_t hash_atom(const JSString *str, int atom_type)
+{
+    if (str->is_wide_char)
+        return hash_atom16(str->u.str16, str->len, atom_type);
+    else
+        return hash_atom8(str->u.str8, str->len, atom_type);
+}
+
 static __maybe_unused void JS_DumpString(JSRuntime *rt,
                                                   const JSString *p)
 {
@@ -2521,6 +2740,50 @@ static int JS_ResizeAtomHash(JSRuntime *rt, int new_hash_size)
     return 0;
 }
 
+/* the new entries are added in front of the free list */
+static int JS_ResizeAtomArray(JSRuntime *rt, uint32_t new_size)
+{
+    JSAtomStruct *p, **new_array;
+    uint32_t i, start;
+
+    if (new_size > JS_ATOM_MAX)
+        return -1;
+    /* XXX: should use realloc2 to use slack space */
+    new_array = js_realloc_rt(rt, rt->atom_array, sizeof(*new_array) * new_size);
+    if (!new_array)
+        return -1;
+    /* Note: the atom 0 is not used */
+    start = rt->atom_size;
+    if (start == 0) {
+        /* JS_ATOM_NULL entry */
+        p = js_mallocz_rt(rt, sizeof(JSAtomStruct));
+        if (!p) {
+            js_free_rt(rt, new_array);
+            return -1;
+        }
+        p->header.ref_count = 1;  /* not refcounted */
+        p->atom_type = JS_ATOM_TYPE_SYMBOL;
+#ifdef DUMP_LEAKS
+        list_add_tail(&p->link, &rt->string_list);
+#endif
+        new_array[0] = p;
+        rt->atom_count++;
+        start = 1;
+    }
+    for(i = start; i < new_size; i++) {
+        uint32_t next;
+        if (i == (new_size - 1))
+            next = rt->atom_free_index;
+        else
+            next = i + 1;
+        new_array[i] = atom_set_free(next);
+    }
+    rt->atom_size = new_size;
+    rt->atom_array = new_array;
+    rt->atom_free_index = start;
+    return 0;
+}
+
 static int JS_InitAtoms(JSRuntime *rt)
 {
     int i, len, atom_type;
@@ -2647,7 +2910,7 @@ static JSAtom __JS_NewAtom(JSRuntime *rt, JSString *str, int atom_type)
         }
         /* try and locate an already registered atom */
         len = str->len;
-        h = hash_string(str, atom_type);
+        h = hash_atom(str, atom_type);
         h &= JS_ATOM_HASH_MASK;
         h1 = h & (rt->atom_hash_size - 1);
         i = rt->atom_hash[h1];
@@ -2675,49 +2938,12 @@ static JSAtom __JS_NewAtom(JSRuntime *rt, JSString *str, int atom_type)
 
     if (rt->atom_free_index == 0) {
         /* allow new atom entries */
-        uint32_t new_size, start;
-        JSAtomStruct **new_array;
-
         /* alloc new with size progression 3/2:
            4 6 9 13 19 28 42 63 94 141 211 316 474 711 1066 1599 2398 3597 5395 8092
            preallocating space for predefined atoms (at least 195).
          */
-        new_size = max_int(211, rt->atom_size * 3 / 2);
-        if (new_size > JS_ATOM_MAX)
+        if (JS_ResizeAtomArray(rt, max_int(211, rt->atom_size * 3 / 2)))
             goto fail;
-        /* XXX: should use realloc2 to use slack space */
-        new_array = js_realloc_rt(rt, rt->atom_array, sizeof(*new_array) * new_size);
-        if (!new_array)
-            goto fail;
-        /* Note: the atom 0 is not used */
-        start = rt->atom_size;
-        if (start == 0) {
-            /* JS_ATOM_NULL entry */
-            p = js_mallocz_rt(rt, sizeof(JSAtomStruct));
-            if (!p) {
-                js_free_rt(rt, new_array);
-                goto fail;
-            }
-            p->header.ref_count = 1;  /* not refcounted */
-            p->atom_type = JS_ATOM_TYPE_SYMBOL;
-#ifdef DUMP_LEAKS
-            list_add_tail(&p->link, &rt->string_list);
-#endif
-            new_array[0] = p;
-            rt->atom_count++;
-            start = 1;
-        }
-        rt->atom_size = new_size;
-        rt->atom_array = new_array;
-        rt->atom_free_index = start;
-        for(i = start; i < new_size; i++) {
-            uint32_t next;
-            if (i == (new_size - 1))
-                next = 0;
-            else
-                next = i + 1;
-            rt->atom_array[i] = atom_set_free(next);
-        }
     }
 
     if (str) {
@@ -2799,8 +3025,16 @@ static JSAtom __JS_FindAtom(JSRuntime *rt, const char *str, size_t len,
 {
     uint32_t h, h1, i;
     JSAtomStruct *p;
-
-    h = hash_string8((const uint8_t *)str, len, JS_ATOM_TYPE_STRING);
+    size_t j;
+    uint8_t c;
+
+    /* non ASCII UTF-8 does not compare bytewise with the atom characters */
+    c = 0;
+    for(j = 0; j < len; j++)
+        c |= str[j];
+    if (c >= 0x80)
+        return JS_ATOM_NULL;
+    h = hash_atom8((const uint8_t *)str, len, JS_ATOM_TYPE_STRING);
     h &= JS_ATOM_HASH_MASK;
     h1 = h & (rt->atom_hash_size - 1);
     i = rt->atom_hash[h1];
@@ -2908,6 +3142,39 @@ JSAtom JS_NewAtom(JSContext *ctx, const char *str)
     return JS_NewAtomLen(ctx, str, strlen(str));
 }
 
+int JS_NewAtoms(JSContext *ctx, JSAtom *atoms, const char * const *strs,
+                const size_t *lens, uint32_t count)
+{
+    JSRuntime *rt = ctx->rt;
+    uint32_t i, n, hash_size;
+
+    /* grow the atom array and the hash table once for the whole batch */
+    n = rt->atom_count + count;
+    if (n < count || n > JS_ATOM_MAX)
+        goto fail;
+    if (n > rt->atom_size && JS_ResizeAtomArray(rt, n))
+        goto fail;
+    hash_size = rt->atom_hash_size;
+    while (n >= JS_ATOM_COUNT_RESIZE(hash_size))
+        hash_size *= 2;
+    if (hash_size != rt->atom_hash_size && JS_ResizeAtomHash(rt, hash_size))
+        goto fail;
+
+    for(i = 0; i < count; i++) {
+        atoms[i] = JS_NewAtomLen(ctx, strs[i], lens[i]);
+        if (atoms[i] == JS_ATOM_NULL) {
+            while (i > 0)
+                JS_FreeAtom(ctx, atoms[--i]);
+            goto fail;
+        }
+    }
+    return 0;
+ fail:
+    if (JS_IsNull(rt->current_exception))
+        JS_ThrowOutOfMemory(ctx);
+    return -1;
+}
+
 JSAtom JS_NewAtomUInt32(JSContext *ctx, uint32_t n)
 {
     if (n <= JS_ATOM_MAX_INT) {
@@ -3301,6 +3568,11 @@ static JSAtom js_atom_concat_num(JSContext *ctx, JSAtom name, uint32_t n)
     return js_atom_concat_str(ctx, name, buf);
 }
 
+static inline BOOL tag_is_string(uint32_t tag)
+{
+    return tag == JS_TAG_STRING || tag == JS_TAG_STRING_ROPE;
+}
+
 static inline BOOL JS_IsEmptyString(JSValueConst v)
 {
     return JS_VALUE_GET_TAG(v) == JS_TAG_STRING && JS_VALUE_GET_STRING(v)->len == 0;
@@ -4037,24 +4309,30 @@ static int memcmp16(const uint16_t *src1, const uint16_t *src2, int len)
     return 0;
 }
 
-static int js_string_memcmp(const JSString *p1, const JSString *p2, int len)
+static int js_string_memcmp2(const JSString *p1, int pos1,
+                             const JSString *p2, int pos2, int len)
 {
     int res;
 
     if (likely(!p1->is_wide_char)) {
         if (likely(!p2->is_wide_char))
-            res = memcmp(p1->u.str8, p2->u.str8, len);
+            res = memcmp(p1->u.str8 + pos1, p2->u.str8 + pos2, len);
         else
-            res = -memcmp16_8(p2->u.str16, p1->u.str8, len);
+            res = -memcmp16_8(p2->u.str16 + pos2, p1->u.str8 + pos1, len);
     } else {
         if (!p2->is_wide_char)
-            res = memcmp16_8(p1->u.str16, p2->u.str8, len);
+            res = memcmp16_8(p1->u.str16 + pos1, p2->u.str8 + pos2, len);
         else
-            res = memcmp16(p1->u.str16, p2->u.str16, len);
+            res = memcmp16(p1->u.str16 + pos1, p2->u.str16 + pos2, len);
     }
     return res;
 }
 
+static int js_string_memcmp(const JSString *p1, const JSString *p2, int len)
+{
+    return js_string_memcmp2(p1, 0, p2, 0, len);
+}
+
 /* return < 0, 0 or > 0 */
 static int js_string_compare(JSContext *ctx,
                              const JSString *p1, const JSString *p2)
@@ -4111,6 +4389,309 @@ static JSValue JS_ConcatString1(JSContext *ctx,
     return JS_MKPTR(JS_TAG_STRING, p);
 }
 
+/* Rope support */
+
+typedef struct JSStringRopeIter {
+    int sp;
+    JSValueConst stack[JS_STRING_ROPE_MAX_DEPTH + 1];
+} JSStringRopeIter;
+
+/* 'v' is a string or a rope */
+static void js_string_rope_iter_init(JSStringRopeIter *it, JSValueConst v)
+{
+    it->sp = 0;
+    it->stack[it->sp++] = v;
+}
+
+/* return the next flat string of the concatenation or NULL at the
+   end. The stack never holds more entries than the depth of the rope. */
+static JSString *js_string_rope_iter_next(JSStringRopeIter *it)
+{
+    JSValueConst v;
+    JSStringRope *r;
+
+    if (it->sp == 0)
+        return NULL;
+    v = it->stack[--it->sp];
+    while (JS_VALUE_GET_TAG(v) == JS_TAG_STRING_ROPE) {
+        r = JS_VALUE_GET_PTR(v);
+        if (r->depth != 0)
+            it->stack[it->sp++] = r->right;
+        v = r->left;
+    }
+    return JS_VALUE_GET_STRING(v);
+}
+
+static uint32_t js_string_value_len(JSValueConst v)
+{
+    if (JS_VALUE_GET_TAG(v) == JS_TAG_STRING_ROPE)
+        return ((JSStringRope *)JS_VALUE_GET_PTR(v))->len;
+    else
+        return JS_VALUE_GET_STRING(v)->len;
+}
+
+static int js_string_value_is_wide_char(JSValueConst v)
+{
+    if (JS_VALUE_GET_TAG(v) == JS_TAG_STRING_ROPE)
+        return ((JSStringRope *)JS_VALUE_GET_PTR(v))->is_wide_char;
+    else
+        return JS_VALUE_GET_STRING(v)->is_wide_char;
+}
+
+static int js_string_value_depth(JSValueConst v)
+{
+    if (JS_VALUE_GET_TAG(v) == JS_TAG_STRING_ROPE)
+        return ((JSStringRope *)JS_VALUE_GET_PTR(v))->depth;
+    else
+        return 0;
+}
+
+/* copy the characters of the string or rope 'v' to 'p' at 'pos' */
+static void js_string_rope_copy(JSString *p, uint32_t pos, JSValueConst v)
+{
+    JSStringRopeIter it;
+    JSString *p1;
+
+    js_string_rope_iter_init(&it, v);
+    while ((p1 = js_string_rope_iter_next(&it)) != NULL) {
+        if (p->is_wide_char)
+            copy_str16(p->u.str16 + pos, p1, 0, p1->len);
+        else
+            memcpy(p->u.str8 + pos, p1->u.str8, p1->len);
+        pos += p1->len;
+    }
+}
+
+/* Compare the characters of two strings or ropes without flattening
+   them. Return < 0, 0 or > 0. */
+static int js_string_rope_compare(JSValueConst op1, JSValueConst op2)
+{
+    JSStringRopeIter it1, it2;
+    JSString *p1, *p2;
+    uint32_t pos1, pos2, len1, len2;
+    int len, res;
+
+    js_string_rope_iter_init(&it1, op1);
+    js_string_rope_iter_init(&it2, op2);
+    p1 = js_string_rope_iter_next(&it1);
+    p2 = js_string_rope_iter_next(&it2);
+    pos1 = pos2 = 0;
+    while (p1 && p2) {
+        len = min_int(p1->len - pos1, p2->len - pos2);
+        res = js_string_memcmp2(p1, pos1, p2, pos2, len);
+        if (res != 0)
+            return res;
+        pos1 += len;
+        pos2 += len;
+        if (pos1 == p1->len) {
+            p1 = js_string_rope_iter_next(&it1);
+            pos1 = 0;
+        }
+        if (pos2 == p2->len) {
+            p2 = js_string_rope_iter_next(&it2);
+            pos2 = 0;
+        }
+    }
+    len1 = js_string_value_len(op1);
+    len2 = js_string_value_len(op2);
+    if (len1 == len2)
+        return 0;
+    else if (len1 < len2)
+        return -1;
+    else
+        return 1;
+}
+
+static BOOL js_string_value_eq(JSValueConst op1, JSValueConst op2)
+{
+    if (JS_VALUE_GET_TAG(op1) == JS_TAG_STRING &&
+        JS_VALUE_GET_TAG(op2) == JS_TAG_STRING) {
+        return js_string_compare(NULL, JS_VALUE_GET_STRING(op1),
+                                 JS_VALUE_GET_STRING(op2)) == 0;
+    }
+    return js_string_value_len(op1) == js_string_value_len(op2) &&
+        js_string_rope_compare(op1, op2) == 0;
+}
+
+static uint32_t js_string_value_hash(JSValueConst v, uint32_t h)
+{
+    JSStringRopeIter it;
+    JSString *p;
+
+    js_string_rope_iter_init(&it, v);
+    while ((p = js_string_rope_iter_next(&it)) != NULL)
+        h = hash_string(p, h);
+    return h;
+}
+
+/* Return a new reference to a flat string with the characters of the
+   rope. The rope keeps it and releases its children, so it is only
+   flattened once. */
+static JSValue js_string_rope_flatten(JSContext *ctx, JSStringRope *r)
+{
+    JSString *p;
+
+    if (r->depth != 0) {
+        p = js_alloc_string(ctx, r->len, r->is_wide_char);
+        if (!p)
+            return JS_EXCEPTION;
+        js_string_rope_copy(p, 0, JS_MKPTR(JS_TAG_STRING_ROPE, r));
+        if (!r->is_wide_char)
+            p->u.str8[r->len] = '\0';
+        JS_FreeValue(ctx, r->left);
+        JS_FreeValue(ctx, r->right);
+        r->left = JS_MKPTR(JS_TAG_STRING, p);
+        r->right = JS_UNDEFINED;
+        r->depth = 0;
+    }
+    return JS_DupValue(ctx, r->left);
+}
+
+/* return a flat string if 'val' is a rope, otherwise 'val' */
+static JSValue js_flatten_string_free(JSContext *ctx, JSValue val)
+{
+    JSValue ret;
+
+    if (JS_VALUE_GET_TAG(val) != JS_TAG_STRING_ROPE)
+        return val;
+    ret = js_string_rope_flatten(ctx, JS_VALUE_GET_PTR(val));
+    JS_FreeValue(ctx, val);
+    return ret;
+}
+
+/* Return the flat string holding the characters of the string or rope
+   'val'. It stays valid as long as 'val'. Return NULL if exception. */
+static JSString *js_get_flat_string(JSContext *ctx, JSValueConst val)
+{
+    JSValue str;
+
+    if (JS_VALUE_GET_TAG(val) != JS_TAG_STRING_ROPE)
+        return JS_VALUE_GET_STRING(val);
+    str = js_string_rope_flatten(ctx, JS_VALUE_GET_PTR(val));
+    if (JS_IsException(str))
+        return NULL;
+    /* the rope holds another reference */
+    JS_FreeValue(ctx, str);
+    return JS_VALUE_GET_STRING(str);
+}
+
+/* 'left' and 'right' are non empty strings or ropes */
+static JSValue js_new_string_rope(JSContext *ctx, JSValue left, JSValue right)
+{
+    JSStringRope *r;
+    JSString *p;
+    uint32_t len;
+    int depth, is_wide_char;
+
+    len = js_string_value_len(left) + js_string_value_len(right);
+    is_wide_char = js_string_value_is_wide_char(left) |
+        js_string_value_is_wide_char(right);
+    depth = max_int(js_string_value_depth(left),
+                    js_string_value_depth(right)) + 1;
+    if (unlikely(depth > JS_STRING_ROPE_MAX_DEPTH)) {
+        /* only reached by mixing appends and prepends: give up on
+           the tree and copy */
+        p = js_alloc_string(ctx, len, is_wide_char);
+        if (!p)
+            goto fail;
+        js_string_rope_copy(p, 0, left);
+        js_string_rope_copy(p, js_string_value_len(left), right);
+        if (!is_wide_char)
+            p->u.str8[len] = '\0';
+        JS_FreeValue(ctx, left);
+        JS_FreeValue(ctx, right);
+        return JS_MKPTR(JS_TAG_STRING, p);
+    }
+    r = js_malloc(ctx, sizeof(*r));
+    if (!r)
+        goto fail;
+    r->header.ref_count = 1;
+    r->len = len;
+    r->is_wide_char = is_wide_char;
+    r->depth = depth;
+    r->left = left;
+    r->right = right;
+    return JS_MKPTR(JS_TAG_STRING_ROPE, r);
+ fail:
+    JS_FreeValue(ctx, left);
+    JS_FreeValue(ctx, right);
+    return JS_EXCEPTION;
+}
+
+/* take the children of the unflattened rope 'val' and free it */
+static void js_string_rope_split(JSContext *ctx, JSValue val,
+                                 JSValue *pleft, JSValue *pright)
+{
+    JSStringRope *r = JS_VALUE_GET_PTR(val);
+
+    if (r->header.ref_count == 1) {
+        *pleft = r->left;
+        *pright = r->right;
+        js_free(ctx, r);
+    } else {
+        *pleft = JS_DupValue(ctx, r->left);
+        *pright = JS_DupValue(ctx, r->right);
+        JS_FreeValue(ctx, val);
+    }
+}
+
+static JSValue JS_ConcatString(JSContext *ctx, JSValue op1, JSValue op2);
+
+/* op1 and op2 are strings or ropes */
+static JSValue js_concat_string_rope(JSContext *ctx, JSValue op1, JSValue op2)
+{
+    JSStringRope *r;
+    JSValue left, right;
+    uint32_t len1, len2;
+
+    len1 = js_string_value_len(op1);
+    len2 = js_string_value_len(op2);
+    if (len2 == 0) {
+        JS_FreeValue(ctx, op2);
+        return op1;
+    }
+    if (len1 == 0) {
+        JS_FreeValue(ctx, op1);
+        return op2;
+    }
+    if (len1 + len2 > JS_STRING_LEN_MAX) {
+        JS_FreeValue(ctx, op1);
+        JS_FreeValue(ctx, op2);
+        return JS_ThrowInternalError(ctx, "string too long");
+    }
+    /* When appending to a rope, the new string is concatenated to its
+       right child as long as it does not outweigh the left one, so
+       that repeated appends build a balanced tree the way a binary
+       counter carries. Prepending is symmetric. */
+    if (JS_VALUE_GET_TAG(op1) == JS_TAG_STRING_ROPE) {
+        r = JS_VALUE_GET_PTR(op1);
+        if (r->depth != 0 &&
+            js_string_value_len(r->right) + len2 <= js_string_value_len(r->left)) {
+            js_string_rope_split(ctx, op1, &left, &right);
+            right = JS_ConcatString(ctx, right, op2);
+            if (JS_IsException(right)) {
+                JS_FreeValue(ctx, left);
+                return JS_EXCEPTION;
+            }
+            return js_new_string_rope(ctx, left, right);
+        }
+    }
+    if (JS_VALUE_GET_TAG(op2) == JS_TAG_STRING_ROPE) {
+        r = JS_VALUE_GET_PTR(op2);
+        if (r->depth != 0 &&
+            len1 + js_string_value_len(r->left) <= js_string_value_len(r->right)) {
+            js_string_rope_split(ctx, op2, &left, &right);
+            left = JS_ConcatString(ctx, op1, left);
+            if (JS_IsException(left)) {
+                JS_FreeValue(ctx, right);
+                return JS_EXCEPTION;
+            }
+            return js_new_string_rope(ctx, left, right);
+        }
+    }
+    return js_new_string_rope(ctx, op1, op2);
+}
+
 /* op1 and op2 are converted to strings. For convience, op1 or op2 =
    JS_EXCEPTION are accepted and return JS_EXCEPTION.  */
 static JSValue JS_ConcatString(JSContext *ctx, JSValue op1, JSValue op2)
@@ -4118,20 +4699,23 @@ static JSValue JS_ConcatString(JSContext *ctx, JSValue op1, JSValue op2)
     JSValue ret;
     JSString *p1, *p2;
 
-    if (unlikely(JS_VALUE_GET_TAG(op1) != JS_TAG_STRING)) {
+    if (unlikely(!tag_is_string(JS_VALUE_GET_TAG(op1)))) {
         op1 = JS_ToStringFree(ctx, op1);
         if (JS_IsException(op1)) {
             JS_FreeValue(ctx, op2);
             return JS_EXCEPTION;
         }
     }
-    if (unlikely(JS_VALUE_GET_TAG(op2) != JS_TAG_STRING)) {
+    if (unlikely(!tag_is_string(JS_VALUE_GET_TAG(op2)))) {
         op2 = JS_ToStringFree(ctx, op2);
         if (JS_IsException(op2)) {
             JS_FreeValue(ctx, op1);
             return JS_EXCEPTION;
         }
     }
+    if (JS_VALUE_GET_TAG(op1) == JS_TAG_STRING_ROPE ||
+        JS_VALUE_GET_TAG(op2) == JS_TAG_STRING_ROPE)
+        return js_concat_string_rope(ctx, op1, op2);
     p1 = JS_VALUE_GET_STRING(op1);
     p2 = JS_VALUE_GET_STRING(op2);
 
@@ -4154,6 +4738,8 @@ static JSValue JS_ConcatString(JSContext *ctx, JSValue op1, JSValue op2)
         JS_FreeValue(ctx, op2);
         return op1;
     }
+    if (p1->len + p2->len >= JS_STRING_ROPE_SHORT_LEN)
+        return js_concat_string_rope(ctx, op1, op2);
     ret = JS_ConcatString1(ctx, p1, p2);
     JS_FreeValue(ctx, op1);
     JS_FreeValue(ctx, op2);
@@ -4264,6 +4850,51 @@ static void js_shape_hash_unlink(JSRuntime *rt, JSShape *sh)
     rt->shape_hash_count--;
 }
 
+static void js_reset_inline_caches(JSFunctionBytecode *b)
+{
+    uint32_t i;
+    for(i = 0; i < b->ic_count; i++) {
+        b->ic[i].next_entry = 0;
+        memset(b->ic[i].entries, 0, sizeof(b->ic[i].entries));
+    }
+}
+
+/* When the ids wrap around, give new ids to the live shapes and empty
+   the inline caches and property plans so that a stale id can never
+   match. */
+static no_inline void js_renumber_shapes(JSRuntime *rt)
+{
+    struct list_head *lists[2] = { &rt->gc_obj_list, &rt->tmp_obj_list };
+    struct list_head *el;
+    JSGCObjectHeader *gp;
+    JSPropertyPlan *plan;
+    int i;
+
+    rt->last_shape_id = 0;
+    for(i = 0; i < countof(lists); i++) {
+        list_for_each(el, lists[i]) {
+            gp = list_entry(el, JSGCObjectHeader, link);
+            if (gp->gc_obj_type == JS_GC_OBJ_TYPE_SHAPE)
+                ((JSShape *)gp)->id = ++rt->last_shape_id;
+            else if (gp->gc_obj_type == JS_GC_OBJ_TYPE_FUNCTION_BYTECODE)
+                js_reset_inline_caches((JSFunctionBytecode *)gp);
+        }
+    }
+    list_for_each(el, &rt->property_plan_list) {
+        plan = list_entry(el, JSPropertyPlan, link);
+        plan->next_entry = 0;
+        for(i = 0; i < JS_PROPERTY_PLAN_ENTRY_COUNT; i++)
+            plan->entries[i].shape_id = 0;
+    }
+}
+
+static inline void js_shape_update_id(JSRuntime *rt, JSShape *sh)
+{
+    if (unlikely(++rt->last_shape_id == 0))
+        js_renumber_shapes(rt);
+    sh->id = ++rt->last_shape_id;
+}
+
 /* create a new empty shape with prototype 'proto' */
 static no_inline JSShape *js_new_shape2(JSContext *ctx, JSObject *proto,
                                         int hash_size, int prop_size)
@@ -4291,6 +4922,7 @@ static no_inline JSShape *js_new_shape2(JSContext *ctx, JSObject *proto,
     sh->prop_hash_mask = hash_size - 1;
     sh->prop_count = 0;
     sh->prop_size = prop_size;
+    js_shape_update_id(rt, sh);
 
     /* insert in the hash table */
     sh->hash = shape_initial_hash(proto);
@@ -4326,6 +4958,7 @@ static JSShape *js_clone_shape(JSContext *ctx, JSShape *sh1)
     sh = get_shape_from_alloc(sh_alloc, hash_size);
     sh->header.ref_count = 1;
     add_gc_object(ctx->rt, &sh->header, JS_GC_OBJ_TYPE_SHAPE);
+    js_shape_update_id(ctx->rt, sh);
     sh->is_hashed = FALSE;
     if (sh->proto) {
         JS_DupValue(ctx, JS_MKPTR(JS_TAG_OBJECT, sh->proto));
@@ -4375,6 +5008,35 @@ static void js_free_shape_null(JSRuntime *rt, JSShape *sh)
         js_free_shape(rt, sh);
 }
 
+/* Objects created with a shape of at most JS_INLINE_PROP_MAX slots get
+   their property array in the same allocation, right after the JSObject.
+   It moves to a separate allocation when the object outgrows it. */
+#define JS_INLINE_PROP_MAX 8
+
+static inline BOOL js_object_has_inline_prop(const JSObject *p)
+{
+    return p->prop == (JSProperty *)(p + 1);
+}
+
+/* resize the property array of 'p' whose current shape is 'sh'. Only
+   the sh->prop_count first properties are kept. */
+static JSProperty *js_resize_prop_array(JSContext *ctx, JSObject *p,
+                                        JSShape *sh, uint32_t new_size)
+{
+    JSProperty *new_prop;
+
+    if (js_object_has_inline_prop(p)) {
+        /* the inline array has at least sh->prop_size slots */
+        if (new_size <= sh->prop_size)
+            return p->prop;
+        new_prop = js_malloc(ctx, sizeof(new_prop[0]) * new_size);
+        if (new_prop)
+            memcpy(new_prop, p->prop, sizeof(new_prop[0]) * sh->prop_count);
+        return new_prop;
+    }
+    return js_realloc(ctx, p->prop, sizeof(new_prop[0]) * new_size);
+}
+
 /* make space to hold at least 'count' properties */
 static no_inline int resize_properties(JSContext *ctx, JSShape **psh,
                                        JSObject *p, uint32_t count)
@@ -4391,7 +5053,7 @@ static no_inline int resize_properties(JSContext *ctx, JSShape **psh,
        in case of memory allocation failure */
     if (p) {
         JSProperty *new_prop;
-        new_prop = js_realloc(ctx, p->prop, sizeof(new_prop[0]) * new_size);
+        new_prop = js_resize_prop_array(ctx, p, sh, new_size);
         if (unlikely(!new_prop))
             return -1;
         p->prop = new_prop;
@@ -4477,6 +5139,7 @@ static int add_shape_property(JSContext *ctx, JSShape **psh,
     pr = &prop[sh->prop_count++];
     pr->atom = JS_DupAtom(ctx, atom);
     pr->flags = prop_flags;
+    js_shape_update_id(rt, sh);
     sh->has_small_array_index |= __JS_AtomIsTaggedInt(atom);
     /* add in hash table */
     hash_mask = sh->prop_hash_mask;
@@ -4587,10 +5250,26 @@ static JSValue JS_NewObjectFromShape(JSContext *ctx, JSShape *sh, JSClassID clas
 {
     JSObject *p;
 
-    js_trigger_gc(ctx->rt, sizeof(JSObject));
-    p = js_malloc(ctx, sizeof(JSObject));
-    if (unlikely(!p))
-        goto fail;
+    if (sh->prop_size <= JS_INLINE_PROP_MAX) {
+        size_t size = sizeof(JSObject) + sizeof(JSProperty) * sh->prop_size;
+        js_trigger_gc(ctx->rt, size);
+        p = js_malloc(ctx, size);
+        if (unlikely(!p))
+            goto fail;
+        p->prop = (JSProperty *)(p + 1);
+    } else {
+        js_trigger_gc(ctx->rt, sizeof(JSObject));
+        p = js_malloc(ctx, sizeof(JSObject));
+        if (unlikely(!p))
+            goto fail;
+        p->prop = js_malloc(ctx, sizeof(JSProperty) * sh->prop_size);
+        if (unlikely(!p->prop)) {
+            js_free(ctx, p);
+        fail:
+            js_free_shape(ctx->rt, sh);
+            return JS_EXCEPTION;
+        }
+    }
     p->class_id = class_id;
     p->extensible = TRUE;
     p->free_mark = 0;
@@ -4603,13 +5282,6 @@ static JSValue JS_NewObjectFromShape(JSContext *ctx, JSShape *sh, JSClassID clas
     p->first_weak_ref = NULL;
     p->u.opaque = NULL;
     p->shape = sh;
-    p->prop = js_malloc(ctx, sizeof(JSProperty) * sh->prop_size);
-    if (unlikely(!p->prop)) {
-        js_free(ctx, p);
-    fail:
-        js_free_shape(ctx->rt, sh);
-        return JS_EXCEPTION;
-    }
 
     switch(class_id) {
     case JS_CLASS_OBJECT:
@@ -5014,6 +5686,8 @@ static void js_autoinit_free(JSRuntime *rt, JSProperty *pr)
 {
     if (pr->u.init.u.init_id >= JS_AUTOINIT_ID_PROP) {
         JS_FreeContext(pr->u.init.u.realm);
+    } else if (pr->u.init.u.init_id == JS_AUTOINIT_ID_BACKTRACE) {
+        js_backtrace_free(rt, pr->u.init.opaque);
     }
 }
 
@@ -5022,6 +5696,8 @@ static void js_autoinit_mark(JSRuntime *rt, JSProperty *pr,
 {
     if (pr->u.init.u.init_id >= JS_AUTOINIT_ID_PROP) {
         mark_func(rt, &pr->u.init.u.realm->header);
+    } else if (pr->u.init.u.init_id == JS_AUTOINIT_ID_BACKTRACE) {
+        js_backtrace_mark(rt, pr->u.init.opaque, mark_func);
     }
 }
 
@@ -5270,7 +5946,8 @@ static void free_object(JSRuntime *rt, JSObject *p)
         free_property(rt, &p->prop[i], pr->flags);
         pr++;
     }
-    js_free_rt(rt, p->prop);
+    if (!js_object_has_inline_prop(p))
+        js_free_rt(rt, p->prop);
     /* as an optimization we destroy the shape immediately without
        putting it in gc_zero_ref_count_list */
     js_free_shape(rt, sh);
@@ -5363,6 +6040,15 @@ void __JS_FreeValueRT(JSRuntime *rt, JSValue v)
             }
         }
         break;
+    case JS_TAG_STRING_ROPE:
+        {
+            /* the recursion is bounded by JS_STRING_ROPE_MAX_DEPTH */
+            JSStringRope *r = JS_VALUE_GET_PTR(v);
+            JS_FreeValueRT(rt, r->left);
+            JS_FreeValueRT(rt, r->right);
+            js_free_rt(rt, r);
+        }
+        break;
     case JS_TAG_OBJECT:
     case JS_TAG_FUNCTION_BYTECODE:
         {
@@ -5750,6 +6436,17 @@ static void compute_value_size(JSValueConst val, JSMemoryUsage_helper *hp)
     case JS_TAG_STRING:
         compute_jsstring_size(JS_VALUE_GET_STRING(val), hp);
         break;
+    case JS_TAG_STRING_ROPE:
+        {
+            JSStringRope *r = JS_VALUE_GET_PTR(val);
+            double s_ref_count = r->header.ref_count;
+            hp->str_count += 1 / s_ref_count;
+            hp->str_size += sizeof(*r) / s_ref_count;
+            compute_value_size(r->left, hp);
+            if (r->depth != 0)
+                compute_value_size(r->right, hp);
+        }
+        break;
 #ifdef CONFIG_BIGNUM
     case JS_TAG_BIG_INT:
     case JS_TAG_BIG_FLOAT:
@@ -5839,7 +6536,8 @@ void JS_ComputeMemoryUsage(JSRuntime *rt, JSMemoryUsage *s)
         sh = p->shape;
         s->obj_count++;
         if (p->prop) {
-            s->memory_used_count++;
+            if (!js_object_has_inline_prop(p))
+                s->memory_used_count++;
             s->prop_size += sh->prop_size * sizeof(*p->prop);
             s->prop_count += sh->prop_count;
             prs = get_shape_prop(sh);
@@ -6305,105 +7003,224 @@ static int find_line_num(JSContext *ctx, JSFunctionBytecode *b,
 
 /* in order to avoid executing arbitrary code during the stack trace
    generation, we only look at simple 'name' properties containing a
-   string. */
-static const char *get_func_name(JSContext *ctx, JSValueConst func)
+   string. Return JS_UNDEFINED if there is no such name. */
+static JSValueConst get_func_name(JSValueConst func)
 {
     JSProperty *pr;
     JSShapeProperty *prs;
     JSValueConst val;
     
     if (JS_VALUE_GET_TAG(func) != JS_TAG_OBJECT)
-        return NULL;
+        return JS_UNDEFINED;
     prs = find_own_property(&pr, JS_VALUE_GET_OBJ(func), JS_ATOM_name);
     if (!prs)
-        return NULL;
+        return JS_UNDEFINED;
     if ((prs->flags & JS_PROP_TMASK) != JS_PROP_NORMAL)
-        return NULL;
+        return JS_UNDEFINED;
     val = pr->u.value;
-    if (JS_VALUE_GET_TAG(val) != JS_TAG_STRING)
-        return NULL;
-    return JS_ToCString(ctx, val);
+    if (!tag_is_string(JS_VALUE_GET_TAG(val)))
+        return JS_UNDEFINED;
+    return val;
 }
 
 #define JS_BACKTRACE_FLAG_SKIP_FIRST_LEVEL (1 << 0)
 /* only taken into account if filename is provided */
 #define JS_BACKTRACE_FLAG_SINGLE_LEVEL     (1 << 1)
 
+typedef struct JSBacktraceFrame {
+    JSValue func_name; /* string or JS_UNDEFINED */
+    JSFunctionBytecode *b; /* NULL for a native function */
+    uint32_t pc_pos;
+} JSBacktraceFrame;
+
+/* stack frames captured when an error is created. The 'stack' string
+   is only built when the property is read. */
+struct JSBacktrace {
+    int frame_count;
+    JSBacktraceFrame frames[0];
+};
+
+/* return NULL if there is not enough memory. No exception is raised. */
+static JSBacktrace *js_backtrace_capture(JSContext *ctx, int backtrace_flags)
+{
+    JSRuntime *rt = ctx->rt;
+    JSStackFrame *sf, *first_sf;
+    JSBacktrace *bt;
+    JSBacktraceFrame *fr;
+    JSFunctionBytecode *b;
+    int n;
+
+    first_sf = rt->current_stack_frame;
+    if (first_sf && (backtrace_flags & JS_BACKTRACE_FLAG_SKIP_FIRST_LEVEL))
+        first_sf = first_sf->prev_frame;
+    n = 0;
+    for(sf = first_sf; sf != NULL; sf = sf->prev_frame) {
+        n++;
+        /* stop backtrace if JS_EVAL_FLAG_BACKTRACE_BARRIER was used */
+        b = JS_GetFunctionBytecode(sf->cur_func);
+        if (b && b->backtrace_barrier)
+            break;
+    }
+    bt = js_malloc_rt(rt, sizeof(*bt) + sizeof(bt->frames[0]) * n);
+    if (!bt)
+        return NULL;
+    bt->frame_count = n;
+    fr = bt->frames;
+    for(sf = first_sf; n > 0; sf = sf->prev_frame, n--, fr++) {
+        fr->func_name = JS_DupValueRT(rt, get_func_name(sf->cur_func));
+        b = JS_GetFunctionBytecode(sf->cur_func);
+        fr->b = b;
+        fr->pc_pos = 0;
+        if (b) {
+            JS_DupValueRT(rt, JS_MKPTR(JS_TAG_FUNCTION_BYTECODE, b));
+            if (b->has_debug)
+                fr->pc_pos = sf->cur_pc - b->byte_code_buf - 1;
+        }
+    }
+    return bt;
+}
+
+static void js_backtrace_free(JSRuntime *rt, JSBacktrace *bt)
+{
+    JSBacktraceFrame *fr;
+    int i;
+
+    for(i = 0; i < bt->frame_count; i++) {
+        fr = &bt->frames[i];
+        JS_FreeValueRT(rt, fr->func_name);
+        if (fr->b)
+            JS_FreeValueRT(rt, JS_MKPTR(JS_TAG_FUNCTION_BYTECODE, fr->b));
+    }
+    js_free_rt(rt, bt);
+}
+
+static void js_backtrace_mark(JSRuntime *rt, JSBacktrace *bt,
+                              JS_MarkFunc *mark_func)
+{
+    int i;
+
+    for(i = 0; i < bt->frame_count; i++) {
+        if (bt->frames[i].b)
+            mark_func(rt, &bt->frames[i].b->header);
+    }
+}
+
+static void js_backtrace_format(StringBuffer *b, const JSBacktrace *bt)
+{
+    const JSBacktraceFrame *fr;
+    JSFunctionBytecode *fb;
+    JSValueConst name;
+    char buf[16];
+    int i, line_num1;
+
+    for(i = 0; i < bt->frame_count; i++) {
+        fr = &bt->frames[i];
+        string_buffer_puts8(b, "    at ");
+        name = fr->func_name;
+        if (JS_IsUndefined(name) ||
+            (JS_VALUE_GET_TAG(name) == JS_TAG_STRING &&
+             JS_VALUE_GET_STRING(name)->len == 0))
+            string_buffer_puts8(b, "<anonymous>");
+        else
+            string_buffer_concat_value(b, name);
+
+        fb = fr->b;
+        if (fb) {
+            if (fb->has_debug) {
+                string_buffer_puts8(b, " (");
+                string_buffer_concat_value_free(b, JS_AtomToString(b->ctx, fb->debug.filename));
+                line_num1 = find_line_num(b->ctx, fb, fr->pc_pos);
+                if (line_num1 != -1) {
+                    snprintf(buf, sizeof(buf), ":%d", line_num1);
+                    string_buffer_puts8(b, buf);
+                }
+                string_buffer_putc8(b, ')');
+            }
+        } else {
+            string_buffer_puts8(b, " (native)");
+        }
+        string_buffer_putc8(b, '\n');
+    }
+}
+
+/* JS_AUTOINIT_ID_BACKTRACE: replace the 'stack' property by its
+   string, keeping its attributes */
+static int js_backtrace_autoinit(JSContext *ctx, JSObject *p, JSAtom atom,
+                                 void *opaque)
+{
+    JSShapeProperty *prs;
+    JSProperty *pr;
+    StringBuffer b_s, *b = &b_s;
+    JSValue str;
+
+    string_buffer_init(ctx, b, 0);
+    js_backtrace_format(b, opaque);
+    str = string_buffer_end(b);
+    if (JS_IsException(str))
+        return -1;
+
+    prs = find_own_property(&pr, p, atom);
+    if (js_shape_prepare_update(ctx, p, &prs)) {
+        JS_FreeValue(ctx, str);
+        return -1;
+    }
+    js_autoinit_free(ctx->rt, pr);
+    prs->flags &= ~JS_PROP_TMASK;
+    pr->u.value = str;
+    return 0;
+}
+
 /* if filename != NULL, an additional level is added with the filename
-   and line number information (used for parse error). */
+   and line number information (used for parse error). Otherwise the
+   'stack' string is only built when the property is read. */
 static void build_backtrace(JSContext *ctx, JSValueConst error_obj,
                             const char *filename, int line_num,
                             int backtrace_flags)
 {
-    JSStackFrame *sf;
+    JSBacktrace *bt;
     JSValue str;
-    DynBuf dbuf;
-    const char *func_name_str;
-    const char *str1;
-    JSObject *p;
-    BOOL backtrace_barrier;
-    
-    js_dbuf_init(ctx, &dbuf);
+    StringBuffer b_s, *b = &b_s;
+    char buf[16];
+
+    bt = NULL;
+    if (!filename || !(backtrace_flags & JS_BACKTRACE_FLAG_SINGLE_LEVEL)) {
+        bt = js_backtrace_capture(ctx, backtrace_flags);
+        if (!bt) {
+            str = JS_NULL;
+            goto done;
+        }
+        if (!filename && JS_VALUE_GET_TAG(error_obj) == JS_TAG_OBJECT &&
+            !find_own_property1(JS_VALUE_GET_OBJ(error_obj), JS_ATOM_stack)) {
+            JS_DefineAutoInitProperty(ctx, error_obj, JS_ATOM_stack,
+                                      JS_AUTOINIT_ID_BACKTRACE, bt,
+                                      JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE);
+            return;
+        }
+    }
+
+    string_buffer_init(ctx, b, 0);
     if (filename) {
-        dbuf_printf(&dbuf, "    at %s", filename);
-        if (line_num != -1)
-            dbuf_printf(&dbuf, ":%d", line_num);
-        dbuf_putc(&dbuf, '\n');
         str = JS_NewString(ctx, filename);
+        string_buffer_puts8(b, "    at ");
+        string_buffer_concat_value(b, str);
+        if (line_num != -1) {
+            snprintf(buf, sizeof(buf), ":%d", line_num);
+            string_buffer_puts8(b, buf);
+        }
+        string_buffer_putc8(b, '\n');
         JS_DefinePropertyValue(ctx, error_obj, JS_ATOM_fileName, str,
                                JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE);
         JS_DefinePropertyValue(ctx, error_obj, JS_ATOM_lineNumber, JS_NewInt32(ctx, line_num),
                                JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE);
-        if (backtrace_flags & JS_BACKTRACE_FLAG_SINGLE_LEVEL)
-            goto done;
     }
-    for(sf = ctx->rt->current_stack_frame; sf != NULL; sf = sf->prev_frame) {
-        if (backtrace_flags & JS_BACKTRACE_FLAG_SKIP_FIRST_LEVEL) {
-            backtrace_flags &= ~JS_BACKTRACE_FLAG_SKIP_FIRST_LEVEL;
-            continue;
-        }
-        func_name_str = get_func_name(ctx, sf->cur_func);
-        if (!func_name_str || func_name_str[0] == '\0')
-            str1 = "<anonymous>";
-        else
-            str1 = func_name_str;
-        dbuf_printf(&dbuf, "    at %s", str1);
-        JS_FreeCString(ctx, func_name_str);
-
-        p = JS_VALUE_GET_OBJ(sf->cur_func);
-        backtrace_barrier = FALSE;
-        if (js_class_has_bytecode(p->class_id)) {
-            JSFunctionBytecode *b;
-            char atom_buf[ATOM_GET_STR_BUF_SIZE];
-            int line_num1;
-
-            b = p->u.func.function_bytecode;
-            backtrace_barrier = b->backtrace_barrier;
-            if (b->has_debug) {
-                line_num1 = find_line_num(ctx, b,
-                                          sf->cur_pc - b->byte_code_buf - 1);
-                dbuf_printf(&dbuf, " (%s",
-                            JS_AtomGetStr(ctx, atom_buf, sizeof(atom_buf),
-                                          b->debug.filename));
-                if (line_num1 != -1)
-                    dbuf_printf(&dbuf, ":%d", line_num1);
-                dbuf_putc(&dbuf, ')');
-            }
-        } else {
-            dbuf_printf(&dbuf, " (native)");
-        }
-        dbuf_putc(&dbuf, '\n');
-        /* stop backtrace if JS_EVAL_FLAG_BACKTRACE_BARRIER was used */
-        if (backtrace_barrier)
-            break;
+    if (bt) {
+        js_backtrace_format(b, bt);
+        js_backtrace_free(ctx->rt, bt);
     }
- done:
-    dbuf_putc(&dbuf, '\0');
-    if (dbuf_error(&dbuf))
+    str = string_buffer_end(b);
+    if (JS_IsException(str))
         str = JS_NULL;
-    else
-        str = JS_NewString(ctx, (char *)dbuf.buf);
-    dbuf_free(&dbuf);
+ done:
     JS_DefinePropertyValue(ctx, error_obj, JS_ATOM_stack, str,
                            JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE);
 }
@@ -6725,6 +7542,7 @@ JSValueConst JS_GetPrototype(JSContext *ctx, JSValueConst val)
         val = ctx->class_proto[JS_CLASS_BOOLEAN];
         break;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         val = ctx->class_proto[JS_CLASS_STRING];
         break;
     case JS_TAG_SYMBOL:
@@ -6852,6 +7670,9 @@ static int JS_AutoInitProperty(JSContext *ctx, JSObject *p, JSAtom prop, JSPrope
         case JS_AUTOINIT_ID_MODULE_NS:
             ret = js_module_ns_autoinit(ctx, p, prop, pr->u.init.opaque);
             break;
+        case JS_AUTOINIT_ID_BACKTRACE:
+            ret = js_backtrace_autoinit(ctx, p, prop, pr->u.init.opaque);
+            break;
         default:
             abort();
         }
@@ -6876,9 +7697,17 @@ JSValue JS_GetPropertyInternal(JSContext *ctx, JSValueConst obj,
             return JS_ThrowTypeError(ctx, "value has no property");
         case JS_TAG_EXCEPTION:
             return JS_EXCEPTION;
+        case JS_TAG_STRING_ROPE:
+            if (prop == JS_ATOM_length)
+                return JS_NewInt32(ctx, js_string_value_len(obj));
+            if (!__JS_AtomIsTaggedInt(prop))
+                break;
+            /* fall thru */
         case JS_TAG_STRING:
             {
-                JSString *p1 = JS_VALUE_GET_STRING(obj);
+                JSString *p1 = js_get_flat_string(ctx, obj);
+                if (!p1)
+                    return JS_EXCEPTION;
                 if (__JS_AtomIsTaggedInt(prop)) {
                     uint32_t idx, ch;
                     idx = __JS_AtomToUInt32(prop);
@@ -7436,6 +8265,56 @@ int JS_GetOwnPropertyNames(JSContext *ctx, JSPropertyEnum **ptab,
                                           JS_VALUE_GET_OBJ(obj), flags);
 }
 
+/* Return the shape of 'obj' if it is an ordinary object whose
+   prototype is Object.prototype or null and whose own properties are
+   all data properties, so that its enumerable string keyed properties
+   can be read slot by slot without lookup. Return NULL otherwise. */
+const void *JS_GetPlainObjectShape(JSContext *ctx, JSValueConst obj,
+                                   uint32_t *pcount)
+{
+    JSObject *p;
+    JSShape *sh;
+    JSShapeProperty *prs;
+    uint32_t i;
+
+    if (JS_VALUE_GET_TAG(obj) != JS_TAG_OBJECT)
+        return NULL;
+    p = JS_VALUE_GET_OBJ(obj);
+    if (p->class_id != JS_CLASS_OBJECT)
+        return NULL;
+    sh = p->shape;
+    if (sh->proto != NULL &&
+        sh->proto != JS_VALUE_GET_OBJ(ctx->class_proto[JS_CLASS_OBJECT]))
+        return NULL;
+    for(i = 0, prs = get_shape_prop(sh); i < sh->prop_count; i++, prs++) {
+        if (prs->atom != JS_ATOM_NULL &&
+            (prs->flags & JS_PROP_TMASK) != JS_PROP_NORMAL)
+            return NULL;
+    }
+    *pcount = sh->prop_count;
+    return sh;
+}
+
+/* Return the value of the slot 'idx' of an object accepted by
+   JS_GetPlainObjectShape() and set '*patom' to its name, or to
+   JS_ATOM_NULL (0) if the slot is deleted, not enumerable or not
+   string keyed. The name only depends on the shape. Neither the atom
+   nor the value are duplicated. */
+JSValueConst JS_GetPlainObjectSlot(JSContext *ctx, JSValueConst obj,
+                                   uint32_t idx, JSAtom *patom)
+{
+    JSObject *p = JS_VALUE_GET_OBJ(obj);
+    JSShapeProperty *prs = &get_shape_prop(p->shape)[idx];
+
+    if (prs->atom == JS_ATOM_NULL || !(prs->flags & JS_PROP_ENUMERABLE) ||
+        !JS_AtomIsString(ctx, prs->atom)) {
+        *patom = JS_ATOM_NULL;
+        return JS_UNDEFINED;
+    }
+    *patom = prs->atom;
+    return p->prop[idx].u.value;
+}
+
 /* Return -1 if exception,
    FALSE if the property does not exist, TRUE if it exists. If TRUE is
    returned, the property descriptor 'desc' is filled present. */
@@ -7785,8 +8664,7 @@ static JSProperty *add_property(JSContext *ctx,
             /*  the property array may need to be resized */
             if (new_sh->prop_size != sh->prop_size) {
                 JSProperty *new_prop;
-                new_prop = js_realloc(ctx, p->prop, sizeof(p->prop[0]) *
-                                      new_sh->prop_size);
+                new_prop = js_resize_prop_array(ctx, p, sh, new_sh->prop_size);
                 if (!new_prop)
                     return NULL;
                 p->prop = new_prop;
@@ -8038,6 +8916,23 @@ static int set_array_length(JSContext *ctx, JSObject *p, JSProperty *prop,
     return TRUE;
 }
 
+/* Grow the storage of the fast array 'p' to at least 'new_len' elements */
+static int expand_fast_array(JSContext *ctx, JSObject *p, uint32_t new_len)
+{
+    uint32_t new_size;
+    size_t slack;
+    JSValue *new_array_prop;
+    /* XXX: potential arithmetic overflow */
+    new_size = max_int(new_len, p->u.array.u1.size * 3 / 2);
+    new_array_prop = js_realloc2(ctx, p->u.array.u.values, sizeof(JSValue) * new_size, &slack);
+    if (!new_array_prop)
+        return -1;
+    new_size += slack / sizeof(*new_array_prop);
+    p->u.array.u.values = new_array_prop;
+    p->u.array.u1.size = new_size;
+    return 0;
+}
+
 /* Preconditions: 'p' must be of class JS_CLASS_ARRAY, p->fast_array =
    TRUE and p->extensible = TRUE */
 static int add_fast_array_element(JSContext *ctx, JSObject *p,
@@ -8060,19 +8955,10 @@ static int add_fast_array_element(JSContext *ctx, JSObject *p,
         }
     }
     if (unlikely(new_len > p->u.array.u1.size)) {
-        uint32_t new_size;
-        size_t slack;
-        JSValue *new_array_prop;
-        /* XXX: potential arithmetic overflow */
-        new_size = max_int(new_len, p->u.array.u1.size * 3 / 2);
-        new_array_prop = js_realloc2(ctx, p->u.array.u.values, sizeof(JSValue) * new_size, &slack);
-        if (!new_array_prop) {
+        if (expand_fast_array(ctx, p, new_len)) {
             JS_FreeValue(ctx, val);
             return -1;
         }
-        new_size += slack / sizeof(*new_array_prop);
-        p->u.array.u.values = new_array_prop;
-        p->u.array.u1.size = new_size;
     }
     p->u.array.u.values[new_len - 1] = val;
     p->u.array.count = new_len;
@@ -8749,6 +9635,8 @@ static int js_shape_prepare_update(JSContext *ctx, JSObject *p,
             sh->is_hashed = FALSE;
         }
     }
+    /* the caller modifies the shape in place */
+    js_shape_update_id(ctx->rt, sh);
     return 0;
 }
 
@@ -9667,8 +10555,9 @@ static int JS_ToBoolFree(JSContext *ctx, JSValue val)
     case JS_TAG_EXCEPTION:
         return -1;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         {
-            BOOL ret = JS_VALUE_GET_STRING(val)->len != 0;
+            BOOL ret = js_string_value_len(val) != 0;
             JS_FreeValue(ctx, val);
             return ret;
         }
@@ -9741,13 +10630,192 @@ static inline int to_digit(int c)
         return 36;
 }
 
-/* XXX: remove */
+#define POW10_MIN_EXP10 (-348)
+#define POW10_MAX_EXP10 347
+
+/* 128-bit mantissas of the powers of ten, used to convert decimal
+   numbers to and from float64 */
+static const uint64_t pow10_table[POW10_MAX_EXP10 - POW10_MIN_EXP10 + 1][2] = {
+#include "quickjs-pow10.h"
+};
+
+/* return the high 64 bits of a * b and store the low 64 bits in *plo */
+static inline uint64_t mul_u64(uint64_t *plo, uint64_t a, uint64_t b)
+{
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 r = (unsigned __int128)a * b;
+    *plo = (uint64_t)r;
+    return (uint64_t)(r >> 64);
+#else
+    uint64_t a0, a1, b0, b1, p00, p01, p10, p11, mid;
+    a0 = (uint32_t)a;
+    a1 = a >> 32;
+    b0 = (uint32_t)b;
+    b1 = b >> 32;
+    p00 = a0 * b0;
+    p01 = a0 * b1;
+    p10 = a1 * b0;
+    p11 = a1 * b1;
+    mid = (p00 >> 32) + (uint32_t)p01 + (uint32_t)p10;
+    *plo = (mid << 32) | (uint32_t)p00;
+    return p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+#endif
+}
+
+/* floor(log2(10^q)) for POW10_MIN_EXP10 <= q <= POW10_MAX_EXP10 */
+static inline int floor_log2_pow10(int q)
+{
+    return (q * 217706) >> 16;
+}
+
+/* Eisel-Lemire algorithm: store in *pd the float64 nearest to
+   man * 10^exp10. Return FALSE if the result cannot be decided with the
+   128-bit approximation of 10^exp10 or if it is not a normal number. */
+static BOOL js_eisel_lemire(double *pd, uint64_t man, int exp10, BOOL is_neg)
+{
+    const uint64_t *pow10;
+    uint64_t x_hi, x_lo, y_hi, y_lo, merged_hi, merged_lo, mant, exp2, msb;
+    int shift;
+    JSFloat64Union u;
+
+    if (man == 0) {
+        *pd = is_neg ? -0.0 : 0.0;
+        return TRUE;
+    }
+    if (exp10 < POW10_MIN_EXP10 || exp10 > POW10_MAX_EXP10)
+        return FALSE;
+    shift = clz64(man);
+    man <<= shift;
+    exp2 = (uint64_t)(floor_log2_pow10(exp10) + 64 + 1023) - shift;
+
+    pow10 = pow10_table[exp10 - POW10_MIN_EXP10];
+    x_hi = mul_u64(&x_lo, man, pow10[0]);
+    if ((x_hi & 0x1ff) == 0x1ff && x_lo + man < man) {
+        /* the low bits of the product may carry: use the 192-bit product */
+        y_hi = mul_u64(&y_lo, man, pow10[1]);
+        merged_hi = x_hi;
+        merged_lo = x_lo + y_hi;
+        if (merged_lo < x_lo)
+            merged_hi++;
+        if ((merged_hi & 0x1ff) == 0x1ff && merged_lo + 1 == 0 &&
+            y_lo + man < man)
+            return FALSE;
+        x_hi = merged_hi;
+        x_lo = merged_lo;
+    }
+
+    /* keep 54 bits */
+    msb = x_hi >> 63;
+    mant = x_hi >> (msb + 9);
+    exp2 -= 1 ^ msb;
+    /* halfway between two float64: the approximation cannot tell */
+    if (x_lo == 0 && (x_hi & 0x1ff) == 0 && (mant & 3) == 1)
+        return FALSE;
+    /* round to 53 bits */
+    mant += mant & 1;
+    mant >>= 1;
+    if ((mant >> 53) != 0) {
+        mant >>= 1;
+        exp2++;
+    }
+    /* subnormal, infinite or zero result */
+    if (exp2 - 1 >= 0x7ff - 1)
+        return FALSE;
+    u.u64 = (exp2 << 52) | (mant & (((uint64_t)1 << 52) - 1)) |
+        ((uint64_t)is_neg << 63);
+    *pd = u.d;
+    return TRUE;
+}
+
+/* fast conversion of a decimal number as output by js_atof:
+   [-]digits[.digits][(e|E)[+|-]digits]. The first 19 significant
+   digits are kept. Return FALSE if strtod() must be used. */
+static BOOL js_atod10(double *pd, const char *p)
+{
+    uint64_t man;
+    int n_digits, exp10, e, c;
+    BOOL is_neg, is_trunc, is_neg_exp;
+    double d, d1;
+
+    is_neg = FALSE;
+    if (*p == '-') {
+        is_neg = TRUE;
+        p++;
+    }
+    man = 0;
+    n_digits = 0;
+    exp10 = 0;
+    is_trunc = FALSE;
+    while (*p == '0')
+        p++;
+    for(; is_digit((uint8_t)*p); p++) {
+        c = *p - '0';
+        if (n_digits < 19) {
+            man = man * 10 + c;
+            n_digits++;
+        } else {
+            exp10++;
+            is_trunc |= (c != 0);
+        }
+    }
+    if (*p == '.') {
+        p++;
+        if (n_digits == 0) {
+            while (*p == '0') {
+                p++;
+                exp10--;
+            }
+        }
+        for(; is_digit((uint8_t)*p); p++) {
+            c = *p - '0';
+            if (n_digits < 19) {
+                man = man * 10 + c;
+                n_digits++;
+                exp10--;
+            } else {
+                is_trunc |= (c != 0);
+            }
+        }
+    }
+    if (*p == 'e' || *p == 'E') {
+        p++;
+        is_neg_exp = FALSE;
+        if (*p == '+') {
+            p++;
+        } else if (*p == '-') {
+            is_neg_exp = TRUE;
+            p++;
+        }
+        e = 0;
+        for(; is_digit((uint8_t)*p); p++) {
+            if (e < 100000)
+                e = e * 10 + (*p - '0');
+        }
+        exp10 += is_neg_exp ? -e : e;
+    }
+    if (*p != '\0')
+        return FALSE;
+    if (!js_eisel_lemire(&d, man, exp10, is_neg))
+        return FALSE;
+    if (is_trunc) {
+        /* the result is exact if the next mantissa rounds to the
+           same float64 */
+        if (!js_eisel_lemire(&d1, man + 1, exp10, is_neg) || d != d1)
+            return FALSE;
+    }
+    *pd = d;
+    return TRUE;
+}
+
 static double js_strtod(const char *p, int radix, BOOL is_float)
 {
     double d;
     int c;
     
-    if (!is_float || radix != 10) {
+    if (radix == 10) {
+        if (!js_atod10(&d, p))
+            d = strtod(p, NULL);
+    } else {
         uint64_t n_max, n;
         int int_exp, is_neg;
         
@@ -9761,10 +10829,7 @@ static double js_strtod(const char *p, int radix, BOOL is_float)
         while (*p == '0')
             p++;
         n = 0;
-        if (radix == 10)
-            n_max = ((uint64_t)-1 - 9) / 10; /* most common case */
-        else
-            n_max = ((uint64_t)-1 - (radix - 1)) / radix;
+        n_max = ((uint64_t)-1 - (radix - 1)) / radix;
         /* XXX: could be more precise */
         int_exp = 0;
         while (*p != '\0') {
@@ -9784,8 +10849,6 @@ static double js_strtod(const char *p, int radix, BOOL is_float)
         }
         if (is_neg)
             d = -d;
-    } else {
-        d = strtod(p, NULL);
     }
     return d;
 }
@@ -10189,6 +11252,7 @@ static JSValue JS_ToNumberHintFree(JSContext *ctx, JSValue val,
             return JS_EXCEPTION;
         goto redo;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         {
             const char *str;
             const char *p;
@@ -10592,6 +11656,34 @@ int JS_ToInt64Ext(JSContext *ctx, int64_t *pres, JSValueConst val)
         return JS_ToInt64(ctx, pres, val);
 }
 
+/* ToInt32() of a double */
+static inline int32_t js_double_to_int32(double d)
+{
+    JSFloat64Union u;
+    int32_t ret;
+    int e;
+
+    u.d = d;
+    /* we avoid doing fmod(x, 2^32) */
+    e = (u.u64 >> 52) & 0x7ff;
+    if (likely(e <= (1023 + 30))) {
+        /* fast case */
+        ret = (int32_t)d;
+    } else if (e <= (1023 + 30 + 53)) {
+        uint64_t v;
+        /* remainder modulo 2^32 */
+        v = (u.u64 & (((uint64_t)1 << 52) - 1)) | ((uint64_t)1 << 52);
+        v = v << ((e - 1023) - 52 + 32);
+        ret = v >> 32;
+        /* take the sign into account */
+        if (u.u64 >> 63)
+            ret = -ret;
+    } else {
+        ret = 0; /* also handles NaN and +inf */
+    }
+    return ret;
+}
+
 /* return (<0, 0) in case of exception */
 static int JS_ToInt32Free(JSContext *ctx, int32_t *pres, JSValue val)
 {
@@ -10608,30 +11700,7 @@ static int JS_ToInt32Free(JSContext *ctx, int32_t *pres, JSValue val)
         ret = JS_VALUE_GET_INT(val);
         break;
     case JS_TAG_FLOAT64:
-        {
-            JSFloat64Union u;
-            double d;
-            int e;
-            d = JS_VALUE_GET_FLOAT64(val);
-            u.d = d;
-            /* we avoid doing fmod(x, 2^32) */
-            e = (u.u64 >> 52) & 0x7ff;
-            if (likely(e <= (1023 + 30))) {
-                /* fast case */
-                ret = (int32_t)d;
-            } else if (e <= (1023 + 30 + 53)) {
-                uint64_t v;
-                /* remainder modulo 2^32 */
-                v = (u.u64 & (((uint64_t)1 << 52) - 1)) | ((uint64_t)1 << 52);
-                v = v << ((e - 1023) - 52 + 32);
-                ret = v >> 32;
-                /* take the sign into account */
-                if (u.u64 >> 63)
-                    ret = -ret;
-            } else {
-                ret = 0; /* also handles NaN and +inf */
-            }
-        }
+        ret = js_double_to_int32(JS_VALUE_GET_FLOAT64(val));
         break;
 #ifdef CONFIG_BIGNUM
     case JS_TAG_BIG_FLOAT:
@@ -10999,20 +12068,189 @@ static char *i64toa(char *buf_end, int64_t n, unsigned int base)
         n = -n;
     }
     *--q = '\0';
-    do {
-        digit = (uint64_t)n % base;
-        n = (uint64_t)n / base;
-        if (digit < 10)
-            digit += '0';
-        else
-            digit += 'a' - 10;
-        *--q = digit;
-    } while (n != 0);
+    if (base == 10) {
+        /* most common case: division by a constant */
+        do {
+            *--q = '0' + (uint64_t)n % 10;
+            n = (uint64_t)n / 10;
+        } while (n != 0);
+    } else {
+        do {
+            digit = (uint64_t)n % base;
+            n = (uint64_t)n / base;
+            if (digit < 10)
+                digit += '0';
+            else
+                digit += 'a' - 10;
+            *--q = digit;
+        } while (n != 0);
+    }
     if (is_neg)
         *--q = '-';
     return q;
 }
 
+/* Grisu3 shortest conversion of float64 to decimal (Florian Loitsch,
+   "Printing Floating-Point Numbers Quickly and Accurately with
+   Integers"). It fails for about 0.5% of the numbers, which are then
+   converted with js_ecvt1(). */
+
+typedef struct {
+    uint64_t f;
+    int e;
+} JSDiyFp;
+
+static inline JSDiyFp diy_fp_mul(JSDiyFp a, JSDiyFp b)
+{
+    JSDiyFp r;
+    uint64_t lo;
+    r.f = mul_u64(&lo, a.f, b.f);
+    r.f += lo >> 63; /* round */
+    r.e = a.e + b.e + 64;
+    return r;
+}
+
+static inline JSDiyFp diy_fp_normalize(uint64_t f, int e)
+{
+    JSDiyFp r;
+    int shift = clz64(f);
+    r.f = f << shift;
+    r.e = e - shift;
+    return r;
+}
+
+static const uint32_t pow10_u32[10] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+    1000000000,
+};
+
+/* remove the last digit while it gets closer to 'w' and check that the
+   result is inside the safe interval */
+static BOOL grisu_round_weed(char *buf, int len, uint64_t dist_too_high_w,
+                             uint64_t unsafe_interval, uint64_t rest,
+                             uint64_t ten_kappa, uint64_t unit)
+{
+    uint64_t small_dist = dist_too_high_w - unit;
+    uint64_t big_dist = dist_too_high_w + unit;
+
+    while (rest < small_dist && unsafe_interval - rest >= ten_kappa &&
+           (rest + ten_kappa < small_dist ||
+            small_dist - rest >= rest + ten_kappa - small_dist)) {
+        buf[len - 1]--;
+        rest += ten_kappa;
+    }
+    if (rest < big_dist && unsafe_interval - rest >= ten_kappa &&
+        (rest + ten_kappa < big_dist ||
+         big_dist - rest > rest + ten_kappa - big_dist))
+        return FALSE;
+    return 2 * unit <= rest && rest <= unsafe_interval - 4 * unit;
+}
+
+/* generate the shortest digits of a number between 'low' and 'high'
+   which are scaled so that -60 <= e <= -32. Return FALSE if the digits
+   may not be the shortest or the closest to 'w'. */
+static BOOL grisu_digit_gen(char *buf, int *plen, int *pkappa,
+                            JSDiyFp low, JSDiyFp w, JSDiyFp high)
+{
+    uint64_t unit, too_low, too_high, unsafe_interval, one, fractionals;
+    uint64_t rest;
+    uint32_t integrals, divisor;
+    int shift, kappa, len, digit;
+
+    unit = 1;
+    too_low = low.f - unit;
+    too_high = high.f + unit;
+    unsafe_interval = too_high - too_low;
+    shift = -w.e;
+    one = (uint64_t)1 << shift;
+    integrals = (uint32_t)(too_high >> shift);
+    fractionals = too_high & (one - 1);
+    /* integrals >= 8 because e >= -60 */
+    kappa = 1;
+    while (kappa < 10 && integrals >= pow10_u32[kappa])
+        kappa++;
+    divisor = pow10_u32[kappa - 1];
+    len = 0;
+    while (kappa > 0) {
+        digit = integrals / divisor;
+        buf[len++] = '0' + digit;
+        integrals %= divisor;
+        kappa--;
+        rest = ((uint64_t)integrals << shift) + fractionals;
+        if (rest < unsafe_interval) {
+            *plen = len;
+            *pkappa = kappa;
+            return grisu_round_weed(buf, len, too_high - w.f,
+                                    unsafe_interval, rest,
+                                    (uint64_t)divisor << shift, unit);
+        }
+        divisor /= 10;
+    }
+    for(;;) {
+        fractionals *= 10;
+        unit *= 10;
+        unsafe_interval *= 10;
+        digit = fractionals >> shift;
+        buf[len++] = '0' + digit;
+        fractionals &= one - 1;
+        kappa--;
+        if (fractionals < unsafe_interval) {
+            *plen = len;
+            *pkappa = kappa;
+            return grisu_round_weed(buf, len, (too_high - w.f) * unit,
+                                    unsafe_interval, fractionals, one, unit);
+        }
+    }
+}
+
+/* 'd' must be finite and non zero. Store in 'buf' the shortest digits
+   which convert back to 'd' and return their number, or return 0 if
+   Grisu3 fails. */
+static int js_grisu3(double d, int *decpt, char *buf)
+{
+    JSFloat64Union u;
+    JSDiyFp w, m_plus, m_minus, c;
+    uint64_t f;
+    int e, biased_e, q, min_e, len, kappa;
+
+    u.d = d;
+    biased_e = (u.u64 >> 52) & 0x7ff;
+    f = u.u64 & (((uint64_t)1 << 52) - 1);
+    if (biased_e == 0) {
+        e = 1 - 1075;
+    } else {
+        e = biased_e - 1075;
+        f |= (uint64_t)1 << 52;
+    }
+    w = diy_fp_normalize(f, e);
+    /* boundaries: the lower one is closer for the powers of two */
+    m_plus = diy_fp_normalize((f << 1) + 1, e - 1);
+    if ((u.u64 & (((uint64_t)1 << 52) - 1)) == 0 && biased_e > 1) {
+        m_minus.f = (f << 2) - 1;
+        m_minus.e = e - 2;
+    } else {
+        m_minus.f = (f << 1) - 1;
+        m_minus.e = e - 1;
+    }
+    m_minus.f <<= m_minus.e - m_plus.e;
+    m_minus.e = m_plus.e;
+
+    /* smallest 10^q so that the scaled exponent is >= -60 */
+    min_e = -60 - (w.e + 64);
+    q = ((min_e + 63) * 78913) >> 18;
+    while (floor_log2_pow10(q) - 63 < min_e)
+        q++;
+    c.f = pow10_table[q - POW10_MIN_EXP10][0];
+    c.f += pow10_table[q - POW10_MIN_EXP10][1] >> 63;
+    c.e = floor_log2_pow10(q) - 63;
+
+    if (!grisu_digit_gen(buf, &len, &kappa, diy_fp_mul(m_minus, c),
+                         diy_fp_mul(w, c), diy_fp_mul(m_plus, c)))
+        return 0;
+    *decpt = len + kappa - q;
+    return len;
+}
+
 /* buf1 contains the printf result */
 static void js_ecvt1(double d, int n_digits, int *decpt, int *sign, char *buf,
                      int rounding_mode, char *buf1, int buf1_size)
@@ -11045,6 +12283,14 @@ static int js_ecvt(double d, int n_digits, int *decpt, int *sign, char *buf,
 
     if (!is_fixed) {
         unsigned int n_digits_min, n_digits_max;
+        if (d != 0) {
+            n_digits = js_grisu3(d, decpt, buf);
+            if (n_digits != 0) {
+                buf[n_digits] = '\0';
+                *sign = (d < 0);
+                return n_digits;
+            }
+        }
         /* find the minimum amount of digits (XXX: inefficient but simple) */
         n_digits_min = 1;
         n_digits_max = 17;
@@ -11263,9 +12509,10 @@ JSValue JS_ToStringInternal(JSContext *ctx, JSValueConst val, BOOL is_ToProperty
     switch(tag) {
     case JS_TAG_STRING:
         return JS_DupValue(ctx, val);
+    case JS_TAG_STRING_ROPE:
+        return js_string_rope_flatten(ctx, JS_VALUE_GET_PTR(val));
     case JS_TAG_INT:
-        snprintf(buf, sizeof(buf), "%d", JS_VALUE_GET_INT(val));
-        str = buf;
+        str = i64toa(buf + sizeof(buf), JS_VALUE_GET_INT(val), 10);
         goto new_string;
     case JS_TAG_BOOL:
         return JS_AtomToString(ctx, JS_VALUE_GET_BOOL(val) ?
@@ -11347,26 +12594,33 @@ static JSValue JS_ToStringCheckObject(JSContext *ctx, JSValueConst val)
     return JS_ToString(ctx, val);
 }
 
-static JSValue JS_ToQuotedString(JSContext *ctx, JSValueConst val1)
+/* append the JSON string literal of 'p' */
+static int string_buffer_put_quoted(StringBuffer *b, const JSString *p)
 {
-    JSValue val;
-    JSString *p;
-    int i;
-    uint32_t c;
-    StringBuffer b_s, *b = &b_s;
+    int i, j, c;
     char buf[16];
 
-    val = JS_ToStringCheckObject(ctx, val1);
-    if (JS_IsException(val))
-        return val;
-    p = JS_VALUE_GET_STRING(val);
-
-    if (string_buffer_init(ctx, b, p->len + 2))
-        goto fail;
-
     if (string_buffer_putc8(b, '\"'))
-        goto fail;
+        return -1;
     for(i = 0; i < p->len; ) {
+        /* copy the runs of characters which are not escaped at once */
+        j = i;
+        if (p->is_wide_char) {
+            while (j < p->len && (c = p->u.str16[j]) >= 0x20 &&
+                   c != '\"' && c != '\\' && (c < 0xd800 || c >= 0xe000))
+                j++;
+            if (j > i && string_buffer_write16(b, p->u.str16 + i, j - i))
+                return -1;
+        } else {
+            while (j < p->len && (c = p->u.str8[j]) >= 0x20 &&
+                   c != '\"' && c != '\\')
+                j++;
+            if (j > i && string_buffer_write8(b, p->u.str8 + i, j - i))
+                return -1;
+        }
+        i = j;
+        if (i >= p->len)
+            break;
         c = string_getc(p, &i);
         switch(c) {
         case '\t':
@@ -11388,23 +12642,39 @@ static JSValue JS_ToQuotedString(JSContext *ctx, JSValueConst val1)
         case '\\':
         quote:
             if (string_buffer_putc8(b, '\\'))
-                goto fail;
+                return -1;
             if (string_buffer_putc8(b, c))
-                goto fail;
+                return -1;
             break;
         default:
             if (c < 32 || (c >= 0xd800 && c < 0xe000)) {
                 snprintf(buf, sizeof(buf), "\\u%04x", c);
                 if (string_buffer_puts8(b, buf))
-                    goto fail;
+                    return -1;
             } else {
                 if (string_buffer_putc(b, c))
-                    goto fail;
+                    return -1;
             }
             break;
         }
     }
-    if (string_buffer_putc8(b, '\"'))
+    return string_buffer_putc8(b, '\"');
+}
+
+static JSValue JS_ToQuotedString(JSContext *ctx, JSValueConst val1)
+{
+    JSValue val;
+    JSString *p;
+    StringBuffer b_s, *b = &b_s;
+
+    val = JS_ToStringCheckObject(ctx, val1);
+    if (JS_IsException(val))
+        return val;
+    p = JS_VALUE_GET_STRING(val);
+
+    if (string_buffer_init(ctx, b, p->len + 2))
+        goto fail;
+    if (string_buffer_put_quoted(b, p))
         goto fail;
     JS_FreeValue(ctx, val);
     return string_buffer_end(b);
@@ -11623,6 +12893,12 @@ static __maybe_unused void JS_DumpValueShort(JSRuntime *rt,
             JS_DumpString(rt, p);
         }
         break;
+    case JS_TAG_STRING_ROPE:
+        {
+            JSStringRope *r = JS_VALUE_GET_PTR(val);
+            printf("[rope len=%u depth=%d]", r->len, r->depth);
+        }
+        break;
     case JS_TAG_FUNCTION_BYTECODE:
         {
             JSFunctionBytecode *b = JS_VALUE_GET_PTR(val);
@@ -11898,6 +13174,7 @@ static bf_t *JS_ToBigIntFree(JSContext *ctx, bf_t *buf, JSValue val)
         JS_FreeValue(ctx, val);
         break;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         val = JS_StringToBigIntErr(ctx, val);
         if (JS_IsException(val))
             return NULL;
@@ -13182,10 +14459,10 @@ static no_inline __exception int js_add_slow(JSContext *ctx, JSValue *sp)
         /* try to call an overloaded operator */
         if ((tag1 == JS_TAG_OBJECT &&
              (tag2 != JS_TAG_NULL && tag2 != JS_TAG_UNDEFINED &&
-              tag2 != JS_TAG_STRING)) ||
+              !tag_is_string(tag2))) ||
             (tag2 == JS_TAG_OBJECT &&
              (tag1 != JS_TAG_NULL && tag1 != JS_TAG_UNDEFINED &&
-              tag1 != JS_TAG_STRING))) {
+              !tag_is_string(tag1)))) {
             ret = js_call_binary_op_fallback(ctx, &res, op1, op2, OP_add,
                                              FALSE, HINT_NONE);
             if (ret != 0) {
@@ -13215,7 +14492,7 @@ static no_inline __exception int js_add_slow(JSContext *ctx, JSValue *sp)
         tag2 = JS_VALUE_GET_NORM_TAG(op2);
     }
 
-    if (tag1 == JS_TAG_STRING || tag2 == JS_TAG_STRING) {
+    if (tag_is_string(tag1) || tag_is_string(tag2)) {
         sp[-2] = JS_ConcatString(ctx, op1, op2);
         if (JS_IsException(sp[-2]))
             goto exception;
@@ -13498,6 +14775,13 @@ static no_inline int js_relational_slow(JSContext *ctx, JSValue *sp,
         JS_FreeValue(ctx, op1);
         goto exception;
     }
+    op1 = js_flatten_string_free(ctx, op1);
+    op2 = js_flatten_string_free(ctx, op2);
+    if (JS_IsException(op1) || JS_IsException(op2)) {
+        JS_FreeValue(ctx, op1);
+        JS_FreeValue(ctx, op2);
+        goto exception;
+    }
     tag1 = JS_VALUE_GET_NORM_TAG(op1);
     tag2 = JS_VALUE_GET_NORM_TAG(op2);
 
@@ -13626,6 +14910,16 @@ static no_inline __exception int js_eq_slow(JSContext *ctx, JSValue *sp,
     op1 = sp[-2];
     op2 = sp[-1];
  redo:
+    if (unlikely(JS_VALUE_GET_TAG(op1) == JS_TAG_STRING_ROPE ||
+                 JS_VALUE_GET_TAG(op2) == JS_TAG_STRING_ROPE)) {
+        op1 = js_flatten_string_free(ctx, op1);
+        op2 = js_flatten_string_free(ctx, op2);
+        if (JS_IsException(op1) || JS_IsException(op2)) {
+            JS_FreeValue(ctx, op1);
+            JS_FreeValue(ctx, op2);
+            goto exception;
+        }
+    }
     tag1 = JS_VALUE_GET_NORM_TAG(op1);
     tag2 = JS_VALUE_GET_NORM_TAG(op2);
     if (tag_is_number(tag1) && tag_is_number(tag2)) {
@@ -14000,7 +15294,7 @@ static no_inline __exception int js_add_slow(JSContext *ctx, JSValue *sp)
         }
         tag1 = JS_VALUE_GET_TAG(op1);
         tag2 = JS_VALUE_GET_TAG(op2);
-        if (tag1 == JS_TAG_STRING || tag2 == JS_TAG_STRING) {
+        if (tag_is_string(tag1) || tag_is_string(tag2)) {
             sp[-2] = JS_ConcatString(ctx, op1, op2);
             if (JS_IsException(sp[-2]))
                 goto exception;
@@ -14095,6 +15389,13 @@ static no_inline int js_relational_slow(JSContext *ctx, JSValue *sp,
         JS_FreeValue(ctx, op1);
         goto exception;
     }
+    op1 = js_flatten_string_free(ctx, op1);
+    op2 = js_flatten_string_free(ctx, op2);
+    if (JS_IsException(op1) || JS_IsException(op2)) {
+        JS_FreeValue(ctx, op1);
+        JS_FreeValue(ctx, op2);
+        goto exception;
+    }
     if (JS_VALUE_GET_TAG(op1) == JS_TAG_STRING &&
         JS_VALUE_GET_TAG(op2) == JS_TAG_STRING) {
         JSString *p1, *p2;
@@ -14160,6 +15461,16 @@ static no_inline __exception int js_eq_slow(JSContext *ctx, JSValue *sp,
     op1 = sp[-2];
     op2 = sp[-1];
  redo:
+    if (unlikely(JS_VALUE_GET_TAG(op1) == JS_TAG_STRING_ROPE ||
+                 JS_VALUE_GET_TAG(op2) == JS_TAG_STRING_ROPE)) {
+        op1 = js_flatten_string_free(ctx, op1);
+        op2 = js_flatten_string_free(ctx, op2);
+        if (JS_IsException(op1) || JS_IsException(op2)) {
+            JS_FreeValue(ctx, op1);
+            JS_FreeValue(ctx, op2);
+            goto exception;
+        }
+    }
     tag1 = JS_VALUE_GET_NORM_TAG(op1);
     tag2 = JS_VALUE_GET_NORM_TAG(op2);
     if (tag1 == tag2 ||
@@ -14265,15 +15576,11 @@ static BOOL js_strict_eq2(JSContext *ctx, JSValue op1, JSValue op2,
         res = (tag1 == tag2);
         break;
     case JS_TAG_STRING:
-        {
-            JSString *p1, *p2;
-            if (tag1 != tag2) {
-                res = FALSE;
-            } else {
-                p1 = JS_VALUE_GET_STRING(op1);
-                p2 = JS_VALUE_GET_STRING(op2);
-                res = (js_string_compare(ctx, p1, p2) == 0);
-            }
+    case JS_TAG_STRING_ROPE:
+        if (!tag_is_string(tag2)) {
+            res = FALSE;
+        } else {
+            res = js_string_value_eq(op1, op2);
         }
         break;
     case JS_TAG_SYMBOL:
@@ -14517,6 +15824,7 @@ static __exception int js_operator_typeof(JSContext *ctx, JSValue op1)
         atom = JS_ATOM_boolean;
         break;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         atom = JS_ATOM_string;
         break;
     case JS_TAG_OBJECT:
@@ -14744,6 +16052,50 @@ static JSValue js_build_rest(JSContext *ctx, int first, int argc, JSValueConst *
     return val;
 }
 
+/* 'tmpl' is an object of the constant pool whose shape has the final
+   layout of the literal. The values are consumed. */
+static JSValue js_build_object_literal(JSContext *ctx, JSValueConst tmpl,
+                                       JSValue *values, int count)
+{
+    JSObject *p;
+    JSShape *sh;
+    JSShapeProperty *prs;
+    JSValue obj;
+    int i;
+
+    sh = JS_VALUE_GET_OBJ(tmpl)->shape;
+    if (likely(sh->proto == JS_VALUE_GET_OBJ(ctx->class_proto[JS_CLASS_OBJECT]) &&
+               sh->prop_count == count)) {
+        obj = JS_NewObjectFromShape(ctx, js_dup_shape(sh), JS_CLASS_OBJECT);
+        if (JS_IsException(obj))
+            goto fail;
+        p = JS_VALUE_GET_OBJ(obj);
+        for(i = 0; i < count; i++)
+            p->prop[i].u.value = values[i];
+        return obj;
+    }
+
+    /* the template was created in another realm */
+    obj = JS_NewObject(ctx);
+    if (JS_IsException(obj))
+        goto fail;
+    prs = get_shape_prop(sh);
+    for(i = 0; i < count; i++) {
+        if (JS_DefinePropertyValue(ctx, obj, prs[i].atom, values[i],
+                                   JS_PROP_C_W_E | JS_PROP_THROW) < 0) {
+            while (++i < count)
+                JS_FreeValue(ctx, values[i]);
+            JS_FreeValue(ctx, obj);
+            return JS_EXCEPTION;
+        }
+    }
+    return obj;
+ fail:
+    for(i = 0; i < count; i++)
+        JS_FreeValue(ctx, values[i]);
+    return JS_EXCEPTION;
+}
+
 static JSValue build_for_in_iterator(JSContext *ctx, JSValue obj)
 {
     JSObject *p, *p1;
@@ -15217,6 +16569,134 @@ static BOOL js_get_fast_array(JSContext *ctx, JSValueConst obj,
     return FALSE;
 }
 
+/* Get the element 'idx' of a fast array without a property lookup.
+   Return FALSE if 'obj' is not a fast array or has no such element:
+   the generic property access must then be used. As any JS code can
+   change the array, it must be called again for every element. */
+static BOOL js_get_fast_array_element(JSContext *ctx, JSValueConst obj,
+                                      int64_t idx, JSValue *pval)
+{
+    JSObject *p;
+
+    if (JS_VALUE_GET_TAG(obj) != JS_TAG_OBJECT)
+        return FALSE;
+    p = JS_VALUE_GET_OBJ(obj);
+    if (p->class_id != JS_CLASS_ARRAY || !p->fast_array ||
+        (uint64_t)idx >= p->u.array.count)
+        return FALSE;
+    *pval = JS_DupValue(ctx, p->u.array.u.values[idx]);
+    return TRUE;
+}
+
+/* Same as JS_DefinePropertyValueInt64(ctx, obj, idx, val,
+   JS_PROP_C_W_E | JS_PROP_THROW) but directly appends to the extensible
+   fast arrays holding 'idx' elements. */
+static int js_define_array_element(JSContext *ctx, JSValueConst obj,
+                                   int64_t idx, JSValue val)
+{
+    if (JS_VALUE_GET_TAG(obj) == JS_TAG_OBJECT) {
+        JSObject *p = JS_VALUE_GET_OBJ(obj);
+        if (p->class_id == JS_CLASS_ARRAY && p->fast_array &&
+            p->extensible && idx == p->u.array.count)
+            return add_fast_array_element(ctx, p, val, JS_PROP_THROW);
+    }
+    return JS_DefinePropertyValueInt64(ctx, obj, idx, val,
+                                       JS_PROP_C_W_E | JS_PROP_THROW);
+}
+
+/* Reserve the storage of 'len' elements in 'obj' if it is an empty
+   fast array, to avoid growing it element by element. */
+static int js_reserve_fast_array(JSContext *ctx, JSValueConst obj,
+                                 uint32_t len)
+{
+    JSObject *p;
+
+    if (JS_VALUE_GET_TAG(obj) != JS_TAG_OBJECT)
+        return 0;
+    p = JS_VALUE_GET_OBJ(obj);
+    if (p->class_id != JS_CLASS_ARRAY || !p->fast_array ||
+        p->u.array.count != 0 || len <= p->u.array.u1.size)
+        return 0;
+    return expand_fast_array(ctx, p, len);
+}
+
+/* Return TRUE and set '*parray' and '*plen' to the elements of 'obj'
+   if it is an Array without holes, i.e. whose length is its number of
+   fast array elements. */
+BOOL JS_GetFastArray(JSContext *ctx, JSValueConst obj, JSValue **parray,
+                     uint32_t *plen)
+{
+    JSObject *p;
+
+    if (!js_get_fast_array(ctx, obj, parray, plen))
+        return FALSE;
+    p = JS_VALUE_GET_OBJ(obj);
+    return JS_VALUE_GET_TAG(p->prop[0].u.value) == JS_TAG_INT &&
+        JS_VALUE_GET_INT(p->prop[0].u.value) == *plen;
+}
+
+/* Return an array of the 'len' values of 'tab', which are stolen even
+   if an exception is returned. */
+JSValue JS_NewArrayFrom(JSContext *ctx, uint32_t len, JSValue *tab)
+{
+    JSValue obj;
+    JSObject *p;
+    uint32_t i;
+
+    obj = JS_NewArray(ctx);
+    if (JS_IsException(obj))
+        goto fail;
+    if (len > 0) {
+        p = JS_VALUE_GET_OBJ(obj);
+        if (len > INT32_MAX) {
+            JS_ThrowRangeError(ctx, "invalid array length");
+            JS_FreeValue(ctx, obj);
+            goto fail;
+        }
+        if (expand_fast_array(ctx, p, len)) {
+            JS_FreeValue(ctx, obj);
+            goto fail;
+        }
+        memcpy(p->u.array.u.values, tab, sizeof(tab[0]) * len);
+        p->u.array.count = len;
+        p->prop[0].u.value = JS_NewInt32(ctx, len);
+    }
+    return obj;
+ fail:
+    for(i = 0; i < len; i++)
+        JS_FreeValue(ctx, tab[i]);
+    return JS_EXCEPTION;
+}
+
+/* Release the unused storage of the fast array 'obj' */
+static void js_shrink_fast_array(JSContext *ctx, JSValueConst obj)
+{
+    JSObject *p;
+    JSValue *new_array_prop;
+    uint32_t count;
+
+    if (JS_VALUE_GET_TAG(obj) != JS_TAG_OBJECT)
+        return;
+    p = JS_VALUE_GET_OBJ(obj);
+    if (p->class_id != JS_CLASS_ARRAY || !p->fast_array)
+        return;
+    count = p->u.array.count;
+    if (p->u.array.u1.size <= count + count / 2)
+        return;
+    if (count == 0) {
+        js_free_rt(ctx->rt, p->u.array.u.values);
+        p->u.array.u.values = NULL;
+        p->u.array.u1.size = 0;
+        return;
+    }
+    new_array_prop = js_realloc_rt(ctx->rt, p->u.array.u.values,
+                                   sizeof(JSValue) * count);
+    if (new_array_prop) {
+        p->u.array.u.values = new_array_prop;
+        p->u.array.u1.size = count;
+    }
+}
+
 static __exception int js_append_enumerate(JSContext *ctx, JSValue *sp)
 {
     JSValue iterator, enumobj, method, value;
@@ -15257,10 +16737,27 @@ static __exception int js_append_enumerate(JSContext *ctx, JSValue *sp)
     &&  JS_IsCFunction(ctx, method, (JSCFunction *)js_array_iterator_next, 0)
     &&  js_get_fast_array(ctx, sp[-1], &arrp, &count32)) {
         int64_t len;
+        JSObject *p = JS_VALUE_GET_OBJ(sp[-3]);
         /* Handle fast arrays explicitly */
         if (js_get_length64(ctx, &len, sp[-1]))
             goto exception;
-        for (i = 0; i < count32; i++) {
+        i = 0;
+        if (p->class_id == JS_CLASS_ARRAY && p->fast_array &&
+            p->extensible && p->u.array.count == pos &&
+            JS_VALUE_GET_TAG(p->prop[0].u.value) == JS_TAG_INT &&
+            JS_VALUE_GET_INT(p->prop[0].u.value) == pos &&
+            pos + count32 <= INT32_MAX) {
+            /* copy to the end of the array being built */
+            if (pos + count32 > p->u.array.u1.size &&
+                expand_fast_array(ctx, p, pos + count32))
+                goto exception;
+            for (; i < count32; i++)
+                p->u.array.u.values[pos + i] = JS_DupValue(ctx, arrp[i]);
+            pos += count32;
+            p->u.array.count = pos;
+            p->prop[0].u.value = JS_NewInt32(ctx, pos);
+        }
+        for (; i < count32; i++) {
             if (JS_DefinePropertyValueUint32(ctx, sp[-3], pos++,
                                              JS_DupValue(ctx, arrp[i]), JS_PROP_C_W_E) < 0)
                 goto exception;
@@ -15863,6 +17360,395 @@ typedef enum {
 #define FUNC_RET_YIELD      1
 #define FUNC_RET_YIELD_STAR 2
 
+static void js_inline_cache_add(JSInlineCache *ic, JSShape *sh,
+                                JSShape *holder_sh, JSShapeProperty *prs)
+{
+    JSInlineCacheEntry *e;
+    int i;
+
+    /* reuse the entry of the receiver shape if the holder changed */
+    for(i = 0; i < JS_IC_ENTRY_COUNT; i++) {
+        if (ic->entries[i].shape_id == sh->id)
+            break;
+    }
+    if (i == JS_IC_ENTRY_COUNT) {
+        i = ic->next_entry;
+        ic->next_entry = (i + 1) % JS_IC_ENTRY_COUNT;
+    }
+    e = &ic->entries[i];
+    e->shape_id = sh->id;
+    if (holder_sh) {
+        e->holder_shape_id = holder_sh->id;
+        e->prop_index = prs - get_shape_prop(holder_sh);
+    } else {
+        e->holder_shape_id = 0;
+        e->prop_index = prs - get_shape_prop(sh);
+    }
+}
+
+/* TRUE if the lookup of a non index property in 'p' only depends on
+   its shape, i.e. it continues in the prototype when the shape does
+   not have the property */
+static inline BOOL js_shape_lookup_only(JSObject *p)
+{
+    return !p->is_exotic ||
+        (p->fast_array && (p->class_id == JS_CLASS_ARRAY ||
+                           p->class_id == JS_CLASS_ARGUMENTS));
+}
+
+static no_inline JSValue js_get_field_ic_miss(JSContext *ctx,
+                                              JSInlineCache *ic,
+                                              JSValueConst obj)
+{
+    JSObject *p, *holder;
+    JSShapeProperty *prs;
+    JSProperty *pr;
+
+    ctx->rt->ic_stats.get_misses++;
+    if (JS_VALUE_GET_TAG(obj) == JS_TAG_OBJECT) {
+        /* only plain data properties of the object or of its direct
+           prototype are cached */
+        p = JS_VALUE_GET_OBJ(obj);
+        prs = find_own_property(&pr, p, ic->atom);
+        if (prs) {
+            if (!(prs->flags & JS_PROP_TMASK)) {
+                js_inline_cache_add(ic, p->shape, NULL, prs);
+                return JS_DupValue(ctx, pr->u.value);
+            }
+        } else if (js_shape_lookup_only(p) && p->shape->proto &&
+                   !__JS_AtomIsTaggedInt(ic->atom)) {
+            holder = p->shape->proto;
+            prs = find_own_property(&pr, holder, ic->atom);
+            if (prs && !(prs->flags & JS_PROP_TMASK)) {
+                js_inline_cache_add(ic, p->shape, holder->shape, prs);
+                return JS_DupValue(ctx, pr->u.value);
+            }
+        }
+    }
+    return JS_GetProperty(ctx, obj, ic->atom);
+}
+
+static force_inline JSValue js_get_field_ic(JSContext *ctx, JSInlineCache *ic,
+                                            JSValueConst obj)
+{
+    JSObject *p, *holder;
+    JSInlineCacheEntry *e;
+    uint32_t shape_id;
+    int i;
+
+    if (likely(JS_VALUE_GET_TAG(obj) == JS_TAG_OBJECT)) {
+        p = JS_VALUE_GET_OBJ(obj);
+        shape_id = p->shape->id;
+        for(i = 0; i < JS_IC_ENTRY_COUNT; i++) {
+            e = &ic->entries[i];
+            if (e->shape_id != shape_id)
+                continue;
+            if (!e->holder_shape_id) {
+                ctx->rt->ic_stats.get_hits++;
+                return JS_DupValue(ctx, p->prop[e->prop_index].u.value);
+            }
+            /* the shape may also be used by exotic objects */
+            holder = p->shape->proto;
+            if (js_shape_lookup_only(p) &&
+                holder->shape->id == e->holder_shape_id) {
+                ctx->rt->ic_stats.get_hits++;
+                return JS_DupValue(ctx, holder->prop[e->prop_index].u.value);
+            }
+            break;
+        }
+    }
+    return js_get_field_ic_miss(ctx, ic, obj);
+}
+
+/* 'val' is freed */
+static no_inline int js_put_field_ic_miss(JSContext *ctx, JSInlineCache *ic,
+                                         JSValueConst obj, JSValue val)
+{
+    JSObject *p;
+    JSShapeProperty *prs;
+    JSProperty *pr;
+
+    ctx->rt->ic_stats.put_misses++;
+    if (JS_VALUE_GET_TAG(obj) == JS_TAG_OBJECT) {
+        /* only existing writable data properties are cached */
+        p = JS_VALUE_GET_OBJ(obj);
+        prs = find_own_property(&pr, p, ic->atom);
+        if (prs && (prs->flags & (JS_PROP_TMASK | JS_PROP_WRITABLE |
+                                  JS_PROP_LENGTH)) == JS_PROP_WRITABLE) {
+            js_inline_cache_add(ic, p->shape, NULL, prs);
+            set_value(ctx, &pr->u.value, val);
+            return TRUE;
+        }
+    }
+    return JS_SetPropertyInternal(ctx, obj, ic->atom, val,
+                                  JS_PROP_THROW_STRICT);
+}
+
+/* 'val' is freed */
+static force_inline int js_put_field_ic(JSContext *ctx, JSInlineCache *ic,
+                                        JSValueConst obj, JSValue val)
+{
+    JSObject *p;
+    uint32_t shape_id;
+    int i;
+
+    if (likely(JS_VALUE_GET_TAG(obj) == JS_TAG_OBJECT)) {
+        p = JS_VALUE_GET_OBJ(obj);
+        shape_id = p->shape->id;
+        for(i = 0; i < JS_IC_ENTRY_COUNT; i++) {
+            if (ic->entries[i].shape_id == shape_id) {
+                ctx->rt->ic_stats.put_hits++;
+                set_value(ctx, &p->prop[ic->entries[i].prop_index].u.value, val);
+                return TRUE;
+            }
+        }
+    }
+    return js_put_field_ic_miss(ctx, ic, obj, val);
+}
+
+JSPropertyPlan *JS_NewPropertyPlan(JSContext *ctx, const JSAtom *atoms,
+                                   uint32_t count)
+{
+    JSPropertyPlan *plan;
+    uint32_t *prop_index;
+    uint32_t i;
+
+    if (count > (INT32_MAX - sizeof(*plan)) /
+        ((JS_PROPERTY_PLAN_ENTRY_COUNT + 1) * sizeof(uint32_t))) {
+        JS_ThrowRangeError(ctx, "too many properties");
+        return NULL;
+    }
+    plan = js_mallocz(ctx, sizeof(*plan) + count * sizeof(JSAtom) +
+                      JS_PROPERTY_PLAN_ENTRY_COUNT * count * sizeof(uint32_t));
+    if (!plan)
+        return NULL;
+    plan->count = count;
+    for(i = 0; i < count; i++)
+        plan->atoms[i] = JS_DupAtom(ctx, atoms[i]);
+    prop_index = (uint32_t *)(plan->atoms + count);
+    for(i = 0; i < JS_PROPERTY_PLAN_ENTRY_COUNT; i++)
+        plan->entries[i].prop_index = prop_index + i * count;
+    list_add_tail(&plan->link, &ctx->rt->property_plan_list);
+    return plan;
+}
+
+void JS_FreePropertyPlan(JSRuntime *rt, JSPropertyPlan *plan)
+{
+    uint32_t i;
+
+    if (!plan)
+        return;
+    list_del(&plan->link);
+    if (plan->object_shape)
+        js_free_shape(rt, plan->object_shape);
+    for(i = 0; i < plan->count; i++)
+        JS_FreeAtomRT(rt, plan->atoms[i]);
+    js_free_rt(rt, plan);
+}
+
+/* Return the entry of the shape of 'p', resolving the properties of
+   the plan on a miss. */
+static JSPropertyPlanEntry *js_property_plan_find(JSPropertyPlan *plan,
+                                                  JSObject *p)
+{
+    JSShape *sh = p->shape;
+    JSPropertyPlanEntry *e;
+    JSShapeProperty *prs;
+    JSProperty *pr;
+    uint32_t i, idx;
+
+    for(i = 0; i < JS_PROPERTY_PLAN_ENTRY_COUNT; i++) {
+        if (plan->entries[i].shape_id == sh->id)
+            return &plan->entries[i];
+    }
+    e = &plan->entries[plan->next_entry];
+    plan->next_entry = (plan->next_entry + 1) % JS_PROPERTY_PLAN_ENTRY_COUNT;
+    e->shape_id = sh->id;
+    for(i = 0; i < plan->count; i++) {
+        /* own properties of the shape take precedence over the exotic
+           behavior of the object, as in JS_GetPropertyInternal() */
+        prs = find_own_property(&pr, p, plan->atoms[i]);
+        if (!prs || (prs->flags & JS_PROP_TMASK)) {
+            idx = JS_PROPERTY_PLAN_LOOKUP;
+        } else {
+            idx = prs - get_shape_prop(sh);
+            if ((prs->flags & (JS_PROP_WRITABLE | JS_PROP_LENGTH)) !=
+                JS_PROP_WRITABLE)
+                idx |= JS_PROPERTY_PLAN_READ_ONLY;
+        }
+        e->prop_index[i] = idx;
+    }
+    return e;
+}
+
+/* Return 'e' if it still describes 'p' after a full lookup, NULL
+   otherwise: a getter or setter may change the shape of the object or
+   replace the entry. */
+static inline JSPropertyPlanEntry *js_property_plan_check(JSPropertyPlanEntry *e,
+                                                         JSObject *p,
+                                                         uint32_t shape_id)
+{
+    if (e && (p->shape->id != shape_id || e->shape_id != shape_id))
+        return NULL;
+    return e;
+}
+
+int JS_GetPropertiesByPlan(JSContext *ctx, JSValueConst obj,
+                           JSPropertyPlan *plan, JSValue *values)
+{
+    JSPropertyPlanEntry *e = NULL;
+    JSObject *p = NULL;
+    uint32_t i, idx, shape_id = 0;
+
+    if (JS_VALUE_GET_TAG(obj) == JS_TAG_OBJECT) {
+        p = JS_VALUE_GET_OBJ(obj);
+        e = js_property_plan_find(plan, p);
+        shape_id = e->shape_id;
+    }
+    for(i = 0; i < plan->count; i++) {
+        if (e && (idx = e->prop_index[i]) != JS_PROPERTY_PLAN_LOOKUP) {
+            idx &= ~JS_PROPERTY_PLAN_READ_ONLY;
+            values[i] = JS_DupValue(ctx, p->prop[idx].u.value);
+        } else {
+            values[i] = JS_GetProperty(ctx, obj, plan->atoms[i]);
+            if (JS_IsException(values[i])) {
+                while (i-- > 0)
+                    JS_FreeValue(ctx, values[i]);
+                for(i = 0; i < plan->count; i++)
+                    values[i] = JS_UNDEFINED;
+                return -1;
+            }
+            e = js_property_plan_check(e, p, shape_id);
+        }
+    }
+    return 0;
+}
+
+int JS_SetPropertiesByPlan(JSContext *ctx, JSValueConst obj,
+                           JSPropertyPlan *plan, JSValue *values)
+{
+    JSPropertyPlanEntry *e = NULL;
+    JSObject *p = NULL;
+    uint32_t i, shape_id = 0;
+
+    if (JS_VALUE_GET_TAG(obj) == JS_TAG_OBJECT) {
+        p = JS_VALUE_GET_OBJ(obj);
+        e = js_property_plan_find(plan, p);
+        shape_id = e->shape_id;
+    }
+    for(i = 0; i < plan->count; i++) {
+        /* JS_PROPERTY_PLAN_LOOKUP includes the read only flag */
+        if (e && !(e->prop_index[i] & JS_PROPERTY_PLAN_READ_ONLY)) {
+            set_value(ctx, &p->prop[e->prop_index[i]].u.value, values[i]);
+        } else {
+            if (JS_SetProperty(ctx, obj, plan->atoms[i], values[i]) < 0) {
+                while (++i < plan->count)
+                    JS_FreeValue(ctx, values[i]);
+                return -1;
+            }
+            e = js_property_plan_check(e, p, shape_id);
+        }
+    }
+    return 0;
+}
+
+JSValue JS_NewObjectFromPlan(JSContext *ctx, JSPropertyPlan *plan,
+                             JSValue *values)
+{
+    JSShape *sh = plan->object_shape;
+    JSObject *p;
+    JSValue obj;
+    uint32_t i;
+
+    if (sh && sh->proto == JS_VALUE_GET_OBJ(ctx->class_proto[JS_CLASS_OBJECT])) {
+        obj = JS_NewObjectFromShape(ctx, js_dup_shape(sh), JS_CLASS_OBJECT);
+        if (JS_IsException(obj))
+            goto fail;
+        p = JS_VALUE_GET_OBJ(obj);
+        for(i = 0; i < plan->count; i++)
+            p->prop[i].u.value = values[i];
+        return obj;
+    }
+
+    obj = JS_NewObject(ctx);
+    if (JS_IsException(obj))
+        goto fail;
+    for(i = 0; i < plan->count; i++) {
+        if (JS_DefinePropertyValue(ctx, obj, plan->atoms[i], values[i],
+                                   JS_PROP_C_W_E | JS_PROP_THROW) < 0) {
+            while (++i < plan->count)
+                JS_FreeValue(ctx, values[i]);
+            JS_FreeValue(ctx, obj);
+            return JS_EXCEPTION;
+        }
+    }
+    /* the shape is kept only if every property has its own slot, in
+       the order of the plan, i.e. the plan has no duplicate names */
+    p = JS_VALUE_GET_OBJ(obj);
+    if (!sh && p->shape->prop_count == plan->count)
+        plan->object_shape = js_dup_shape(p->shape);
+    return obj;
+ fail:
+    for(i = 0; i < plan->count; i++)
+        JS_FreeValue(ctx, values[i]);
+    return JS_EXCEPTION;
+}
+
+#ifdef CONFIG_OPCODE_HISTOGRAM
+#define OPCODE_TRIPLE_HASH_BITS 16
+
+typedef struct JSOpcodeHistogram {
+    uint32_t history; /* last executed opcodes, the latest in the low byte */
+    uint64_t count1[256];
+    uint64_t count2[256 * 256];
+    /* open addressing hash table of the 24 bit triples */
+    struct {
+        uint32_t key; /* triple + 1, 0 if unused */
+        uint64_t count;
+    } count3[1 << OPCODE_TRIPLE_HASH_BITS];
+    uint32_t triple_count;
+    uint64_t dropped_triples; /* executions not counted because the table is full */
+} JSOpcodeHistogram;
+
+static no_inline void js_opcode_histogram_add(JSRuntime *rt, int opcode)
+{
+    JSOpcodeHistogram *h = rt->opcode_histogram;
+    uint32_t triple, i, mask;
+
+    if (!h) {
+        h = js_mallocz_rt(rt, sizeof(*h));
+        if (!h)
+            return;
+        rt->opcode_histogram = h;
+    }
+    h->history = (h->history << 8) | opcode;
+    h->count1[opcode]++;
+    h->count2[h->history & 0xffff]++;
+
+    triple = h->history & 0xffffff;
+    mask = (1 << OPCODE_TRIPLE_HASH_BITS) - 1;
+    i = (triple * 0x9e3779b1) >> (32 - OPCODE_TRIPLE_HASH_BITS);
+    for(;;) {
+        if (h->count3[i].key == triple + 1) {
+            h->count3[i].count++;
+            break;
+        }
+        if (h->count3[i].key == 0) {
+            /* keep the load factor below 3/4 */
+            if (h->triple_count >= (mask + 1) / 4 * 3) {
+                h->dropped_triples++;
+            } else {
+                h->count3[i].key = triple + 1;
+                h->count3[i].count = 1;
+                h->triple_count++;
+            }
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+}
+#endif
+
 /* argv[] is modified if (flags & JS_CALL_FLAG_COPY_ARGV) = 0. */
 static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                                JSValueConst this_obj, JSValueConst new_target,
@@ -15879,8 +17765,13 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
     JSVarRef **var_refs;
     size_t alloca_size;
 
+#ifdef CONFIG_OPCODE_HISTOGRAM
+#define RECORD_OPCODE(pc) js_opcode_histogram_add(rt, *(pc));
+#else
+#define RECORD_OPCODE(pc)
+#endif
 #if !DIRECT_DISPATCH
-#define SWITCH(pc)      switch (opcode = *pc++)
+#define SWITCH(pc)      RECORD_OPCODE(pc) switch (opcode = *pc++)
 #define CASE(op)        case op
 #define DEFAULT         default
 #define BREAK           break
@@ -15895,7 +17786,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
 #include "quickjs-opcode.h"
         [ OP_COUNT ... 255 ] = &&case_default
     };
-#define SWITCH(pc)      goto *dispatch_table[opcode = *pc++];
+#define SWITCH(pc)      RECORD_OPCODE(pc) goto *dispatch_table[opcode = *pc++];
 #define CASE(op)        case_ ## op
 #define DEFAULT         case_default
 #define BREAK           SWITCH(pc)
@@ -15941,6 +17832,15 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                          (JSValueConst *)argv, flags);
     }
     b = p->u.func.function_bytecode;
+    if (unlikely(!b->ic_initialized)) {
+        if (b->is_lazy) {
+            b = js_compile_lazy_function(caller_ctx, p);
+            if (!b)
+                return JS_EXCEPTION;
+        }
+        if (!b->ic_initialized)
+            js_init_inline_caches(rt, b);
+    }
 
     if (unlikely(argc < b->arg_count || (flags & JS_CALL_FLAG_COPY_ARGV))) {
         arg_allocated_size = b->arg_count;
@@ -16088,6 +17988,20 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             if (unlikely(JS_IsException(sp[-1])))
                 goto exception;
             BREAK;
+        CASE(OP_object_literal):
+            {
+                JSValue obj;
+                int count;
+                count = get_u16(pc);
+                pc += 2;
+                obj = js_build_object_literal(ctx, sp[-1], sp - 1 - count, count);
+                JS_FreeValue(ctx, sp[-1]);
+                sp -= count + 1;
+                if (unlikely(JS_IsException(obj)))
+                    goto exception;
+                *sp++ = obj;
+            }
+            BREAK;
         CASE(OP_special_object):
             {
                 int arg = *pc++;
@@ -17023,6 +18937,71 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                     goto exception;
             }
             BREAK;
+        CASE(OP_if_not_lt):
+        CASE(OP_if_not_lt8):
+            {
+                int res;
+                JSValue op1, op2;
+
+                op1 = sp[-2];
+                op2 = sp[-1];
+                if (likely(JS_VALUE_IS_BOTH_INT(op1, op2))) {
+                    res = JS_VALUE_GET_INT(op1) < JS_VALUE_GET_INT(op2);
+                } else if (JS_VALUE_IS_BOTH_FLOAT(op1, op2)) {
+                    res = JS_VALUE_GET_FLOAT64(op1) < JS_VALUE_GET_FLOAT64(op2);
+                } else {
+                    if (js_relational_slow(ctx, sp, OP_lt))
+                        goto exception;
+                    res = JS_VALUE_GET_BOOL(sp[-2]);
+                }
+                sp -= 2;
+                if (opcode == OP_if_not_lt) {
+                    pc += 4;
+                    if (!res)
+                        pc += (int32_t)get_u32(pc - 4) - 4;
+                } else {
+                    pc += 1;
+                    if (!res)
+                        pc += (int8_t)pc[-1] - 1;
+                }
+                if (unlikely(js_poll_interrupts(ctx)))
+                    goto exception;
+            }
+            BREAK;
+        CASE(OP_inc_loc_check):
+        CASE(OP_dec_loc_check):
+            {
+                JSValue op1;
+                int val;
+                int idx;
+                idx = get_u16(pc);
+                pc += 2;
+
+                op1 = var_buf[idx];
+                if (unlikely(JS_IsUninitialized(op1))) {
+                    JS_ThrowReferenceErrorUninitialized(ctx, JS_ATOM_NULL);
+                    goto exception;
+                }
+                if (JS_VALUE_GET_TAG(op1) == JS_TAG_INT) {
+                    val = JS_VALUE_GET_INT(op1);
+                    if (opcode == OP_inc_loc_check) {
+                        if (unlikely(val == INT32_MAX))
+                            goto inc_loc_check_slow;
+                        val++;
+                    } else {
+                        if (unlikely(val == INT32_MIN))
+                            goto inc_loc_check_slow;
+                        val--;
+                    }
+                    var_buf[idx] = JS_NewInt32(ctx, val);
+                } else {
+                inc_loc_check_slow:
+                    if (js_unary_arith_slow(ctx, var_buf + idx + 1,
+                                            opcode == OP_inc_loc_check ? OP_inc : OP_dec))
+                        goto exception;
+                }
+            }
+            BREAK;
 #endif
         CASE(OP_catch):
             {
@@ -17271,6 +19250,50 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             }
             BREAK;
 
+        CASE(OP_get_field_ic):
+            {
+                JSValue val;
+                JSInlineCache *ic;
+                ic = &b->ic[get_u32(pc)];
+                pc += 4;
+
+                val = js_get_field_ic(ctx, ic, sp[-1]);
+                if (unlikely(JS_IsException(val)))
+                    goto exception;
+                JS_FreeValue(ctx, sp[-1]);
+                sp[-1] = val;
+            }
+            BREAK;
+
+        CASE(OP_get_field2_ic):
+            {
+                JSValue val;
+                JSInlineCache *ic;
+                ic = &b->ic[get_u32(pc)];
+                pc += 4;
+
+                val = js_get_field_ic(ctx, ic, sp[-1]);
+                if (unlikely(JS_IsException(val)))
+                    goto exception;
+                *sp++ = val;
+            }
+            BREAK;
+
+        CASE(OP_put_field_ic):
+            {
+                int ret;
+                JSInlineCache *ic;
+                ic = &b->ic[get_u32(pc)];
+                pc += 4;
+
+                ret = js_put_field_ic(ctx, ic, sp[-2], sp[-1]);
+                JS_FreeValue(ctx, sp[-2]);
+                sp -= 2;
+                if (unlikely(ret < 0))
+                    goto exception;
+            }
+            BREAK;
+
         CASE(OP_private_symbol):
             {
                 JSAtom atom;
@@ -17645,7 +19668,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                         goto add_loc_slow;
                     var_buf[idx] = JS_NewInt32(ctx, r);
                     sp--;
-                } else if (JS_VALUE_GET_TAG(ops[0]) == JS_TAG_STRING) {
+                } else if (tag_is_string(JS_VALUE_GET_TAG(ops[0]))) {
                     sp--;
                     ops[1] = JS_ToPrimitiveFree(ctx, ops[1], HINT_NONE);
                     if (JS_IsException(ops[1])) {
@@ -18579,6 +20602,11 @@ static __exception int async_func_init(JSContext *ctx, JSAsyncFunctionState *s,
     init_list_head(&sf->var_ref_list);
     p = JS_VALUE_GET_OBJ(func_obj);
     b = p->u.func.function_bytecode;
+    if (unlikely(b->is_lazy)) {
+        b = js_compile_lazy_function(ctx, p);
+        if (!b)
+            return -1;
+    }
     sf->js_mode = b->js_mode;
     sf->cur_pc = b->byte_code_buf;
     arg_buf_len = max_int(b->arg_count, argc);
@@ -18969,7 +20997,10 @@ static int js_async_function_resolve_create(JSContext *ctx,
     return 0;
 }
 
-static void js_async_function_resume(JSContext *ctx, JSAsyncFunctionData *s)
+/* Return -1 if the function was interrupted: the uncatchable error is
+   left pending instead of rejecting the promise of the function, so
+   that the script cannot catch it. */
+static int js_async_function_resume(JSContext *ctx, JSAsyncFunctionData *s)
 {
     JSValue func_ret, ret2;
 
@@ -18978,6 +21009,11 @@ static void js_async_function_resume(JSContext *ctx, JSAsyncFunctionData *s)
         JSValue error;
     fail:
         error = JS_GetException(ctx);
+        if (JS_IsUncatchableError(ctx, error)) {
+            js_async_function_terminate(ctx->rt, s);
+            JS_Throw(ctx, error);
+            return -1;
+        }
         ret2 = JS_Call(ctx, s->resolving_funcs[1], JS_UNDEFINED,
                        1, (JSValueConst *)&error);
         JS_FreeValue(ctx, error);
@@ -19024,6 +21060,7 @@ static void js_async_function_resume(JSContext *ctx, JSAsyncFunctionData *s)
                 goto fail;
         }
     }
+    return 0;
 }
 
 static JSValue js_async_function_resolve_call(JSContext *ctx,
@@ -19048,7 +21085,8 @@ static JSValue js_async_function_resolve_call(JSContext *ctx,
         /* return value of await */
         s->func_state.frame.cur_sp[-1] = JS_DupValue(ctx, arg);
     }
-    js_async_function_resume(ctx, s);
+    if (js_async_function_resume(ctx, s))
+        return JS_EXCEPTION;
     return JS_UNDEFINED;
 }
 
@@ -19080,7 +21118,11 @@ static JSValue js_async_function_call(JSContext *ctx, JSValueConst func_obj,
     }
     s->is_active = TRUE;
 
-    js_async_function_resume(ctx, s);
+    if (js_async_function_resume(ctx, s)) {
+        JS_FreeValue(ctx, promise);
+        js_async_function_free(ctx->rt, s);
+        return JS_EXCEPTION;
+    }
 
     js_async_function_free(ctx->rt, s);
 
@@ -19726,6 +21768,12 @@ typedef struct JSFunctionDef {
     BOOL is_derived_class_constructor;
     BOOL in_function_body;
     BOOL backtrace_barrier;
+    BOOL lazy_functions; /* true if the top level functions are compiled
+                            on their first call */
+    BOOL is_called_on_creation; /* function expression called where it
+                                   is defined, so never compiled lazily */
+    BOOL uses_private_names; /* a private name appears in the function or
+                                in its children */
     JSFunctionKindEnum func_kind : 8;
     JSParseFunctionEnum func_type : 8;
     uint8_t js_mode; /* bitmap of JS_MODE_x */
@@ -19846,7 +21894,7 @@ typedef struct JSParseState {
 } JSParseState;
 
 typedef struct JSOpCode {
-#ifdef DUMP_BYTECODE
+#if defined(DUMP_BYTECODE) || defined(CONFIG_OPCODE_HISTOGRAM)
     const char *name;
 #endif
     uint8_t size; /* in bytes */
@@ -19859,7 +21907,7 @@ typedef struct JSOpCode {
 
 static const JSOpCode opcode_info[OP_COUNT + (OP_TEMP_END - OP_TEMP_START)] = {
 #define FMT(f)
-#ifdef DUMP_BYTECODE
+#if defined(DUMP_BYTECODE) || defined(CONFIG_OPCODE_HISTOGRAM)
 #define DEF(id, size, n_pop, n_push, f) { #id, size, n_pop, n_push, OP_FMT_ ## f },
 #else
 #define DEF(id, size, n_pop, n_push, f) { size, n_pop, n_push, OP_FMT_ ## f },
@@ -19881,6 +21929,77 @@ static const JSOpCode opcode_info[OP_COUNT + (OP_TEMP_END - OP_TEMP_START)] = {
 #define short_opcode_info(op) opcode_info[op]
 #endif
 
+#ifdef CONFIG_OPCODE_HISTOGRAM
+typedef struct JSOpcodeHistogramRow {
+    uint32_t key;
+    uint64_t count;
+} JSOpcodeHistogramRow;
+
+static int js_opcode_histogram_row_cmp(const void *a, const void *b, void *opaque)
+{
+    const JSOpcodeHistogramRow *ra = a, *rb = b;
+    return (ra->count < rb->count) - (ra->count > rb->count);
+}
+
+static void js_dump_opcode_histogram_rows(FILE *fp, JSOpcodeHistogramRow *rows,
+                                          int count, int length, uint64_t total)
+{
+    int i, j;
+
+    rqsort(rows, count, sizeof(rows[0]), js_opcode_histogram_row_cmp, NULL);
+    for(i = 0; i < count && i < 40 && rows[i].count != 0; i++) {
+        fprintf(fp, "%14" PRIu64 " %5.2f%% ", rows[i].count,
+                100.0 * rows[i].count / total);
+        for(j = length - 1; j >= 0; j--) {
+            fprintf(fp, " %s", short_opcode_info((rows[i].key >> (8 * j)) & 0xff).name);
+        }
+        fprintf(fp, "\n");
+    }
+}
+
+static void js_dump_opcode_histogram(JSRuntime *rt, FILE *fp)
+{
+    JSOpcodeHistogram *h = rt->opcode_histogram;
+    JSOpcodeHistogramRow *rows;
+    uint64_t total;
+    int i, count;
+
+    if (!h)
+        return;
+    rows = js_malloc_rt(rt, sizeof(rows[0]) * (256 * 256));
+    if (!rows)
+        return;
+    total = 0;
+    for(i = 0; i < 256; i++) {
+        rows[i].key = i;
+        rows[i].count = h->count1[i];
+        total += h->count1[i];
+    }
+    fprintf(fp, "\nopcodes (%" PRIu64 " executed):\n", total);
+    js_dump_opcode_histogram_rows(fp, rows, 256, 1, total);
+
+    for(i = 0; i < 256 * 256; i++) {
+        rows[i].key = i;
+        rows[i].count = h->count2[i];
+    }
+    fprintf(fp, "\nopcode pairs:\n");
+    js_dump_opcode_histogram_rows(fp, rows, 256 * 256, 2, total);
+
+    count = 0;
+    for(i = 0; i < countof(h->count3); i++) {
+        if (h->count3[i].key != 0) {
+            rows[count].key = h->count3[i].key - 1;
+            rows[count].count = h->count3[i].count;
+            count++;
+        }
+    }
+    fprintf(fp, "\nopcode triples (%" PRIu64 " not counted):\n",
+            h->dropped_triples);
+    js_dump_opcode_histogram_rows(fp, rows, count, 3, total);
+    js_free_rt(rt, rows);
+}
+#endif
+
 static __exception int next_token(JSParseState *s);
 
 static void free_token(JSParseState *s, JSToken *token)
@@ -20026,6 +22145,130 @@ static int js_parse_error_reserved_identifier(JSParseState *s)
                                         s->token.u.ident.atom));
 }
 
+/* Source scanning helpers. They return the first byte at or after 'p'
+   that the tokenizer must look at, checking SCAN_VEC_SIZE bytes at a
+   time. Non ASCII bytes always stop the scan, so UTF-8 is only decoded
+   by the general code. The vector loops never read at or past 'end':
+   the scalar code handles the last bytes. */
+#if SCAN_VEC_SIZE == 32
+typedef __m256i scan_vec;
+#define scan_load(p)    _mm256_loadu_si256((const __m256i *)(p))
+#define scan_store(p, a) _mm256_storeu_si256((__m256i *)(p), a)
+#define scan_splat(c)   _mm256_set1_epi8((char)(c))
+#define scan_or(a, b)   _mm256_or_si256(a, b)
+#define scan_and(a, b)  _mm256_and_si256(a, b)
+#define scan_xor(a, b)  _mm256_xor_si256(a, b)
+#define scan_add(a, b)  _mm256_add_epi8(a, b)
+#define scan_eq(a, b)   _mm256_cmpeq_epi8(a, b)
+#define scan_lt(a, b)   _mm256_cmpgt_epi8(b, a)
+#define scan_mask(a)    ((uint32_t)_mm256_movemask_epi8(a))
+#define SCAN_MASK_ALL   0xffffffffU
+#elif SCAN_VEC_SIZE == 16
+typedef __m128i scan_vec;
+#define scan_load(p)    _mm_loadu_si128((const __m128i *)(p))
+#define scan_store(p, a) _mm_storeu_si128((__m128i *)(p), a)
+#define scan_splat(c)   _mm_set1_epi8((char)(c))
+#define scan_or(a, b)   _mm_or_si128(a, b)
+#define scan_and(a, b)  _mm_and_si128(a, b)
+#define scan_xor(a, b)  _mm_xor_si128(a, b)
+#define scan_add(a, b)  _mm_add_epi8(a, b)
+#define scan_eq(a, b)   _mm_cmpeq_epi8(a, b)
+#define scan_lt(a, b)   _mm_cmplt_epi8(a, b)
+#define scan_mask(a)    ((uint32_t)_mm_movemask_epi8(a))
+#define SCAN_MASK_ALL   0xffffU
+#endif
+
+#ifdef SCAN_VEC_SIZE
+/* 0xff in the lanes holding a byte in [lo, lo + n - 1] */
+static inline scan_vec scan_in_range(scan_vec v, int lo, int n)
+{
+    return scan_lt(scan_add(v, scan_splat(0x80 - lo)), scan_splat(0x80 + n));
+}
+#endif
+
+/* stops at ' ' and '\t' */
+static const uint8_t *scan_spaces(const uint8_t *p, const uint8_t *end)
+{
+#ifdef SCAN_VEC_SIZE
+    while (end - p >= SCAN_VEC_SIZE) {
+        scan_vec v = scan_load(p);
+        uint32_t m = scan_mask(scan_or(scan_eq(v, scan_splat(' ')),
+                                       scan_eq(v, scan_splat('\t'))));
+        if (m != SCAN_MASK_ALL)
+            return p + ctz32(~m);
+        p += SCAN_VEC_SIZE;
+    }
+#endif
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    return p;
+}
+
+/* stops at a line terminator, a non ASCII byte or '\0'. With
+   'block_comment', also stops at '*'. */
+static const uint8_t *scan_comment(const uint8_t *p, const uint8_t *end,
+                                   BOOL block_comment)
+{
+#ifdef SCAN_VEC_SIZE
+    scan_vec star = scan_splat(block_comment ? '*' : '\n');
+    while (end - p >= SCAN_VEC_SIZE) {
+        scan_vec v = scan_load(p);
+        uint32_t m = scan_mask(scan_or(scan_or(scan_eq(v, scan_splat('\n')),
+                                               scan_eq(v, scan_splat('\r'))),
+                                       scan_or(scan_eq(v, scan_splat('\0')),
+                                               scan_eq(v, star)))) |
+            scan_mask(v);
+        if (m)
+            return p + ctz32(m);
+        p += SCAN_VEC_SIZE;
+    }
+#endif
+    return p;
+}
+
+/* stops at the first byte that is not an ASCII identifier character */
+static const uint8_t *scan_ident(const uint8_t *p, const uint8_t *end)
+{
+#ifdef SCAN_VEC_SIZE
+    while (end - p >= SCAN_VEC_SIZE) {
+        scan_vec v = scan_load(p);
+        uint32_t m = scan_mask(scan_or(scan_or(scan_in_range(scan_or(v, scan_splat(0x20)), 'a', 26),
+                                               scan_in_range(v, '0', 10)),
+                                       scan_or(scan_eq(v, scan_splat('_')),
+                                               scan_eq(v, scan_splat('$')))));
+        if (m != SCAN_MASK_ALL)
+            return p + ctz32(~m);
+        p += SCAN_VEC_SIZE;
+    }
+#endif
+    while (p < end && *p < 128 && lre_js_is_ident_next(*p))
+        p++;
+    return p;
+}
+
+/* stops at 'sep', '\\', '$', a control character or a non ASCII byte */
+static const uint8_t *scan_string(const uint8_t *p, const uint8_t *end,
+                                  int sep)
+{
+#ifdef SCAN_VEC_SIZE
+    while (end - p >= SCAN_VEC_SIZE) {
+        scan_vec v = scan_load(p);
+        /* the signed comparison also catches the non ASCII bytes */
+        uint32_t m = scan_mask(scan_or(scan_or(scan_lt(v, scan_splat(0x20)),
+                                               scan_eq(v, scan_splat(sep))),
+                                       scan_or(scan_eq(v, scan_splat('\\')),
+                                               scan_eq(v, scan_splat('$')))));
+        if (m)
+            return p + ctz32(m);
+        p += SCAN_VEC_SIZE;
+    }
+#endif
+    while (p < end && *p >= 0x20 && *p < 0x80 && *p != sep &&
+           *p != '\\' && *p != '$')
+        p++;
+    return p;
+}
+
 static __exception int js_parse_template_part(JSParseState *s, const uint8_t *p)
 {
     uint32_t c;
@@ -20035,6 +22278,12 @@ static __exception int js_parse_template_part(JSParseState *s, const uint8_t *p)
     if (string_buffer_init(s->ctx, b, 32))
         goto fail;
     for(;;) {
+        const uint8_t *p_run = scan_string(p, s->buf_end, '`');
+        if (p_run != p) {
+            if (string_buffer_write8(b, p, p_run - p))
+                goto fail;
+            p = p_run;
+        }
         if (p >= s->buf_end)
             goto unexpected_eof;
         c = *p++;
@@ -20099,6 +22348,12 @@ static __exception int js_parse_string(JSParseState *s, int sep,
     if (string_buffer_init(s->ctx, b, 32))
         goto fail;
     for(;;) {
+        const uint8_t *p_run = scan_string(p, s->buf_end, sep);
+        if (p_run != p) {
+            if (string_buffer_write8(b, p, p_run - p))
+                goto fail;
+            p = p_run;
+        }
         if (p >= s->buf_end)
             goto invalid_char;
         c = *p;
@@ -20359,6 +22614,14 @@ static JSAtom parse_ident(JSParseState *s, const uint8_t **pp,
     JSAtom atom;
     
     p = *pp;
+    if (c < 128 && !*pident_has_escape && !is_private) {
+        /* an ASCII identifier is interned straight from the source */
+        p1 = scan_ident(p, s->buf_end);
+        if (*p1 != '\\' && *p1 < 128) {
+            *pp = p1;
+            return JS_NewAtomLen(s->ctx, (const char *)p - 1, p1 - p + 1);
+        }
+    }
     buf = ident_buf;
     ident_size = sizeof(ident_buf);
     ident_pos = 0;
@@ -20461,13 +22724,14 @@ static __exception int next_token(JSParseState *s)
         /* fall through */
     case ' ':
     case '\t':
-        p++;
+        p = scan_spaces(p + 1, s->buf_end);
         goto redo;
     case '/':
         if (p[1] == '*') {
             /* comment */
             p += 2;
             for(;;) {
+                p = scan_comment(p, s->buf_end, TRUE);
                 if (*p == '\0' && p >= s->buf_end) {
                     js_parse_error(s, "unexpected end of comment");
                     goto fail;
@@ -20500,6 +22764,7 @@ static __exception int next_token(JSParseState *s)
             p += 2;
         skip_line_comment:
             for(;;) {
+                p = scan_comment(p, s->buf_end, FALSE);
                 if (*p == '\0' && p >= s->buf_end)
                     break;
                 if (*p == '\r' || *p == '\n')
@@ -20590,6 +22855,7 @@ static __exception int next_token(JSParseState *s)
         /* private name */
         {
             const uint8_t *p1;
+            JSFunctionDef *fd;
             p++;
             p1 = p;
             c = *p1++;
@@ -20609,6 +22875,12 @@ static __exception int next_token(JSParseState *s)
                 goto fail;
             s->token.u.ident.atom = atom;
             s->token.val = TOK_PRIVATE_NAME;
+            /* an undeclared private name is only reported when the
+               variables are resolved, so the enclosing functions are
+               not compiled lazily */
+            for(fd = s->cur_func; fd && !fd->uses_private_names;
+                fd = fd->parent)
+                fd->uses_private_names = TRUE;
         }
         break;
     case '.':
@@ -22133,17 +24405,70 @@ static void set_object_name_computed(JSParseState *s)
     }
 }
 
+/* maximum number of fields of an object literal built from a template */
+#define JS_MAX_LITERAL_FIELDS 32
+
+/* Replace 'object v1 define_field(a1) ... vn define_field(an)' by
+   'v1 ... vn push_const(template) object_literal(n)'. The template is an
+   object with the final shape, so the literal is allocated with all its
+   slots in one step. The erased code is left as nops for phase 2. */
+static __exception int optimize_object_literal(JSParseState *s, int object_pos,
+                                               const int *field_pos, int field_count)
+{
+    JSFunctionDef *fd = s->cur_func;
+    JSValue tmpl;
+    JSAtom atom;
+    int i, idx;
+
+    tmpl = JS_NewObject(s->ctx);
+    if (JS_IsException(tmpl))
+        return -1;
+    for(i = 0; i < field_count; i++) {
+        atom = get_u32(fd->byte_code.buf + field_pos[i] + 1);
+        if (JS_DefinePropertyValue(s->ctx, tmpl, atom, JS_UNDEFINED,
+                                   JS_PROP_C_W_E) < 0) {
+            JS_FreeValue(s->ctx, tmpl);
+            return -1;
+        }
+    }
+    if (JS_VALUE_GET_OBJ(tmpl)->shape->prop_count != field_count) {
+        /* duplicate field names: keep the generic code */
+        JS_FreeValue(s->ctx, tmpl);
+        return 0;
+    }
+    idx = cpool_add(s, tmpl);
+    if (idx < 0) {
+        JS_FreeValue(s->ctx, tmpl);
+        return -1;
+    }
+    fd->byte_code.buf[object_pos] = OP_nop;
+    for(i = 0; i < field_count; i++) {
+        JS_FreeAtom(s->ctx, get_u32(fd->byte_code.buf + field_pos[i] + 1));
+        memset(fd->byte_code.buf + field_pos[i], OP_nop, 5);
+    }
+    emit_op(s, OP_push_const);
+    emit_u32(s, idx);
+    emit_op(s, OP_object_literal);
+    emit_u16(s, field_count);
+    return 0;
+}
+
 static __exception int js_parse_object_literal(JSParseState *s)
 {
     JSAtom name = JS_ATOM_NULL;
     const uint8_t *start_ptr;
     int start_line, prop_type;
     BOOL has_proto;
+    int object_pos, field_count;
+    int field_pos[JS_MAX_LITERAL_FIELDS];
 
     if (next_token(s))
         goto fail;
     /* XXX: add an initial length that will be patched back */
     emit_op(s, OP_object);
+    object_pos = s->cur_func->last_opcode_pos;
+    /* -1 once a property cannot be represented in a template */
+    field_count = 0;
     has_proto = FALSE;
     while (s->token.val != '}') {
         /* specific case for getter/setter */
@@ -22151,6 +24476,7 @@ static __exception int js_parse_object_literal(JSParseState *s)
         start_line = s->token.line_num;
 
         if (s->token.val == TOK_ELLIPSIS) {
+            field_count = -1;
             if (next_token(s))
                 return -1;
             if (js_parse_assign_expr(s, TRUE))
@@ -22174,6 +24500,7 @@ static __exception int js_parse_object_literal(JSParseState *s)
             emit_u16(s, s->cur_func->scope_level);
             emit_op(s, OP_define_field);
             emit_atom(s, name);
+            goto add_field;
         } else if (s->token.val == '(') {
             BOOL is_getset = (prop_type == PROP_TYPE_GET ||
                               prop_type == PROP_TYPE_SET);
@@ -22209,6 +24536,7 @@ static __exception int js_parse_object_literal(JSParseState *s)
                 op_flags = OP_DEFINE_METHOD_METHOD;
             }
             emit_u8(s, op_flags | OP_DEFINE_METHOD_ENUMERABLE);
+            field_count = -1;
         } else {
             if (js_parse_expect(s, ':'))
                 goto fail;
@@ -22218,6 +24546,7 @@ static __exception int js_parse_object_literal(JSParseState *s)
                 set_object_name_computed(s);
                 emit_op(s, OP_define_array_el);
                 emit_op(s, OP_drop);
+                field_count = -1;
             } else if (name == JS_ATOM___proto__) {
                 if (has_proto) {
                     js_parse_error(s, "duplicate __proto__ property name");
@@ -22225,10 +24554,16 @@ static __exception int js_parse_object_literal(JSParseState *s)
                 }
                 emit_op(s, OP_set_proto);
                 has_proto = TRUE;
+                field_count = -1;
             } else {
                 set_object_name(s, name);
                 emit_op(s, OP_define_field);
                 emit_atom(s, name);
+            add_field:
+                if (field_count >= 0 && field_count < JS_MAX_LITERAL_FIELDS)
+                    field_pos[field_count++] = s->cur_func->last_opcode_pos;
+                else
+                    field_count = -1;
             }
         }
         JS_FreeAtom(s->ctx, name);
@@ -22241,6 +24576,10 @@ static __exception int js_parse_object_literal(JSParseState *s)
     }
     if (js_parse_expect(s, '}'))
         goto fail;
+    if (OPTIMIZE && field_count > 0) {
+        if (optimize_object_literal(s, object_pos, field_pos, field_count))
+            goto fail;
+    }
     return 0;
  fail:
     JS_FreeAtom(s->ctx, name);
@@ -22757,7 +25096,7 @@ static __exception int js_parse_class(JSParseState *s, BOOL is_class_expr,
     put_u32(fd->byte_code.buf + ctor_cpool_offset, ctor_fd->parent_cpool_idx);
 
     /* store the class source code in the constructor. */
-    if (!(fd->js_mode & JS_MODE_STRIP)) {
+    if (!(fd->js_mode & (JS_MODE_STRIP | JS_MODE_STRIP_SOURCE))) {
         js_free(ctx, ctor_fd->source);
         ctor_fd->source_len = s->buf_ptr - class_start_ptr;
         ctor_fd->source = js_strndup(ctx, (const char *)class_start_ptr,
@@ -23777,6 +26116,26 @@ static void optional_chain_test(JSParseState *s, int *poptional_chaining_label,
     emit_label(s, label_next);
 }
 
+/* a function expression which is called right away, as in
+   "(function() {...})()", is compiled eagerly even if lazy functions are
+   enabled: it would be parsed twice for nothing */
+static void mark_called_function(JSFunctionDef *fd)
+{
+    JSFunctionDef *fd1;
+    int pos;
+
+    if (!fd->lazy_functions || list_empty(&fd->child_list))
+        return;
+    pos = fd->last_opcode_pos;
+    if (pos >= 5 && fd->byte_code.buf[pos] == OP_set_name)
+        pos -= 5;
+    if (pos < 0 || fd->byte_code.buf[pos] != OP_fclosure)
+        return;
+    fd1 = list_entry(fd->child_list.prev, JSFunctionDef, link);
+    if (fd1->parent_cpool_idx == get_u32(fd->byte_code.buf + pos + 1))
+        fd1->is_called_on_creation = TRUE;
+}
+
 static __exception int js_parse_postfix_expr(JSParseState *s, BOOL accept_lparen)
 {
     FuncCallType call_type;
@@ -24106,6 +26465,7 @@ static __exception int js_parse_postfix_expr(JSParseState *s, BOOL accept_lparen
 
             if (call_type == FUNC_CALL_NORMAL) {
             parse_func_call2:
+                mark_called_function(fd);
                 switch(opcode = get_prev_opcode(fd)) {
                 case OP_get_field:
                     /* keep the object on the stack */
@@ -28106,6 +30466,46 @@ static void free_bytecode_atoms(JSRuntime *rt,
     }
 }
 
+/* Replace the get_field, get_field2 and put_field opcodes with their
+   inline cached versions. Done when the function is first called so
+   that functions which never run do not pay for the caches. */
+static void js_init_inline_caches(JSRuntime *rt, JSFunctionBytecode *b)
+{
+    int pos, op;
+    uint32_t count;
+    uint8_t *bc_buf = b->byte_code_buf;
+
+    b->ic_initialized = TRUE;
+    if (b->read_only_bytecode)
+        return;
+
+    count = 0;
+    for(pos = 0; pos < b->byte_code_len; pos += short_opcode_info(op).size) {
+        op = bc_buf[pos];
+        if (op == OP_get_field || op == OP_get_field2 || op == OP_put_field)
+            count++;
+    }
+    if (count == 0)
+        return;
+    /* the caches are an optimization: ignore allocation failures */
+    b->ic = js_mallocz_rt(rt, sizeof(b->ic[0]) * count);
+    if (!b->ic)
+        return;
+    b->ic_count = count;
+
+    count = 0;
+    for(pos = 0; pos < b->byte_code_len; pos += short_opcode_info(op).size) {
+        op = bc_buf[pos];
+        if (op == OP_get_field || op == OP_get_field2 || op == OP_put_field) {
+            /* the cache takes over the atom reference of the bytecode */
+            b->ic[count].atom = get_u32(bc_buf + pos + 1);
+            bc_buf[pos] = op - OP_get_field + OP_get_field_ic;
+            put_u32(bc_buf + pos + 1, count);
+            count++;
+        }
+    }
+}
+
 static void js_free_function_def(JSContext *ctx, JSFunctionDef *fd)
 {
     int i;
@@ -30827,6 +33227,15 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
 
             if (ls->addr == -1) {
                 int diff = ls->pos2 - pos - 1;
+                if (diff < 128 && op == OP_if_not_lt) {
+                    jp->size = 1;
+                    jp->op = OP_if_not_lt8;
+                    dbuf_putc(&bc_out, OP_if_not_lt8);
+                    dbuf_putc(&bc_out, 0);
+                    if (!add_reloc(ctx, ls, bc_out.size - 1, 1))
+                        goto fail;
+                    break;
+                }
                 if (diff < 128 && (op == OP_if_false || op == OP_if_true || op == OP_goto)) {
                     jp->size = 1;
                     jp->op = OP_if_false8 + (op - OP_if_false);
@@ -30847,6 +33256,13 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
                 }
             } else {
                 int diff = ls->addr - bc_out.size - 1;
+                if (diff == (int8_t)diff && op == OP_if_not_lt) {
+                    jp->size = 1;
+                    jp->op = OP_if_not_lt8;
+                    dbuf_putc(&bc_out, OP_if_not_lt8);
+                    dbuf_putc(&bc_out, diff);
+                    break;
+                }
                 if (diff == (int8_t)diff && (op == OP_if_false || op == OP_if_true || op == OP_goto)) {
                     jp->size = 1;
                     jp->op = OP_if_false8 + (op - OP_if_false);
@@ -31147,6 +33563,50 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
                     if (line2 >= 0) line_num = line2;
                     break;
                 }
+                /* Transformation: dup put_loc_check(n) drop -> put_loc_check(n) */
+                if (code_match(&cc, pos_next, OP_put_loc_check, -1, OP_drop, -1)) {
+                    if (cc.line_num >= 0) line_num = cc.line_num;
+                    add_pc2line_info(s, bc_out.size, line_num);
+                    dbuf_putc(&bc_out, OP_put_loc_check);
+                    dbuf_put_u16(&bc_out, cc.idx);
+                    pos_next = cc.pos;
+                    break;
+                }
+            }
+            goto no_change;
+
+        case OP_get_loc_check:
+            if (OPTIMIZE) {
+                /* transformation:
+                   get_loc_check(n) post_dec put_loc_check(n) drop -> dec_loc_check(n)
+                   get_loc_check(n) post_inc put_loc_check(n) drop -> inc_loc_check(n)
+                   get_loc_check(n) dec dup put_loc_check(n) drop -> dec_loc_check(n)
+                   get_loc_check(n) inc dup put_loc_check(n) drop -> inc_loc_check(n)
+                 */
+                int idx;
+                idx = get_u16(bc_buf + pos + 1);
+                if (code_match(&cc, pos_next, M2(OP_post_dec, OP_post_inc), OP_put_loc_check, idx, OP_drop, -1) ||
+                    code_match(&cc, pos_next, M2(OP_dec, OP_inc), OP_dup, OP_put_loc_check, idx, OP_drop, -1)) {
+                    if (cc.line_num >= 0) line_num = cc.line_num;
+                    add_pc2line_info(s, bc_out.size, line_num);
+                    dbuf_putc(&bc_out, (cc.op == OP_inc || cc.op == OP_post_inc) ? OP_inc_loc_check : OP_dec_loc_check);
+                    dbuf_put_u16(&bc_out, idx);
+                    pos_next = cc.pos;
+                    break;
+                }
+            }
+            goto no_change;
+
+        case OP_lt:
+            if (OPTIMIZE) {
+                /* transformation: lt if_false(l) -> if_not_lt(l) */
+                if (code_match(&cc, pos_next, OP_if_false, -1)) {
+                    if (cc.line_num >= 0) line_num = cc.line_num;
+                    label = find_jump_target(s, cc.label, &op1, NULL);
+                    pos_next = cc.pos;
+                    op = OP_if_not_lt;
+                    goto has_label;
+                }
             }
             goto no_change;
 
@@ -31380,6 +33840,7 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
             case OP_if_false:
             case OP_if_true:
             case OP_goto:
+            case OP_if_not_lt:
                 pos = jp->pos;
                 diff = s->label_slots[jp->label].addr - pos;
                 if (diff >= -128 && diff <= 127 + delta) {
@@ -31387,6 +33848,8 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
                     jp->size = 1;
                     if (op == OP_goto16) {
                         bc_out.buf[pos - 1] = jp->op = OP_goto8;
+                    } else if (op == OP_if_not_lt) {
+                        bc_out.buf[pos - 1] = jp->op = OP_if_not_lt8;
                     } else {
                         bc_out.buf[pos - 1] = jp->op = OP_if_false8 + (op - OP_if_false);
                     }
@@ -31564,10 +34027,16 @@ static __exception int compute_stack_size_rec(JSContext *ctx,
             break;
         case OP_if_true8:
         case OP_if_false8:
+        case OP_if_not_lt8:
             diff = (int8_t)bc_buf[pos + 1];
             if (compute_stack_size_rec(ctx, fd, s, pos + 1 + diff, op, stack_len))
                 return -1;
             break;
+        case OP_if_not_lt:
+            diff = get_u32(bc_buf + pos + 1);
+            if (compute_stack_size_rec(ctx, fd, s, pos + 1 + diff, op, stack_len))
+                return -1;
+            break;
 #endif
         case OP_if_true:
         case OP_if_false:
@@ -31669,6 +34138,69 @@ static int add_module_variables(JSContext *ctx, JSFunctionDef *fd)
     return 0;
 }
 
+/* Top level functions of a global script can only reference global
+   variables, so they can be compiled on their own from their source
+   code. The other functions may capture variables of their parents. */
+static BOOL js_is_lazy_function(JSFunctionDef *fd)
+{
+    JSFunctionDef *parent = fd->parent;
+
+    return parent->lazy_functions &&
+        fd->parent_scope_level == 1 &&
+        (fd->func_type == JS_PARSE_FUNC_STATEMENT ||
+         fd->func_type == JS_PARSE_FUNC_VAR ||
+         fd->func_type == JS_PARSE_FUNC_EXPR) &&
+        !fd->is_called_on_creation &&
+        !fd->uses_private_names &&
+        fd->js_mode == parent->js_mode && /* no directive of its own */
+        fd->source != NULL;
+}
+
+/* create the stub of a lazy function. It only keeps what js_closure()
+   and Function.prototype.toString need. The function definition is
+   freed. */
+static JSValue js_create_lazy_function(JSContext *ctx, JSFunctionDef *fd)
+{
+    JSFunctionBytecode *b;
+
+    b = js_mallocz(ctx, sizeof(*b) + sizeof(b->cpool[0]));
+    if (!b) {
+        js_free_function_def(ctx, fd);
+        return JS_EXCEPTION;
+    }
+    b->header.ref_count = 1;
+    b->is_lazy = 1;
+    b->is_func_expr = fd->is_func_expr;
+    b->js_mode = fd->js_mode;
+    b->has_prototype = fd->has_prototype;
+    b->has_simple_parameter_list = fd->has_simple_parameter_list;
+    b->func_kind = fd->func_kind;
+    b->new_target_allowed = fd->new_target_allowed;
+    b->super_call_allowed = fd->super_call_allowed;
+    b->super_allowed = fd->super_allowed;
+    b->arguments_allowed = fd->arguments_allowed;
+    b->func_name = fd->func_name;
+    fd->func_name = JS_ATOM_NULL;
+    b->defined_arg_count = fd->defined_arg_count;
+    b->realm = JS_DupContext(ctx);
+    /* the compiled function is stored in cpool[0] */
+    b->cpool = (void *)(b + 1);
+    b->cpool[0] = JS_UNDEFINED;
+    b->cpool_count = 1;
+
+    b->has_debug = 1;
+    b->debug.filename = fd->filename;
+    fd->filename = JS_ATOM_NULL;
+    b->debug.line_num = fd->line_num;
+    b->debug.source = fd->source;
+    b->debug.source_len = fd->source_len;
+    fd->source = NULL;
+
+    add_gc_object(ctx->rt, &b->header, JS_GC_OBJ_TYPE_FUNCTION_BYTECODE);
+    js_free_function_def(ctx, fd);
+    return JS_MKPTR(JS_TAG_FUNCTION_BYTECODE, b);
+}
+
 /* create a function object from a function definition. The function
    definition is freed. All the child functions are also created. It
    must be done this way to resolve all the variables. */
@@ -31723,7 +34255,10 @@ static JSValue js_create_function(JSContext *ctx, JSFunctionDef *fd)
 
         fd1 = list_entry(el, JSFunctionDef, link);
         cpool_idx = fd1->parent_cpool_idx;
-        func_obj = js_create_function(ctx, fd1);
+        if (js_is_lazy_function(fd1))
+            func_obj = js_create_lazy_function(ctx, fd1);
+        else
+            func_obj = js_create_function(ctx, fd1);
         if (JS_IsException(func_obj))
             goto fail;
         /* save it in the constant pool */
@@ -31905,6 +34440,11 @@ static void free_function_bytecode(JSRuntime *rt, JSFunctionBytecode *b)
     }
 #endif
     free_bytecode_atoms(rt, b->byte_code_buf, b->byte_code_len, TRUE);
+    if (b->ic) {
+        for(i = 0; i < b->ic_count; i++)
+            JS_FreeAtomRT(rt, b->ic[i].atom);
+        js_free_rt(rt, b->ic);
+    }
 
     if (b->vardefs) {
         for(i = 0; i < b->arg_count + b->var_count; i++) {
@@ -32449,7 +34989,7 @@ static __exception int js_parse_function_decl2(JSParseState *s,
             else
                 emit_op(s, OP_return);
 
-            if (!(fd->js_mode & JS_MODE_STRIP)) {
+            if (!(fd->js_mode & (JS_MODE_STRIP | JS_MODE_STRIP_SOURCE))) {
                 /* save the function source code */
                 /* the end of the function source code is after the last
                    token of the function source stored into s->last_ptr */
@@ -32476,7 +35016,7 @@ static __exception int js_parse_function_decl2(JSParseState *s,
         if (js_parse_source_element(s))
             goto fail;
     }
-    if (!(fd->js_mode & JS_MODE_STRIP)) {
+    if (!(fd->js_mode & (JS_MODE_STRIP | JS_MODE_STRIP_SOURCE))) {
         /* save the function source code */
         fd->source_len = s->buf_ptr - ptr;
         fd->source = js_strndup(ctx, (const char *)ptr, fd->source_len);
@@ -32702,6 +35242,80 @@ JSValue JS_EvalFunction(JSContext *ctx, JSValue fun_obj)
     return JS_EvalFunctionInternal(ctx, fun_obj, ctx->global_obj, NULL, NULL);
 }
 
+/* compile the source code of a lazy function as if it was the top level
+   function of a global script, which it was */
+static JSValue js_parse_lazy_function(JSContext *ctx, JSFunctionBytecode *b)
+{
+    JSParseState s1, *s = &s1;
+    JSFunctionDef *fd, *fd1;
+    JSValue func_obj;
+    const char *filename;
+    int err;
+
+    filename = JS_AtomToCString(ctx, b->debug.filename);
+    if (!filename)
+        return JS_EXCEPTION;
+    js_parse_init(ctx, s, b->debug.source, b->debug.source_len, filename);
+    s->line_num = s->token.line_num = b->debug.line_num;
+    s->allow_html_comments = TRUE;
+
+    fd = js_new_function_def(ctx, NULL, TRUE, FALSE, filename, 1);
+    if (!fd) {
+        JS_FreeCString(ctx, filename);
+        return JS_EXCEPTION;
+    }
+    s->cur_func = fd;
+    fd->eval_type = JS_EVAL_TYPE_GLOBAL;
+    fd->is_global_var = TRUE;
+    fd->has_this_binding = TRUE;
+    fd->arguments_allowed = TRUE;
+    fd->js_mode = b->js_mode;
+    fd->func_name = JS_DupAtom(ctx, JS_ATOM__eval_);
+    push_scope(s); /* body scope */
+
+    fd1 = NULL;
+    err = next_token(s);
+    if (!err) {
+        err = js_parse_function_decl2(s, b->is_func_expr ? JS_PARSE_FUNC_EXPR :
+                                      JS_PARSE_FUNC_STATEMENT,
+                                      JS_FUNC_NORMAL, JS_ATOM_NULL,
+                                      s->token.ptr, s->token.line_num,
+                                      JS_PARSE_EXPORT_NONE, &fd1);
+    }
+    free_token(s, &s->token);
+    if (err) {
+        func_obj = JS_EXCEPTION;
+    } else {
+        /* fd1 is removed from fd */
+        func_obj = js_create_function(ctx, fd1);
+    }
+    js_free_function_def(ctx, fd);
+    JS_FreeCString(ctx, filename);
+    /* it would reference the variables of the parent otherwise */
+    assert(JS_IsException(func_obj) ||
+           ((JSFunctionBytecode *)JS_VALUE_GET_PTR(func_obj))->closure_var_count == 0);
+    return func_obj;
+}
+
+/* compile a lazy function on its first call. The function object is
+   switched to the compiled bytecode, which is also kept by the stub for
+   the other closures created from it. */
+static JSFunctionBytecode *js_compile_lazy_function(JSContext *ctx, JSObject *p)
+{
+    JSFunctionBytecode *b = p->u.func.function_bytecode;
+    JSValue func;
+
+    if (JS_IsUndefined(b->cpool[0])) {
+        func = js_parse_lazy_function(b->realm, b);
+        if (JS_IsException(func))
+            return NULL;
+        b->cpool[0] = func;
+    }
+    p->u.func.function_bytecode = JS_VALUE_GET_PTR(JS_DupValue(ctx, b->cpool[0]));
+    JS_FreeValue(ctx, JS_MKPTR(JS_TAG_FUNCTION_BYTECODE, b));
+    return p->u.func.function_bytecode;
+}
+
 static void skip_shebang(JSParseState *s)
 {
     const uint8_t *p = s->buf_ptr;
@@ -32765,6 +35379,8 @@ static JSValue __JS_EvalInternal(JSContext *ctx, JSValueConst this_obj,
             js_mode |= JS_MODE_STRICT;
         if (flags & JS_EVAL_FLAG_STRIP)
             js_mode |= JS_MODE_STRIP;
+        if (flags & JS_EVAL_FLAG_STRIP_SOURCE)
+            js_mode |= JS_MODE_STRIP_SOURCE;
         if (eval_type == JS_EVAL_TYPE_MODULE) {
             JSAtom module_name = JS_NewAtom(ctx, filename);
             if (module_name == JS_ATOM_NULL)
@@ -32782,6 +35398,9 @@ static JSValue __JS_EvalInternal(JSContext *ctx, JSValueConst this_obj,
     fd->eval_type = eval_type;
     fd->has_this_binding = (eval_type != JS_EVAL_TYPE_DIRECT);
     fd->backtrace_barrier = ((flags & JS_EVAL_FLAG_BACKTRACE_BARRIER) != 0);
+    /* the bytecode of lazy functions cannot be serialized */
+    fd->lazy_functions = (eval_type == JS_EVAL_TYPE_GLOBAL &&
+                          (flags & (JS_EVAL_FLAG_LAZY | JS_EVAL_FLAG_COMPILE_ONLY)) == JS_EVAL_FLAG_LAZY);
     if (eval_type == JS_EVAL_TYPE_DIRECT) {
         fd->new_target_allowed = b->new_target_allowed;
         fd->super_call_allowed = b->super_call_allowed;
@@ -32914,9 +35533,9 @@ typedef enum BCTagEnum {
 } BCTagEnum;
 
 #ifdef CONFIG_BIGNUM
-#define BC_BASE_VERSION 2
+#define BC_BASE_VERSION 8
 #else
-#define BC_BASE_VERSION 1
+#define BC_BASE_VERSION 7
 #endif
 #define BC_BE_VERSION 0x40
 #ifdef WORDS_BIGENDIAN
@@ -33133,7 +35752,8 @@ static void bc_byte_swap(uint8_t *bc_buf, int bc_len)
 }
 
 static int JS_WriteFunctionBytecode(BCWriterState *s,
-                                    const uint8_t *bc_buf1, int bc_len)
+                                    const uint8_t *bc_buf1, int bc_len,
+                                    const JSInlineCache *ic)
 {
     int pos, len, op;
     JSAtom atom;
@@ -33148,6 +35768,12 @@ static int JS_WriteFunctionBytecode(BCWriterState *s,
     pos = 0;
     while (pos < bc_len) {
         op = bc_buf[pos];
+        if (op >= OP_get_field_ic && op <= OP_put_field_ic) {
+            /* the inline caches are not serialized */
+            op = op - OP_get_field_ic + OP_get_field;
+            bc_buf[pos] = op;
+            put_u32(bc_buf + pos + 1, ic[get_u32(bc_buf + pos + 1)].atom);
+        }
         len = short_opcode_info(op).size;
         switch(short_opcode_info(op).fmt) {
         case OP_FMT_atom:
@@ -33354,8 +35980,11 @@ static int JS_WriteObjectRec(BCWriterState *s, JSValueConst obj)
         }
         break;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         {
-            JSString *p = JS_VALUE_GET_STRING(obj);
+            JSString *p = js_get_flat_string(s->ctx, obj);
+            if (!p)
+                goto fail;
             bc_put_u8(s, BC_TAG_STRING);
             JS_WriteString(s, p);
         }
@@ -33427,7 +36056,7 @@ static int JS_WriteObjectRec(BCWriterState *s, JSValueConst obj)
                 bc_put_u8(s, flags);
             }
 
-            if (JS_WriteFunctionBytecode(s, b->byte_code_buf, b->byte_code_len))
+            if (JS_WriteFunctionBytecode(s, b->byte_code_buf, b->byte_code_len, b->ic))
                 goto fail;
 
             if (b->has_debug) {
@@ -34926,6 +37555,15 @@ static JSValue JS_ToObject(JSContext *ctx, JSValueConst val)
     case JS_TAG_FLOAT64:
         obj = JS_NewObjectClass(ctx, JS_CLASS_NUMBER);
         goto set_value;
+    case JS_TAG_STRING_ROPE:
+        {
+            JSValue str = js_string_rope_flatten(ctx, JS_VALUE_GET_PTR(val));
+            if (JS_IsException(str))
+                return str;
+            obj = JS_ToObject(ctx, str);
+            JS_FreeValue(ctx, str);
+            return obj;
+        }
     case JS_TAG_STRING:
         /* XXX: should call the string constructor */
         {
@@ -36743,7 +39381,9 @@ static JSValue js_array_from(JSContext *ctx, JSValueConst this_val,
     JSValueConst args[2];
     JSValue stack[2];
     JSValue iter, r, v, v2, arrayLike;
+    JSValue *arrp;
     int64_t k, len;
+    uint32_t count32;
     int done, mapping;
 
     mapping = FALSE;
@@ -36775,6 +39415,9 @@ static JSValue js_array_from(JSContext *ctx, JSValueConst this_val,
             r = JS_NewArray(ctx);
         if (JS_IsException(r))
             goto exception;
+        if (js_get_fast_array(ctx, items, &arrp, &count32) &&
+            js_reserve_fast_array(ctx, r, count32))
+            goto exception;
         stack[0] = JS_DupValue(ctx, items);
         if (js_for_of_start(ctx, &stack[1], FALSE))
             goto exception;
@@ -36793,8 +39436,7 @@ static JSValue js_array_from(JSContext *ctx, JSValueConst this_val,
                 if (JS_IsException(v))
                     goto exception_close;
             }
-            if (JS_DefinePropertyValueInt64(ctx, r, k, v,
-                                            JS_PROP_C_W_E | JS_PROP_THROW) < 0)
+            if (js_define_array_element(ctx, r, k, v) < 0)
                 goto exception_close;
         }
     } else {
@@ -36826,8 +39468,7 @@ static JSValue js_array_from(JSContext *ctx, JSValueConst this_val,
                 if (JS_IsException(v))
                     goto exception;
             }
-            if (JS_DefinePropertyValueInt64(ctx, r, k, v,
-                                            JS_PROP_C_W_E | JS_PROP_THROW) < 0)
+            if (js_define_array_element(ctx, r, k, v) < 0)
                 goto exception;
         }
     }
@@ -37047,6 +39688,8 @@ static JSValue js_array_every(JSContext *ctx, JSValueConst this_val,
     JSValueConst func, this_arg;
     int64_t len, k, n;
     int present;
+    JSValue *arrp;
+    uint32_t count32;
 
     ret = JS_UNDEFINED;
     val = JS_UNDEFINED;
@@ -37082,11 +39725,18 @@ static JSValue js_array_every(JSContext *ctx, JSValueConst this_val,
         ret = JS_ArraySpeciesCreate(ctx, obj, JS_NewInt64(ctx, len));
         if (JS_IsException(ret))
             goto exception;
+        if (js_get_fast_array(ctx, obj, &arrp, &count32) &&
+            js_reserve_fast_array(ctx, ret, count32))
+            goto exception;
         break;
     case special_filter:
         ret = JS_ArraySpeciesCreate(ctx, obj, JS_NewInt32(ctx, 0));
         if (JS_IsException(ret))
             goto exception;
+        /* the unused storage is released at the end */
+        if (js_get_fast_array(ctx, obj, &arrp, &count32) &&
+            js_reserve_fast_array(ctx, ret, count32))
+            goto exception;
         break;
     case special_map | special_TA:
         args[0] = obj;
@@ -37104,9 +39754,19 @@ static JSValue js_array_every(JSContext *ctx, JSValueConst this_val,
     n = 0;
 
     for(k = 0; k < len; k++) {
-        present = JS_TryGetPropertyInt64(ctx, obj, k, &val);
-        if (present < 0)
-            goto exception;
+        if (special & special_TA) {
+            /* typed arrays have no holes */
+            val = JS_GetPropertyInt64(ctx, obj, k);
+            if (JS_IsException(val))
+                goto exception;
+            present = TRUE;
+        } else if (js_get_fast_array_element(ctx, obj, k, &val)) {
+            present = TRUE;
+        } else {
+            present = JS_TryGetPropertyInt64(ctx, obj, k, &val);
+            if (present < 0)
+                goto exception;
+        }
         if (present) {
             index_val = JS_NewInt64(ctx, k);
             if (JS_IsException(index_val))
@@ -37134,8 +39794,7 @@ static JSValue js_array_every(JSContext *ctx, JSValueConst this_val,
                 }
                 break;
             case special_map:
-                if (JS_DefinePropertyValueInt64(ctx, ret, k, res,
-                                                JS_PROP_C_W_E | JS_PROP_THROW) < 0)
+                if (js_define_array_element(ctx, ret, k, res) < 0)
                     goto exception;
                 break;
             case special_map | special_TA:
@@ -37145,8 +39804,7 @@ static JSValue js_array_every(JSContext *ctx, JSValueConst this_val,
             case special_filter:
             case special_filter | special_TA:
                 if (JS_ToBoolFree(ctx, res)) {
-                    if (JS_DefinePropertyValueInt64(ctx, ret, n++, JS_DupValue(ctx, val),
-                                                    JS_PROP_C_W_E | JS_PROP_THROW) < 0)
+                    if (js_define_array_element(ctx, ret, n++, JS_DupValue(ctx, val)) < 0)
                         goto exception;
                 }
                 break;
@@ -37159,6 +39817,8 @@ static JSValue js_array_every(JSContext *ctx, JSValueConst this_val,
         }
     }
 done:
+    if (special == special_filter)
+        js_shrink_fast_array(ctx, ret);
     if (special == (special_filter | special_TA)) {
         JSValue arr;
         args[0] = obj;
@@ -37233,9 +39893,13 @@ static JSValue js_array_reduce(JSContext *ctx, JSValueConst this_val,
     }
     for (; k < len; k++) {
         k1 = (special & special_reduceRight) ? len - k - 1 : k;
-        present = JS_TryGetPropertyInt64(ctx, obj, k1, &val);
-        if (present < 0)
-            goto exception;
+        if (js_get_fast_array_element(ctx, obj, k1, &val)) {
+            present = TRUE;
+        } else {
+            present = JS_TryGetPropertyInt64(ctx, obj, k1, &val);
+            if (present < 0)
+                goto exception;
+        }
         if (present) {
             index_val = JS_NewInt64(ctx, k1);
             if (JS_IsException(index_val))
@@ -38243,6 +40907,19 @@ static JSValue js_array_iterator_next(JSContext *ctx, JSValueConst this_val,
     if (JS_IsUndefined(it->obj))
         goto done;
     p = JS_VALUE_GET_OBJ(it->obj);
+    if (p->class_id == JS_CLASS_ARRAY && p->fast_array &&
+        it->idx < p->u.array.count) {
+        /* the element exists so its index is below the length */
+        idx = it->idx;
+        it->idx = idx + 1;
+        *pdone = FALSE;
+        if (it->kind == JS_ITERATOR_KIND_VALUE)
+            return JS_DupValue(ctx, p->u.array.u.values[idx]);
+        if (it->kind == JS_ITERATOR_KIND_KEY)
+            return JS_NewUint32(ctx, idx);
+        val = JS_DupValue(ctx, p->u.array.u.values[idx]);
+        goto make_entry;
+    }
     if (p->class_id >= JS_CLASS_UINT8C_ARRAY &&
         p->class_id <= JS_CLASS_FLOAT64_ARRAY) {
         if (typed_array_is_detached(ctx, p)) {
@@ -38278,6 +40955,7 @@ static JSValue js_array_iterator_next(JSContext *ctx, JSValueConst this_val,
         } else {
             JSValueConst args[2];
             JSValue num;
+        make_entry:
             num = JS_NewUint32(ctx, idx);
             args[0] = num;
             args[1] = val;
@@ -38869,6 +41547,9 @@ static JSValue js_thisStringValue(JSContext *ctx, JSValueConst this_val)
     if (JS_VALUE_GET_TAG(this_val) == JS_TAG_STRING)
         return JS_DupValue(ctx, this_val);
 
+    if (JS_VALUE_GET_TAG(this_val) == JS_TAG_STRING_ROPE)
+        return js_string_rope_flatten(ctx, JS_VALUE_GET_PTR(this_val));
+
     if (JS_VALUE_GET_TAG(this_val) == JS_TAG_OBJECT) {
         JSObject *p = JS_VALUE_GET_OBJ(this_val);
         if (p->class_id == JS_CLASS_STRING) {
@@ -39129,11 +41810,46 @@ static int string_indexof_char(JSString *p, int c, int from)
         }
     } else {
         if ((c & ~0xff) == 0) {
-            for (i = from; i < len; i++) {
-                if (p->u.str8[i] == (uint8_t)c)
-                    return i;
+            const uint8_t *q = memchr(p->u.str8 + from, c, len - from);
+            if (q)
+                return q - p->u.str8;
+        }
+    }
+    return -1;
+}
+
+/* search 's2' in 's1' from 'from'. The candidates are the positions
+   where both the first and the last characters match, checked
+   SCAN_VEC_SIZE positions at a time. */
+static int string_indexof8(const uint8_t *s1, int len1, const uint8_t *s2,
+                           int len2, int from)
+{
+    const uint8_t *q;
+    int i;
+
+#ifdef SCAN_VEC_SIZE
+    if (len2 >= 2) {
+        scan_vec first = scan_splat(s2[0]);
+        scan_vec last = scan_splat(s2[len2 - 1]);
+        for (i = from; i + len2 - 1 + SCAN_VEC_SIZE <= len1; i += SCAN_VEC_SIZE) {
+            uint32_t m = scan_mask(scan_and(scan_eq(scan_load(s1 + i), first),
+                                            scan_eq(scan_load(s1 + i + len2 - 1), last)));
+            while (m) {
+                int j = i + ctz32(m);
+                if (!memcmp(s1 + j + 1, s2 + 1, len2 - 2))
+                    return j;
+                m &= m - 1;
             }
         }
+        from = i;
+    }
+#endif
+    for (i = from; i + len2 <= len1; i = q - s1 + 1) {
+        q = memchr(s1 + i, s2[0], len1 - len2 + 1 - i);
+        if (!q)
+            break;
+        if (!memcmp(q + 1, s2 + 1, len2 - 1))
+            return q - s1;
     }
     return -1;
 }
@@ -39144,6 +41860,8 @@ static int string_indexof(JSString *p1, JSString *p2, int from)
     int c, i, j, len1 = p1->len, len2 = p2->len;
     if (len2 == 0)
         return from;
+    if (!p1->is_wide_char && !p2->is_wide_char)
+        return string_indexof8(p1->u.str8, len1, p2->u.str8, len2, from);
     for (i = from, c = string_get(p2, 0); i + len2 <= len1; i = j + 1) {
         j = string_indexof_char(p1, c, i);
         if (j < 0 || j + len2 > len1)
@@ -39211,7 +41929,10 @@ static JSValue js_string_indexOf(JSContext *ctx, JSValueConst this_val,
         inc = 1;
     }
     ret = -1;
-    if (len >= v_len && inc * (stop - start) >= 0) {
+    if (!lastIndexOf) {
+        if (len >= v_len && start <= stop)
+            ret = string_indexof(p, p1, start);
+    } else if (len >= v_len && inc * (stop - start) >= 0) {
         for (i = start;; i += inc) {
             if (!string_cmp(p, p1, i, 0, v_len)) {
                 ret = i;
@@ -39274,7 +41995,10 @@ static JSValue js_string_includes(JSContext *ctx, JSValueConst this_val,
         start = stop = pos;
     }
     ret = 0;
-    if (start >= 0 && start <= stop) {
+    if (magic == 0) {
+        if (start >= 0 && start <= stop)
+            ret = string_indexof(p, p1, start) >= 0;
+    } else if (start >= 0 && start <= stop) {
         for (i = start;; i++) {
             if (!string_cmp(p, p1, i, 0, v_len)) {
                 ret = 1;
@@ -39398,8 +42122,10 @@ static JSValue js_string___GetSubstitution(JSContext *ctx, JSValueConst this_val
     if (!JS_IsString(rep) || !JS_IsString(str))
         return JS_ThrowTypeError(ctx, "not a string");
 
-    sp = JS_VALUE_GET_STRING(str);
-    rp = JS_VALUE_GET_STRING(rep);
+    sp = js_get_flat_string(ctx, str);
+    rp = js_get_flat_string(ctx, rep);
+    if (!sp || !rp)
+        return JS_EXCEPTION;
 
     string_buffer_init(ctx, b, 0);
 
@@ -39996,10 +42722,88 @@ static JSValue js_string_localeCompare(JSContext *ctx, JSValueConst this_val,
     return JS_NewInt32(ctx, cmp);
 }
 
+/* convert the case of the Latin-1 character 'c'. Return -1 if the
+   result is not a single Latin-1 character. */
+static int latin1_case_conv(int c, BOOL to_lower)
+{
+    uint32_t res[LRE_CC_RES_LEN_MAX];
+
+    if (c < 0x80) {
+        if (to_lower)
+            return c - 'A' < 26U ? c + 0x20 : c;
+        else
+            return c - 'a' < 26U ? c - 0x20 : c;
+    }
+    if (lre_case_conv(res, c, to_lower) != 1 || res[0] > 0xff)
+        return -1;
+    return res[0];
+}
+
+/* case conversion of an 8 bit string: the unchanged strings are
+   returned as is and the ASCII characters are converted
+   SCAN_VEC_SIZE at a time. Return JS_UNDEFINED if a character does
+   not convert to a single Latin-1 character. */
+static JSValue js_string_case_conv8(JSContext *ctx, JSValueConst val,
+                                    BOOL to_lower)
+{
+    JSString *p = JS_VALUE_GET_STRING(val), *str;
+    const uint8_t *src = p->u.str8;
+    uint8_t *dst;
+    int i, end, len = p->len, c, lo = to_lower ? 'A' : 'a';
+
+    /* first character which may change */
+    i = 0;
+#ifdef SCAN_VEC_SIZE
+    for (; i + SCAN_VEC_SIZE <= len; i += SCAN_VEC_SIZE) {
+        scan_vec v = scan_load(src + i);
+        if (scan_mask(scan_in_range(v, lo, 26)) | scan_mask(v))
+            break;
+    }
+#endif
+    for (; i < len; i++) {
+        c = src[i];
+        if (latin1_case_conv(c, to_lower) != c)
+            break;
+    }
+    if (i == len)
+        return JS_DupValue(ctx, val);
+
+    str = js_alloc_string(ctx, len, 0);
+    if (!str)
+        return JS_EXCEPTION;
+    dst = str->u.str8;
+    memcpy(dst, src, i);
+    while (i < len) {
+        end = len;
+#ifdef SCAN_VEC_SIZE
+        if (i + SCAN_VEC_SIZE <= len) {
+            scan_vec v = scan_load(src + i);
+            if (!scan_mask(v)) {
+                scan_store(dst + i, scan_xor(v, scan_and(scan_in_range(v, lo, 26),
+                                                         scan_splat(0x20))));
+                i += SCAN_VEC_SIZE;
+                continue;
+            }
+            end = i + SCAN_VEC_SIZE;
+        }
+#endif
+        for (; i < end; i++) {
+            c = latin1_case_conv(src[i], to_lower);
+            if (c < 0) {
+                js_free_string(ctx->rt, str);
+                return JS_UNDEFINED;
+            }
+            dst[i] = c;
+        }
+    }
+    dst[len] = '\0';
+    return JS_MKPTR(JS_TAG_STRING, str);
+}
+
 static JSValue js_string_toLowerCase(JSContext *ctx, JSValueConst this_val,
                                      int argc, JSValueConst *argv, int to_lower)
 {
-    JSValue val;
+    JSValue val, ret;
     StringBuffer b_s, *b = &b_s;
     JSString *p;
     int i, c, j, l;
@@ -40011,6 +42815,13 @@ static JSValue js_string_toLowerCase(JSContext *ctx, JSValueConst this_val,
     p = JS_VALUE_GET_STRING(val);
     if (p->len == 0)
         return val;
+    if (!p->is_wide_char) {
+        ret = js_string_case_conv8(ctx, val, to_lower);
+        if (!JS_IsUndefined(ret)) {
+            JS_FreeValue(ctx, val);
+            return ret;
+        }
+    }
     if (string_buffer_init(ctx, b, p->len))
         goto fail;
     for(i = 0; i < p->len;) {
@@ -40081,6 +42892,22 @@ static JSValue JS_NewUTF32String(JSContext *ctx, const uint32_t *buf, int len)
     return JS_EXCEPTION;
 }
 
+static BOOL str8_is_ascii(const uint8_t *buf, int len)
+{
+    int i = 0;
+#ifdef SCAN_VEC_SIZE
+    for (; i + SCAN_VEC_SIZE <= len; i += SCAN_VEC_SIZE) {
+        if (scan_mask(scan_load(buf + i)))
+            return FALSE;
+    }
+#endif
+    for (; i < len; i++) {
+        if (buf[i] >= 0x80)
+            return FALSE;
+    }
+    return TRUE;
+}
+
 static JSValue js_string_normalize(JSContext *ctx, JSValueConst this_val,
                                    int argc, JSValueConst *argv)
 {
@@ -40089,15 +42916,12 @@ static JSValue js_string_normalize(JSContext *ctx, JSValueConst this_val,
     int is_compat, buf_len, out_len;
     UnicodeNormalizationEnum n_type;
     JSValue val;
+    JSString *str;
     uint32_t *buf, *out_buf;
 
     val = JS_ToStringCheckObject(ctx, this_val);
     if (JS_IsException(val))
         return val;
-    buf_len = JS_ToUTF32String(ctx, &buf, val);
-    JS_FreeValue(ctx, val);
-    if (buf_len < 0)
-        return JS_EXCEPTION;
 
     if (argc == 0 || JS_IsUndefined(argv[0])) {
         n_type = UNICODE_NFC;
@@ -40123,12 +42947,23 @@ static JSValue js_string_normalize(JSContext *ctx, JSValueConst this_val,
             JS_FreeCString(ctx, form);
             JS_ThrowRangeError(ctx, "bad normalization form");
         fail1:
-            js_free(ctx, buf);
+            JS_FreeValue(ctx, val);
             return JS_EXCEPTION;
         }
         JS_FreeCString(ctx, form);
     }
 
+    /* the Latin-1 characters are in NFC and the ASCII ones are in all
+       the forms */
+    str = JS_VALUE_GET_STRING(val);
+    if (!str->is_wide_char &&
+        (n_type == UNICODE_NFC || str8_is_ascii(str->u.str8, str->len)))
+        return val;
+
+    buf_len = JS_ToUTF32String(ctx, &buf, val);
+    JS_FreeValue(ctx, val);
+    if (buf_len < 0)
+        return JS_EXCEPTION;
     out_len = unicode_normalize(&out_buf, buf, buf_len, n_type,
                                 ctx->rt, (DynBufReallocFunc *)js_realloc_rt);
     js_free(ctx, buf);
@@ -40807,7 +43642,72 @@ static void js_regexp_finalizer(JSRuntime *rt, JSValue val)
     JS_FreeValueRT(rt, JS_MKPTR(JS_TAG_STRING, re->pattern));
 }
 
-/* create a string containing the RegExp bytecode */
+static void js_regexp_cache_clear(JSRuntime *rt)
+{
+    JSRegExpCacheEntry *e;
+    int i;
+
+    for(i = 0; i < JS_REGEXP_CACHE_SIZE; i++) {
+        e = &rt->regexp_cache[i];
+        if (e->pattern) {
+            JS_FreeValueRT(rt, JS_MKPTR(JS_TAG_STRING, e->pattern));
+            JS_FreeValueRT(rt, JS_MKPTR(JS_TAG_STRING, e->bytecode));
+            e->pattern = NULL;
+            e->bytecode = NULL;
+        }
+    }
+}
+
+/* return the cached bytecode of (pattern, re_flags) or NULL */
+static JSString *js_regexp_cache_find(JSRuntime *rt, JSString *pattern,
+                                      int re_flags, uint32_t hash)
+{
+    JSRegExpCacheEntry *e;
+    int i;
+
+    for(i = 0; i < JS_REGEXP_CACHE_SIZE; i++) {
+        e = &rt->regexp_cache[i];
+        if (e->pattern && e->hash == hash && e->re_flags == re_flags &&
+            e->pattern->len == pattern->len &&
+            !js_string_memcmp(e->pattern, pattern, pattern->len)) {
+            e->last_use = ++rt->regexp_cache_clock;
+            return e->bytecode;
+        }
+    }
+    return NULL;
+}
+
+/* add an entry, evicting the least recently used one if the cache is full */
+static void js_regexp_cache_add(JSRuntime *rt, JSString *pattern,
+                                int re_flags, uint32_t hash, JSString *bytecode)
+{
+    JSRegExpCacheEntry *e, *e1;
+    int i;
+
+    e = &rt->regexp_cache[0];
+    for(i = 0; i < JS_REGEXP_CACHE_SIZE; i++) {
+        e1 = &rt->regexp_cache[i];
+        if (!e1->pattern) {
+            e = e1;
+            break;
+        }
+        /* the clock difference handles the wrap around */
+        if ((int32_t)(e1->last_use - e->last_use) < 0)
+            e = e1;
+    }
+    if (e->pattern) {
+        JS_FreeValueRT(rt, JS_MKPTR(JS_TAG_STRING, e->pattern));
+        JS_FreeValueRT(rt, JS_MKPTR(JS_TAG_STRING, e->bytecode));
+    }
+    e->pattern = JS_VALUE_GET_STRING(JS_DupValueRT(rt, JS_MKPTR(JS_TAG_STRING, pattern)));
+    e->bytecode = JS_VALUE_GET_STRING(JS_DupValueRT(rt, JS_MKPTR(JS_TAG_STRING, bytecode)));
+    e->hash = hash;
+    e->re_flags = re_flags;
+    e->last_use = ++rt->regexp_cache_clock;
+}
+
+/* create a string containing the RegExp bytecode. The bytecode is
+   immutable so it is shared through a per runtime cache. */
 static JSValue js_compile_regexp(JSContext *ctx, JSValueConst pattern,
                                  JSValueConst flags)
 {
@@ -40817,6 +43717,8 @@ static JSValue js_compile_regexp(JSContext *ctx, JSValueConst pattern,
     size_t i, len;
     int re_bytecode_len;
     JSValue ret;
+    JSString *p, *bc;
+    uint32_t hash;
     char error_msg[64];
 
     re_flags = 0;
@@ -40858,6 +43760,20 @@ static JSValue js_compile_regexp(JSContext *ctx, JSValueConst pattern,
         JS_FreeCString(ctx, str);
     }
 
+    p = NULL;
+    hash = 0;
+    if (JS_VALUE_GET_TAG(pattern) == JS_TAG_STRING) {
+        p = JS_VALUE_GET_STRING(pattern);
+        if (p->len <= JS_REGEXP_CACHE_PATTERN_MAX) {
+            hash = hash_string(p, re_flags);
+            bc = js_regexp_cache_find(ctx->rt, p, re_flags, hash);
+            if (bc)
+                return JS_DupValue(ctx, JS_MKPTR(JS_TAG_STRING, bc));
+        } else {
+            p = NULL;
+        }
+    }
+
     str = JS_ToCStringLen2(ctx, &len, pattern, !(re_flags & LRE_FLAG_UTF16));
     if (!str)
         return JS_EXCEPTION;
@@ -40871,6 +43787,8 @@ static JSValue js_compile_regexp(JSContext *ctx, JSValueConst pattern,
 
     ret = js_new_string8(ctx, re_bytecode_buf, re_bytecode_len);
     js_free(ctx, re_bytecode_buf);
+    if (p && !JS_IsException(ret))
+        js_regexp_cache_add(ctx->rt, p, re_flags, hash, JS_VALUE_GET_STRING(ret));
     return ret;
 }
 
@@ -42248,134 +45166,461 @@ void JS_AddIntrinsicRegExp(JSContext *ctx)
 
 /* JSON */
 
-/* XXX: this parser is less strict than the JSON standard because we
-   reuse the Javascript tokenizer. It could be improved by adding a
-   specific JSON parse flag. */
-static JSValue json_parse_value(JSParseState *s)
+/* number of recently seen object keys whose atom is kept while parsing.
+   Must be a power of two. */
+#define JSON_ATOM_CACHE_SIZE 64
+
+typedef struct JSONParseState {
+    JSContext *ctx;
+    const uint8_t *buf_start;
+    const uint8_t *buf_ptr;
+    const uint8_t *buf_end;
+    const char *filename;
+    /* the objects of a JSON document usually repeat the same keys, so
+       their atoms are cached by a hash of their bytes */
+    JSAtom atom_cache[JSON_ATOM_CACHE_SIZE];
+} JSONParseState;
+
+#if defined(_WIN32)
+static int json_parse_error(JSONParseState *s, const char *fmt, ...)
+#else
+static int __attribute__((format(printf, 2, 3))) json_parse_error(JSONParseState *s, const char *fmt, ...)
+#endif
 {
     JSContext *ctx = s->ctx;
-    JSValue val = JS_NULL;
-    BOOL is_neg;
-    int ret;
+    const uint8_t *p;
+    va_list ap;
+    int line_num;
 
-    switch(s->token.val) {
-    case '{':
-        {
-            JSValue prop_val, prop_str;
+    va_start(ap, fmt);
+    JS_ThrowError2(ctx, JS_SYNTAX_ERROR, fmt, ap, FALSE);
+    va_end(ap);
+    /* the line number is only needed here */
+    line_num = 1;
+    for(p = s->buf_start; p < s->buf_ptr; p++)
+        line_num += (*p == '\n');
+    build_backtrace(ctx, ctx->rt->current_exception, s->filename, line_num,
+                    0);
+    return -1;
+}
 
-            if (next_token(s))
+static int json_parse_unexpected(JSONParseState *s)
+{
+    const uint8_t *p = s->buf_ptr, *p_next;
+
+    if (p >= s->buf_end)
+        return json_parse_error(s, "unexpected end of input");
+    p_next = p + 1;
+    if (*p >= 0x80 && unicode_from_utf8(p, s->buf_end - p, &p_next) < 0)
+        p_next = p + 1;
+    return json_parse_error(s, "unexpected token: '%.*s'",
+                            (int)(p_next - p), (const char *)p);
+}
+
+/* skip the JSON white space and return the next byte or -1 at the end */
+static inline int json_skip_ws(JSONParseState *s)
+{
+    const uint8_t *p = s->buf_ptr, *end = s->buf_end;
+    int c;
+
+    for(;;) {
+        if (p >= end) {
+            s->buf_ptr = p;
+            return -1;
+        }
+        c = *p;
+        if (c == ' ' || c == '\t' || c == '\r') {
+            p++;
+        } else if (c == '\n') {
+            /* skip the indentation of pretty printed JSON */
+            p = scan_spaces(p + 1, end);
+        } else {
+            s->buf_ptr = p;
+            return c;
+        }
+    }
+}
+
+static int json_parse_hex4(const uint8_t *p, const uint8_t *end)
+{
+    int i, c, h, v;
+
+    if (end - p < 4)
+        return -1;
+    v = 0;
+    for(i = 0; i < 4; i++) {
+        c = p[i];
+        h = from_hex(c);
+        if (h < 0)
+            return -1;
+        v = (v << 4) | h;
+    }
+    return v;
+}
+
+/* 's->buf_ptr' is after the opening quote. Parse the characters that
+   follow the first 'p' which are not plain ASCII. */
+static JSValue json_parse_string_slow(JSONParseState *s, const uint8_t *p)
+{
+    const uint8_t *start = s->buf_ptr, *end = s->buf_end, *p_run, *p_next;
+    StringBuffer b_s, *b = &b_s;
+    int c;
+
+    if (string_buffer_init(s->ctx, b, p - start + 16))
+        return JS_EXCEPTION;
+    if (string_buffer_write8(b, start, p - start))
+        goto fail;
+    for(;;) {
+        p_run = scan_string(p, end, '"');
+        if (p_run != p) {
+            if (string_buffer_write8(b, p, p_run - p))
                 goto fail;
-            val = JS_NewObject(ctx);
-            if (JS_IsException(val))
+            p = p_run;
+        }
+        if (p >= end) {
+            s->buf_ptr = p;
+            json_parse_error(s, "unexpected end of string");
+            goto fail;
+        }
+        c = *p;
+        if (c == '"') {
+            p++;
+            break;
+        } else if (c == '\\') {
+            c = (p + 1 < end) ? p[1] : -1;
+            switch(c) {
+            case '"':
+            case '\\':
+            case '/':
+                break;
+            case 'b':
+                c = '\b';
+                break;
+            case 'f':
+                c = '\f';
+                break;
+            case 'n':
+                c = '\n';
+                break;
+            case 'r':
+                c = '\r';
+                break;
+            case 't':
+                c = '\t';
+                break;
+            case 'u':
+                /* surrogate pairs are two separate escapes */
+                c = json_parse_hex4(p + 2, end);
+                if (c < 0)
+                    goto invalid_escape;
+                p += 4;
+                break;
+            default:
+            invalid_escape:
+                s->buf_ptr = p;
+                json_parse_error(s, "malformed escape sequence in string literal");
                 goto fail;
-            if (s->token.val != '}') {
-                for(;;) {
-                    if (s->token.val != TOK_STRING) {
-                        js_parse_error(s, "expecting property name");
-                        goto fail;
-                    }
-                    prop_str = JS_DupValue(ctx, s->token.u.str.str);
-                    if (next_token(s)) {
-                        JS_FreeValue(ctx, prop_str);
-                        goto fail;
-                    }
-                    if (js_parse_expect(s, ':')) {
-                        JS_FreeValue(ctx, prop_str);
-                        goto fail;
-                    }
-                    prop_val = json_parse_value(s);
-                    if (JS_IsException(prop_val)) {
-                        JS_FreeValue(ctx, prop_str);
-                        goto fail;
-                    }
-                    ret = JS_DefinePropertyValueValue(ctx, val, prop_str,
-                                                      prop_val, JS_PROP_C_W_E);
-                    if (ret < 0)
-                        goto fail;
-
-                    if (s->token.val != ',')
-                        break;
-                    if (next_token(s))
-                        goto fail;
-                }
             }
-            if (js_parse_expect(s, '}'))
+            p += 2;
+            if (string_buffer_putc16(b, c))
                 goto fail;
-        }
-        break;
-    case '[':
-        {
-            JSValue el;
-            uint32_t idx;
-
-            if (next_token(s))
+        } else if (c == '$') {
+            p++;
+            if (string_buffer_putc8(b, c))
                 goto fail;
-            val = JS_NewArray(ctx);
-            if (JS_IsException(val))
+        } else if (c < 0x20) {
+            s->buf_ptr = p;
+            json_parse_error(s, "invalid character in a JSON string");
+            goto fail;
+        } else {
+            c = unicode_from_utf8(p, end - p, &p_next);
+            if (c < 0) {
+                s->buf_ptr = p;
+                json_parse_error(s, "invalid UTF-8 sequence");
                 goto fail;
-            if (s->token.val != ']') {
-                idx = 0;
-                for(;;) {
-                    el = json_parse_value(s);
-                    if (JS_IsException(el))
-                        goto fail;
-                    ret = JS_DefinePropertyValueUint32(ctx, val, idx, el, JS_PROP_C_W_E);
-                    if (ret < 0)
-                        goto fail;
-                    if (s->token.val != ',')
-                        break;
-                    if (next_token(s))
-                        goto fail;
-                    idx++;
-                }
             }
-            if (js_parse_expect(s, ']'))
+            p = p_next;
+            if (string_buffer_putc(b, c))
                 goto fail;
         }
-        break;
-    case TOK_STRING:
-        val = JS_DupValue(ctx, s->token.u.str.str);
-        if (next_token(s))
-            goto fail;
-        break;
-    case TOK_NUMBER:
-        is_neg = 0;
-        goto number;
-    case '-':
-        if (next_token(s))
+    }
+    s->buf_ptr = p;
+    return string_buffer_end(b);
+ fail:
+    string_buffer_free(b);
+    return JS_EXCEPTION;
+}
+
+/* 's->buf_ptr' is on the opening quote */
+static JSValue json_parse_string(JSONParseState *s)
+{
+    const uint8_t *start, *p;
+
+    start = ++s->buf_ptr;
+    p = scan_string(start, s->buf_end, '"');
+    if (likely(p < s->buf_end && *p == '"')) {
+        s->buf_ptr = p + 1;
+        return js_new_string8(s->ctx, start, p - start);
+    }
+    return json_parse_string_slow(s, p);
+}
+
+/* 's->buf_ptr' is on the opening quote. Return JS_ATOM_NULL if
+   exception. */
+static JSAtom json_parse_key(JSONParseState *s)
+{
+    JSContext *ctx = s->ctx;
+    const uint8_t *start, *p;
+    JSAtom atom, *pcache;
+    JSAtomStruct *str;
+    JSValue val;
+    size_t len;
+    uint32_t h;
+
+    start = s->buf_ptr + 1;
+    p = scan_string(start, s->buf_end, '"');
+    if (unlikely(p >= s->buf_end || *p != '"')) {
+        val = json_parse_string(s);
+        if (JS_IsException(val))
+            return JS_ATOM_NULL;
+        return JS_NewAtomStr(ctx, JS_VALUE_GET_STRING(val));
+    }
+    s->buf_ptr = p + 1;
+    len = p - start;
+    h = len;
+    if (len != 0)
+        h = h * 31 + start[0] * 7 + start[len >> 1] * 3 + start[len - 1];
+    pcache = &s->atom_cache[h & (JSON_ATOM_CACHE_SIZE - 1)];
+    atom = *pcache;
+    if (atom != JS_ATOM_NULL) {
+        str = ctx->rt->atom_array[atom];
+        if (str->len == len && !str->is_wide_char &&
+            !memcmp(str->u.str8, start, len))
+            return JS_DupAtom(ctx, atom);
+    }
+    atom = JS_NewAtomLen(ctx, (const char *)start, len);
+    if (atom != JS_ATOM_NULL && !__JS_AtomIsTaggedInt(atom)) {
+        JS_FreeAtom(ctx, *pcache);
+        *pcache = JS_DupAtom(ctx, atom);
+    }
+    return atom;
+}
+
+static JSValue json_parse_number(JSONParseState *s)
+{
+    const uint8_t *start, *p, *end;
+    char buf1[64], *buf;
+    BOOL is_int;
+    int64_t v;
+    size_t len;
+    double d;
+
+    start = p = s->buf_ptr;
+    end = s->buf_end;
+    if (*p == '-')
+        p++;
+    if (p >= end || !is_digit(*p))
+        goto fail;
+    if (*p == '0') {
+        p++;
+    } else {
+        while (p < end && is_digit(*p))
+            p++;
+    }
+    is_int = TRUE;
+    if (p < end && *p == '.') {
+        p++;
+        if (p >= end || !is_digit(*p))
             goto fail;
-        if (s->token.val != TOK_NUMBER) {
-            js_parse_error(s, "number expected");
+        while (p < end && is_digit(*p))
+            p++;
+        is_int = FALSE;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if (p < end && (*p == '+' || *p == '-'))
+            p++;
+        if (p >= end || !is_digit(*p))
             goto fail;
+        while (p < end && is_digit(*p))
+            p++;
+        is_int = FALSE;
+    }
+    s->buf_ptr = p;
+    len = p - start;
+    /* fast path for the integers without rounding */
+    if (is_int && len <= 16) {
+        v = 0;
+        for(p = start + (*start == '-'); p < s->buf_ptr; p++)
+            v = v * 10 + (*p - '0');
+        if (*start == '-') {
+            if (v == 0)
+                return __JS_NewFloat64(s->ctx, -0.0);
+            v = -v;
         }
-        is_neg = 1;
-    number:
-        val = s->token.u.num.val;
-        if (is_neg) {
-            double d;
-            JS_ToFloat64(ctx, &d, val);  /* no exception possible */
-            val = JS_NewFloat64(ctx, -d);
-        }
-        if (next_token(s))
+        return JS_NewInt64(s->ctx, v);
+    }
+    if (len < sizeof(buf1)) {
+        buf = buf1;
+    } else {
+        buf = js_malloc(s->ctx, len + 1);
+        if (!buf)
+            return JS_EXCEPTION;
+    }
+    memcpy(buf, start, len);
+    buf[len] = '\0';
+    d = js_strtod(buf, 10, TRUE);
+    if (buf != buf1)
+        js_free(s->ctx, buf);
+    return JS_NewFloat64(s->ctx, d);
+ fail:
+    s->buf_ptr = p;
+    json_parse_unexpected(s);
+    return JS_EXCEPTION;
+}
+
+static BOOL json_match(JSONParseState *s, const char *str, size_t len)
+{
+    if (s->buf_end - s->buf_ptr < len || memcmp(s->buf_ptr, str, len))
+        return FALSE;
+    s->buf_ptr += len;
+    return TRUE;
+}
+
+/* 's->buf_ptr' is on the first byte of the value */
+static JSValue json_parse_value(JSONParseState *s)
+{
+    JSContext *ctx = s->ctx;
+    JSValue val, el;
+    JSObject *p;
+    JSProperty *pr;
+    JSAtom atom;
+    int c, ret;
+
+    if (js_check_stack_overflow(ctx->rt, 0)) {
+        json_parse_error(s, "stack overflow");
+        return JS_EXCEPTION;
+    }
+    val = JS_UNDEFINED;
+    switch(s->buf_ptr < s->buf_end ? *s->buf_ptr : -1) {
+    case '{':
+        s->buf_ptr++;
+        val = JS_NewObject(ctx);
+        if (JS_IsException(val))
             goto fail;
+        p = JS_VALUE_GET_OBJ(val);
+        c = json_skip_ws(s);
+        if (c != '}') {
+            for(;;) {
+                if (c != '"') {
+                    json_parse_error(s, "expecting property name");
+                    goto fail;
+                }
+                atom = json_parse_key(s);
+                if (atom == JS_ATOM_NULL)
+                    goto fail;
+                if (json_skip_ws(s) != ':') {
+                    JS_FreeAtom(ctx, atom);
+                    json_parse_error(s, "expecting '%c'", ':');
+                    goto fail;
+                }
+                s->buf_ptr++;
+                json_skip_ws(s);
+                el = json_parse_value(s);
+                if (JS_IsException(el)) {
+                    JS_FreeAtom(ctx, atom);
+                    goto fail;
+                }
+                /* the object is still a plain extensible object: add
+                   the new keys directly */
+                if (likely(!find_own_property(&pr, p, atom))) {
+                    pr = add_property(ctx, p, atom, JS_PROP_C_W_E);
+                    if (!pr) {
+                        JS_FreeValue(ctx, el);
+                        ret = -1;
+                    } else {
+                        pr->u.value = el;
+                        ret = 0;
+                    }
+                } else {
+                    ret = JS_DefinePropertyValue(ctx, val, atom, el,
+                                                 JS_PROP_C_W_E);
+                }
+                JS_FreeAtom(ctx, atom);
+                if (ret < 0)
+                    goto fail;
+                c = json_skip_ws(s);
+                if (c != ',')
+                    break;
+                s->buf_ptr++;
+                c = json_skip_ws(s);
+            }
+            if (c != '}') {
+                if (c < 0)
+                    json_parse_unexpected(s);
+                else
+                    json_parse_error(s, "expecting '%c'", '}');
+                goto fail;
+            }
+        }
+        s->buf_ptr++;
         break;
-    case TOK_FALSE:
-    case TOK_TRUE:
-        val = JS_NewBool(ctx, s->token.val - TOK_FALSE);
-        if (next_token(s))
+    case '[':
+        s->buf_ptr++;
+        val = JS_NewArray(ctx);
+        if (JS_IsException(val))
             goto fail;
+        p = JS_VALUE_GET_OBJ(val);
+        c = json_skip_ws(s);
+        if (c != ']') {
+            for(;;) {
+                el = json_parse_value(s);
+                if (JS_IsException(el))
+                    goto fail;
+                if (add_fast_array_element(ctx, p, el, 0) < 0)
+                    goto fail;
+                c = json_skip_ws(s);
+                if (c != ',')
+                    break;
+                s->buf_ptr++;
+                json_skip_ws(s);
+            }
+            if (c != ']') {
+                if (c < 0)
+                    json_parse_unexpected(s);
+                else
+                    json_parse_error(s, "expecting '%c'", ']');
+                goto fail;
+            }
+        }
+        s->buf_ptr++;
         break;
-    case TOK_NULL:
-        if (next_token(s))
-            goto fail;
+    case '"':
+        val = json_parse_string(s);
+        break;
+    case '-':
+    case '0': case '1': case '2': case '3': case '4':
+    case '5': case '6': case '7': case '8': case '9':
+        val = json_parse_number(s);
+        break;
+    case 't':
+        if (!json_match(s, "true", 4))
+            goto unexpected;
+        val = JS_TRUE;
+        break;
+    case 'f':
+        if (!json_match(s, "false", 5))
+            goto unexpected;
+        val = JS_FALSE;
+        break;
+    case 'n':
+        if (!json_match(s, "null", 4))
+            goto unexpected;
+        val = JS_NULL;
         break;
     default:
-        if (s->token.val == TOK_EOF) {
-            js_parse_error(s, "unexpected end of input");
-        } else {
-            js_parse_error(s, "unexpected token: '%.*s'",
-                           (int)(s->buf_ptr - s->token.ptr), s->token.ptr);
-        }
+    unexpected:
+        json_parse_unexpected(s);
         goto fail;
     }
     return val;
@@ -42384,27 +45629,32 @@ static JSValue json_parse_value(JSParseState *s)
     return JS_EXCEPTION;
 }
 
+/* strict JSON parser (RFC 8259). 'buf' is UTF-8 and does not need to be
+   zero terminated. */
 JSValue JS_ParseJSON(JSContext *ctx, const char *buf, size_t buf_len,
                      const char *filename)
 {
-    JSParseState s1, *s = &s1;
+    JSONParseState s1, *s = &s1;
     JSValue val;
+    int i;
 
-    js_parse_init(ctx, s, buf, buf_len, filename);
+    s->ctx = ctx;
+    s->buf_start = (const uint8_t *)buf;
+    s->buf_ptr = s->buf_start;
+    s->buf_end = s->buf_start + buf_len;
+    s->filename = filename;
+    memset(s->atom_cache, 0, sizeof(s->atom_cache));
 
-    if (next_token(s))
-        goto fail;
+    json_skip_ws(s);
     val = json_parse_value(s);
-    if (JS_IsException(val))
-        goto fail;
-    if (s->token.val != TOK_EOF) {
-        if (js_parse_error(s, "unexpected data at the end"))
-            goto fail;
+    if (!JS_IsException(val) && json_skip_ws(s) >= 0) {
+        JS_FreeValue(ctx, val);
+        json_parse_error(s, "unexpected data at the end");
+        val = JS_EXCEPTION;
     }
+    for(i = 0; i < JSON_ATOM_CACHE_SIZE; i++)
+        JS_FreeAtom(ctx, s->atom_cache[i]);
     return val;
- fail:
-    free_token(s, &s->token);
-    return JS_EXCEPTION;
 }
 
 static JSValue internalize_json_property(JSContext *ctx, JSValueConst holder,
@@ -42519,16 +45769,10 @@ typedef struct JSONStringifyContext {
     StringBuffer *b;
 } JSONStringifyContext;
 
-static JSValue JS_ToQuotedStringFree(JSContext *ctx, JSValue val) {
-    JSValue r = JS_ToQuotedString(ctx, val);
-    JS_FreeValue(ctx, val);
-    return r;
-}
-
 static JSValue js_json_check(JSContext *ctx, JSONStringifyContext *jsc,
-                             JSValueConst holder, JSValue val, JSValueConst key)
+                             JSValueConst holder, JSValue val, JSAtom key)
 {
-    JSValue v;
+    JSValue v, key_str;
     JSValueConst args[2];
 
     if (JS_IsObject(val)
@@ -42540,7 +45784,13 @@ static JSValue js_json_check(JSContext *ctx, JSONStringifyContext *jsc,
             if (JS_IsException(f))
                 goto exception;
             if (JS_IsFunction(ctx, f)) {
-                v = JS_CallFree(ctx, f, val, 1, &key);
+                key_str = JS_AtomToString(ctx, key);
+                if (JS_IsException(key_str)) {
+                    JS_FreeValue(ctx, f);
+                    goto exception;
+                }
+                v = JS_CallFree(ctx, f, val, 1, (JSValueConst *)&key_str);
+                JS_FreeValue(ctx, key_str);
                 JS_FreeValue(ctx, val);
                 val = v;
                 if (JS_IsException(val))
@@ -42551,9 +45801,13 @@ static JSValue js_json_check(JSContext *ctx, JSONStringifyContext *jsc,
         }
 
     if (!JS_IsUndefined(jsc->replacer_func)) {
-        args[0] = key;
+        key_str = JS_AtomToString(ctx, key);
+        if (JS_IsException(key_str))
+            goto exception;
+        args[0] = key_str;
         args[1] = val;
         v = JS_Call(ctx, jsc->replacer_func, holder, 2, args);
+        JS_FreeValue(ctx, key_str);
         JS_FreeValue(ctx, val);
         val = v;
         if (JS_IsException(val))
@@ -42565,6 +45819,7 @@ static JSValue js_json_check(JSContext *ctx, JSONStringifyContext *jsc,
         if (JS_IsFunction(ctx, val))
             break;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
     case JS_TAG_INT:
     case JS_TAG_FLOAT64:
 #ifdef CONFIG_BIGNUM
@@ -42588,34 +45843,57 @@ exception:
     return JS_EXCEPTION;
 }
 
+/* append the JSON string literal of 'val' and free it */
+static int json_put_quoted_free(JSContext *ctx, StringBuffer *b, JSValue val)
+{
+    int ret;
+
+    if (JS_VALUE_GET_TAG(val) != JS_TAG_STRING) {
+        val = JS_ToStringFree(ctx, val);
+        if (JS_IsException(val))
+            return -1;
+    }
+    ret = string_buffer_put_quoted(b, JS_VALUE_GET_STRING(val));
+    JS_FreeValue(ctx, val);
+    return ret;
+}
+
+static int json_put_quoted_atom(JSContext *ctx, StringBuffer *b, JSAtom atom)
+{
+    char buf[16];
+
+    if (__JS_AtomIsTaggedInt(atom)) {
+        snprintf(buf, sizeof(buf), "\"%u\"", __JS_AtomToUInt32(atom));
+        return string_buffer_puts8(b, buf);
+    }
+    return string_buffer_put_quoted(b, ctx->rt->atom_array[atom]);
+}
+
 static int js_json_to_str(JSContext *ctx, JSONStringifyContext *jsc,
                           JSValueConst holder, JSValue val,
                           JSValueConst indent)
 {
-    JSValue indent1, sep, sep1, tab, v, prop;
+    JSValue indent1, sep, sep1, v;
     JSObject *p;
+    JSPropertyEnum *tab;
+    uint32_t tab_len;
     int64_t i, len;
     int cl, ret;
     BOOL has_content;
+    char buf[JS_DTOA_BUF_SIZE];
     
     indent1 = JS_UNDEFINED;
     sep = JS_UNDEFINED;
     sep1 = JS_UNDEFINED;
-    tab = JS_UNDEFINED;
-    prop = JS_UNDEFINED;
+    tab = NULL;
+    tab_len = 0;
 
     switch (JS_VALUE_GET_NORM_TAG(val)) {
     case JS_TAG_OBJECT:
         p = JS_VALUE_GET_OBJ(val);
         cl = p->class_id;
         if (cl == JS_CLASS_STRING) {
-            val = JS_ToStringFree(ctx, val);
-            if (JS_IsException(val))
-                goto exception;
-            val = JS_ToQuotedStringFree(ctx, val);
-            if (JS_IsException(val))
-                goto exception;
-            return string_buffer_concat_value_free(jsc->b, val);
+            return json_put_quoted_free(ctx, jsc->b, val);
         } else if (cl == JS_CLASS_NUMBER) {
             val = JS_ToNumberFree(ctx, val);
             if (JS_IsException(val))
@@ -42666,19 +45944,24 @@ static int js_json_to_str(JSContext *ctx, JSONStringifyContext *jsc,
                 goto exception;
             string_buffer_putc8(jsc->b, '[');
             for(i = 0; i < len; i++) {
+                JSAtom atom;
                 if (i > 0)
                     string_buffer_putc8(jsc->b, ',');
                 string_buffer_concat_value(jsc->b, sep);
-                v = JS_GetPropertyInt64(ctx, val, i);
+                /* toJSON() or the replacer may modify the array */
+                if (p->fast_array && i < p->u.array.count)
+                    v = JS_DupValue(ctx, p->u.array.u.values[i]);
+                else
+                    v = JS_GetPropertyInt64(ctx, val, i);
                 if (JS_IsException(v))
                     goto exception;
-                /* XXX: could do this string conversion only when needed */
-                prop = JS_ToStringFree(ctx, JS_NewInt64(ctx, i));
-                if (JS_IsException(prop))
+                atom = JS_NewAtomInt64(ctx, i);
+                if (atom == JS_ATOM_NULL) {
+                    JS_FreeValue(ctx, v);
                     goto exception;
-                v = js_json_check(ctx, jsc, val, v, prop);
-                JS_FreeValue(ctx, prop);
-                prop = JS_UNDEFINED;
+                }
+                v = js_json_check(ctx, jsc, val, v, atom);
+                JS_FreeAtom(ctx, atom);
                 if (JS_IsException(v))
                     goto exception;
                 if (JS_IsUndefined(v))
@@ -42692,37 +45975,47 @@ static int js_json_to_str(JSContext *ctx, JSONStringifyContext *jsc,
             }
             string_buffer_putc8(jsc->b, ']');
         } else {
-            if (!JS_IsUndefined(jsc->property_list))
-                tab = JS_DupValue(ctx, jsc->property_list);
-            else
-                tab = js_object_keys(ctx, JS_UNDEFINED, 1, (JSValueConst *)&val, JS_ITERATOR_KIND_KEY);
-            if (JS_IsException(tab))
-                goto exception;
-            if (js_get_length64(ctx, &len, tab))
-                goto exception;
+            if (!JS_IsUndefined(jsc->property_list)) {
+                if (js_get_length64(ctx, &len, jsc->property_list))
+                    goto exception;
+                tab = js_mallocz(ctx, sizeof(tab[0]) * max_int(len, 1));
+                if (!tab)
+                    goto exception;
+                for(i = 0; i < len; i++) {
+                    v = JS_GetPropertyInt64(ctx, jsc->property_list, i);
+                    if (JS_IsException(v))
+                        goto exception;
+                    tab[i].atom = JS_ValueToAtom(ctx, v);
+                    JS_FreeValue(ctx, v);
+                    if (tab[i].atom == JS_ATOM_NULL)
+                        goto exception;
+                    tab_len++;
+                }
+            } else {
+                /* enumerate the keys as atoms: they are only converted
+                   to strings when toJSON() or the replacer need them */
+                if (JS_GetOwnPropertyNamesInternal(ctx, &tab, &tab_len, p,
+                                                   JS_GPN_STRING_MASK |
+                                                   JS_GPN_ENUM_ONLY))
+                    goto exception;
+            }
             string_buffer_putc8(jsc->b, '{');
             has_content = FALSE;
-            for(i = 0; i < len; i++) {
-                JS_FreeValue(ctx, prop);
-                prop = JS_GetPropertyInt64(ctx, tab, i);
-                if (JS_IsException(prop))
-                    goto exception;
-                v = JS_GetPropertyValue(ctx, val, JS_DupValue(ctx, prop));
+            for(i = 0; i < tab_len; i++) {
+                v = JS_GetProperty(ctx, val, tab[i].atom);
                 if (JS_IsException(v))
                     goto exception;
-                v = js_json_check(ctx, jsc, val, v, prop);
+                v = js_json_check(ctx, jsc, val, v, tab[i].atom);
                 if (JS_IsException(v))
                     goto exception;
                 if (!JS_IsUndefined(v)) {
                     if (has_content)
                         string_buffer_putc8(jsc->b, ',');
-                    prop = JS_ToQuotedStringFree(ctx, prop);
-                    if (JS_IsException(prop)) {
+                    string_buffer_concat_value(jsc->b, sep);
+                    if (json_put_quoted_atom(ctx, jsc->b, tab[i].atom)) {
                         JS_FreeValue(ctx, v);
                         goto exception;
                     }
-                    string_buffer_concat_value(jsc->b, sep);
-                    string_buffer_concat_value(jsc->b, prop);
                     string_buffer_putc8(jsc->b, ':');
                     string_buffer_concat_value(jsc->b, sep1);
                     if (js_json_to_str(ctx, jsc, val, v, indent1))
@@ -42739,31 +46032,32 @@ static int js_json_to_str(JSContext *ctx, JSONStringifyContext *jsc,
         if (check_exception_free(ctx, js_array_pop(ctx, jsc->stack, 0, NULL, 0)))
             goto exception;
         JS_FreeValue(ctx, val);
-        JS_FreeValue(ctx, tab);
+        js_free_prop_enum(ctx, tab, tab_len);
         JS_FreeValue(ctx, sep);
         JS_FreeValue(ctx, sep1);
         JS_FreeValue(ctx, indent1);
-        JS_FreeValue(ctx, prop);
         return 0;
     case JS_TAG_STRING:
-        val = JS_ToQuotedStringFree(ctx, val);
-        if (JS_IsException(val))
-            goto exception;
-        goto concat_value;
-    case JS_TAG_FLOAT64:
-        if (!isfinite(JS_VALUE_GET_FLOAT64(val))) {
-            val = JS_NULL;
-        }
-        goto concat_value;
+    case JS_TAG_STRING_ROPE:
+        return json_put_quoted_free(ctx, jsc->b, val);
     case JS_TAG_INT:
-#ifdef CONFIG_BIGNUM
-    case JS_TAG_BIG_FLOAT:
-#endif
+        /* the numbers are formatted without creating a string */
+        return string_buffer_puts8(jsc->b,
+                                   i64toa(buf + sizeof(buf),
+                                          JS_VALUE_GET_INT(val), 10));
+    case JS_TAG_FLOAT64:
+        if (!isfinite(JS_VALUE_GET_FLOAT64(val)))
+            return string_buffer_puts8(jsc->b, "null");
+        js_dtoa1(buf, JS_VALUE_GET_FLOAT64(val), 10, 0, JS_DTOA_VAR_FORMAT);
+        return string_buffer_puts8(jsc->b, buf);
     case JS_TAG_BOOL:
+        return string_buffer_puts8(jsc->b,
+                                   JS_VALUE_GET_BOOL(val) ? "true" : "false");
     case JS_TAG_NULL:
-    concat_value:
-        return string_buffer_concat_value_free(jsc->b, val);
+        return string_buffer_puts8(jsc->b, "null");
 #ifdef CONFIG_BIGNUM
+    case JS_TAG_BIG_FLOAT:
+        return string_buffer_concat_value_free(jsc->b, val);
     case JS_TAG_BIG_INT:
         JS_ThrowTypeError(ctx, "bigint are forbidden in JSON.stringify");
         goto exception;
@@ -42775,33 +46069,34 @@ static int js_json_to_str(JSContext *ctx, JSONStringifyContext *jsc,
     
 exception:
     JS_FreeValue(ctx, val);
-    JS_FreeValue(ctx, tab);
+    js_free_prop_enum(ctx, tab, tab_len);
     JS_FreeValue(ctx, sep);
     JS_FreeValue(ctx, sep1);
     JS_FreeValue(ctx, indent1);
-    JS_FreeValue(ctx, prop);
     return -1;
 }
 
-JSValue JS_JSONStringify(JSContext *ctx, JSValueConst obj,
-                         JSValueConst replacer, JSValueConst space0)
+/* Serialize 'obj' in 'b'. Return -1 if exception, 0 if 'obj' has no
+   JSON representation (JSON.stringify() returns undefined) and 1
+   otherwise. */
+static int js_json_stringify_buf(JSContext *ctx, StringBuffer *b,
+                                 JSValueConst obj, JSValueConst replacer,
+                                 JSValueConst space0)
 {
-    StringBuffer b_s;
     JSONStringifyContext jsc_s, *jsc = &jsc_s;
-    JSValue val, v, space, ret, wrapper;
-    int res;
+    JSValue val, v, space, wrapper;
+    int res, ret;
     int64_t i, j, n;
 
     jsc->replacer_func = JS_UNDEFINED;
     jsc->stack = JS_UNDEFINED;
     jsc->property_list = JS_UNDEFINED;
     jsc->gap = JS_UNDEFINED;
-    jsc->b = &b_s;
+    jsc->b = b;
     jsc->empty = JS_AtomToString(ctx, JS_ATOM_empty_string);
-    ret = JS_UNDEFINED;
+    ret = -1;
     wrapper = JS_UNDEFINED;
 
-    string_buffer_init(ctx, jsc->b, 0);
     jsc->stack = JS_NewArray(ctx);
     if (JS_IsException(jsc->stack))
         goto exception;
@@ -42875,8 +46170,11 @@ JSValue JS_JSONStringify(JSContext *ctx, JSValueConst obj,
             goto exception;
         jsc->gap = JS_NewStringLen(ctx, "          ", n);
     } else if (JS_IsString(space)) {
-        JSString *p = JS_VALUE_GET_STRING(space);
-        jsc->gap = js_sub_string(ctx, p, 0, min_int(p->len, 10));
+        JSString *p = js_get_flat_string(ctx, space);
+        if (p)
+            jsc->gap = js_sub_string(ctx, p, 0, min_int(p->len, 10));
+        else
+            jsc->gap = JS_EXCEPTION;
     } else {
         jsc->gap = JS_DupValue(ctx, jsc->empty);
     }
@@ -42891,24 +46189,18 @@ JSValue JS_JSONStringify(JSContext *ctx, JSValueConst obj,
         goto exception;
     val = JS_DupValue(ctx, obj);
                            
-    val = js_json_check(ctx, jsc, wrapper, val, jsc->empty);
+    val = js_json_check(ctx, jsc, wrapper, val, JS_ATOM_empty_string);
     if (JS_IsException(val))
         goto exception;
     if (JS_IsUndefined(val)) {
-        ret = JS_UNDEFINED;
-        goto done1;
+        ret = 0;
+        goto exception;
     }
     if (js_json_to_str(ctx, jsc, wrapper, val, jsc->empty))
         goto exception;
-
-    ret = string_buffer_end(jsc->b);
-    goto done;
+    ret = 1;
 
 exception:
-    ret = JS_EXCEPTION;
-done1:
-    string_buffer_free(jsc->b);
-done:
     JS_FreeValue(ctx, wrapper);
     JS_FreeValue(ctx, jsc->empty);
     JS_FreeValue(ctx, jsc->gap);
@@ -42917,6 +46209,103 @@ done:
     return ret;
 }
 
+JSValue JS_JSONStringify(JSContext *ctx, JSValueConst obj,
+                         JSValueConst replacer, JSValueConst space0)
+{
+    StringBuffer b_s, *b = &b_s;
+    int res;
+
+    string_buffer_init(ctx, b, 0);
+    res = js_json_stringify_buf(ctx, b, obj, replacer, space0);
+    if (res <= 0) {
+        string_buffer_free(b);
+        return res < 0 ? JS_EXCEPTION : JS_UNDEFINED;
+    }
+    return string_buffer_end(b);
+}
+
+/* write the UTF-8 encoding of the characters of 'b'. The runs of ASCII
+   characters are written in place. */
+static int string_buffer_write_utf8(StringBuffer *b, JSWriteFunc *write_func,
+                                    void *opaque)
+{
+    uint8_t buf[256];
+    const uint8_t *src8;
+    const uint16_t *src16;
+    int i, j, len, c, c1, buf_len;
+
+    len = b->len;
+    buf_len = 0;
+    if (!b->is_wide_char) {
+        src8 = b->str->u.str8;
+        for(i = 0; i < len; ) {
+            for(j = i; j < len && src8[j] < 0x80; j++)
+                continue;
+            if (j > i) {
+                if (buf_len != 0 && write_func(opaque, buf, buf_len))
+                    return -1;
+                buf_len = 0;
+                if (write_func(opaque, src8 + i, j - i))
+                    return -1;
+                i = j;
+            }
+            for(; i < len && src8[i] >= 0x80; i++) {
+                if (buf_len > sizeof(buf) - 2) {
+                    if (write_func(opaque, buf, buf_len))
+                        return -1;
+                    buf_len = 0;
+                }
+                c = src8[i];
+                buf[buf_len++] = (c >> 6) | 0xc0;
+                buf[buf_len++] = (c & 0x3f) | 0x80;
+            }
+        }
+    } else {
+        src16 = b->str->u.str16;
+        for(i = 0; i < len; ) {
+            if (buf_len > sizeof(buf) - UTF8_CHAR_LEN_MAX) {
+                if (write_func(opaque, buf, buf_len))
+                    return -1;
+                buf_len = 0;
+            }
+            c = src16[i++];
+            if (c < 0x80) {
+                buf[buf_len++] = c;
+                continue;
+            }
+            /* unpaired surrogates are kept as in JS_ToCStringLen() */
+            if (c >= 0xd800 && c < 0xdc00 && i < len) {
+                c1 = src16[i];
+                if (c1 >= 0xdc00 && c1 < 0xe000) {
+                    i++;
+                    c = (((c & 0x3ff) << 10) | (c1 & 0x3ff)) + 0x10000;
+                }
+            }
+            buf_len += unicode_to_utf8(buf + buf_len, c);
+        }
+    }
+    if (buf_len != 0 && write_func(opaque, buf, buf_len))
+        return -1;
+    return 0;
+}
+
+int JS_JSONStringifyUTF8(JSContext *ctx, JSValueConst obj,
+                         JSValueConst replacer, JSValueConst space0,
+                         JSWriteFunc *write_func, void *opaque)
+{
+    StringBuffer b_s, *b = &b_s;
+    int res;
+
+    string_buffer_init(ctx, b, 0);
+    res = js_json_stringify_buf(ctx, b, obj, replacer, space0);
+    if (res > 0 && string_buffer_write_utf8(b, write_func, opaque)) {
+        JS_ThrowOutOfMemory(ctx);
+        res = -1;
+    }
+    string_buffer_free(b);
+    return res;
+}
+
 static JSValue js_json_stringify(JSContext *ctx, JSValueConst this_val,
                                  int argc, JSValueConst *argv)
 {
@@ -44183,27 +47572,47 @@ static const JSCFunctionListEntry js_symbol_funcs[] = {
 
 /* Set/Map/WeakSet/WeakMap */
 
+/* The records are stored in insertion order in a dense array and
+   indexed by an open addressed hash table (linear probing) containing
+   the record index + 1, or 0 for a free slot. A deleted record keeps
+   its place until the next rebuild of the table, which compacts the
+   records. The enumerations keep a cursor (a record index) which is
+   updated on rebuild, so that they skip the deleted records and see
+   the added ones. */
+
 typedef struct JSMapRecord {
-    int ref_count; /* used during enumeration to avoid freeing the record */
-    BOOL empty; /* TRUE if the record is deleted */
-    struct JSMapState *map;
-    struct JSMapRecord *next_weak_ref;
-    struct list_head link;
-    struct list_head hash_link;
-    JSValue key;
+    JSValue key; /* JS_UNINITIALIZED if the record is deleted */
     JSValue value;
+    uint32_t hash;
 } JSMapRecord;
 
+/* WeakMap/WeakSet reference to a key object, linked from
+   JSObject.first_weak_ref */
+typedef struct JSMapWeakRef {
+    struct JSMapWeakRef *next_weak_ref;
+    struct JSMapState *map;
+} JSMapWeakRef;
+
+/* current position of an iterator or of forEach() */
+typedef struct JSMapCursor {
+    struct list_head link; /* JSMapState.cursors */
+    uint32_t pos; /* index of the next record to visit */
+} JSMapCursor;
+
 typedef struct JSMapState {
     BOOL is_weak; /* TRUE if WeakSet/WeakMap */
-    struct list_head records; /* list of JSMapRecord.link */
-    uint32_t record_count;
-    struct list_head *hash_table;
-    uint32_t hash_size; /* must be a power of two */
-    uint32_t record_count_threshold; /* count at which a hash table
-                                        resize is needed */
+    uint32_t record_count; /* number of live records */
+    uint32_t records_used; /* number of records including the deleted ones */
+    uint32_t records_size; /* allocated records */
+    JSMapRecord *records;
+    uint32_t *hash_table; /* record index + 1, 0 if free */
+    uint32_t hash_size; /* 0 or 2 * records_size */
+    struct list_head cursors; /* list of JSMapCursor.link */
 } JSMapState;
 
+#define MAP_RECORDS_MIN 4
+#define MAP_RECORDS_MAX (1U << 30)
+
 #define MAGIC_SET (1 << 0)
 #define MAGIC_WEAK (1 << 1)
 
@@ -44223,15 +47632,9 @@ static JSValue js_map_constructor(JSContext *ctx, JSValueConst new_target,
     s = js_mallocz(ctx, sizeof(*s));
     if (!s)
         goto fail;
-    init_list_head(&s->records);
+    init_list_head(&s->cursors);
     s->is_weak = is_weak;
     JS_SetOpaque(obj, s);
-    s->hash_size = 1;
-    s->hash_table = js_malloc(ctx, sizeof(s->hash_table[0]) * s->hash_size);
-    if (!s->hash_table)
-        goto fail;
-    init_list_head(&s->hash_table[0]);
-    s->record_count_threshold = 4;
 
     arr = JS_UNDEFINED;
     if (argc > 0)
@@ -44328,8 +47731,7 @@ static JSValueConst map_normalize_key(JSContext *ctx, JSValueConst key)
     return key;
 }
 
-/* XXX: better hash ? */
-static uint32_t map_hash_key(JSContext *ctx, JSValueConst key)
+static uint32_t map_hash_key(JSValueConst key)
 {
     uint32_t tag = JS_VALUE_GET_NORM_TAG(key);
     uint32_t h;
@@ -44343,6 +47745,11 @@ static uint32_t map_hash_key(JSContext *ctx, JSValueConst key)
     case JS_TAG_STRING:
         h = hash_string(JS_VALUE_GET_STRING(key), 0);
         break;
+    case JS_TAG_STRING_ROPE:
+        /* same hash as the flat string */
+        h = js_string_value_hash(key, 0);
+        tag = JS_TAG_STRING;
+        break;
     case JS_TAG_OBJECT:
     case JS_TAG_SYMBOL:
         h = (uintptr_t)JS_VALUE_GET_PTR(key) * 3163;
@@ -44364,170 +47771,249 @@ static uint32_t map_hash_key(JSContext *ctx, JSValueConst key)
         break;
     }
     h ^= tag;
+    /* the low bits select the hash table slot: mix the high bits in */
+    h ^= h >> 16;
+    h *= 0x45d9f3b;
+    h ^= h >> 16;
     return h;
 }
 
 static JSMapRecord *map_find_record(JSContext *ctx, JSMapState *s,
-                                    JSValueConst key)
+                                    JSValueConst key, uint32_t h)
 {
-    struct list_head *el;
+    uint32_t i, idx, mask;
     JSMapRecord *mr;
-    uint32_t h;
-    h = map_hash_key(ctx, key) & (s->hash_size - 1);
-    list_for_each(el, &s->hash_table[h]) {
-        mr = list_entry(el, JSMapRecord, hash_link);
-        if (js_same_value_zero(ctx, mr->key, key))
+
+    if (s->hash_size == 0)
+        return NULL;
+    mask = s->hash_size - 1;
+    for(i = h & mask; (idx = s->hash_table[i]) != 0; i = (i + 1) & mask) {
+        mr = &s->records[idx - 1];
+        /* the deleted records never match as their key is uninitialized */
+        if (mr->hash == h && js_same_value_zero(ctx, mr->key, key))
             return mr;
     }
     return NULL;
 }
 
-static void map_hash_resize(JSContext *ctx, JSMapState *s)
+/* find the record of a WeakMap/WeakSet key without a context */
+static JSMapRecord *map_find_weak_record(JSMapState *s, JSObject *p)
 {
-    uint32_t new_hash_size, i, h;
-    size_t slack;
-    struct list_head *new_hash_table, *el;
+    uint32_t i, idx, mask, h;
     JSMapRecord *mr;
 
-    /* XXX: no reporting of memory allocation failure */
-    if (s->hash_size == 1)
-        new_hash_size = 4;
-    else
-        new_hash_size = s->hash_size * 2;
-    new_hash_table = js_realloc2(ctx, s->hash_table,
-                                 sizeof(new_hash_table[0]) * new_hash_size, &slack);
-    if (!new_hash_table)
-        return;
-    new_hash_size += slack / sizeof(*new_hash_table);
+    h = map_hash_key(JS_MKPTR(JS_TAG_OBJECT, p));
+    mask = s->hash_size - 1;
+    for(i = h & mask;; i = (i + 1) & mask) {
+        idx = s->hash_table[i];
+        assert(idx != 0);
+        mr = &s->records[idx - 1];
+        if (JS_VALUE_GET_TAG(mr->key) == JS_TAG_OBJECT &&
+            JS_VALUE_GET_OBJ(mr->key) == p)
+            return mr;
+    }
+}
 
-    for(i = 0; i < new_hash_size; i++)
-        init_list_head(&new_hash_table[i]);
+/* Remove the deleted records and reallocate the records and the hash
+   table for 'new_size' records ('new_size' = 0 or a power of two >=
+   record_count). The cursors are moved to the same live record. */
+static int map_rebuild(JSRuntime *rt, JSMapState *s, uint32_t new_size)
+{
+    JSMapRecord *records;
+    uint32_t *hash_table;
+    uint32_t i, j, n, hash_size, mask;
+    struct list_head *el;
+    JSMapCursor *c;
 
-    list_for_each(el, &s->records) {
-        mr = list_entry(el, JSMapRecord, link);
-        if (!mr->empty) {
-            h = map_hash_key(ctx, mr->key) & (new_hash_size - 1);
-            list_add_tail(&mr->hash_link, &new_hash_table[h]);
+    hash_size = new_size * 2;
+    hash_table = NULL;
+    if (hash_size != 0) {
+        hash_table = js_mallocz_rt(rt, sizeof(hash_table[0]) * hash_size);
+        if (!hash_table)
+            return -1;
+    }
+    if (new_size > s->records_size) {
+        records = js_realloc_rt(rt, s->records, sizeof(records[0]) * new_size);
+        if (!records) {
+            js_free_rt(rt, hash_table);
+            return -1;
         }
+        s->records = records;
     }
-    s->hash_table = new_hash_table;
-    s->hash_size = new_hash_size;
-    s->record_count_threshold = new_hash_size * 2;
+    records = s->records;
+
+    /* a cursor is moved to the number of live records before it */
+    list_for_each(el, &s->cursors) {
+        c = list_entry(el, JSMapCursor, link);
+        n = 0;
+        for(i = 0; i < c->pos && i < s->records_used; i++) {
+            if (!JS_IsUninitialized(records[i].key))
+                n++;
+        }
+        c->pos = n;
+    }
+
+    for(i = j = 0; i < s->records_used; i++) {
+        if (!JS_IsUninitialized(records[i].key)) {
+            if (i != j)
+                records[j] = records[i];
+            j++;
+        }
+    }
+    assert(j == s->record_count);
+    s->records_used = j;
+
+    if (new_size == 0) {
+        js_free_rt(rt, records);
+        s->records = NULL;
+    } else if (new_size < s->records_size) {
+        records = js_realloc_rt(rt, records, sizeof(records[0]) * new_size);
+        /* keep the larger array if the shrink fails */
+        if (records)
+            s->records = records;
+    }
+    s->records_size = new_size;
+
+    /* the stored hashes avoid hashing the keys again */
+    mask = hash_size - 1;
+    for(i = 0; i < s->records_used; i++) {
+        j = s->records[i].hash & mask;
+        while (hash_table[j] != 0)
+            j = (j + 1) & mask;
+        hash_table[j] = i + 1;
+    }
+    js_free_rt(rt, s->hash_table);
+    s->hash_table = hash_table;
+    s->hash_size = hash_size;
+    return 0;
 }
 
 static JSMapRecord *map_add_record(JSContext *ctx, JSMapState *s,
-                                   JSValueConst key)
+                                   JSValueConst key, uint32_t h)
 {
-    uint32_t h;
+    uint32_t i, mask, new_size;
     JSMapRecord *mr;
 
-    mr = js_malloc(ctx, sizeof(*mr));
-    if (!mr)
-        return NULL;
-    mr->ref_count = 1;
-    mr->map = s;
-    mr->empty = FALSE;
+    if (s->records_used >= s->records_size) {
+        /* grow unless enough deleted records can be reused */
+        new_size = s->records_size;
+        if (s->record_count >= new_size - new_size / 4) {
+            if (new_size >= MAP_RECORDS_MAX) {
+                JS_ThrowRangeError(ctx, "too many elements");
+                return NULL;
+            }
+            new_size = max_int(new_size * 2, MAP_RECORDS_MIN);
+        }
+        if (map_rebuild(ctx->rt, s, new_size)) {
+            JS_ThrowOutOfMemory(ctx);
+            return NULL;
+        }
+    }
     if (s->is_weak) {
         JSObject *p = JS_VALUE_GET_OBJ(key);
+        JSMapWeakRef *wr;
         /* Add the weak reference */
-        mr->next_weak_ref = p->first_weak_ref;
-        p->first_weak_ref = mr;
+        wr = js_malloc(ctx, sizeof(*wr));
+        if (!wr)
+            return NULL;
+        wr->map = s;
+        wr->next_weak_ref = p->first_weak_ref;
+        p->first_weak_ref = wr;
     } else {
         JS_DupValue(ctx, key);
     }
+    mask = s->hash_size - 1;
+    for(i = h & mask; s->hash_table[i] != 0; i = (i + 1) & mask)
+        continue;
+    s->hash_table[i] = s->records_used + 1;
+    mr = &s->records[s->records_used++];
 #if defined(JS_VALUE_CANNOT_BE_CAST)
     mr->key = key;
 #else
     mr->key = (JSValue)key;
 #endif
-    h = map_hash_key(ctx, key) & (s->hash_size - 1);
-    list_add_tail(&mr->hash_link, &s->hash_table[h]);
-    list_add_tail(&mr->link, &s->records);
+    mr->value = JS_UNDEFINED;
+    mr->hash = h;
     s->record_count++;
-    if (s->record_count >= s->record_count_threshold) {
-        map_hash_resize(ctx, s);
-    }
     return mr;
 }
 
-/* Remove the weak reference from the object weak
-   reference list. we don't use a doubly linked list to
-   save space, assuming a given object has few weak
-       references to it */
-static void delete_weak_ref(JSRuntime *rt, JSMapRecord *mr)
+/* Remove the weak reference of 's' from the object weak reference
+   list. We don't use a doubly linked list to save space, assuming a
+   given object has few weak references to it */
+static void delete_weak_ref(JSRuntime *rt, JSMapState *s, JSValueConst key)
 {
-    JSMapRecord **pmr, *mr1;
+    JSMapWeakRef **pwr, *wr;
     JSObject *p;
 
-    p = JS_VALUE_GET_OBJ(mr->key);
-    pmr = &p->first_weak_ref;
+    p = JS_VALUE_GET_OBJ(key);
+    pwr = &p->first_weak_ref;
     for(;;) {
-        mr1 = *pmr;
-        assert(mr1 != NULL);
-        if (mr1 == mr)
+        wr = *pwr;
+        assert(wr != NULL);
+        if (wr->map == s)
             break;
-        pmr = &mr1->next_weak_ref;
+        pwr = &wr->next_weak_ref;
     }
-    *pmr = mr1->next_weak_ref;
+    *pwr = wr->next_weak_ref;
+    js_free_rt(rt, wr);
 }
 
+/* The record is marked as deleted before freeing its key and value
+   because the finalizers may access the map. */
 static void map_delete_record(JSRuntime *rt, JSMapState *s, JSMapRecord *mr)
 {
-    if (mr->empty)
-        return;
-    list_del(&mr->hash_link);
+    JSValue key, value;
+
+    key = mr->key;
+    value = mr->value;
+    mr->key = JS_UNINITIALIZED;
+    mr->value = JS_UNDEFINED;
+    s->record_count--;
     if (s->is_weak) {
-        delete_weak_ref(rt, mr);
+        delete_weak_ref(rt, s, key);
     } else {
-        JS_FreeValueRT(rt, mr->key);
+        JS_FreeValueRT(rt, key);
     }
-    JS_FreeValueRT(rt, mr->value);
-    if (--mr->ref_count == 0) {
-        list_del(&mr->link);
-        js_free_rt(rt, mr);
-    } else {
-        /* keep a zombie record for iterators */
-        mr->empty = TRUE;
-        mr->key = JS_UNDEFINED;
-        mr->value = JS_UNDEFINED;
-    }
-    s->record_count--;
+    JS_FreeValueRT(rt, value);
 }
 
-static void map_decref_record(JSRuntime *rt, JSMapRecord *mr)
+/* Release the memory of a map which has lost most of its records */
+static void map_shrink(JSRuntime *rt, JSMapState *s)
 {
-    if (--mr->ref_count == 0) {
-        /* the record can be safely removed */
-        assert(mr->empty);
-        list_del(&mr->link);
-        js_free_rt(rt, mr);
+    uint32_t new_size;
+
+    if (s->records_size > 64 && s->record_count < s->records_size / 8) {
+        new_size = MAP_RECORDS_MIN;
+        while (new_size < s->record_count * 2)
+            new_size *= 2;
+        /* no error: the map is still usable */
+        map_rebuild(rt, s, new_size);
     }
 }
 
 static void reset_weak_ref(JSRuntime *rt, JSObject *p)
 {
-    JSMapRecord *mr, *mr_next;
+    JSMapWeakRef *wr;
+    JSMapRecord *mr;
     JSMapState *s;
-    
-    /* first pass to remove the records from the WeakMap/WeakSet
-       lists */
-    for(mr = p->first_weak_ref; mr != NULL; mr = mr->next_weak_ref) {
-        s = mr->map;
+    JSValue value;
+
+    /* Unlink one reference at a time: freeing a value may finalize
+       another WeakMap/WeakSet which then removes its own reference
+       from the list. */
+    while ((wr = p->first_weak_ref) != NULL) {
+        p->first_weak_ref = wr->next_weak_ref;
+        s = wr->map;
         assert(s->is_weak);
-        assert(!mr->empty); /* no iterator on WeakMap/WeakSet */
-        list_del(&mr->hash_link);
-        list_del(&mr->link);
-    }
-    
-    /* second pass to free the values to avoid modifying the weak
-       reference list while traversing it. */
-    for(mr = p->first_weak_ref; mr != NULL; mr = mr_next) {
-        mr_next = mr->next_weak_ref;
-        JS_FreeValueRT(rt, mr->value);
-        js_free_rt(rt, mr);
+        js_free_rt(rt, wr);
+        mr = map_find_weak_record(s, p);
+        value = mr->value;
+        mr->key = JS_UNINITIALIZED;
+        mr->value = JS_UNDEFINED;
+        s->record_count--;
+        JS_FreeValueRT(rt, value);
     }
-
-    p->first_weak_ref = NULL; /* fail safe */
 }
 
 static JSValue js_map_set(JSContext *ctx, JSValueConst this_val,
@@ -44536,6 +48022,7 @@ static JSValue js_map_set(JSContext *ctx, JSValueConst this_val,
     JSMapState *s = JS_GetOpaque2(ctx, this_val, JS_CLASS_MAP + magic);
     JSMapRecord *mr;
     JSValueConst key, value;
+    uint32_t h;
 
     if (!s)
         return JS_EXCEPTION;
@@ -44546,11 +48033,12 @@ static JSValue js_map_set(JSContext *ctx, JSValueConst this_val,
         value = JS_UNDEFINED;
     else
         value = argv[1];
-    mr = map_find_record(ctx, s, key);
+    h = map_hash_key(key);
+    mr = map_find_record(ctx, s, key, h);
     if (mr) {
         JS_FreeValue(ctx, mr->value);
     } else {
-        mr = map_add_record(ctx, s, key);
+        mr = map_add_record(ctx, s, key, h);
         if (!mr)
             return JS_EXCEPTION;
     }
@@ -44568,7 +48056,7 @@ static JSValue js_map_get(JSContext *ctx, JSValueConst this_val,
     if (!s)
         return JS_EXCEPTION;
     key = map_normalize_key(ctx, argv[0]);
-    mr = map_find_record(ctx, s, key);
+    mr = map_find_record(ctx, s, key, map_hash_key(key));
     if (!mr)
         return JS_UNDEFINED;
     else
@@ -44585,7 +48073,7 @@ static JSValue js_map_has(JSContext *ctx, JSValueConst this_val,
     if (!s)
         return JS_EXCEPTION;
     key = map_normalize_key(ctx, argv[0]);
-    mr = map_find_record(ctx, s, key);
+    mr = map_find_record(ctx, s, key, map_hash_key(key));
     return JS_NewBool(ctx, (mr != NULL));
 }
 
@@ -44599,10 +48087,11 @@ static JSValue js_map_delete(JSContext *ctx, JSValueConst this_val,
     if (!s)
         return JS_EXCEPTION;
     key = map_normalize_key(ctx, argv[0]);
-    mr = map_find_record(ctx, s, key);
+    mr = map_find_record(ctx, s, key, map_hash_key(key));
     if (!mr)
         return JS_FALSE;
     map_delete_record(ctx->rt, s, mr);
+    map_shrink(ctx->rt, s);
     return JS_TRUE;
 }
 
@@ -44610,15 +48099,16 @@ static JSValue js_map_clear(JSContext *ctx, JSValueConst this_val,
                             int argc, JSValueConst *argv, int magic)
 {
     JSMapState *s = JS_GetOpaque2(ctx, this_val, JS_CLASS_MAP + magic);
-    struct list_head *el, *el1;
-    JSMapRecord *mr;
+    uint32_t i;
 
     if (!s)
         return JS_EXCEPTION;
-    list_for_each_safe(el, el1, &s->records) {
-        mr = list_entry(el, JSMapRecord, link);
-        map_delete_record(ctx->rt, s, mr);
+    for(i = 0; i < s->records_used; i++) {
+        if (!JS_IsUninitialized(s->records[i].key))
+            map_delete_record(ctx->rt, s, &s->records[i]);
     }
+    /* cannot fail when freeing the records */
+    map_rebuild(ctx->rt, s, 0);
     return JS_UNDEFINED;
 }
 
@@ -44636,8 +48126,8 @@ static JSValue js_map_forEach(JSContext *ctx, JSValueConst this_val,
     JSMapState *s = JS_GetOpaque2(ctx, this_val, JS_CLASS_MAP + magic);
     JSValueConst func, this_arg;
     JSValue ret, args[3];
-    struct list_head *el;
     JSMapRecord *mr;
+    JSMapCursor cursor;
 
     if (!s)
         return JS_EXCEPTION;
@@ -44648,37 +48138,36 @@ static JSValue js_map_forEach(JSContext *ctx, JSValueConst this_val,
         this_arg = JS_UNDEFINED;
     if (check_function(ctx, func))
         return JS_EXCEPTION;
-    /* Note: the list can be modified while traversing it, but the
-       current element is locked */
-    el = s->records.next;
-    while (el != &s->records) {
-        mr = list_entry(el, JSMapRecord, link);
-        if (!mr->empty) {
-            mr->ref_count++;
-            /* must duplicate in case the record is deleted */
-            args[1] = JS_DupValue(ctx, mr->key);
-            if (magic)
-                args[0] = args[1];
-            else
-                args[0] = JS_DupValue(ctx, mr->value);
+    /* Note: the map can be modified by the callback, the cursor is
+       updated if the records move */
+    cursor.pos = 0;
+    list_add_tail(&cursor.link, &s->cursors);
+    while (cursor.pos < s->records_used) {
+        mr = &s->records[cursor.pos++];
+        if (JS_IsUninitialized(mr->key))
+            continue;
+        /* must duplicate in case the record is deleted */
+        args[1] = JS_DupValue(ctx, mr->key);
+        if (magic)
+            args[0] = args[1];
+        else
+            args[0] = JS_DupValue(ctx, mr->value);
 #if defined(JS_VALUE_CANNOT_BE_CAST)
-            args[2] = this_val;
+        args[2] = this_val;
 #else
-            args[2] = (JSValue)this_val;
+        args[2] = (JSValue)this_val;
 #endif
-            ret = JS_Call(ctx, func, this_arg, 3, (JSValueConst *)args);
-            JS_FreeValue(ctx, args[0]);
-            if (!magic)
-                JS_FreeValue(ctx, args[1]);
-            el = el->next;
-            map_decref_record(ctx->rt, mr);
-            if (JS_IsException(ret))
-                return ret;
-            JS_FreeValue(ctx, ret);
-        } else {
-            el = el->next;
+        ret = JS_Call(ctx, func, this_arg, 3, (JSValueConst *)args);
+        JS_FreeValue(ctx, args[0]);
+        if (!magic)
+            JS_FreeValue(ctx, args[1]);
+        if (JS_IsException(ret)) {
+            list_del(&cursor.link);
+            return ret;
         }
+        JS_FreeValue(ctx, ret);
     }
+    list_del(&cursor.link);
     return JS_UNDEFINED;
 }
 
@@ -44686,25 +48175,18 @@ static void js_map_finalizer(JSRuntime *rt, JSValue val)
 {
     JSObject *p;
     JSMapState *s;
-    struct list_head *el, *el1;
-    JSMapRecord *mr;
+    uint32_t i;
 
     p = JS_VALUE_GET_OBJ(val);
     s = p->u.map_state;
     if (s) {
         /* if the object is deleted we are sure that no iterator is
            using it */
-        list_for_each_safe(el, el1, &s->records) {
-            mr = list_entry(el, JSMapRecord, link);
-            if (!mr->empty) {
-                if (s->is_weak)
-                    delete_weak_ref(rt, mr);
-                else
-                    JS_FreeValueRT(rt, mr->key);
-                JS_FreeValueRT(rt, mr->value);
-            }
-            js_free_rt(rt, mr);
+        for(i = 0; i < s->records_used; i++) {
+            if (!JS_IsUninitialized(s->records[i].key))
+                map_delete_record(rt, s, &s->records[i]);
         }
+        js_free_rt(rt, s->records);
         js_free_rt(rt, s->hash_table);
         js_free_rt(rt, s);
     }
@@ -44714,13 +48196,15 @@ static void js_map_mark(JSRuntime *rt, JSValueConst val, JS_MarkFunc *mark_func)
 {
     JSObject *p = JS_VALUE_GET_OBJ(val);
     JSMapState *s;
-    struct list_head *el;
     JSMapRecord *mr;
+    uint32_t i;
 
     s = p->u.map_state;
     if (s) {
-        list_for_each(el, &s->records) {
-            mr = list_entry(el, JSMapRecord, link);
+        for(i = 0; i < s->records_used; i++) {
+            mr = &s->records[i];
+            if (JS_IsUninitialized(mr->key))
+                continue;
             if (!s->is_weak)
                 JS_MarkValue(rt, mr->key, mark_func);
             JS_MarkValue(rt, mr->value, mark_func);
@@ -44733,7 +48217,7 @@ static void js_map_mark(JSRuntime *rt, JSValueConst val, JS_MarkFunc *mark_func)
 typedef struct JSMapIteratorData {
     JSValue obj;
     JSIteratorKindEnum kind;
-    JSMapRecord *cur_record;
+    JSMapCursor cursor; /* linked in the map while obj is defined */
 } JSMapIteratorData;
 
 static void js_map_iterator_finalizer(JSRuntime *rt, JSValue val)
@@ -44746,8 +48230,8 @@ static void js_map_iterator_finalizer(JSRuntime *rt, JSValue val)
     if (it) {
         /* During the GC sweep phase the Map finalizer may be
            called before the Map iterator finalizer */
-        if (JS_IsLiveObject(rt, it->obj) && it->cur_record) {
-            map_decref_record(rt, it->cur_record);
+        if (JS_IsLiveObject(rt, it->obj)) {
+            list_del(&it->cursor.link);
         }
         JS_FreeValueRT(rt, it->obj);
         js_free_rt(rt, it);
@@ -44761,7 +48245,6 @@ static void js_map_iterator_mark(JSRuntime *rt, JSValueConst val,
     JSMapIteratorData *it;
     it = p->u.map_iterator_data;
     if (it) {
-        /* the record is already marked by the object */
         JS_MarkValue(rt, it->obj, mark_func);
     }
 }
@@ -44789,7 +48272,8 @@ static JSValue js_create_map_iterator(JSContext *ctx, JSValueConst this_val,
     }
     it->obj = JS_DupValue(ctx, this_val);
     it->kind = kind;
-    it->cur_record = NULL;
+    it->cursor.pos = 0;
+    list_add_tail(&it->cursor.link, &s->cursors);
     JS_SetOpaque(enum_obj, it);
     return enum_obj;
  fail:
@@ -44803,7 +48287,6 @@ static JSValue js_map_iterator_next(JSContext *ctx, JSValueConst this_val,
     JSMapIteratorData *it;
     JSMapState *s;
     JSMapRecord *mr;
-    struct list_head *el;
 
     it = JS_GetOpaque2(ctx, this_val, JS_CLASS_MAP_ITERATOR + magic);
     if (!it) {
@@ -44814,17 +48297,10 @@ static JSValue js_map_iterator_next(JSContext *ctx, JSValueConst this_val,
         goto done;
     s = JS_GetOpaque(it->obj, JS_CLASS_MAP + magic);
     assert(s != NULL);
-    if (!it->cur_record) {
-        el = s->records.next;
-    } else {
-        mr = it->cur_record;
-        el = mr->link.next;
-        map_decref_record(ctx->rt, mr); /* the record can be freed here */
-    }
     for(;;) {
-        if (el == &s->records) {
+        if (it->cursor.pos >= s->records_used) {
             /* no more record  */
-            it->cur_record = NULL;
+            list_del(&it->cursor.link);
             JS_FreeValue(ctx, it->obj);
             it->obj = JS_UNDEFINED;
         done:
@@ -44832,16 +48308,10 @@ static JSValue js_map_iterator_next(JSContext *ctx, JSValueConst this_val,
             *pdone = TRUE;
             return JS_UNDEFINED;
         }
-        mr = list_entry(el, JSMapRecord, link);
-        if (!mr->empty)
+        mr = &s->records[it->cursor.pos++];
+        if (!JS_IsUninitialized(mr->key))
             break;
-        /* get the next record */
-        el = mr->link.next;
     }
-
-    /* lock the record so that it won't be freed */
-    mr->ref_count++;
-    it->cur_record = mr;
     *pdone = FALSE;
 
     if (it->kind == JS_ITERATOR_KIND_KEY) {
@@ -45049,8 +48519,13 @@ static JSValue promise_reaction_job(JSContext *ctx, int argc,
         res = JS_Call(ctx, handler, JS_UNDEFINED, 1, &arg);
     }
     is_reject = JS_IsException(res);
-    if (is_reject)
+    if (is_reject) {
         res = JS_GetException(ctx);
+        /* an interruption is not turned into a rejection that the
+           script could catch */
+        if (JS_IsUncatchableError(ctx, res))
+            return JS_Throw(ctx, res);
+    }
     func = argv[is_reject];
     /* as an extension, we support undefined as value to avoid
        creating a dummy promise in the 'await' implementation of async
@@ -47848,6 +51323,7 @@ static JSValue JS_ToBigIntCtorFree(JSContext *ctx, JSValue val)
             break;
         goto redo;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         val = JS_StringToBigIntErr(ctx, val);
         break;
     case JS_TAG_OBJECT:
@@ -48399,6 +51875,7 @@ static JSValue js_bigfloat_constructor(JSContext *ctx,
                 break;
             goto redo;
         case JS_TAG_STRING:
+        case JS_TAG_STRING_ROPE:
             {
                 const char *str, *p;
                 size_t len;
@@ -49079,6 +52556,7 @@ static JSValue JS_ToBigDecimalFree(JSContext *ctx, JSValue val,
             break;
         goto redo;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         {
             const char *str, *p;
             size_t len;
@@ -50259,6 +53737,128 @@ static JSValue js_typed_array_get_toStringTag(JSContext *ctx,
     return JS_AtomToString(ctx, ctx->rt->class_array[p->class_id].class_name);
 }
 
+/* Conversion of the elements of typed arrays with different number
+   types, done with the ToNumber() then ToInt/ToUint8Clamp/float
+   conversions of the generic path. The elements go through a buffer
+   of doubles, which holds exactly the value of any element, in chunks
+   of TA_CONVERT_CHUNK elements. */
+#define TA_CONVERT_CHUNK 256
+
+static inline BOOL is_bigint_typed_array(int class_id)
+{
+#ifdef CONFIG_BIGNUM
+    return class_id == JS_CLASS_BIG_INT64_ARRAY ||
+        class_id == JS_CLASS_BIG_UINT64_ARRAY;
+#else
+    return FALSE;
+#endif
+}
+
+static void js_typed_array_load_float64(double *d, const uint8_t *src,
+                                        int class_id, size_t n)
+{
+    size_t i;
+
+    switch(class_id) {
+    case JS_CLASS_INT8_ARRAY:
+        for(i = 0; i < n; i++)
+            d[i] = ((const int8_t *)src)[i];
+        break;
+    case JS_CLASS_UINT8C_ARRAY:
+    case JS_CLASS_UINT8_ARRAY:
+        for(i = 0; i < n; i++)
+            d[i] = src[i];
+        break;
+    case JS_CLASS_INT16_ARRAY:
+        for(i = 0; i < n; i++)
+            d[i] = ((const int16_t *)src)[i];
+        break;
+    case JS_CLASS_UINT16_ARRAY:
+        for(i = 0; i < n; i++)
+            d[i] = ((const uint16_t *)src)[i];
+        break;
+    case JS_CLASS_INT32_ARRAY:
+        for(i = 0; i < n; i++)
+            d[i] = ((const int32_t *)src)[i];
+        break;
+    case JS_CLASS_UINT32_ARRAY:
+        for(i = 0; i < n; i++)
+            d[i] = ((const uint32_t *)src)[i];
+        break;
+    case JS_CLASS_FLOAT32_ARRAY:
+        for(i = 0; i < n; i++)
+            d[i] = ((const float *)src)[i];
+        break;
+    case JS_CLASS_FLOAT64_ARRAY:
+        memcpy(d, src, n * sizeof(double));
+        break;
+    default:
+        abort();
+    }
+}
+
+static void js_typed_array_store_float64(uint8_t *dst, int class_id,
+                                         const double *d, size_t n)
+{
+    size_t i;
+
+    switch(class_id) {
+    case JS_CLASS_UINT8C_ARRAY:
+        for(i = 0; i < n; i++) {
+            /* also handles NaN */
+            if (!(d[i] > 0))
+                dst[i] = 0;
+            else if (d[i] > 255)
+                dst[i] = 255;
+            else
+                dst[i] = lrint(d[i]);
+        }
+        break;
+    case JS_CLASS_INT8_ARRAY:
+    case JS_CLASS_UINT8_ARRAY:
+        for(i = 0; i < n; i++)
+            dst[i] = js_double_to_int32(d[i]);
+        break;
+    case JS_CLASS_INT16_ARRAY:
+    case JS_CLASS_UINT16_ARRAY:
+        for(i = 0; i < n; i++)
+            ((uint16_t *)dst)[i] = js_double_to_int32(d[i]);
+        break;
+    case JS_CLASS_INT32_ARRAY:
+    case JS_CLASS_UINT32_ARRAY:
+        for(i = 0; i < n; i++)
+            ((uint32_t *)dst)[i] = js_double_to_int32(d[i]);
+        break;
+    case JS_CLASS_FLOAT32_ARRAY:
+        for(i = 0; i < n; i++)
+            ((float *)dst)[i] = d[i];
+        break;
+    case JS_CLASS_FLOAT64_ARRAY:
+        memcpy(dst, d, n * sizeof(double));
+        break;
+    default:
+        abort();
+    }
+}
+
+static void js_typed_array_convert(uint8_t *dst, int dst_class_id,
+                                   const uint8_t *src, int src_class_id,
+                                   size_t len)
+{
+    double buf[TA_CONVERT_CHUNK];
+    int dst_shift = typed_array_size_log2(dst_class_id);
+    int src_shift = typed_array_size_log2(src_class_id);
+    size_t i, n;
+
+    for(i = 0; i < len; i += n) {
+        n = min_int(len - i, TA_CONVERT_CHUNK);
+        js_typed_array_load_float64(buf, src + (i << src_shift),
+                                    src_class_id, n);
+        js_typed_array_store_float64(dst + (i << dst_shift), dst_class_id,
+                                     buf, n);
+    }
+}
+
 static JSValue js_typed_array_set_internal(JSContext *ctx,
                                            JSValueConst dst,
                                            JSValueConst src,
@@ -50302,17 +53902,36 @@ static JSValue js_typed_array_set_internal(JSContext *ctx,
             goto range_error;
 
         /* copying between typed objects */
-        if (src_p->class_id == p->class_id) {
-            /* same type, use memmove */
+        if (src_p->class_id == p->class_id ||
+            (is_bigint_typed_array(src_p->class_id) && is_bigint_typed_array(p->class_id))) {
+            /* same type or same bits, use memmove */
             memmove(dest_abuf->data + dest_ta->offset + (offset << shift),
                     src_abuf->data + src_ta->offset, src_len << shift);
             goto done;
         }
-        if (dest_abuf->data == src_abuf->data) {
-            /* copying between the same buffer using different types of mappings
-               would require a temporary buffer */
+        if (!is_bigint_typed_array(src_p->class_id) && !is_bigint_typed_array(p->class_id)) {
+            uint8_t *dst_ptr = dest_abuf->data + dest_ta->offset + (offset << shift);
+            const uint8_t *src_ptr = src_abuf->data + src_ta->offset;
+            size_t src_size = src_len << typed_array_size_log2(src_p->class_id);
+            uint8_t *tmp = NULL;
+
+            if (dest_abuf->data == src_abuf->data &&
+                src_ptr < dst_ptr + (src_len << shift) &&
+                dst_ptr < src_ptr + src_size) {
+                /* overlapping mappings of the same buffer with different
+                   types: convert from a copy */
+                tmp = js_malloc(ctx, src_size);
+                if (!tmp)
+                    goto fail;
+                memcpy(tmp, src_ptr, src_size);
+                src_ptr = tmp;
+            }
+            js_typed_array_convert(dst_ptr, p->class_id, src_ptr,
+                                   src_p->class_id, src_len);
+            js_free(ctx, tmp);
+            goto done;
         }
-        /* otherwise, default behavior is slow but correct */
+        /* otherwise, the generic path throws the BigInt/Number TypeError */
     } else {
         if (js_get_length64(ctx, &src_len, src_obj))
             goto fail;
@@ -50609,6 +54228,50 @@ static JSValue js_typed_array_copyWithin(JSContext *ctx, JSValueConst this_val,
     return JS_DupValue(ctx, this_val);
 }
 
+/* Store 'count' elements of (1 << shift) bytes holding the low bits of
+   'v64'. Values made of a single repeated byte (such as 0 or -1) use
+   memset. Otherwise the first element is stored and then copied with
+   memcpy in chunks doubling up to TA_FILL_CHUNK bytes, so that the
+   source of the copies stays in the cache. */
+#define TA_FILL_CHUNK 4096
+
+static void js_typed_array_fill_bits(uint8_t *ptr, int shift, uint64_t v64,
+                                     size_t count)
+{
+    size_t size, len, pos, n, chunk;
+
+    size = (size_t)1 << shift;
+    if (shift < 3)
+        v64 &= ((uint64_t)1 << (size * 8)) - 1;
+    if (v64 == (v64 & 0xff) * (UINT64_MAX / 0xff >> (64 - size * 8))) {
+        memset(ptr, v64, count << shift);
+        return;
+    }
+    switch(shift) {
+    case 1:
+        *(uint16_t *)ptr = v64;
+        break;
+    case 2:
+        *(uint32_t *)ptr = v64;
+        break;
+    case 3:
+        *(uint64_t *)ptr = v64;
+        break;
+    default:
+        abort();
+    }
+    len = count << shift;
+    chunk = size;
+    for(pos = size; pos < len; pos += n) {
+        n = len - pos;
+        if (n > chunk)
+            n = chunk;
+        memcpy(ptr + pos, ptr, n);
+        if (chunk < TA_FILL_CHUNK)
+            chunk = pos + n;
+    }
+}
+
 static JSValue js_typed_array_fill(JSContext *ctx, JSValueConst this_val,
                                    int argc, JSValueConst *argv)
 {
@@ -50672,29 +54335,9 @@ static JSValue js_typed_array_fill(JSContext *ctx, JSValueConst this_val,
         return JS_ThrowTypeErrorDetachedArrayBuffer(ctx);
     
     shift = typed_array_size_log2(p->class_id);
-    switch(shift) {
-    case 0:
-        if (k < final) {
-            memset(p->u.array.u.uint8_ptr + k, v64, final - k);
-        }
-        break;
-    case 1:
-        for(; k < final; k++) {
-            p->u.array.u.uint16_ptr[k] = v64;
-        }
-        break;
-    case 2:
-        for(; k < final; k++) {
-            p->u.array.u.uint32_ptr[k] = v64;
-        }
-        break;
-    case 3:
-        for(; k < final; k++) {
-            p->u.array.u.uint64_ptr[k] = v64;
-        }
-        break;
-    default:
-        abort();
+    if (k < final) {
+        js_typed_array_fill_bits(p->u.array.u.uint8_ptr + (k << shift),
+                                 shift, v64, final - k);
     }
     return JS_DupValue(ctx, this_val);
 }
@@ -50755,12 +54398,115 @@ exception:
 #define special_lastIndexOf 1
 #define special_includes -1
 
+#ifdef SCAN_VEC_SIZE
+/* bytes compared per iteration of the js_typed_array_scan() loop */
+#define TA_SCAN_BLOCK 64
+
+/* keep the lowest bit of the groups of (1 << shift) bits of 'm' which
+   are all set */
+static inline uint64_t scan_mask_elts(uint64_t m, int shift)
+{
+    static const uint64_t elt_bits[4] = {
+        UINT64_MAX, 0x5555555555555555, 0x1111111111111111,
+        0x0101010101010101,
+    };
+    if (shift >= 1)
+        m &= m >> 1;
+    if (shift >= 2)
+        m &= m >> 2;
+    if (shift >= 3)
+        m &= m >> 4;
+    return m & elt_bits[shift];
+}
+
+static inline uint64_t scan_block_mask(const uint8_t *p, scan_vec vv,
+                                       scan_vec vm)
+{
+    uint64_t m = 0;
+    int i;
+    for(i = 0; i < TA_SCAN_BLOCK; i += SCAN_VEC_SIZE)
+        m |= (uint64_t)scan_mask(scan_eq(scan_and(scan_load(p + i), vm), vv)) << i;
+    return m;
+}
+#endif
+
+/* Return the index of the first element of (1 << shift) bytes found
+   from 'k' to 'stop' (excluded) in the direction 'inc' such that
+   (x & mask) == v, or -1. The vector loop compares the bytes of
+   TA_SCAN_BLOCK / (1 << shift) elements at a time and keeps the
+   elements in which all the bytes match. */
+static int js_typed_array_scan(const uint8_t *ptr, int shift, int k,
+                               int stop, int inc, uint64_t v, uint64_t mask)
+{
+#ifdef SCAN_VEC_SIZE
+    int n = TA_SCAN_BLOCK >> shift;
+    if ((stop - k) * inc >= n) {
+        uint8_t buf[2 * SCAN_VEC_SIZE];
+        scan_vec vv, vm;
+        uint64_t m;
+        int i;
+
+        for(i = 0; i < SCAN_VEC_SIZE; i += 1 << shift) {
+            memcpy(buf + i, &v, 1 << shift);
+            memcpy(buf + SCAN_VEC_SIZE + i, &mask, 1 << shift);
+        }
+        vv = scan_load(buf);
+        vm = scan_load(buf + SCAN_VEC_SIZE);
+        if (inc > 0) {
+            for(; k + n <= stop; k += n) {
+                m = scan_block_mask(ptr + ((size_t)k << shift), vv, vm);
+                m = scan_mask_elts(m, shift);
+                if (m)
+                    return k + (ctz64(m) >> shift);
+            }
+        } else {
+            for(; k - n >= stop; k -= n) {
+                m = scan_block_mask(ptr + ((size_t)(k - n + 1) << shift), vv, vm);
+                m = scan_mask_elts(m, shift);
+                if (m)
+                    return k - n + 1 + ((63 - clz64(m)) >> shift);
+            }
+        }
+    }
+#endif
+    switch(shift) {
+    case 0:
+        for(; k != stop; k += inc) {
+            if ((ptr[k] & mask) == v)
+                return k;
+        }
+        break;
+    case 1:
+        for(; k != stop; k += inc) {
+            if ((((const uint16_t *)ptr)[k] & mask) == v)
+                return k;
+        }
+        break;
+    case 2:
+        for(; k != stop; k += inc) {
+            if ((((const uint32_t *)ptr)[k] & mask) == v)
+                return k;
+        }
+        break;
+    case 3:
+        for(; k != stop; k += inc) {
+            if ((((const uint64_t *)ptr)[k] & mask) == v)
+                return k;
+        }
+        break;
+    default:
+        abort();
+    }
+    return -1;
+}
+
 static JSValue js_typed_array_indexOf(JSContext *ctx, JSValueConst this_val,
                                       int argc, JSValueConst *argv, int special)
 {
     JSObject *p;
-    int len, tag, is_int, is_bigint, k, stop, inc, res = -1;
+    int len, tag, is_int, is_bigint, k, stop, inc, shift, res = -1;
     int64_t v64;
+    uint64_t mask;
     double d;
     float f;
 
@@ -50842,6 +54588,8 @@ static JSValue js_typed_array_indexOf(JSContext *ctx, JSValueConst this_val,
     }
 
     p = JS_VALUE_GET_OBJ(this_val);
+    shift = typed_array_size_log2(p->class_id);
+    mask = UINT64_MAX;
     switch (p->class_id) {
     case JS_CLASS_INT8_ARRAY:
         if (is_int && (int8_t)v64 == v64)
@@ -50851,22 +54599,16 @@ static JSValue js_typed_array_indexOf(JSContext *ctx, JSValueConst this_val,
     case JS_CLASS_UINT8_ARRAY:
         if (is_int && (uint8_t)v64 == v64) {
             const uint8_t *pv, *pp;
-            uint16_t v;
         scan8:
-            pv = p->u.array.u.uint8_ptr;
-            v = v64;
             if (inc > 0) {
-                pp = memchr(pv + k, v, len - k);
+                pv = p->u.array.u.uint8_ptr;
+                pp = memchr(pv + k, (uint8_t)v64, len - k);
                 if (pp)
                     res = pp - pv;
-            } else {
-                for (; k != stop; k += inc) {
-                    if (pv[k] == v) {
-                        res = k;
-                        break;
-                    }
-                }
+                break;
             }
+            v64 &= 0xff;
+            goto scan;
         }
         break;
     case JS_CLASS_INT16_ARRAY:
@@ -50875,17 +54617,9 @@ static JSValue js_typed_array_indexOf(JSContext *ctx, JSValueConst this_val,
         break;
     case JS_CLASS_UINT16_ARRAY:
         if (is_int && (uint16_t)v64 == v64) {
-            const uint16_t *pv;
-            uint16_t v;
         scan16:
-            pv = p->u.array.u.uint16_ptr;
-            v = v64;
-            for (; k != stop; k += inc) {
-                if (pv[k] == v) {
-                    res = k;
-                    break;
-                }
-            }
+            v64 &= 0xffff;
+            goto scan;
         }
         break;
     case JS_CLASS_INT32_ARRAY:
@@ -50894,17 +54628,9 @@ static JSValue js_typed_array_indexOf(JSContext *ctx, JSValueConst this_val,
         break;
     case JS_CLASS_UINT32_ARRAY:
         if (is_int && (uint32_t)v64 == v64) {
-            const uint32_t *pv;
-            uint32_t v;
         scan32:
-            pv = p->u.array.u.uint32_ptr;
-            v = v64;
-            for (; k != stop; k += inc) {
-                if (pv[k] == v) {
-                    res = k;
-                    break;
-                }
-            }
+            v64 &= 0xffffffff;
+            goto scan;
         }
         break;
     case JS_CLASS_FLOAT32_ARRAY:
@@ -50922,13 +54648,18 @@ static JSValue js_typed_array_indexOf(JSContext *ctx, JSValueConst this_val,
                 }
             }
         } else if ((f = (float)d) == d) {
-            const float *pv = p->u.array.u.float_ptr;
-            for (; k != stop; k += inc) {
-                if (pv[k] == f) {
-                    res = k;
-                    break;
-                }
+            union {
+                float f;
+                uint32_t u32;
+            } u;
+            u.f = f;
+            v64 = u.u32;
+            /* -0 and +0 are equal */
+            if (f == 0) {
+                v64 = 0;
+                mask = 0x7fffffff;
             }
+            goto scan;
         }
         break;
     case JS_CLASS_FLOAT64_ARRAY:
@@ -50946,13 +54677,14 @@ static JSValue js_typed_array_indexOf(JSContext *ctx, JSValueConst this_val,
                 }
             }
         } else {
-            const double *pv = p->u.array.u.double_ptr;
-            for (; k != stop; k += inc) {
-                if (pv[k] == d) {
-                    res = k;
-                    break;
-                }
+            JSFloat64Union u;
+            u.d = d;
+            v64 = u.u64;
+            if (d == 0) {
+                v64 = 0;
+                mask = 0x7fffffffffffffff;
             }
+            goto scan;
         }
         break;
 #ifdef CONFIG_BIGNUM
@@ -50960,26 +54692,20 @@ static JSValue js_typed_array_indexOf(JSContext *ctx, JSValueConst this_val,
         if (is_bigint || (is_math_mode(ctx) && is_int &&
                           v64 >= -MAX_SAFE_INTEGER &&
                           v64 <= MAX_SAFE_INTEGER)) {
-            goto scan64;
+            goto scan;
         }
         break;
     case JS_CLASS_BIG_UINT64_ARRAY:
         if (is_bigint || (is_math_mode(ctx) && is_int &&
                           v64 >= 0 && v64 <= MAX_SAFE_INTEGER)) {
-            const uint64_t *pv;
-            uint64_t v;
-        scan64:
-            pv = p->u.array.u.uint64_ptr;
-            v = v64;
-            for (; k != stop; k += inc) {
-                if (pv[k] == v) {
-                    res = k;
-                    break;
-                }
-            }
+            goto scan;
         }
         break;
 #endif
+    scan:
+        res = js_typed_array_scan(p->u.array.u.uint8_ptr, shift, k, stop, inc,
+                                  v64, mask);
+        break;
     }
 
 done:
@@ -51321,6 +55047,93 @@ static JSValue js_TA_get_float64(JSContext *ctx, const void *a) {
     return __JS_NewFloat64(ctx, *(const double *)a);
 }
 
+/* Without a comparison function, arrays of TA_RADIX_SORT_MIN elements
+   per byte of element or more are sorted with a least significant
+   digit radix sort, which does one pass per byte of element. The
+   element bits are mapped to keys whose unsigned order is the order
+   of js_TA_cmp_xxx: the sign bit of signed integers is flipped, the
+   bits of negative floats are all flipped and positive floats get their
+   sign bit set, so -0 sorts before +0. NaNs of any sign map to the
+   largest key. The elements themselves are moved, so NaN payloads are
+   kept, and the sort is stable. */
+#define TA_RADIX_SORT_MIN 64
+
+static inline uint8_t js_TA_key_uint8(uint8_t x) { return x; }
+static inline uint8_t js_TA_key_int8(uint8_t x) { return x ^ 0x80; }
+static inline uint16_t js_TA_key_uint16(uint16_t x) { return x; }
+static inline uint16_t js_TA_key_int16(uint16_t x) { return x ^ 0x8000; }
+static inline uint32_t js_TA_key_uint32(uint32_t x) { return x; }
+static inline uint32_t js_TA_key_int32(uint32_t x) { return x ^ 0x80000000; }
+#ifdef CONFIG_BIGNUM
+static inline uint64_t js_TA_key_uint64(uint64_t x) { return x; }
+static inline uint64_t js_TA_key_int64(uint64_t x) { return x ^ ((uint64_t)1 << 63); }
+#endif
+
+static inline uint32_t js_TA_key_float32(uint32_t x)
+{
+    if ((x & 0x7fffffff) > 0x7f800000)
+        return 0xffffffff;
+    return (x >> 31) ? ~x : x | 0x80000000;
+}
+
+static inline uint64_t js_TA_key_float64(uint64_t x)
+{
+    if ((x & 0x7fffffffffffffff) > 0x7ff0000000000000)
+        return UINT64_MAX;
+    return (x >> 63) ? ~x : x | ((uint64_t)1 << 63);
+}
+
+#define DEF_TA_RADIX_SORT(name, elt_t)                                  \
+static void js_TA_radix_sort_ ## name(void *array, void *tmp, size_t len) \
+{                                                                       \
+    uint32_t count[sizeof(elt_t)][256];                                 \
+    elt_t *a = array, *src, *dst, *t;                                   \
+    size_t i, j, d, sum, c;                                             \
+                                                                        \
+    memset(count, 0, sizeof(count));                                    \
+    for(i = 0; i < len; i++) {                                          \
+        elt_t k = js_TA_key_ ## name(a[i]);                             \
+        for(d = 0; d < sizeof(elt_t); d++)                              \
+            count[d][(k >> (d * 8)) & 0xff]++;                          \
+    }                                                                   \
+    src = a;                                                            \
+    dst = tmp;                                                          \
+    for(d = 0; d < sizeof(elt_t); d++) {                                \
+        uint32_t *cnt = count[d];                                       \
+        /* skip the digits that are the same in all the elements */     \
+        if (cnt[(js_TA_key_ ## name(a[0]) >> (d * 8)) & 0xff] == len)   \
+            continue;                                                   \
+        sum = 0;                                                        \
+        for(j = 0; j < 256; j++) {                                      \
+            c = cnt[j];                                                 \
+            cnt[j] = sum;                                               \
+            sum += c;                                                   \
+        }                                                               \
+        for(i = 0; i < len; i++) {                                      \
+            elt_t v = src[i];                                           \
+            dst[cnt[(js_TA_key_ ## name(v) >> (d * 8)) & 0xff]++] = v;  \
+        }                                                               \
+        t = src;                                                        \
+        src = dst;                                                      \
+        dst = t;                                                        \
+    }                                                                   \
+    if (src != a)                                                       \
+        memcpy(a, src, len * sizeof(elt_t));                            \
+}
+
+DEF_TA_RADIX_SORT(uint8, uint8_t)
+DEF_TA_RADIX_SORT(int8, uint8_t)
+DEF_TA_RADIX_SORT(uint16, uint16_t)
+DEF_TA_RADIX_SORT(int16, uint16_t)
+DEF_TA_RADIX_SORT(uint32, uint32_t)
+DEF_TA_RADIX_SORT(int32, uint32_t)
+#ifdef CONFIG_BIGNUM
+DEF_TA_RADIX_SORT(uint64, uint64_t)
+DEF_TA_RADIX_SORT(int64, uint64_t)
+#endif
+DEF_TA_RADIX_SORT(float32, uint32_t)
+DEF_TA_RADIX_SORT(float64, uint64_t)
+
 struct TA_sort_context {
     JSContext *ctx;
     int exception;
@@ -51392,6 +55205,7 @@ static JSValue js_typed_array_sort(JSContext *ctx, JSValueConst this_val,
     struct TA_sort_context tsc;
     void *array_ptr;
     int (*cmpfun)(const void *a, const void *b, void *opaque);
+    void (*radix_sort)(void *array, void *tmp, size_t len);
 
     tsc.ctx = ctx;
     tsc.exception = 0;
@@ -51410,45 +55224,55 @@ static JSValue js_typed_array_sort(JSContext *ctx, JSValueConst this_val,
         case JS_CLASS_INT8_ARRAY:
             tsc.getfun = js_TA_get_int8;
             cmpfun = js_TA_cmp_int8;
+            radix_sort = js_TA_radix_sort_int8;
             break;
         case JS_CLASS_UINT8C_ARRAY:
         case JS_CLASS_UINT8_ARRAY:
             tsc.getfun = js_TA_get_uint8;
             cmpfun = js_TA_cmp_uint8;
+            radix_sort = js_TA_radix_sort_uint8;
             break;
         case JS_CLASS_INT16_ARRAY:
             tsc.getfun = js_TA_get_int16;
             cmpfun = js_TA_cmp_int16;
+            radix_sort = js_TA_radix_sort_int16;
             break;
         case JS_CLASS_UINT16_ARRAY:
             tsc.getfun = js_TA_get_uint16;
             cmpfun = js_TA_cmp_uint16;
+            radix_sort = js_TA_radix_sort_uint16;
             break;
         case JS_CLASS_INT32_ARRAY:
             tsc.getfun = js_TA_get_int32;
             cmpfun = js_TA_cmp_int32;
+            radix_sort = js_TA_radix_sort_int32;
             break;
         case JS_CLASS_UINT32_ARRAY:
             tsc.getfun = js_TA_get_uint32;
             cmpfun = js_TA_cmp_uint32;
+            radix_sort = js_TA_radix_sort_uint32;
             break;
 #ifdef CONFIG_BIGNUM
         case JS_CLASS_BIG_INT64_ARRAY:
             tsc.getfun = js_TA_get_int64;
             cmpfun = js_TA_cmp_int64;
+            radix_sort = js_TA_radix_sort_int64;
             break;
         case JS_CLASS_BIG_UINT64_ARRAY:
             tsc.getfun = js_TA_get_uint64;
             cmpfun = js_TA_cmp_uint64;
+            radix_sort = js_TA_radix_sort_uint64;
             break;
 #endif
         case JS_CLASS_FLOAT32_ARRAY:
             tsc.getfun = js_TA_get_float32;
             cmpfun = js_TA_cmp_float32;
+            radix_sort = js_TA_radix_sort_float32;
             break;
         case JS_CLASS_FLOAT64_ARRAY:
             tsc.getfun = js_TA_get_float64;
             cmpfun = js_TA_cmp_float64;
+            radix_sort = js_TA_radix_sort_float64;
             break;
         default:
             abort();
@@ -51510,9 +55334,19 @@ static JSValue js_typed_array_sort(JSContext *ctx, JSValueConst this_val,
             js_free(ctx, array_tmp);
             js_free(ctx, array_idx);
         } else {
-            rqsort(array_ptr, len, elt_size, cmpfun, &tsc);
-            if (tsc.exception)
-                return JS_EXCEPTION;
+            void *array_tmp = NULL;
+            if (len >= TA_RADIX_SORT_MIN * elt_size) {
+                /* no exception: rqsort sorts in place */
+                array_tmp = js_malloc_rt(ctx->rt, len * elt_size);
+            }
+            if (array_tmp) {
+                radix_sort(array_ptr, array_tmp, len);
+                js_free_rt(ctx->rt, array_tmp);
+            } else {
+                rqsort(array_ptr, len, elt_size, cmpfun, &tsc);
+                if (tsc.exception)
+                    return JS_EXCEPTION;
+            }
         }
     }
     return JS_DupValue(ctx, this_val);
@@ -62,6 +62,10 @@ typedef uint32_t JSAtom;
 
 #ifndef JS_PTR64
 #define JS_NAN_BOXING
+#elif defined(CONFIG_NAN_BOXING64)
+/* 8 byte JSValue on 64 bit targets. Heap pointers must fit in 48 bits,
+   so it cannot be used with top byte pointer tagging. */
+#define JS_NAN_BOXING64
 #endif
 
 enum {
@@ -72,6 +76,7 @@ enum {
     JS_TAG_BIG_FLOAT   = -9,
     JS_TAG_SYMBOL      = -8,
     JS_TAG_STRING      = -7,
+    JS_TAG_STRING_ROPE = -6, /* concatenation tree, see JS_IsString() */
     JS_TAG_MODULE      = -3, /* used internally */
     JS_TAG_FUNCTION_BYTECODE = -2, /* used internally */
     JS_TAG_OBJECT      = -1,
@@ -84,7 +89,7 @@ enum {
     JS_TAG_CATCH_OFFSET = 5,
     JS_TAG_EXCEPTION   = 6,
     JS_TAG_FLOAT64     = 7,
-    /* any larger tag is FLOAT64 if JS_NAN_BOXING */
+    /* any larger tag is FLOAT64 if JS_NAN_BOXING or JS_NAN_BOXING64 */
 };
 
 typedef struct JSRefCountHeader {
@@ -192,7 +197,75 @@ static inline JS_BOOL JS_VALUE_IS_NAN(JSValue v)
     return tag == (JS_NAN >> 32);
 }
     
-#else /* !JS_NAN_BOXING */
+#elif defined(JS_NAN_BOXING64)
+
+typedef uint64_t JSValue;
+
+#define JSValueConst JSValue
+
+/* The tag is in the high 16 bits and the payload in the low 48
+   bits. Doubles are rotated left by one bit so that the exponent is
+   in the high bits, which makes the NaN encodings 0xffe1 to 0xffff of
+   the high 16 bits contiguous, then offset by JS_FLOAT64_TAG_ADDEND64
+   so that these encodings become the tags from JS_TAG_FIRST. Every
+   other encoding decodes to a tag that JS_TAG_IS_FLOAT64() accepts.
+   NaNs are normalized to the one NaN sharing its high bits with the
+   infinities (0xffe0), so they never alias a tag. */
+#define JS_FLOAT64_TAG_ADDEND64 (JS_TAG_FIRST + 31)
+
+#define JS_VALUE_GET_TAG(v) (int)((int64_t)(v) >> 48)
+#define JS_VALUE_GET_INT(v) (int)(v)
+#define JS_VALUE_GET_BOOL(v) (int)(v)
+#define JS_VALUE_GET_PTR(v) (void *)(intptr_t)((v) & 0xffffffffffff)
+
+#define JS_MKVAL(tag, val) (((uint64_t)(uint16_t)(tag) << 48) | (uint32_t)(val))
+#define JS_MKPTR(tag, ptr) (((uint64_t)(uint16_t)(tag) << 48) | (uintptr_t)(ptr))
+
+static inline double JS_VALUE_GET_FLOAT64(JSValue v)
+{
+    union {
+        uint64_t u64;
+        double d;
+    } u;
+    v -= (uint64_t)JS_FLOAT64_TAG_ADDEND64 << 48;
+    u.u64 = (v >> 1) | (v << 63);
+    return u.d;
+}
+
+#define JS_NAN ((uint64_t)0xffe0000000000002 + ((uint64_t)JS_FLOAT64_TAG_ADDEND64 << 48))
+
+static inline JSValue __JS_NewFloat64(JSContext *ctx, double d)
+{
+    union {
+        double d;
+        uint64_t u64;
+    } u;
+    u.d = d;
+    /* normalize NaN */
+    if (js_unlikely((u.u64 & 0x7fffffffffffffff) > 0x7ff0000000000000))
+        return JS_NAN;
+    return ((u.u64 << 1) | (u.u64 >> 63)) + ((uint64_t)JS_FLOAT64_TAG_ADDEND64 << 48);
+}
+
+#define JS_TAG_IS_FLOAT64(tag) ((unsigned)((tag) - JS_TAG_FIRST) >= (JS_TAG_FLOAT64 - JS_TAG_FIRST))
+
+/* same as JS_VALUE_GET_TAG, but return JS_TAG_FLOAT64 with NaN boxing */
+static inline int JS_VALUE_GET_NORM_TAG(JSValue v)
+{
+    int tag;
+    tag = JS_VALUE_GET_TAG(v);
+    if (JS_TAG_IS_FLOAT64(tag))
+        return JS_TAG_FLOAT64;
+    else
+        return tag;
+}
+
+static inline JS_BOOL JS_VALUE_IS_NAN(JSValue v)
+{
+    return v == JS_NAN;
+}
+
+#else /* !JS_NAN_BOXING && !JS_NAN_BOXING64 */
 
 typedef union JSValueUnion {
     void *ptr;
@@ -251,7 +324,7 @@ static inline JS_BOOL JS_VALUE_IS_NAN(JSValue v)
     return (u.u64 & 0x7fffffffffffffff) > 0x7ff0000000000000;
 }
 
-#endif /* !JS_NAN_BOXING */
+#endif /* !JS_NAN_BOXING && !JS_NAN_BOXING64 */
 
 #define JS_VALUE_IS_BOTH_INT(v1, v2) ((JS_VALUE_GET_TAG(v1) | JS_VALUE_GET_TAG(v2)) == 0)
 #define JS_VALUE_IS_BOTH_FLOAT(v1, v2) (JS_TAG_IS_FLOAT64(JS_VALUE_GET_TAG(v1)) && JS_TAG_IS_FLOAT64(JS_VALUE_GET_TAG(v2)))
@@ -316,6 +389,13 @@ static inline JS_BOOL JS_VALUE_IS_NAN(JSValue v)
 #define JS_EVAL_FLAG_COMPILE_ONLY (1 << 5)
 /* don't include the stack frames before this eval in the Error() backtraces */
 #define JS_EVAL_FLAG_BACKTRACE_BARRIER (1 << 6)
+/* don't keep the source code of the functions. Unlike 'strip' mode, the
+   line numbers are kept for the backtraces */
+#define JS_EVAL_FLAG_STRIP_SOURCE (1 << 7)
+/* compile the top level functions of a global script when they are first
+   called. They are still parsed by JS_Eval(), so syntax errors are
+   reported as usual. Ignored with JS_EVAL_FLAG_COMPILE_ONLY. */
+#define JS_EVAL_FLAG_LAZY (1 << 8)
 
 typedef JSValue JSCFunction(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv);
 typedef JSValue JSCFunctionMagic(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv, int magic);
@@ -342,6 +422,8 @@ JSRuntime *JS_NewRuntime(void);
 void JS_SetRuntimeInfo(JSRuntime *rt, const char *info);
 void JS_SetMemoryLimit(JSRuntime *rt, size_t limit);
 void JS_SetGCThreshold(JSRuntime *rt, size_t gc_threshold);
+void JS_AdjustExternalMemory(JSRuntime *rt, int64_t delta);
+size_t JS_GetExternalMemory(JSRuntime *rt);
 void JS_SetMaxStackSize(JSRuntime *rt, size_t stack_size);
 JSRuntime *JS_NewRuntime2(const JSMallocFunctions *mf, void *opaque);
 void JS_FreeRuntime(JSRuntime *rt);
@@ -420,9 +502,23 @@ typedef struct JSMemoryUsage {
 void JS_ComputeMemoryUsage(JSRuntime *rt, JSMemoryUsage *s);
 void JS_DumpMemoryUsage(FILE *fp, const JSMemoryUsage *s, JSRuntime *rt);
 
+/* executions of the property access opcodes that were served by their
+   inline cache (hits) or needed a full property lookup (misses) */
+typedef struct JSInlineCacheStats {
+    int64_t get_hits, get_misses;
+    int64_t put_hits, put_misses;
+} JSInlineCacheStats;
+
+void JS_GetInlineCacheStats(JSRuntime *rt, JSInlineCacheStats *s);
+void JS_ResetInlineCacheStats(JSRuntime *rt);
+
 /* atom support */
 JSAtom JS_NewAtomLen(JSContext *ctx, const char *str, size_t len);
 JSAtom JS_NewAtom(JSContext *ctx, const char *str);
+/* interns 'count' UTF-8 strings, growing the atom table once for the
+   whole batch. Return -1 with an exception and no atoms on failure. */
+int JS_NewAtoms(JSContext *ctx, JSAtom *atoms, const char * const *strs,
+                const size_t *lens, uint32_t count);
 JSAtom JS_NewAtomUInt32(JSContext *ctx, uint32_t n);
 JSAtom JS_DupAtom(JSContext *ctx, JSAtom v);
 void JS_FreeAtom(JSContext *ctx, JSAtom v);
@@ -617,7 +713,8 @@ static inline JS_BOOL JS_IsUninitialized(JSValueConst v)
 
 static inline JS_BOOL JS_IsString(JSValueConst v)
 {
-    return JS_VALUE_GET_TAG(v) == JS_TAG_STRING;
+    return JS_VALUE_GET_TAG(v) == JS_TAG_STRING ||
+        JS_VALUE_GET_TAG(v) == JS_TAG_STRING_ROPE;
 }
 
 static inline JS_BOOL JS_IsSymbol(JSValueConst v)
@@ -633,6 +730,8 @@ static inline JS_BOOL JS_IsObject(JSValueConst v)
 JSValue JS_Throw(JSContext *ctx, JSValue obj);
 JSValue JS_GetException(JSContext *ctx);
 JS_BOOL JS_IsError(JSContext *ctx, JSValueConst val);
+JS_BOOL JS_IsUncatchableError(JSContext *ctx, JSValueConst val);
+void JS_SetUncatchableError(JSContext *ctx, JSValueConst val, JS_BOOL flag);
 void JS_ResetUncatchableError(JSContext *ctx);
 JSValue JS_NewError(JSContext *ctx);
 JSValue __js_printf_like(2, 3) JS_ThrowSyntaxError(JSContext *ctx, const char *fmt, ...);
@@ -778,6 +877,39 @@ int JS_GetOwnPropertyNames(JSContext *ctx, JSPropertyEnum **ptab,
 int JS_GetOwnProperty(JSContext *ctx, JSPropertyDescriptor *desc,
                       JSValueConst obj, JSAtom prop);
 
+/* Direct access to plain data, for converters to native data
+   structures. The results are only valid until JS code runs again. */
+JS_BOOL JS_GetFastArray(JSContext *ctx, JSValueConst obj, JSValue **parray,
+                        uint32_t *plen);
+JSValue JS_NewArrayFrom(JSContext *ctx, uint32_t len, JSValue *tab);
+const void *JS_GetPlainObjectShape(JSContext *ctx, JSValueConst obj,
+                                   uint32_t *pcount);
+JSValueConst JS_GetPlainObjectSlot(JSContext *ctx, JSValueConst obj,
+                                   uint32_t idx, JSAtom *patom);
+
+/* Property plan: a fixed list of properties read or written together,
+   for example the fields of records exchanged with native code. The
+   plan caches the index of its properties for the last shapes it has
+   seen, so objects with the same layout are accessed without lookup.
+   It must be freed before the runtime. */
+typedef struct JSPropertyPlan JSPropertyPlan;
+
+JSPropertyPlan *JS_NewPropertyPlan(JSContext *ctx, const JSAtom *atoms,
+                                   uint32_t count);
+void JS_FreePropertyPlan(JSRuntime *rt, JSPropertyPlan *plan);
+/* Same as JS_GetProperty() for each property. Return -1 on exception,
+   with all the values set to JS_UNDEFINED. */
+int JS_GetPropertiesByPlan(JSContext *ctx, JSValueConst obj,
+                           JSPropertyPlan *plan, JSValue *values);
+/* Same as JS_SetProperty() for each property, stopping at the first
+   exception. The values are freed. Return -1 on exception. */
+int JS_SetPropertiesByPlan(JSContext *ctx, JSValueConst obj,
+                           JSPropertyPlan *plan, JSValue *values);
+/* Create a plain object with the properties of the plan, like an
+   object literal. The values are freed. */
+JSValue JS_NewObjectFromPlan(JSContext *ctx, JSPropertyPlan *plan,
+                             JSValue *values);
+
 JSValue JS_Call(JSContext *ctx, JSValueConst func_obj, JSValueConst this_obj,
                 int argc, JSValueConst *argv);
 JSValue JS_Invoke(JSContext *ctx, JSValueConst this_val, JSAtom atom,
@@ -810,11 +942,20 @@ void JS_SetOpaque(JSValue obj, void *opaque);
 void *JS_GetOpaque(JSValueConst obj, JSClassID class_id);
 void *JS_GetOpaque2(JSContext *ctx, JSValueConst obj, JSClassID class_id);
 
-/* 'buf' must be zero terminated i.e. buf[buf_len] = '\0'. */
+/* 'buf' is UTF-8 JSON. It does not need to be zero terminated. */
 JSValue JS_ParseJSON(JSContext *ctx, const char *buf, size_t buf_len,
                      const char *filename);
 JSValue JS_JSONStringify(JSContext *ctx, JSValueConst obj,
                          JSValueConst replacer, JSValueConst space0);
+/* return 0 if OK, -1 if the data could not be written */
+typedef int JSWriteFunc(void *opaque, const uint8_t *buf, size_t len);
+/* same as JS_JSONStringify() but the UTF-8 result is written with
+   'write_func' in one or more chunks instead of being returned as a
+   string. Return -1 if exception, 0 if JS_JSONStringify() would
+   return undefined (nothing is written) and 1 otherwise. */
+int JS_JSONStringifyUTF8(JSContext *ctx, JSValueConst obj,
+                         JSValueConst replacer, JSValueConst space0,
+                         JSWriteFunc *write_func, void *opaque);
 
 typedef void JSFreeArrayBufferDataFunc(JSRuntime *rt, void *opaque, void *ptr);
 JSValue JS_NewArrayBuffer(JSContext *ctx, uint8_t *buf, size_t len,
@@ -783,7 +783,7 @@ public:
 
     int getTag() const
     {
-        return JS_VALUE_GET_TAG(v);
+        return JS_VALUE_GET_NORM_TAG(v);
     }
 
     bool operator==(JSValueConst other) const
@@ -0,0 +1,375 @@
+#include "EventLoop.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <limits>
+#include <system_error>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#endif
+
+namespace quickjs {
+
+namespace {
+uint64_t RotateRight(uint64_t value, unsigned count) noexcept
+{
+    count &= 63;
+    return count == 0 ? value : (value >> count) | (value << (64 - count));
+}
+
+unsigned CountTrailingZeros(uint64_t value) noexcept
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return static_cast<unsigned>(index);
+#else
+    return static_cast<unsigned>(__builtin_ctzll(value));
+#endif
+}
+} // namespace
+
+TimerWheel::TimerWheel(uint64_t now) noexcept : _now { now }
+{
+}
+
+void TimerWheel::Schedule(uint64_t id, uint64_t expiry)
+{
+    auto [it, inserted] = _timers.try_emplace(id);
+    Timer* timer = &it->second;
+    if (!inserted)
+    {
+        Unlink(timer);
+    }
+
+    timer->id = id;
+    timer->expiry = expiry;
+    timer->sequence = _nextSequence++;
+    Insert(timer);
+}
+
+bool TimerWheel::Cancel(uint64_t id) noexcept
+{
+    auto it = _timers.find(id);
+    if (it == _timers.end())
+    {
+        return false;
+    }
+
+    Unlink(&it->second);
+    _timers.erase(it);
+    return true;
+}
+
+void TimerWheel::Insert(Timer* timer) noexcept
+{
+    // Expired timers go into the next tick. The slot is chosen on the lowest level where
+    // the expiry is less than a full rotation ahead, so it is never the level's current slot.
+    uint64_t expiry = std::max(timer->expiry, _now + 1);
+    unsigned level = 0;
+    for (; level < LevelCount; ++level)
+    {
+        unsigned shift = level * SlotBits;
+        if ((expiry >> shift) - (_now >> shift) < SlotCount)
+        {
+            break;
+        }
+    }
+
+    if (level == LevelCount)
+    {
+        // Beyond the wheel range: park in the last slot of the top level and cascade again later.
+        level = LevelCount - 1;
+        expiry = ((_now >> (level * SlotBits)) + SlotCount - 1) << (level * SlotBits);
+    }
+
+    unsigned slot = static_cast<unsigned>(expiry >> (level * SlotBits)) & (SlotCount - 1);
+    Level& l = _levels[level];
+    timer->level = static_cast<uint8_t>(level);
+    timer->slot = static_cast<uint8_t>(slot);
+    timer->next = nullptr;
+    timer->prev = l.tails[slot];
+    if (timer->prev)
+    {
+        timer->prev->next = timer;
+    }
+    else
+    {
+        l.heads[slot] = timer;
+    }
+
+    l.tails[slot] = timer;
+    l.occupied |= uint64_t { 1 } << slot;
+}
+
+void TimerWheel::Unlink(Timer* timer) noexcept
+{
+    Level& l = _levels[timer->level];
+    if (timer->prev)
+    {
+        timer->prev->next = timer->next;
+    }
+    else
+    {
+        l.heads[timer->slot] = timer->next;
+    }
+
+    if (timer->next)
+    {
+        timer->next->prev = timer->prev;
+    }
+    else
+    {
+        l.tails[timer->slot] = timer->prev;
+    }
+
+    if (!l.heads[timer->slot])
+    {
+        l.occupied &= ~(uint64_t { 1 } << timer->slot);
+    }
+}
+
+TimerWheel::Timer* TimerWheel::TakeSlot(unsigned level, unsigned slot) noexcept
+{
+    Level& l = _levels[level];
+    Timer* head = l.heads[slot];
+    l.heads[slot] = nullptr;
+    l.tails[slot] = nullptr;
+    l.occupied &= ~(uint64_t { 1 } << slot);
+    return head;
+}
+
+uint64_t TimerWheel::NextWorkTick() const noexcept
+{
+    uint64_t result = std::numeric_limits<uint64_t>::max();
+    for (unsigned level = 0; level < LevelCount; ++level)
+    {
+        uint64_t occupied = _levels[level].occupied;
+        if (!occupied)
+        {
+            continue;
+        }
+
+        // Level 0 slots expire on their tick; higher level slots cascade at their first tick.
+        unsigned shift = level * SlotBits;
+        uint64_t current = _now >> shift;
+        unsigned distance = CountTrailingZeros(RotateRight(occupied, static_cast<unsigned>(current + 1) & (SlotCount - 1)));
+        result = std::min(result, (current + 1 + distance) << shift);
+    }
+
+    return result;
+}
+
+std::optional<uint64_t> TimerWheel::NextExpiry() const noexcept
+{
+    if (_timers.empty())
+    {
+        return std::nullopt;
+    }
+
+    return NextWorkTick();
+}
+
+void TimerWheel::Advance(uint64_t now, std::vector<uint64_t>& expired)
+{
+    std::vector<Timer*> batch;
+    while (_now < now)
+    {
+        uint64_t next = _timers.empty() ? now + 1 : NextWorkTick();
+        if (next > now)
+        {
+            _now = now;
+            break;
+        }
+
+        _now = next;
+
+        // Cascade the higher level slots that start at this tick, timers due now go straight to the batch.
+        for (unsigned level = LevelCount - 1; level > 0; --level)
+        {
+            unsigned shift = level * SlotBits;
+            if ((_now & ((uint64_t { 1 } << shift) - 1)) != 0)
+            {
+                continue;
+            }
+
+            Timer* timer = TakeSlot(level, static_cast<unsigned>(_now >> shift) & (SlotCount - 1));
+            while (timer)
+            {
+                Timer* following = timer->next;
+                if (timer->expiry <= _now)
+                {
+                    batch.push_back(timer);
+                }
+                else
+                {
+                    Insert(timer);
+                }
+
+                timer = following;
+            }
+        }
+
+        for (Timer* timer = TakeSlot(0, static_cast<unsigned>(_now) & (SlotCount - 1)); timer; timer = timer->next)
+        {
+            batch.push_back(timer);
+        }
+
+        std::sort(batch.begin(), batch.end(), [](const Timer* a, const Timer* b) { return a->sequence < b->sequence; });
+        for (Timer* timer : batch)
+        {
+            expired.push_back(timer->id);
+            _timers.erase(timer->id);
+        }
+
+        batch.clear();
+    }
+}
+
+#ifdef __linux__
+
+EventLoopWaiter::EventLoopWaiter()
+    : _epollFd { epoll_create1(EPOLL_CLOEXEC) }
+    , _eventFd { eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC) }
+    , _timerFd { timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC) }
+{
+    if (_epollFd < 0 || _eventFd < 0 || _timerFd < 0)
+    {
+        Close();
+        throw std::system_error(errno, std::generic_category(), "Cannot create the event loop file descriptors");
+    }
+
+    for (int fd : { _eventFd, _timerFd })
+    {
+        epoll_event event {};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &event);
+    }
+}
+
+EventLoopWaiter::~EventLoopWaiter()
+{
+    Close();
+}
+
+void EventLoopWaiter::Close() noexcept
+{
+    for (int fd : { _timerFd, _eventFd, _epollFd })
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+
+    _epollFd = _eventFd = _timerFd = -1;
+}
+
+int EventLoopWaiter::fd() const noexcept
+{
+    return _epollFd;
+}
+
+void EventLoopWaiter::Wake() noexcept
+{
+    uint64_t one = 1;
+    [[maybe_unused]] auto written = write(_eventFd, &one, sizeof(one));
+}
+
+void EventLoopWaiter::ArmTimer(std::optional<uint64_t> delayMs) noexcept
+{
+    itimerspec spec {};
+    if (delayMs)
+    {
+        // A zero it_value disarms the timer, so expire after one nanosecond instead.
+        spec.it_value.tv_sec = static_cast<time_t>(*delayMs / 1000);
+        spec.it_value.tv_nsec = static_cast<long>(*delayMs % 1000) * 1000000 + (*delayMs == 0 ? 1 : 0);
+    }
+
+    timerfd_settime(_timerFd, 0, &spec, nullptr);
+}
+
+void EventLoopWaiter::Wait() noexcept
+{
+    std::array<epoll_event, 2> events;
+    while (epoll_wait(_epollFd, events.data(), static_cast<int>(events.size()), -1) < 0 && errno == EINTR)
+    {
+    }
+
+    Acknowledge();
+}
+
+void EventLoopWaiter::Acknowledge() noexcept
+{
+    uint64_t count;
+    [[maybe_unused]] auto eventRead = read(_eventFd, &count, sizeof(count));
+    [[maybe_unused]] auto timerRead = read(_timerFd, &count, sizeof(count));
+}
+
+#else
+
+EventLoopWaiter::EventLoopWaiter() = default;
+EventLoopWaiter::~EventLoopWaiter() = default;
+
+int EventLoopWaiter::fd() const noexcept
+{
+    return -1;
+}
+
+void EventLoopWaiter::Wake() noexcept
+{
+    {
+        std::lock_guard<std::mutex> lock { _mutex };
+        _woken = true;
+    }
+
+    _condition.notify_one();
+}
+
+void EventLoopWaiter::ArmTimer(std::optional<uint64_t> delayMs) noexcept
+{
+    std::lock_guard<std::mutex> lock { _mutex };
+    if (delayMs)
+    {
+        _deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(*delayMs);
+    }
+    else
+    {
+        _deadline.reset();
+    }
+}
+
+void EventLoopWaiter::Wait() noexcept
+{
+    std::unique_lock<std::mutex> lock { _mutex };
+    if (_deadline)
+    {
+        _condition.wait_until(lock, *_deadline, [this]() { return _woken; });
+    }
+    else
+    {
+        _condition.wait(lock, [this]() { return _woken; });
+    }
+
+    _woken = false;
+    _deadline.reset();
+}
+
+void EventLoopWaiter::Acknowledge() noexcept
+{
+    std::lock_guard<std::mutex> lock { _mutex };
+    _woken = false;
+}
+
+#endif
+
+}
@@ -0,0 +1,120 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace quickjs {
+
+// Hierarchical timing wheel with one tick per millisecond.
+// Each level has 64 slots and every slot of level N spans 64^N ticks. Timers live in
+// intrusive lists, so scheduling and cancelling are O(1), and advancing the clock only
+// visits occupied slots (found through per-level occupancy bitmaps) instead of scanning
+// every timer. Timers of a higher level are cascaded down when the clock reaches their slot.
+class TimerWheel
+{
+public:
+    explicit TimerWheel(uint64_t now = 0) noexcept;
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    // Schedules the timer to expire at the given tick. Rescheduling an existing id moves it.
+    void Schedule(uint64_t id, uint64_t expiry);
+
+    // Returns false if the timer is not scheduled.
+    bool Cancel(uint64_t id) noexcept;
+
+    // Moves the clock forward to now and appends the ids of expired timers,
+    // ordered by expiry and then by the order in which they were scheduled.
+    void Advance(uint64_t now, std::vector<uint64_t>& expired);
+
+    // The earliest tick at which Advance can expire a timer, or nullopt if there are none.
+    // It may be earlier than the actual expiry when timers still need to be cascaded.
+    std::optional<uint64_t> NextExpiry() const noexcept;
+
+    uint64_t Now() const noexcept { return _now; }
+    size_t Size() const noexcept { return _timers.size(); }
+    bool Empty() const noexcept { return _timers.empty(); }
+
+private:
+    static constexpr unsigned SlotBits = 6;
+    static constexpr unsigned SlotCount = 1u << SlotBits;
+    static constexpr unsigned LevelCount = 6;
+
+    struct Timer
+    {
+        uint64_t id;
+        uint64_t expiry;
+        uint64_t sequence;
+        Timer* prev;
+        Timer* next;
+        uint8_t level;
+        uint8_t slot;
+    };
+
+    struct Level
+    {
+        std::array<Timer*, SlotCount> heads {};
+        std::array<Timer*, SlotCount> tails {};
+        uint64_t occupied { 0 };
+    };
+
+    void Insert(Timer* timer) noexcept;
+    void Unlink(Timer* timer) noexcept;
+    Timer* TakeSlot(unsigned level, unsigned slot) noexcept;
+    uint64_t NextWorkTick() const noexcept;
+
+    uint64_t _now;
+    uint64_t _nextSequence { 0 };
+    std::array<Level, LevelCount> _levels {};
+    std::unordered_map<uint64_t, Timer> _timers;
+};
+
+// Lets an event loop block until a timer is due or another thread wakes it up.
+// On Linux it is backed by an epoll fd watching an eventfd and a timerfd, so an external
+// reactor can add fd() to its own poll set and run the loop when it becomes readable.
+// Elsewhere it falls back to a condition variable and fd() returns -1.
+class EventLoopWaiter
+{
+public:
+    EventLoopWaiter();
+    ~EventLoopWaiter();
+
+    EventLoopWaiter(const EventLoopWaiter&) = delete;
+    EventLoopWaiter& operator=(const EventLoopWaiter&) = delete;
+
+    int fd() const noexcept;
+
+    // Makes the waiter ready immediately. Safe to call from any thread.
+    void Wake() noexcept;
+
+    // Makes the waiter ready after the delay. nullopt disarms the timer.
+    void ArmTimer(std::optional<uint64_t> delayMs) noexcept;
+
+    // Blocks until the waiter is ready, then resets it.
+    void Wait() noexcept;
+
+    // Resets the waiter without blocking.
+    void Acknowledge() noexcept;
+
+private:
+#ifdef __linux__
+    void Close() noexcept;
+
+    int _epollFd { -1 };
+    int _eventFd { -1 };
+    int _timerFd { -1 };
+#else
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    std::optional<std::chrono::steady_clock::time_point> _deadline;
+    bool _woken { false };
+#endif
+};
+
+}
@@ -0,0 +1,408 @@
+#include "QuickJSDynamic.h"
+#include "QuickJSNative.h"
+
+#include <jsi/JSIDynamic.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace facebook;
+
+namespace quickjs {
+
+namespace {
+
+// Converts between folly::dynamic and the values of a QuickJS runtime with the QuickJS API.
+// Everything that is not a primitive, a dense array or a plain object with data properties only
+// goes through the JSI conversion, which may run JavaScript (getters, proxies).
+class QuickJSDynamicConverter
+{
+public:
+    QuickJSDynamicConverter(jsi::Runtime& runtime, JSContext* ctx) noexcept
+        : _runtime { runtime }, _ctx { ctx }
+    {
+    }
+
+    ~QuickJSDynamicConverter()
+    {
+        for (const auto& entry : _atoms)
+        {
+            JS_FreeAtom(_ctx, entry.second);
+        }
+    }
+
+    // Returns a new value, or JS_EXCEPTION with the exception pending.
+    JSValue ToJS(const folly::dynamic& dyn)
+    {
+        switch (dyn.type())
+        {
+        case folly::dynamic::NULLT:
+            return JS_NULL;
+        case folly::dynamic::ARRAY:
+        {
+            ValueList elements { _ctx };
+            elements.values.reserve(dyn.size());
+            for (const auto& element : dyn)
+            {
+                JSValue value = ToJS(element);
+                if (JS_IsException(value))
+                {
+                    return JS_EXCEPTION;
+                }
+
+                elements.values.push_back(value);
+            }
+
+            return elements.ToArray();
+        }
+        case folly::dynamic::BOOL:
+            return JS_NewBool(_ctx, dyn.getBool());
+        case folly::dynamic::DOUBLE:
+            return JS_NewFloat64(_ctx, dyn.getDouble());
+        case folly::dynamic::INT64:
+            // Not asDouble(), which throws when the value does not fit.
+            return JS_NewFloat64(_ctx, static_cast<double>(dyn.getInt()));
+        case folly::dynamic::OBJECT:
+        {
+            OwnedValue object { _ctx, JS_NewObject(_ctx) };
+            if (JS_IsException(object.value))
+            {
+                return JS_EXCEPTION;
+            }
+
+            for (const auto& element : dyn.items())
+            {
+                if (!element.first.isNumber() && !element.first.isString())
+                {
+                    continue;
+                }
+
+                JSAtom atom = Intern(element.first);
+                if (atom == 0)
+                {
+                    return JS_EXCEPTION;
+                }
+
+                JSValue value = ToJS(element.second);
+                if (JS_IsException(value) || JS_DefinePropertyValue(_ctx, object.value, atom, value, JS_PROP_C_W_E) < 0)
+                {
+                    return JS_EXCEPTION;
+                }
+            }
+
+            return object.Release();
+        }
+        case folly::dynamic::STRING:
+        {
+            const std::string& str = dyn.getString();
+            return JS_NewStringLen(_ctx, str.data(), str.size());
+        }
+        }
+
+        throw jsi::JSINativeException("Unknown folly::dynamic type");
+    }
+
+    folly::dynamic FromJS(JSValueConst value)
+    {
+        switch (JS_VALUE_GET_NORM_TAG(value))
+        {
+        case JS_TAG_UNDEFINED:
+        case JS_TAG_NULL:
+            return nullptr;
+        case JS_TAG_BOOL:
+            return JS_VALUE_GET_BOOL(value) != 0;
+        case JS_TAG_INT:
+            return static_cast<double>(JS_VALUE_GET_INT(value));
+        case JS_TAG_FLOAT64:
+            return JS_VALUE_GET_FLOAT64(value);
+        case JS_TAG_STRING:
+        case JS_TAG_STRING_ROPE:
+            return ToStdString(value);
+        case JS_TAG_OBJECT:
+            return FromJSObject(value);
+        default:
+            return FromJSI(ToJSIValue(value));
+        }
+    }
+
+private:
+    struct OwnedValue
+    {
+        OwnedValue(JSContext* ctx, JSValue value) noexcept : ctx { ctx }, value { value }
+        {
+        }
+
+        ~OwnedValue()
+        {
+            JS_FreeValue(ctx, value);
+        }
+
+        JSValue Release() noexcept
+        {
+            return std::exchange(value, JS_UNDEFINED);
+        }
+
+        JSContext* ctx;
+        JSValue value;
+    };
+
+    // Owns the values until they are moved into an array.
+    struct ValueList
+    {
+        explicit ValueList(JSContext* ctx) noexcept : ctx { ctx }
+        {
+        }
+
+        ~ValueList()
+        {
+            for (JSValue value : values)
+            {
+                JS_FreeValue(ctx, value);
+            }
+        }
+
+        JSValue ToArray()
+        {
+            JSValue array = JS_NewArrayFrom(ctx, static_cast<uint32_t>(values.size()), values.data());
+            values.clear();
+            return array;
+        }
+
+        JSContext* ctx;
+        std::vector<JSValue> values;
+    };
+
+    // The enumerable string keys of a shape and their slots.
+    struct ShapeKeys
+    {
+        std::vector<uint32_t> slots;
+        std::vector<std::string> names;
+    };
+
+    [[noreturn]]
+    void ThrowPendingException()
+    {
+        CreateJSIValue(_runtime, JS_EXCEPTION);
+        throw jsi::JSINativeException("QuickJS reported an error without exception");
+    }
+
+    jsi::Value ToJSIValue(JSValueConst value)
+    {
+        return CreateJSIValue(_runtime, JS_DupValue(_ctx, value));
+    }
+
+    // Called before going through JSI, which may run JavaScript: the arrays and shapes seen so far
+    // may change.
+    void Invalidate()
+    {
+        ++_generation;
+        _shapeKeys.clear();
+    }
+
+    folly::dynamic FromJSI(const jsi::Value& value)
+    {
+        Invalidate();
+        return jsi::dynamicFromValue(_runtime, value);
+    }
+
+    // Keeps the value alive while it is converted, as getters run by a nested conversion may remove
+    // it from its array or object.
+    folly::dynamic FromJSOwned(JSValueConst value)
+    {
+        if (!JS_VALUE_HAS_REF_COUNT(value))
+        {
+            return FromJS(value);
+        }
+
+        OwnedValue owner { _ctx, JS_DupValue(_ctx, value) };
+        return FromJS(owner.value);
+    }
+
+    std::string ToStdString(JSValueConst value)
+    {
+        size_t length;
+        const char* str = JS_ToCStringLen(_ctx, &length, value);
+        if (!str)
+        {
+            ThrowPendingException();
+        }
+
+        std::string result { str, length };
+        JS_FreeCString(_ctx, str);
+        return result;
+    }
+
+    // Returns 0 (JS_ATOM_NULL) with the exception pending on failure.
+    JSAtom Intern(const folly::dynamic& key)
+    {
+        return key.isString() ? Intern(key.getString()) : Intern(key.asString());
+    }
+
+    JSAtom Intern(const std::string& name)
+    {
+        auto it = _atoms.find(name);
+        if (it != _atoms.end())
+        {
+            return it->second;
+        }
+
+        JSAtom atom = JS_NewAtomLen(_ctx, name.data(), name.size());
+        if (atom != 0)
+        {
+            _atoms.emplace(name, atom);
+        }
+
+        return atom;
+    }
+
+    folly::dynamic FromJSObject(JSValueConst obj)
+    {
+        if (JS_IsFunction(_ctx, obj))
+        {
+            throw jsi::JSError(_runtime, "JS Functions are not convertible to dynamic");
+        }
+
+        JSValue* elements;
+        uint32_t length;
+        if (JS_GetFastArray(_ctx, obj, &elements, &length))
+        {
+            folly::dynamic result = folly::dynamic::array();
+            result.reserve(length);
+            uint64_t generation = _generation;
+            for (uint32_t i = 0; i < length; ++i)
+            {
+                if (generation != _generation)
+                {
+                    // Finish like the JSI conversion, which reads the length again.
+                    Invalidate();
+                    jsi::Array array = ToJSIValue(obj).getObject(_runtime).getArray(_runtime);
+                    for (size_t j = i; j < array.size(_runtime); ++j)
+                    {
+                        result.push_back(FromJSI(array.getValueAtIndex(_runtime, j)));
+                    }
+
+                    break;
+                }
+
+                result.push_back(FromJSOwned(elements[i]));
+            }
+
+            return result;
+        }
+
+        uint32_t slotCount;
+        const void* shape = JS_GetPlainObjectShape(_ctx, obj, &slotCount);
+        if (!shape)
+        {
+            return FromJSI(ToJSIValue(obj));
+        }
+
+        std::shared_ptr<const ShapeKeys> keys = KeysOf(shape, obj, slotCount);
+        folly::dynamic result = folly::dynamic::object();
+        uint64_t generation = _generation;
+        for (size_t i = 0; i < keys->slots.size(); ++i)
+        {
+            jsi::Value jsiValue;
+            JSValueConst value;
+            if (generation == _generation)
+            {
+                JSAtom atom;
+                value = JS_GetPlainObjectSlot(_ctx, obj, keys->slots[i], &atom);
+            }
+            else
+            {
+                // The object may have changed shape: look the remaining names up.
+                Invalidate();
+                jsiValue = ToJSIValue(obj).getObject(_runtime).getProperty(_runtime,
+                    jsi::PropNameID::forUtf8(_runtime, keys->names[i]));
+                value = GetJSValue(_runtime, jsiValue);
+            }
+
+            if (JS_IsUndefined(value))
+            {
+                continue;
+            }
+
+            // Same as the JSI conversion: a function becomes null.
+            if (JS_IsFunction(_ctx, value))
+            {
+                result.insert(keys->names[i], nullptr);
+            }
+            else
+            {
+                result.insert(keys->names[i], FromJSOwned(value));
+            }
+        }
+
+        return result;
+    }
+
+    std::shared_ptr<const ShapeKeys> KeysOf(const void* shape, JSValueConst obj, uint32_t slotCount)
+    {
+        auto& keys = _shapeKeys[shape];
+        if (!keys)
+        {
+            auto newKeys = std::make_shared<ShapeKeys>();
+            for (uint32_t i = 0; i < slotCount; ++i)
+            {
+                JSAtom atom;
+                JS_GetPlainObjectSlot(_ctx, obj, i, &atom);
+                if (atom == 0)
+                {
+                    continue;
+                }
+
+                OwnedValue name { _ctx, JS_AtomToValue(_ctx, atom) };
+                if (JS_IsException(name.value))
+                {
+                    ThrowPendingException();
+                }
+
+                newKeys->slots.push_back(i);
+                newKeys->names.push_back(ToStdString(name.value));
+            }
+
+            keys = std::move(newKeys);
+        }
+
+        return keys;
+    }
+
+    jsi::Runtime& _runtime;
+    JSContext* _ctx;
+    std::unordered_map<std::string, JSAtom> _atoms;
+    // Valid while no JavaScript runs: a shape freed by JavaScript code can be reallocated for other keys.
+    std::unordered_map<const void*, std::shared_ptr<const ShapeKeys>> _shapeKeys;
+    // Counts the conversions through JSI, which may run JavaScript.
+    uint64_t _generation { 0 };
+};
+
+}
+
+folly::dynamic __cdecl dynamicFromValue(jsi::Runtime& runtime, const jsi::Value& value)
+{
+    if (JSContext* ctx = GetJSContext(runtime))
+    {
+        QuickJSDynamicConverter converter { runtime, ctx };
+        return converter.FromJS(GetJSValue(runtime, value));
+    }
+
+    return jsi::dynamicFromValue(runtime, value);
+}
+
+jsi::Value __cdecl valueFromDynamic(jsi::Runtime& runtime, const folly::dynamic& dyn)
+{
+    if (JSContext* ctx = GetJSContext(runtime))
+    {
+        QuickJSDynamicConverter converter { runtime, ctx };
+        return CreateJSIValue(runtime, converter.ToJS(dyn));
+    }
+
+    return jsi::valueFromDynamic(runtime, dyn);
+}
+
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <folly/dynamic.h>
+#include <jsi/jsi.h>
+
+// Conversions between folly::dynamic and JS values. Built with the QuickJSIFolly project option,
+// which defines QUICKJSI_FOLLY.
+
+namespace quickjs {
+
+// Same results as facebook::jsi::dynamicFromValue (jsi/JSIDynamic.h). The values of a QuickJS runtime
+// are read with the QuickJS API: dense arrays from their storage and plain objects slot by slot, with
+// the keys of a shape converted once. Other values and other runtimes go through the JSI conversion.
+folly::dynamic __cdecl dynamicFromValue(facebook::jsi::Runtime& runtime, const facebook::jsi::Value& value);
+
+// Like facebook::jsi::valueFromDynamic. For a QuickJS runtime, arrays are built in one step and object
+// keys are interned once per conversion. The properties are defined like JSON.parse does, so unlike
+// the JSI conversion, a "__proto__" key or a setter on Object.prototype is not invoked.
+facebook::jsi::Value __cdecl valueFromDynamic(facebook::jsi::Runtime& runtime, const folly::dynamic& dyn);
+
+}
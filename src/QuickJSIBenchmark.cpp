@@ -0,0 +1,1164 @@
+#include "gtest/gtest.h"
+#include "QuickJSRuntime.h"
+#include "EventLoop.h"
+#include "jsi/instrumentation.h"
+
+#ifdef QUICKJSI_FOLLY
+#include "QuickJSDynamic.h"
+#include "jsi/JSIDynamic.h"
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <list>
+#include <random>
+#include <sstream>
+
+// Benchmarks are disabled by default. Run them with:
+//   QuickJSI --gtest_also_run_disabled_tests --gtest_filter=Benchmark*
+
+using namespace facebook::jsi;
+
+namespace {
+
+class Stopwatch
+{
+public:
+    double ElapsedMs() const
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - _start).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point _start { std::chrono::steady_clock::now() };
+};
+
+void Report(const char* name, double ms)
+{
+    std::cout << "[ BENCH    ] " << name << ": " << ms << " ms" << std::endl;
+    ::testing::Test::RecordProperty(name, std::to_string(ms));
+}
+
+std::unique_ptr<Runtime> MakeRuntime(bool enableEventLoop = false)
+{
+    quickjs::QuickJSRuntimeArgs args;
+    args.enableEventLoop = enableEventLoop;
+    return quickjs::makeQuickJSRuntime(std::move(args));
+}
+
+} // namespace
+
+constexpr size_t TimerCount = 100000;
+constexpr uint64_t TimerSpreadMs = 1000;
+
+TEST(BenchmarkTimers, DISABLED_TimerWheel100kTimers)
+{
+    std::mt19937_64 random { 1 };
+    quickjs::TimerWheel wheel;
+    std::vector<uint64_t> expired;
+
+    Stopwatch stopwatch;
+    for (uint64_t id = 0; id < TimerCount; ++id)
+    {
+        wheel.Schedule(id, random() % TimerSpreadMs);
+    }
+
+    for (uint64_t now = 0; now <= TimerSpreadMs; ++now)
+    {
+        wheel.Advance(now, expired);
+    }
+
+    Report("TimerWheel schedule + expire 100k timers", stopwatch.ElapsedMs());
+    EXPECT_EQ(expired.size(), TimerCount);
+}
+
+// The unsorted list scanned on every iteration, as done by os_timers in quickjs-libc.c.
+TEST(BenchmarkTimers, DISABLED_LinearScan100kTimers)
+{
+    struct Timer
+    {
+        uint64_t id;
+        uint64_t expiry;
+    };
+
+    std::mt19937_64 random { 1 };
+    std::list<Timer> timers;
+    std::vector<uint64_t> expired;
+
+    Stopwatch stopwatch;
+    for (uint64_t id = 0; id < TimerCount; ++id)
+    {
+        timers.push_back({ id, random() % TimerSpreadMs });
+    }
+
+    for (uint64_t now = 0; now <= TimerSpreadMs; ++now)
+    {
+        for (auto it = timers.begin(); it != timers.end();)
+        {
+            if (it->expiry <= now)
+            {
+                expired.push_back(it->id);
+                it = timers.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    Report("Linear scan schedule + expire 100k timers", stopwatch.ElapsedMs());
+    EXPECT_EQ(expired.size(), TimerCount);
+}
+
+TEST(BenchmarkTimers, DISABLED_SetTimeout100kTimers)
+{
+    auto rt = MakeRuntime(true);
+
+    Stopwatch stopwatch;
+    rt->evaluateJavaScript(std::make_unique<StringBuffer>(R"(
+        var fired = 0;
+        for (let i = 0; i < 100000; ++i) {
+            setTimeout(() => { ++fired; }, i % 50);
+        }
+        var cancelled = [];
+        for (let i = 0; i < 100000; i += 2) {
+            cancelled.push(setTimeout(() => { throw new Error('cancelled timer fired'); }, 1000));
+        }
+        cancelled.forEach(clearTimeout);
+    )"), "<bench>");
+    quickjs::runEventLoop(*rt);
+
+    Report("setTimeout 100k concurrent timers (+50k cancelled)", stopwatch.ElapsedMs());
+    EXPECT_EQ(rt->global().getProperty(*rt, "fired").getNumber(), TimerCount);
+}
+
+namespace {
+
+std::vector<quickjs::ScriptSource> MakeFeatureModules(size_t count)
+{
+    std::vector<quickjs::ScriptSource> sources;
+    for (size_t module = 0; module < count; ++module)
+    {
+        std::ostringstream source;
+        for (int i = 0; i < 2000; ++i)
+        {
+            source << "function feature" << module << "_" << i << "(a, b) {"
+                   << " const o = { x: a, y: b, list: [a, b, " << i << "] };"
+                   << " for (let k = 0; k < o.list.length; ++k) { if (o.list[k] > " << i << ") return o.x * k; }"
+                   << " return `${o.x}-${o.y}`; }\n";
+        }
+
+        sources.push_back({ std::make_shared<StringBuffer>(source.str()), "feature" + std::to_string(module) + ".js" });
+    }
+
+    return sources;
+}
+
+} // namespace
+
+constexpr size_t FeatureModuleCount = 32;
+
+TEST(BenchmarkCompile, DISABLED_SerialEvaluate)
+{
+    auto sources = MakeFeatureModules(FeatureModuleCount);
+    auto rt = MakeRuntime();
+
+    Stopwatch stopwatch;
+    for (const auto& source : sources)
+    {
+        rt->evaluateJavaScript(source.buffer, source.sourceURL);
+    }
+
+    Report("Evaluate 32 modules serially", stopwatch.ElapsedMs());
+}
+
+TEST(BenchmarkCompile, DISABLED_ConcurrentPrepareThenEvaluate)
+{
+    auto sources = MakeFeatureModules(FeatureModuleCount);
+    auto rt = MakeRuntime();
+
+    Stopwatch stopwatch;
+    for (auto& prepared : quickjs::prepareJavaScriptConcurrently(std::move(sources)))
+    {
+        rt->evaluatePreparedJavaScript(prepared.get());
+    }
+
+    Report("Prepare 32 modules concurrently, then evaluate", stopwatch.ElapsedMs());
+}
+
+namespace {
+
+// Evaluates the modules and calls one function in twenty, like a bundle where most features never run.
+void RunLazyCompilationBenchmark(const char* name, bool enableLazyCompilation)
+{
+    auto sources = MakeFeatureModules(FeatureModuleCount);
+    quickjs::QuickJSRuntimeArgs args;
+    args.enableLazyCompilation = enableLazyCompilation;
+    auto rt = quickjs::makeQuickJSRuntime(std::move(args));
+    auto& instrumentation = rt->instrumentation();
+    auto before = instrumentation.getHeapInfo(true);
+
+    Stopwatch stopwatch;
+    for (size_t module = 0; module < sources.size(); ++module)
+    {
+        rt->evaluateJavaScript(sources[module].buffer, sources[module].sourceURL);
+        rt->evaluateJavaScript(std::make_unique<StringBuffer>(
+            "for (let i = 0; i < 2000; i += 20) globalThis['feature" + std::to_string(module) + "_' + i](i, 1);"), "<bench>");
+    }
+
+    Report(name, stopwatch.ElapsedMs());
+    instrumentation.collectGarbage();
+    auto after = instrumentation.getHeapInfo(true);
+    std::cout << "[ BENCH    ] " << (after["quickjs_mallocSize"] - before["quickjs_mallocSize"]) / 1024 << " KB of heap after evaluation" << std::endl;
+}
+
+} // namespace
+
+TEST(BenchmarkCompile, DISABLED_EagerCompilation)
+{
+    RunLazyCompilationBenchmark("Evaluate 32 modules, compiling every function", false);
+}
+
+TEST(BenchmarkCompile, DISABLED_LazyCompilation)
+{
+    RunLazyCompilationBenchmark("Evaluate 32 modules, compiling functions on first call", true);
+}
+
+namespace {
+
+void RunPropertyAccessBenchmark(const char* name, const char* source)
+{
+    auto rt = MakeRuntime();
+    rt->evaluateJavaScript(std::make_unique<StringBuffer>(source), "<bench>");
+    auto run = rt->global().getPropertyAsFunction(*rt, "run");
+    run.call(*rt);
+    quickjs::resetInlineCacheStats(*rt);
+
+    Stopwatch stopwatch;
+    run.call(*rt);
+    Report(name, stopwatch.ElapsedMs());
+
+    auto stats = quickjs::getInlineCacheStats(*rt);
+    std::cout << "[ BENCH    ] get hit rate " << 100.0 * stats.getHits / std::max<uint64_t>(1, stats.getHits + stats.getMisses)
+              << "%, put hit rate " << 100.0 * stats.putHits / std::max<uint64_t>(1, stats.putHits + stats.putMisses) << "%" << std::endl;
+}
+
+} // namespace
+
+TEST(BenchmarkPropertyAccess, DISABLED_MonomorphicFields)
+{
+    RunPropertyAccessBenchmark("Monomorphic field reads and writes", R"(
+        const points = [];
+        for (let i = 0; i < 1000; ++i) points.push({ x: i, y: -i, z: 0 });
+        function run() {
+            for (let n = 0; n < 2000; ++n) {
+                for (const p of points) { p.z = p.x + p.y; }
+            }
+        }
+    )");
+}
+
+TEST(BenchmarkPropertyAccess, DISABLED_PrototypeMethods)
+{
+    RunPropertyAccessBenchmark("Prototype method calls", R"(
+        class Counter { constructor() { this.count = 0; } add(n) { this.count += n; } get() { return this.count; } }
+        const counters = [];
+        for (let i = 0; i < 1000; ++i) counters.push(new Counter());
+        function run() {
+            for (let n = 0; n < 1000; ++n) {
+                for (const c of counters) { c.add(c.get() & 7); }
+            }
+        }
+    )");
+}
+
+TEST(BenchmarkPropertyAccess, DISABLED_PolymorphicFields)
+{
+    RunPropertyAccessBenchmark("Polymorphic (4 shapes) field reads", R"(
+        const objects = [];
+        for (let i = 0; i < 1000; ++i) {
+            switch (i % 4) {
+            case 0: objects.push({ value: i }); break;
+            case 1: objects.push({ a: 0, value: i }); break;
+            case 2: objects.push({ a: 0, b: 0, value: i }); break;
+            case 3: objects.push({ a: 0, b: 0, c: 0, value: i }); break;
+            }
+        }
+        function run() {
+            let sum = 0;
+            for (let n = 0; n < 2000; ++n) {
+                for (const o of objects) { sum += o.value; }
+            }
+            return sum;
+        }
+    )");
+}
+
+// Number crunching scripts used to choose the superinstructions in quickjs-opcode.h.
+// Build quickjs.c with CONFIG_OPCODE_HISTOGRAM to get their opcode pair and triple counts.
+namespace {
+
+void RunInterpreterBenchmark(const char* name, const char* source)
+{
+    auto rt = MakeRuntime();
+    rt->evaluateJavaScript(std::make_unique<StringBuffer>(source), "<bench>");
+    auto run = rt->global().getPropertyAsFunction(*rt, "run");
+
+    Stopwatch stopwatch;
+    auto result = run.call(*rt);
+    Report(name, stopwatch.ElapsedMs());
+    EXPECT_TRUE(result.isNumber());
+}
+
+} // namespace
+
+TEST(BenchmarkInterpreter, DISABLED_Sieve)
+{
+    RunInterpreterBenchmark("Sieve of Eratosthenes", R"(
+        function run() {
+            let count = 0;
+            for (let n = 0; n < 20; ++n) {
+                const flags = new Array(100000).fill(true);
+                count = 0;
+                for (let i = 2; i < flags.length; ++i) {
+                    if (flags[i]) {
+                        ++count;
+                        for (let j = i + i; j < flags.length; j += i) flags[j] = false;
+                    }
+                }
+            }
+            return count;
+        }
+    )");
+}
+
+TEST(BenchmarkInterpreter, DISABLED_Fibonacci)
+{
+    RunInterpreterBenchmark("Recursive Fibonacci", R"(
+        function fib(n) { return n < 2 ? n : fib(n - 1) + fib(n - 2); }
+        function run() { return fib(27); }
+    )");
+}
+
+TEST(BenchmarkInterpreter, DISABLED_MatrixMultiply)
+{
+    RunInterpreterBenchmark("Matrix multiply", R"(
+        function matrix(n, seed) {
+            const m = [];
+            for (let i = 0; i < n; ++i) {
+                const row = [];
+                for (let j = 0; j < n; ++j) row.push((i * j + seed) % 7);
+                m.push(row);
+            }
+            return m;
+        }
+        function multiply(a, b, n) {
+            const c = matrix(n, 0);
+            for (let i = 0; i < n; ++i) {
+                const ai = a[i], ci = c[i];
+                for (let j = 0; j < n; ++j) {
+                    let sum = 0;
+                    for (let k = 0; k < n; ++k) sum += ai[k] * b[k][j];
+                    ci[j] = sum;
+                }
+            }
+            return c;
+        }
+        function run() {
+            const a = matrix(120, 1), b = matrix(120, 2);
+            return multiply(a, b, 120)[7][11];
+        }
+    )");
+}
+
+TEST(BenchmarkInterpreter, DISABLED_NBody)
+{
+    RunInterpreterBenchmark("N-body simulation", R"(
+        function body(x, y, z, vx, vy, vz, mass) { return { x, y, z, vx, vy, vz, mass }; }
+        function advance(bodies, dt) {
+            const n = bodies.length;
+            for (let i = 0; i < n; ++i) {
+                const bi = bodies[i];
+                for (let j = i + 1; j < n; ++j) {
+                    const bj = bodies[j];
+                    const dx = bi.x - bj.x, dy = bi.y - bj.y, dz = bi.z - bj.z;
+                    const d2 = dx * dx + dy * dy + dz * dz;
+                    const mag = dt / (d2 * Math.sqrt(d2));
+                    bi.vx -= dx * bj.mass * mag; bi.vy -= dy * bj.mass * mag; bi.vz -= dz * bj.mass * mag;
+                    bj.vx += dx * bi.mass * mag; bj.vy += dy * bi.mass * mag; bj.vz += dz * bi.mass * mag;
+                }
+            }
+            for (let i = 0; i < n; ++i) {
+                const b = bodies[i];
+                b.x += dt * b.vx; b.y += dt * b.vy; b.z += dt * b.vz;
+            }
+        }
+        function run() {
+            const bodies = [
+                body(0, 0, 0, 0, 0, 0, 39.47),
+                body(4.84, -1.16, -0.10, 0.60, 2.81, -0.02, 0.037),
+                body(8.34, 4.12, -0.40, -1.01, 1.82, 0.008, 0.011),
+                body(12.89, -15.11, -0.22, 1.08, 0.86, -0.01, 0.0017),
+                body(15.37, -25.91, 0.17, 0.97, 0.59, -0.03, 0.002),
+            ];
+            for (let i = 0; i < 100000; ++i) advance(bodies, 0.01);
+            return bodies[0].x;
+        }
+    )");
+}
+
+TEST(BenchmarkInterpreter, DISABLED_Mandelbrot)
+{
+    RunInterpreterBenchmark("Mandelbrot", R"(
+        function run() {
+            let inside = 0;
+            for (let y = 0; y < 200; ++y) {
+                for (let x = 0; x < 200; ++x) {
+                    const cr = x / 100 - 1.5, ci = y / 100 - 1;
+                    let zr = 0, zi = 0, i = 0;
+                    for (; i < 50 && zr * zr + zi * zi < 4; ++i) {
+                        const t = zr * zr - zi * zi + cr;
+                        zi = 2 * zr * zi + ci;
+                        zr = t;
+                    }
+                    if (i === 50) ++inside;
+                }
+            }
+            return inside;
+        }
+    )");
+}
+
+TEST(BenchmarkInterpreter, DISABLED_Crc32)
+{
+    RunInterpreterBenchmark("CRC-32", R"(
+        const table = [];
+        for (let n = 0; n < 256; ++n) {
+            let c = n;
+            for (let k = 0; k < 8; ++k) c = c & 1 ? 0xedb88320 ^ (c >>> 1) : c >>> 1;
+            table.push(c >>> 0);
+        }
+        function crc32(bytes) {
+            let crc = -1;
+            for (let i = 0; i < bytes.length; ++i) crc = table[(crc ^ bytes[i]) & 0xff] ^ (crc >>> 8);
+            return (crc ^ -1) >>> 0;
+        }
+        function run() {
+            const bytes = new Uint8Array(100000);
+            for (let i = 0; i < bytes.length; ++i) bytes[i] = i * 31;
+            let crc = 0;
+            for (let n = 0; n < 20; ++n) crc = crc32(bytes);
+            return crc;
+        }
+    )");
+}
+
+TEST(BenchmarkObjectLiteral, DISABLED_SmallRecords)
+{
+    RunInterpreterBenchmark("Small object literals", R"(
+        function message(i) { return { type: 'event', id: i, time: i * 16, source: null, payload: i & 7 }; }
+        function run() {
+            let sum = 0;
+            for (let i = 0; i < 1000000; ++i) sum += message(i).payload;
+            return sum;
+        }
+    )");
+}
+
+TEST(BenchmarkObjectLayout, DISABLED_SmallObjects)
+{
+    auto rt = MakeRuntime();
+    rt->evaluateJavaScript(std::make_unique<StringBuffer>(R"(
+        var objects = [];
+        function allocate() {
+            for (let i = 0; i < 200000; ++i) objects.push({ x: i, y: i + 1, z: i + 2 });
+        }
+        function run() {
+            let sum = 0;
+            for (let n = 0; n < 20; ++n) {
+                for (let i = 0; i < objects.length; ++i) { const o = objects[i]; sum += o.x + o.y + o.z; }
+            }
+            return sum;
+        }
+    )"), "<bench>");
+
+    auto& instrumentation = rt->instrumentation();
+    instrumentation.collectGarbage();
+    auto before = instrumentation.getHeapInfo(true);
+    rt->global().getPropertyAsFunction(*rt, "allocate").call(*rt);
+    instrumentation.collectGarbage();
+    auto after = instrumentation.getHeapInfo(true);
+
+    auto objectCount = after["quickjs_objectCount"] - before["quickjs_objectCount"];
+    auto mallocSize = after["quickjs_mallocSize"] - before["quickjs_mallocSize"];
+    auto mallocCount = after["quickjs_mallocCount"] - before["quickjs_mallocCount"];
+    std::cout << "[ BENCH    ] " << mallocSize / objectCount << " bytes and " << static_cast<double>(mallocCount) / objectCount
+              << " allocations per 3 property object" << std::endl;
+
+    // Best of five, the reads are short enough to be dominated by scheduling noise otherwise.
+    auto run = rt->global().getPropertyAsFunction(*rt, "run");
+    double best = std::numeric_limits<double>::max();
+    for (int i = 0; i < 5; ++i)
+    {
+        Stopwatch stopwatch;
+        run.call(*rt);
+        best = std::min(best, stopwatch.ElapsedMs());
+    }
+
+    Report("Property reads of 200k small objects", best);
+}
+
+TEST(BenchmarkStrings, DISABLED_RepeatedConcatenation)
+{
+    RunInterpreterBenchmark("Append to a string in a loop", R"(
+        function run() {
+            let length = 0;
+            for (let n = 0; n < 5; ++n) {
+                let s = '';
+                for (let i = 0; i < 200000; ++i) s += 'item ' + i + ', ';
+                length += s.length + s.charCodeAt(s.length - 1);
+            }
+            return length;
+        }
+    )");
+}
+
+TEST(BenchmarkStrings, DISABLED_CaseAndSearchAscii)
+{
+    RunInterpreterBenchmark("Convert, normalize and search a 1.7 MB ASCII text", R"(
+        var text = ('The quick brown fox jumps over the lazy dog while Request ' + 'x'.repeat(20) + ' served\n').repeat(20000);
+        function run() {
+            let count = 0;
+            for (let i = 0; i < 20; ++i) {
+                count += text.toLowerCase().length + text.toUpperCase().length + text.normalize('NFD').length;
+                count += text.indexOf('lazy cat') + (text.includes('zebra') ? 1 : 0) + text.split('served').length;
+            }
+            return count;
+        }
+    )");
+}
+
+TEST(BenchmarkArrays, DISABLED_CallbackBuiltins)
+{
+    RunInterpreterBenchmark("forEach, map, filter, some and reduce over 100k elements", R"(
+        var values = Array.from({ length: 100000 }, function (x, i) { return i; });
+        function run() {
+            let sum = 0;
+            for (let i = 0; i < 10; ++i) {
+                values.forEach(function (x) { sum += x; });
+                sum += values.map(function (x) { return x * 2; }).length;
+                sum += values.filter(function (x) { return (x & 3) === 0; }).length;
+                sum += values.some(function (x) { return x < 0; }) ? 1 : 0;
+                sum += values.reduce(function (a, x) { return a + x; }, 0);
+            }
+            return sum;
+        }
+    )");
+}
+
+TEST(BenchmarkArrays, DISABLED_IteratorsAndSpread)
+{
+    RunInterpreterBenchmark("for-of, entries, spread and Array.from over 100k elements", R"(
+        var values = Array.from({ length: 100000 }, function (x, i) { return i; });
+        function run() {
+            let sum = 0;
+            for (let i = 0; i < 10; ++i) {
+                for (const x of values)
+                    sum += x;
+                for (const [k, x] of values.entries())
+                    sum += k;
+                sum += [...values, ...values].length;
+                sum += Array.from(values).length + Array.from(values, function (x) { return x + 1; }).length;
+            }
+            return sum;
+        }
+    )");
+}
+
+TEST(BenchmarkMaps, DISABLED_MillionEntryMap)
+{
+    auto rt = MakeRuntime();
+    rt->evaluateJavaScript(std::make_unique<StringBuffer>(R"(
+        var cache = new Map();
+        function allocate() {
+            for (let i = 0; i < 1000000; ++i) cache.set(i, i);
+        }
+        function run() {
+            let sum = 0;
+            for (let i = 0; i < 1000000; ++i) sum += cache.get(i);
+            for (let i = 0; i < 1000000; i += 2) cache.delete(i);
+            for (let i = 0; i < 1000000; ++i) sum += cache.has(i) ? 1 : 0;
+            for (const [k, v] of cache) sum += v;
+            for (let i = 0; i < 1000000; i += 2) cache.set(i, i);
+            const names = new Map();
+            for (let i = 0; i < 200000; ++i) names.set('key' + i, i);
+            for (let i = 0; i < 200000; ++i) sum += names.get('key' + i);
+            return sum;
+        }
+    )"), "<bench>");
+
+    auto& instrumentation = rt->instrumentation();
+    instrumentation.collectGarbage();
+    auto before = instrumentation.getHeapInfo(true);
+    rt->global().getPropertyAsFunction(*rt, "allocate").call(*rt);
+    auto after = instrumentation.getHeapInfo(true);
+    std::cout << "[ BENCH    ] " << (after["quickjs_mallocSize"] - before["quickjs_mallocSize"]) / 1000000
+              << " bytes per Map entry" << std::endl;
+
+    auto run = rt->global().getPropertyAsFunction(*rt, "run");
+    Stopwatch stopwatch;
+    auto result = run.call(*rt);
+    Report("3.9M get, has, delete, set and iteration steps on a 1M entry Map", stopwatch.ElapsedMs());
+    EXPECT_TRUE(result.isNumber());
+}
+
+TEST(BenchmarkTypedArrays, DISABLED_SortAndScanFloat64)
+{
+    RunInterpreterBenchmark("Sort, fill, search and convert 2M element typed arrays", R"(
+        var values = new Float64Array(2000000).map(function (x, i) { return Math.sin(i) * 1e6; });
+        var floats = new Float64Array(values.length), ints = new Int32Array(values.length);
+        function run() {
+            let count = 0;
+            for (let i = 0; i < 5; ++i) {
+                floats.set(values);
+                floats.sort();
+                ints.set(values);
+                ints.sort();
+                count += floats.indexOf(values[i]) + ints.lastIndexOf(ints[i]) + (floats.includes(1.5) ? 1 : 0);
+                floats.fill(i + 0.5);
+            }
+            return count;
+        }
+    )");
+}
+
+namespace {
+
+std::vector<std::string> MakeModuleMemberNames()
+{
+    std::vector<std::string> names;
+    for (int module = 0; module < 500; ++module)
+    {
+        for (int member = 0; member < 100; ++member)
+        {
+            names.push_back("NativeModule" + std::to_string(module) + "_method" + std::to_string(member));
+        }
+    }
+
+    return names;
+}
+
+} // namespace
+
+TEST(BenchmarkPropNameID, DISABLED_CreateOneByOne)
+{
+    auto names = MakeModuleMemberNames();
+    auto rt = MakeRuntime();
+    std::vector<PropNameID> ids;
+    ids.reserve(names.size());
+
+    Stopwatch stopwatch;
+    for (const auto& name : names)
+    {
+        ids.push_back(PropNameID::forAscii(*rt, name));
+    }
+
+    Report("50k new PropNameIDs, one by one", stopwatch.ElapsedMs());
+
+    stopwatch = {};
+    for (const auto& name : names)
+    {
+        ids.push_back(PropNameID::forAscii(*rt, name));
+    }
+
+    Report("50k existing PropNameIDs, one by one", stopwatch.ElapsedMs());
+}
+
+TEST(BenchmarkPropNameID, DISABLED_CreateBatch)
+{
+    auto names = MakeModuleMemberNames();
+    std::vector<std::string_view> views { names.begin(), names.end() };
+    auto rt = MakeRuntime();
+
+    Stopwatch stopwatch;
+    auto ids = quickjs::createPropNameIDs(*rt, views);
+    Report("50k new PropNameIDs, batch", stopwatch.ElapsedMs());
+
+    stopwatch = {};
+    auto existing = quickjs::createPropNameIDs(*rt, views);
+    Report("50k existing PropNameIDs, batch", stopwatch.ElapsedMs());
+}
+
+namespace {
+
+const std::vector<std::string_view> RecordFields { "id", "name", "x", "y", "width", "height", "visible", "opacity" };
+
+// 1000 records with the same layout, as a bridge receives them every frame.
+std::vector<Object> MakeRecords(Runtime& rt)
+{
+    auto array = rt.evaluateJavaScript(std::make_unique<StringBuffer>(R"(
+        Array.from({ length: 1000 }, (_, i) => ({
+            id: i, name: 'view' + i, x: i % 640, y: i % 480, width: 100, height: 20, visible: true, opacity: 0.5 }))
+    )"), "<bench>").getObject(rt).getArray(rt);
+
+    std::vector<Object> records;
+    for (size_t i = 0; i < array.size(rt); ++i)
+    {
+        records.push_back(array.getValueAtIndex(rt, i).getObject(rt));
+    }
+    return records;
+}
+
+} // namespace
+
+TEST(BenchmarkPropertyPlan, DISABLED_ReadOneByOne)
+{
+    auto rt = MakeRuntime();
+    auto records = MakeRecords(*rt);
+    auto ids = quickjs::createPropNameIDs(*rt, RecordFields);
+
+    Stopwatch stopwatch;
+    double sum = 0;
+    for (int frame = 0; frame < 1000; ++frame)
+    {
+        for (const auto& record : records)
+        {
+            for (const auto& id : ids)
+            {
+                auto value = record.getProperty(*rt, id);
+                sum += value.isNumber() ? value.getNumber() : 1;
+            }
+        }
+    }
+    Report("Read 1000 frames of 1000 records of 8 fields, getProperty", stopwatch.ElapsedMs());
+    EXPECT_GT(sum, 0);
+}
+
+TEST(BenchmarkPropertyPlan, DISABLED_ReadWithPlan)
+{
+    auto rt = MakeRuntime();
+    auto records = MakeRecords(*rt);
+    auto plan = quickjs::createPropertyPlan(*rt, RecordFields);
+
+    Stopwatch stopwatch;
+    double sum = 0;
+    Value values[8];
+    for (int frame = 0; frame < 1000; ++frame)
+    {
+        for (const auto& record : records)
+        {
+            quickjs::getProperties(*rt, record, *plan, values);
+            for (const auto& value : values)
+            {
+                sum += value.isNumber() ? value.getNumber() : 1;
+            }
+        }
+    }
+    Report("Read 1000 frames of 1000 records of 8 fields, getProperties", stopwatch.ElapsedMs());
+    EXPECT_GT(sum, 0);
+}
+
+TEST(BenchmarkPropertyPlan, DISABLED_UpdateOneByOne)
+{
+    auto rt = MakeRuntime();
+    auto records = MakeRecords(*rt);
+    auto ids = quickjs::createPropNameIDs(*rt, RecordFields);
+
+    Stopwatch stopwatch;
+    for (int frame = 0; frame < 1000; ++frame)
+    {
+        for (auto& record : records)
+        {
+            for (size_t field = 0; field < ids.size(); ++field)
+            {
+                record.setProperty(*rt, ids[field], static_cast<double>(frame + field));
+            }
+        }
+    }
+    Report("Update 1000 frames of 1000 records of 8 fields, setProperty", stopwatch.ElapsedMs());
+}
+
+TEST(BenchmarkPropertyPlan, DISABLED_UpdateWithPlan)
+{
+    auto rt = MakeRuntime();
+    auto records = MakeRecords(*rt);
+    auto plan = quickjs::createPropertyPlan(*rt, RecordFields);
+
+    Stopwatch stopwatch;
+    Value values[8];
+    for (int frame = 0; frame < 1000; ++frame)
+    {
+        for (size_t field = 0; field < plan->size(); ++field)
+        {
+            values[field] = static_cast<double>(frame + field);
+        }
+        for (auto& record : records)
+        {
+            quickjs::setProperties(*rt, record, *plan, values);
+        }
+    }
+    Report("Update 1000 frames of 1000 records of 8 fields, setProperties", stopwatch.ElapsedMs());
+}
+
+TEST(BenchmarkPropertyPlan, DISABLED_CreateOneByOne)
+{
+    auto rt = MakeRuntime();
+    auto ids = quickjs::createPropNameIDs(*rt, RecordFields);
+
+    Stopwatch stopwatch;
+    for (int i = 0; i < 100000; ++i)
+    {
+        Object record(*rt);
+        for (size_t field = 0; field < ids.size(); ++field)
+        {
+            record.setProperty(*rt, ids[field], static_cast<double>(i + field));
+        }
+    }
+    Report("Create 100k records of 8 fields, setProperty", stopwatch.ElapsedMs());
+}
+
+TEST(BenchmarkPropertyPlan, DISABLED_CreateWithPlan)
+{
+    auto rt = MakeRuntime();
+    auto plan = quickjs::createPropertyPlan(*rt, RecordFields);
+
+    Stopwatch stopwatch;
+    Value values[8];
+    for (int i = 0; i < 100000; ++i)
+    {
+        for (size_t field = 0; field < plan->size(); ++field)
+        {
+            values[field] = static_cast<double>(i + field);
+        }
+        quickjs::createObjectFromPlan(*rt, *plan, values);
+    }
+    Report("Create 100k records of 8 fields, createObjectFromPlan", stopwatch.ElapsedMs());
+}
+
+namespace {
+
+// Metro-like bundle of small modules. The minified flavor has no comments or indentation.
+std::string MakeBundle(bool minified)
+{
+    const char* nl = minified ? "" : "\n";
+    const char* indent = minified ? "" : "    ";
+    std::ostringstream source;
+    for (int module = 0; module < 5000; ++module)
+    {
+        if (!minified)
+        {
+            source << "/**\n * Module " << module << ": formats and validates the records shown in the list view.\n"
+                   << " * @param {Object} record The record to format.\n */\n";
+        }
+
+        source << "__d(function(global,require,module,exports){" << nl
+               << indent << "'use strict';" << nl;
+        if (!minified)
+        {
+            source << indent << "// Keep the messages in sync with the server side validation.\n";
+        }
+
+        source << indent << "var messages" << module << "={notFound:'The requested resource could not be found.',"
+               << "forbidden:\"You do not have permission to view this page.\"};" << nl
+               << indent << "function formatRecord" << module << "(record,options){" << nl
+               << indent << indent << "var label=`${record.firstName} ${record.lastName} (${record.identifier})`;" << nl
+               << indent << indent << "return options&&options.uppercase?label.toUpperCase():label;" << nl
+               << indent << "}" << nl
+               << indent << "module.exports={formatRecord:formatRecord" << module << ",messages:messages" << module
+               << ",version:'" << module << ".0.0'};" << nl
+               << "});\n";
+    }
+
+    return source.str();
+}
+
+void RunParseBenchmark(const char* name, const std::string& bundle)
+{
+    auto rt = MakeRuntime();
+    auto buffer = std::make_shared<StringBuffer>(bundle);
+
+    // Best of five, prepareJavaScript parses and compiles the bundle without running it.
+    double best = std::numeric_limits<double>::max();
+    for (int i = 0; i < 5; ++i)
+    {
+        Stopwatch stopwatch;
+        rt->prepareJavaScript(buffer, "bundle.js");
+        best = std::min(best, stopwatch.ElapsedMs());
+    }
+
+    Report(name, best);
+    std::cout << "[ BENCH    ] " << bundle.size() / 1000.0 / best << " MB/s" << std::endl;
+}
+
+} // namespace
+
+TEST(BenchmarkParse, DISABLED_MinifiedBundle)
+{
+    RunParseBenchmark("Parse a minified bundle", MakeBundle(true));
+}
+
+TEST(BenchmarkParse, DISABLED_CommentedBundle)
+{
+    RunParseBenchmark("Parse an indented bundle with comments", MakeBundle(false));
+}
+
+TEST(BenchmarkParse, DISABLED_StringsAndComments)
+{
+    const std::string text = "The quick brown fox jumps over the lazy dog while the compiler keeps scanning ";
+    std::ostringstream source;
+    for (int i = 0; i < 20000; ++i)
+    {
+        source << "    /* " << text << text << i << " */\n"
+               << "    registerString(" << i << ", '" << text << text << text << i << "'); // " << text << "\n";
+    }
+
+    RunParseBenchmark("Parse long string literals and comments", source.str());
+}
+
+TEST(BenchmarkErrors, DISABLED_ThrowAndCatch)
+{
+    RunInterpreterBenchmark("Throw and catch 200k errors 10 frames deep", R"(
+        function thrower(depth) {
+            if (depth == 0) throw new TypeError('failed');
+            return thrower(depth - 1) + 1;
+        }
+        function run() {
+            let caught = 0;
+            for (let i = 0; i < 200000; ++i) {
+                try { thrower(10); } catch (e) { caught += e.message.length; }
+            }
+            return caught;
+        }
+    )");
+}
+
+TEST(BenchmarkErrors, DISABLED_JSErrorConversion)
+{
+    auto rt = MakeRuntime();
+    rt->evaluateJavaScript(std::make_unique<StringBuffer>(R"(
+        function thrower(depth) {
+            if (depth == 0) throw new Error('failed');
+            return thrower(depth - 1) + 1;
+        }
+    )"), "<bench>");
+    auto thrower = rt->global().getPropertyAsFunction(*rt, "thrower");
+
+    size_t length = 0;
+    Stopwatch stopwatch;
+    for (int i = 0; i < 50000; ++i)
+    {
+        try
+        {
+            thrower.call(*rt, 10);
+        }
+        catch (const JSError& e)
+        {
+            length += e.getMessage().size() + e.getStack().size();
+        }
+    }
+
+    Report("Convert 50k exceptions to jsi::JSError", stopwatch.ElapsedMs());
+    EXPECT_GT(length, 0u);
+}
+
+TEST(BenchmarkNumbers, DISABLED_ToString)
+{
+    RunInterpreterBenchmark("Format 1M doubles and small integers", R"(
+        function run() {
+            let length = 0, x = 0.1;
+            for (let i = 0; i < 500000; ++i) {
+                x = x * 1.0001 + 0.37;
+                length += String(x).length + ('' + i).length;
+            }
+            return length;
+        }
+    )");
+}
+
+TEST(BenchmarkNumbers, DISABLED_Parse)
+{
+    RunInterpreterBenchmark("Parse 500k decimal strings", R"(
+        var strings = [];
+        for (let i = 0; i < 1000; ++i) strings.push(String(Math.sin(i) * 1e5), (i * 7.25).toFixed(2) + 'e-3');
+        function run() {
+            let sum = 0;
+            for (let i = 0; i < 250; ++i) {
+                for (let j = 0; j < strings.length; ++j) sum += +strings[j];
+            }
+            return sum;
+        }
+    )");
+}
+
+namespace {
+
+// About 10 MB of records with repeated keys, like the payloads of a bridge.
+std::string MakeJsonRecords()
+{
+    std::string json = "[";
+    for (int i = 0; i < 50000; ++i)
+    {
+        json += i ? "," : "";
+        json += "{\"id\":" + std::to_string(i) + ",\"name\":\"item " + std::to_string(i) + "\",\"price\":" + std::to_string(i) + ".5"
+            + ",\"active\":" + (i % 2 ? "true" : "false") + ",\"tags\":[\"alpha\",\"beta\",\"gamma\"],"
+            + "\"owner\":{\"first\":\"Ada\",\"last\":\"Lovelace\",\"email\":\"ada@example.com\"},\"note\":null}";
+    }
+
+    return json + "]";
+}
+
+} // namespace
+
+TEST(BenchmarkJson, DISABLED_ParseAndStringifyInJS)
+{
+    auto rt = MakeRuntime();
+    rt->global().setProperty(*rt, "json", String::createFromAscii(*rt, MakeJsonRecords()));
+    auto run = rt->evaluateJavaScript(std::make_unique<StringBuffer>(R"(
+        (function () {
+            let length = 0;
+            for (let i = 0; i < 5; ++i) length += JSON.stringify(JSON.parse(json)).length;
+            return length;
+        })
+    )"), "<bench>").getObject(*rt).getFunction(*rt);
+
+    Stopwatch stopwatch;
+    run.call(*rt);
+    Report("JSON.parse and JSON.stringify 5 x 10 MB", stopwatch.ElapsedMs());
+}
+
+TEST(BenchmarkJson, DISABLED_ParseAndStringifyBuffers)
+{
+    auto rt = MakeRuntime();
+    auto json = std::make_shared<StringBuffer>(MakeJsonRecords());
+    std::vector<uint8_t> output;
+
+    Stopwatch stopwatch;
+    for (int i = 0; i < 5; ++i)
+    {
+        auto value = quickjs::parseJson(*rt, *json);
+        output.clear();
+        quickjs::stringifyJson(*rt, value, output);
+    }
+
+    Report("parseJson and stringifyJson 5 x 10 MB", stopwatch.ElapsedMs());
+    EXPECT_EQ(output.size(), json->size());
+}
+
+TEST(BenchmarkRegExp, DISABLED_ScanLog)
+{
+    RunInterpreterBenchmark("Scan a 13 MB log with 4 regexps", R"(
+        var lines = [];
+        for (let i = 0; i < 200000; ++i) {
+            lines.push('2024-01-01 12:00:' + (i % 60) + ' INFO request ' + i + ' served in ' + (i % 97) + 'ms' + (i % 1000 == 0 ? ' ERROR code=' + i : ''));
+        }
+        var text = lines.join('\n');
+        function run() {
+            let count = 0;
+            for (let i = 0; i < 5; ++i) {
+                count += text.match(/ERROR code=\d+/g).length;
+                count += (text.match(/\d+ms QUIT/g) || []).length;
+                count += /^ERROR/.test(text) ? 1 : 0;
+                count += text.replace(/served in 9\dms/g, '').length;
+            }
+            return count;
+        }
+    )");
+}
+
+TEST(BenchmarkRegExp, DISABLED_DynamicPatterns)
+{
+    RunInterpreterBenchmark("Build and test 200k regexps from 50 patterns", R"(
+        function run() {
+            let count = 0;
+            for (let i = 0; i < 200000; ++i) {
+                if (new RegExp('served in ' + (i % 50) + 'ms', 'g').test('request ' + i + ' served in ' + (i % 97) + 'ms')) ++count;
+            }
+            return count;
+        }
+    )");
+}
+
+// The same nested quantifier with and without a lookahead, which keeps it on the backtracking engine.
+TEST(BenchmarkRegExp, DISABLED_NestedQuantifierLinear)
+{
+    RunInterpreterBenchmark("Test /(a|a)*[bc]/ on 10 x 20 and 10 x 100k characters", R"(
+        function run() {
+            let count = 0;
+            for (let i = 0; i < 10; ++i) {
+                if (/(a|a)*[bc]/.test('a'.repeat(20))) ++count;
+                if (/(a|a)*[bc]/.test('a'.repeat(100000))) ++count;
+            }
+            return count;
+        }
+    )");
+}
+
+TEST(BenchmarkRegExp, DISABLED_NestedQuantifierBacktracking)
+{
+    RunInterpreterBenchmark("Test /(?=a)(a|a)*[bc]/ on 10 x 20 characters", R"(
+        function run() {
+            let count = 0;
+            for (let i = 0; i < 10; ++i) {
+                if (/(?=a)(a|a)*[bc]/.test('a'.repeat(20))) ++count;
+            }
+            return count;
+        }
+    )");
+}
+
+TEST(BenchmarkRegExp, DISABLED_ValidateLines)
+{
+    RunInterpreterBenchmark("Validate 200k lines with /^(\\w+\\s?)+$/", R"(
+        var lines = [];
+        for (let i = 0; i < 200000; ++i) {
+            lines.push('request ' + i + ' served in ' + (i % 97) + (i % 100 == 0 ? ' ms!' : ' ms'));
+        }
+        function run() {
+            let count = 0;
+            for (const line of lines) {
+                if (/^(\w+\s?)+$/.test(line)) ++count;
+            }
+            return count;
+        }
+    )");
+}
+
+#ifdef QUICKJSI_FOLLY
+TEST(BenchmarkDynamic, DISABLED_ConvertRecords)
+{
+    auto rt = MakeRuntime();
+    auto records = rt->evaluateJavaScript(std::make_unique<StringBuffer>(R"(
+        Array.from({ length: 20000 }, (_, i) => ({
+            id: i, name: 'record' + i, active: i % 2 == 0, score: i / 7,
+            tags: ['a', 'b', 'c'], position: { x: i, y: -i },
+        }))
+    )"), "<bench>");
+    auto dynamic = quickjs::dynamicFromValue(*rt, records);
+
+    struct Conversions
+    {
+        const char* name;
+        folly::dynamic (*dynamicFromValue)(Runtime&, const Value&);
+        Value (*valueFromDynamic)(Runtime&, const folly::dynamic&);
+    };
+    const Conversions conversions[] = {
+        { "JSI", &facebook::jsi::dynamicFromValue, &facebook::jsi::valueFromDynamic },
+        { "direct", &quickjs::dynamicFromValue, &quickjs::valueFromDynamic },
+    };
+    for (const auto& conversion : conversions)
+    {
+        Stopwatch toDynamic;
+        for (int i = 0; i < 5; ++i)
+            EXPECT_EQ(conversion.dynamicFromValue(*rt, records).size(), 20000u);
+        Report((std::string("dynamicFromValue 5 x 20k records, ") + conversion.name).c_str(), toDynamic.ElapsedMs());
+
+        Stopwatch fromDynamic;
+        for (int i = 0; i < 5; ++i)
+            EXPECT_EQ(conversion.valueFromDynamic(*rt, dynamic).getObject(*rt).getArray(*rt).size(*rt), 20000u);
+        Report((std::string("valueFromDynamic 5 x 20k records, ") + conversion.name).c_str(), fromDynamic.ElapsedMs());
+    }
+}
+#endif
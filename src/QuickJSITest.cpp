@@ -1,6 +1,22 @@
 #include "gtest/gtest.h"
 #include "QuickJSRuntime.h"
 #include "jsi/test/testlib.h"
+#include "EventLoop.h"
+#include "QuickJSNative.h"
+#include "jsi/instrumentation.h"
+
+#ifdef QUICKJSI_FOLLY
+#include "QuickJSDynamic.h"
+#include "jsi/JSIDynamic.h"
+#endif
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <thread>
 
 namespace facebook::jsi {
 
@@ -33,7 +49,1166 @@ TEST_P(QuickJSITest, MultipleEval)
     EXPECT_EQ(rt.global().getProperty(rt, "z").getNumber(), 3);
 }
 
+TEST_P(QuickJSITest, AsyncHostFunctionResolvesFromWorkerThread)
+{
+    std::thread worker;
+    auto fn = quickjs::createAsyncFunctionFromHostFunction(rt, PropNameID::forAscii(rt, "double"), 1,
+        [&worker](Runtime& rt, const Value&, const Value* args, size_t, std::shared_ptr<quickjs::AsyncHostFunctionResolver> resolver)
+        {
+            double input = args[0].getNumber();
+            worker = std::thread([input, resolver = std::move(resolver)]()
+            {
+                resolver->resolve([input](Runtime&) { return Value(input * 2); });
+            });
+        });
+    rt.global().setProperty(rt, "double", fn);
+
+    eval("double(21).then(v => { result = v; })");
+    worker.join();
+
+    quickjs::drainAsyncCompletions(rt);
+    EXPECT_EQ(rt.global().getProperty(rt, "result").getNumber(), 42);
+}
+
+TEST_P(QuickJSITest, AsyncHostFunctionRejects)
+{
+    auto fn = quickjs::createAsyncFunctionFromHostFunction(rt, PropNameID::forAscii(rt, "fail"), 0,
+        [](Runtime&, const Value&, const Value*, size_t, std::shared_ptr<quickjs::AsyncHostFunctionResolver> resolver)
+        {
+            std::thread([resolver = std::move(resolver)]() { resolver->reject("boom"); }).join();
+        });
+    rt.global().setProperty(rt, "fail", fn);
+
+    eval("fail().catch(e => { message = e.message; })");
+    // Completions are drained when a call into JS returns.
+    eval("1");
+    EXPECT_EQ(rt.global().getProperty(rt, "message").getString(rt).utf8(rt), "boom");
+}
+
+TEST_P(QuickJSITest, AsyncHostFunctionRejectsWhenItsValueFactoryThrows)
+{
+    auto fn = quickjs::createAsyncFunctionFromHostFunction(rt, PropNameID::forAscii(rt, "odd"), 0,
+        [](Runtime&, const Value&, const Value*, size_t, std::shared_ptr<quickjs::AsyncHostFunctionResolver> resolver)
+        {
+            resolver->resolve([](Runtime&) -> Value { throw 42; });
+        });
+    rt.global().setProperty(rt, "odd", fn);
+
+    eval("odd().catch(e => { message = e.message; })");
+    eval("1");
+    EXPECT_EQ(rt.global().getProperty(rt, "message").getString(rt).utf8(rt), "Async host function threw an unknown exception");
+}
+
 INSTANTIATE_TEST_CASE_P(
     Runtimes,
     QuickJSITest,
     ::testing::ValuesIn(runtimeGenerators()));
+
+static std::unique_ptr<Runtime> makeRuntimeWithEventLoop()
+{
+    quickjs::QuickJSRuntimeArgs args;
+    args.enableEventLoop = true;
+    return quickjs::makeQuickJSRuntime(std::move(args));
+}
+
+TEST(QuickJSIEventLoop, TimersRunInOrder)
+{
+    auto rt = makeRuntimeWithEventLoop();
+    rt->evaluateJavaScript(std::make_unique<StringBuffer>(R"(
+        var log = [];
+        setTimeout(() => log.push('timeout 20'), 20);
+        setTimeout((a, b) => log.push('timeout 0 ' + a + b), 0, 'x', 'y');
+        var cancelled = setTimeout(() => log.push('cancelled'), 5);
+        clearTimeout(cancelled);
+        setImmediate(() => log.push('immediate'));
+        queueMicrotask(() => log.push('microtask'));
+        var ticks = 0;
+        var interval = setInterval(() => { if (++ticks === 3) clearInterval(interval); log.push('tick ' + ticks); }, 1);
+    )"), "<timers>");
+
+    quickjs::runEventLoop(*rt);
+
+    auto log = rt->evaluateJavaScript(std::make_unique<StringBuffer>("log.join()"), "").getString(*rt).utf8(*rt);
+    EXPECT_EQ(log.find("microtask,"), 0u);
+    EXPECT_LT(log.find("immediate"), log.find("timeout 0 xy"));
+    EXPECT_LT(log.find("tick 3"), log.find("timeout 20"));
+    EXPECT_EQ(log.find("cancelled"), std::string::npos);
+    EXPECT_FALSE(quickjs::hasPendingEventLoopWork(*rt));
+}
+
+TEST(QuickJSIEventLoop, WaitsForAsyncHostFunctions)
+{
+    auto rt = makeRuntimeWithEventLoop();
+    std::thread worker;
+    auto fn = quickjs::createAsyncFunctionFromHostFunction(*rt, PropNameID::forAscii(*rt, "later"), 0,
+        [&worker](Runtime&, const Value&, const Value*, size_t, std::shared_ptr<quickjs::AsyncHostFunctionResolver> resolver)
+        {
+            worker = std::thread([resolver = std::move(resolver)]()
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                resolver->resolve([](Runtime&) { return Value(7); });
+            });
+        });
+    rt->global().setProperty(*rt, "later", fn);
+
+    rt->evaluateJavaScript(std::make_unique<StringBuffer>("later().then(v => setTimeout(() => { result = v; }, 1))"), "");
+    quickjs::runEventLoop(*rt);
+    worker.join();
+
+    EXPECT_EQ(rt->global().getProperty(*rt, "result").getNumber(), 7);
+}
+
+TEST(QuickJSIEventLoop, AsyncCompletionsSurviveAFailedDrain)
+{
+    auto rt = makeRuntimeWithEventLoop();
+    std::vector<std::shared_ptr<quickjs::AsyncHostFunctionResolver>> resolvers;
+    auto fn = quickjs::createAsyncFunctionFromHostFunction(*rt, PropNameID::forAscii(*rt, "later"), 0,
+        [&resolvers](Runtime&, const Value&, const Value*, size_t, std::shared_ptr<quickjs::AsyncHostFunctionResolver> resolver)
+        {
+            resolvers.push_back(std::move(resolver));
+        });
+    rt->global().setProperty(*rt, "later", fn);
+    rt->evaluateJavaScript(std::make_unique<StringBuffer>(R"(
+        var log = [];
+        later().then(v => log.push(v), e => log.push(e.message));
+        later().then(v => log.push(v), e => log.push(e.message));
+        later().then(v => log.push(v), e => log.push(e.message));
+    )"), "");
+
+    resolvers[0]->resolve([](Runtime&) { return Value(1); });
+    resolvers[1]->reject("two");
+    resolvers[2]->resolve([](Runtime&) { return Value(3); });
+
+    // Settling fails when QuickJS runs out of memory. No completion is lost: the one that failed
+    // after its value was created is rejected, and the others settle normally.
+    JSRuntime* jsRuntime = JS_GetRuntime(quickjs::GetJSContext(*rt));
+    JS_SetMemoryLimit(jsRuntime, 1);
+    EXPECT_ANY_THROW(quickjs::drainAsyncCompletions(*rt));
+    JS_SetMemoryLimit(jsRuntime, static_cast<size_t>(-1));
+
+    quickjs::runEventLoop(*rt);
+    EXPECT_EQ(rt->evaluateJavaScript(std::make_unique<StringBuffer>("log.join()"), "").getString(*rt).utf8(*rt),
+        "Async host function result could not be delivered,two,3");
+}
+
+TEST(QuickJSIEventLoop, ThrowingMicrotaskIsReportedToTheHost)
+{
+    auto rt = makeRuntimeWithEventLoop();
+    try
+    {
+        rt->evaluateJavaScript(std::make_unique<StringBuffer>(R"(
+            var log = [];
+            queueMicrotask(() => { throw new Error('boom'); });
+            queueMicrotask(() => log.push('next'));
+            setTimeout(() => queueMicrotask(() => { throw new Error('in timer'); }), 0);
+            setTimeout(() => log.push('timer'), 0);
+        )"), "");
+        FAIL() << "The microtask exception was not reported";
+    }
+    catch (const JSError& error)
+    {
+        EXPECT_EQ(error.getMessage(), "boom");
+    }
+
+    // The microtasks left run on the next call into JS.
+    quickjs::drainAsyncCompletions(*rt);
+    EXPECT_EQ(rt->evaluateJavaScript(std::make_unique<StringBuffer>("log.join()"), "").getString(*rt).utf8(*rt), "next");
+
+    // A timer callback's microtask fails that task only.
+    EXPECT_THROW(quickjs::runEventLoop(*rt), JSError);
+    quickjs::runEventLoop(*rt);
+    EXPECT_EQ(rt->evaluateJavaScript(std::make_unique<StringBuffer>("log.join()"), "").getString(*rt).utf8(*rt), "next,timer");
+}
+
+TEST(TimerWheel, ExpiresInOrderAcrossLevels)
+{
+    quickjs::TimerWheel wheel;
+    std::mt19937_64 random { 42 };
+    std::vector<std::pair<uint64_t, uint64_t>> expected;
+    for (uint64_t id = 0; id < 5000; ++id)
+    {
+        // Spread expiries over several wheel levels.
+        uint64_t expiry = random() % (uint64_t { 1 } << (6 * (1 + id % 4)));
+        wheel.Schedule(id, expiry);
+        expected.emplace_back(std::max<uint64_t>(expiry, 1), id);
+    }
+
+    for (uint64_t id = 0; id < 5000; id += 7)
+    {
+        EXPECT_TRUE(wheel.Cancel(id));
+    }
+
+    expected.erase(std::remove_if(expected.begin(), expected.end(), [](const auto& e) { return e.second % 7 == 0; }), expected.end());
+    std::stable_sort(expected.begin(), expected.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    std::vector<uint64_t> expired;
+    for (uint64_t now = 0; !wheel.Empty(); now += 1 + random() % 300)
+    {
+        size_t before = expired.size();
+        wheel.Advance(now, expired);
+        for (size_t i = before; i < expired.size(); ++i)
+        {
+            ASSERT_EQ(expired[i], expected[i].second);
+            EXPECT_LE(expected[i].first, now);
+        }
+        if (auto next = wheel.NextExpiry())
+        {
+            EXPECT_GT(*next, now);
+        }
+    }
+
+    EXPECT_EQ(expired.size(), expected.size());
+}
+
+TEST(QuickJSIPrepareConcurrently, CompilesOnBackgroundThreads)
+{
+    std::vector<quickjs::ScriptSource> sources;
+    for (int i = 0; i < 8; ++i)
+    {
+        sources.push_back({ std::make_shared<StringBuffer>("var module" + std::to_string(i) + " = " + std::to_string(i) + " * 2;"), "module" + std::to_string(i) + ".js" });
+    }
+    sources.push_back({ std::make_shared<StringBuffer>("var broken = ;"), "broken.js" });
+
+    auto futures = quickjs::prepareJavaScriptConcurrently(std::move(sources));
+    ASSERT_EQ(futures.size(), 9u);
+
+    auto rt = quickjs::makeQuickJSRuntime({});
+    for (int i = 0; i < 8; ++i)
+    {
+        rt->evaluatePreparedJavaScript(futures[i].get());
+        EXPECT_EQ(rt->global().getProperty(*rt, ("module" + std::to_string(i)).c_str()).getNumber(), i * 2);
+    }
+
+    EXPECT_THROW(futures[8].get(), JSINativeException);
+}
+
+TEST(QuickJSIExecutionBudget, InterruptsLongRunningCalls)
+{
+    quickjs::QuickJSRuntimeArgs args;
+    args.callTimeBudget = std::chrono::milliseconds(50);
+    auto rt = quickjs::makeQuickJSRuntime(std::move(args));
+
+    EXPECT_THROW(rt->evaluateJavaScript(std::make_unique<StringBuffer>("while (true) {}"), ""), quickjs::ExecutionTimeoutError);
+    EXPECT_THROW(rt->evaluateJavaScript(std::make_unique<StringBuffer>("try { while (true) {} } catch (e) {} var caught = true;"), ""),
+        quickjs::ExecutionTimeoutError);
+    EXPECT_TRUE(rt->global().getProperty(*rt, "caught").isUndefined());
+
+    auto spin = rt->global().getPropertyAsFunction(*rt, "eval").call(*rt, "(function () { for (;;) {} })").getObject(*rt).getFunction(*rt);
+    EXPECT_THROW(spin.call(*rt), quickjs::ExecutionTimeoutError);
+
+    // Each call gets a fresh budget, and ordinary errors are not reported as timeouts.
+    EXPECT_EQ(rt->evaluateJavaScript(std::make_unique<StringBuffer>("1 + 2"), "").getNumber(), 3);
+    try
+    {
+        rt->evaluateJavaScript(std::make_unique<StringBuffer>("throw new Error('plain')"), "");
+        FAIL();
+    }
+    catch (const quickjs::ExecutionTimeoutError&)
+    {
+        FAIL();
+    }
+    catch (const JSError& e)
+    {
+        EXPECT_EQ(e.getMessage(), "plain");
+    }
+}
+
+TEST(QuickJSIExecutionBudget, InterruptsPromiseJobsAndMicrotasks)
+{
+    quickjs::QuickJSRuntimeArgs args;
+    args.callTimeBudget = std::chrono::milliseconds(50);
+    args.enableEventLoop = true;
+    auto rt = quickjs::makeQuickJSRuntime(std::move(args));
+
+    // Neither the promise chain nor the caller of an async function can catch the interruption.
+    EXPECT_THROW(rt->evaluateJavaScript(std::make_unique<StringBuffer>(R"(
+        Promise.resolve().then(() => { for (;;); }).catch(e => { globalThis.caught = String(e); });
+    )"), ""), quickjs::ExecutionTimeoutError);
+    EXPECT_THROW(rt->evaluateJavaScript(std::make_unique<StringBuffer>(R"(
+        (async () => { try { await 0; for (;;); } catch (e) { globalThis.caught = String(e); } })()
+            .catch(e => { globalThis.caught = String(e); });
+    )"), ""), quickjs::ExecutionTimeoutError);
+    EXPECT_THROW(rt->evaluateJavaScript(std::make_unique<StringBuffer>(R"(
+        (async () => { for (;;); })().catch(e => { globalThis.caught = String(e); });
+    )"), ""), quickjs::ExecutionTimeoutError);
+    EXPECT_THROW(rt->evaluateJavaScript(std::make_unique<StringBuffer>("queueMicrotask(() => { for (;;); })"), ""),
+        quickjs::ExecutionTimeoutError);
+
+    // A timer callback's microtask is interrupted within the budget of its task.
+    rt->evaluateJavaScript(std::make_unique<StringBuffer>("setTimeout(() => queueMicrotask(() => { for (;;); }), 0)"), "");
+    EXPECT_THROW(quickjs::runEventLoop(*rt), quickjs::ExecutionTimeoutError);
+
+    quickjs::runEventLoop(*rt);
+    EXPECT_TRUE(rt->global().getProperty(*rt, "caught").isUndefined());
+    EXPECT_EQ(rt->evaluateJavaScript(std::make_unique<StringBuffer>("Promise.resolve(1).then(v => { globalThis.done = v + 1; }); 0"), "").getNumber(), 0);
+    EXPECT_EQ(rt->global().getProperty(*rt, "done").getNumber(), 2);
+}
+
+TEST(QuickJSIExecutionBudget, RuntimeBudgetIsCumulative)
+{
+    quickjs::QuickJSRuntimeArgs args;
+    args.runtimeTimeBudget = std::chrono::milliseconds(50);
+    auto rt = quickjs::makeQuickJSRuntime(std::move(args));
+
+    EXPECT_EQ(rt->evaluateJavaScript(std::make_unique<StringBuffer>("1 + 2"), "").getNumber(), 3);
+    EXPECT_THROW(rt->evaluateJavaScript(std::make_unique<StringBuffer>("while (true) {}"), ""), quickjs::ExecutionTimeoutError);
+    EXPECT_THROW(rt->evaluateJavaScript(std::make_unique<StringBuffer>("1 + 2"), ""), quickjs::ExecutionTimeoutError);
+}
+
+TEST(QuickJSIExternalMemory, HostObjectsReportingNativeMemoryAreCollected)
+{
+    struct NativeBuffer : HostObject
+    {
+        explicit NativeBuffer(int& live) : live { live } { ++live; }
+        ~NativeBuffer() override { --live; }
+        int& live;
+    };
+
+    int live = 0;
+    auto rt = quickjs::makeQuickJSRuntime({});
+    rt->global().setProperty(*rt, "makeBuffer", Function::createFromHostFunction(*rt, PropNameID::forAscii(*rt, "makeBuffer"), 0,
+        [&live](Runtime& rt, const Value&, const Value*, size_t) -> Value
+        {
+            auto buffer = Object::createFromHostObject(rt, std::make_shared<NativeBuffer>(live));
+            quickjs::setExternalMemoryPressure(rt, buffer, 64 * 1024 * 1024);
+            return buffer;
+        }));
+
+    // Cycles are only reclaimed by the GC, which the small JS heap alone would not trigger.
+    rt->evaluateJavaScript(std::make_unique<StringBuffer>(R"(
+        for (let i = 0; i < 1000; ++i) {
+            const holder = { buffer: makeBuffer() };
+            holder.self = holder;
+        }
+    )"), "");
+    EXPECT_LT(live, 8);
+
+    EXPECT_THROW(quickjs::setExternalMemoryPressure(*rt, Object(*rt), 1), JSINativeException);
+}
+
+TEST(QuickJSIInlineCache, CachesPropertyAccessAndSeesShapeChanges)
+{
+    auto rt = quickjs::makeQuickJSRuntime({});
+    rt->evaluateJavaScript(std::make_unique<StringBuffer>(R"(
+        class Point { constructor(x, y) { this.x = x; this.y = y; } norm() { return this.x * this.x + this.y * this.y; } }
+        function run(points) {
+            let sum = 0;
+            for (const p of points) { p.x = p.x + 1; sum += p.norm(); }
+            return sum;
+        }
+        var points = [];
+        for (let i = 0; i < 1000; ++i) points.push(new Point(i % 3, 1));
+    )"), "");
+
+    // Adding properties in the constructor is not cached, only accesses to existing ones.
+    quickjs::resetInlineCacheStats(*rt);
+    auto result = rt->evaluateJavaScript(std::make_unique<StringBuffer>(R"(
+        run(points);
+        Point.prototype.norm = function () { return 1; };
+        const patched = run(points);
+        delete points[0].y;
+        Object.defineProperty(points[1], 'x', { get() { return 100; } });
+        [patched, points[0].norm === Point.prototype.norm, points[0].y, points[1].x].join()
+    )"), "");
+    EXPECT_EQ(result.getString(*rt).utf8(*rt), "1000,true,,100");
+
+    auto stats = quickjs::getInlineCacheStats(*rt);
+    EXPECT_GT(stats.getHits, 10 * stats.getMisses);
+    EXPECT_GT(stats.putHits, 10 * stats.putMisses);
+}
+
+TEST(QuickJSISuperinstructions, FusedOpcodesKeepSemantics)
+{
+    auto rt = quickjs::makeQuickJSRuntime({});
+    auto result = rt->evaluateJavaScript(std::make_unique<StringBuffer>(R"(
+        function count(from, to) { let n = 0; for (let i = from; i < to; ++i) n++; return n; }
+        function countDown(n) { let i = n; while (0 < i) i--; return i; }
+        function overflow() { let i = 2147483647; i++; return i; }
+        function tdz() { try { x++; let x = 0; } catch (e) { return e instanceof ReferenceError; } }
+        [count(0, 300), count(0.5, 3), count(0, NaN), count('a', 'c'), count(1n, 4n),
+         countDown(5), overflow(), tdz()].join()
+    )"), "");
+    EXPECT_EQ(result.getString(*rt).utf8(*rt), "300,3,0,1,3,0,2147483648,true");
+}
+
+TEST(QuickJSIObjectLiteral, PreparedLiteralsShareShapesWithBuiltObjects)
+{
+    auto source = std::make_shared<StringBuffer>(R"(
+        function literal(i) { return { id: i, name: 'n' + i, tags: [i] }; }
+        function built(i) { const o = {}; o.id = i; o.name = 'n' + i; o.tags = [i]; return o; }
+        function read(o) { return o.id + o.name.length + o.tags.length; }
+        function run() {
+            let sum = 0;
+            for (let i = 0; i < 1000; ++i) sum += read(literal(i)) + read(built(i));
+            return sum;
+        }
+    )");
+
+    auto compiler = quickjs::makeQuickJSRuntime({});
+    auto prepared = compiler->prepareJavaScript(source, "literals.js");
+
+    auto rt = quickjs::makeQuickJSRuntime({});
+    rt->evaluatePreparedJavaScript(prepared);
+    auto run = rt->global().getPropertyAsFunction(*rt, "run");
+    run.call(*rt);
+
+    quickjs::resetInlineCacheStats(*rt);
+    EXPECT_EQ(run.call(*rt).getNumber(), 2 * (999 * 1000 / 2 + 1000 + 3890));
+    EXPECT_EQ(quickjs::getInlineCacheStats(*rt).getMisses, 0u);
+
+    auto result = rt->evaluateJavaScript(std::make_unique<StringBuffer>(R"(
+        const o = literal(7);
+        o.extra = true;
+        delete o.name;
+        [JSON.stringify(literal(1)), JSON.stringify(o), JSON.stringify({ a: 1, a: 2 })].join(' ')
+    )"), "");
+    EXPECT_EQ(result.getString(*rt).utf8(*rt), R"({"id":1,"name":"n1","tags":[1]} {"id":7,"tags":[7],"extra":true} {"a":2})");
+}
+
+TEST(QuickJSIInstrumentation, ReportsHeapInfo)
+{
+    auto rt = quickjs::makeQuickJSRuntime({});
+    auto& instrumentation = rt->instrumentation();
+    auto before = instrumentation.getHeapInfo(true);
+
+    rt->evaluateJavaScript(std::make_unique<StringBuffer>(R"(
+        var objects = [];
+        for (let i = 0; i < 1000; ++i) {
+            const o = { a: i };
+            if (i % 2) { o.b = i; o.c = i; o.d = i; }
+            objects.push(o);
+        }
+    )"), "");
+    auto after = instrumentation.getHeapInfo(true);
+    EXPECT_GE(after["quickjs_objectCount"] - before["quickjs_objectCount"], 1000);
+    EXPECT_GE(after["quickjs_propertyCount"] - before["quickjs_propertyCount"], 2500);
+    EXPECT_GT(after["quickjs_mallocSize"], before["quickjs_mallocSize"]);
+
+    rt->evaluateJavaScript(std::make_unique<StringBuffer>("objects = null;"), "");
+    instrumentation.collectGarbage();
+    EXPECT_LT(instrumentation.getHeapInfo(true)["quickjs_objectCount"], after["quickjs_objectCount"] - 900);
+}
+
+TEST(QuickJSIValues, NumbersRoundTripInEveryValueRepresentation)
+{
+    // Negative numbers and NaNs share their high bits with the tags when JSValue is NaN-boxed.
+    auto rt = quickjs::makeQuickJSRuntime({});
+    auto identity = rt->evaluateJavaScript(std::make_unique<StringBuffer>(R"(
+        var bits = new Uint32Array(2);
+        bits[1] = 0xfff10000;
+        var nonCanonicalNaN = new Float64Array(bits.buffer)[0];
+        (x) => x
+    )"), "").getObject(*rt).getFunction(*rt);
+
+    for (double d : { -0.0, -1.5, -5e-324, -1.7976931348623157e308, -std::numeric_limits<double>::infinity(), 2147483648.0 })
+    {
+        auto result = identity.call(*rt, d);
+        ASSERT_TRUE(result.isNumber());
+        EXPECT_EQ(std::signbit(result.getNumber()), std::signbit(d));
+        EXPECT_EQ(result.getNumber(), d);
+    }
+
+    auto nan = rt->global().getProperty(*rt, "nonCanonicalNaN");
+    ASSERT_TRUE(nan.isNumber());
+    EXPECT_TRUE(std::isnan(nan.getNumber()));
+    EXPECT_TRUE(std::isnan(identity.call(*rt, std::numeric_limits<double>::quiet_NaN()).getNumber()));
+    EXPECT_EQ(rt->evaluateJavaScript(std::make_unique<StringBuffer>("[typeof nonCanonicalNaN, -(2 ** 31) - 1, 2n ** 64n].join()"), "").getString(*rt).utf8(*rt),
+        "number,-2147483649,18446744073709551616");
+}
+
+TEST(QuickJSIStrings, ConcatenatedStringsBehaveLikeFlatStrings)
+{
+    // Long concatenations are kept as ropes until their characters are needed.
+    auto rt = quickjs::makeQuickJSRuntime({});
+    auto result = rt->evaluateJavaScript(std::make_unique<StringBuffer>(R"(
+        var appended = '', prepended = '', mixed = '';
+        for (let i = 0; i < 10000; ++i) {
+            appended += String.fromCharCode(97 + i % 26);
+            prepended = String.fromCharCode(97 + i % 26) + prepended;
+            mixed = i & 1 ? mixed + '€' + i : i + mixed;
+        }
+        const flat = mixed.split('').join('');
+        const keys = new Map([[appended, 1]]);
+        const o = {};
+        o[mixed] = 2;
+        [appended.length, appended[26], prepended[9999], typeof mixed, mixed === flat, mixed < flat + 'a',
+         keys.get(appended.slice(0)), o[flat], JSON.parse(JSON.stringify({ mixed })).mixed === flat].join()
+    )"), "");
+    EXPECT_EQ(result.getString(*rt).utf8(*rt), "10000,a,a,string,true,true,1,2,true");
+
+    auto appended = rt->global().getProperty(*rt, "appended");
+    ASSERT_TRUE(appended.isString());
+    auto utf8 = appended.getString(*rt).utf8(*rt);
+    EXPECT_EQ(utf8.size(), 10000u);
+    EXPECT_EQ(utf8.substr(0, 3), "abc");
+    EXPECT_EQ(utf8.back(), static_cast<char>('a' + 9999 % 26));
+    EXPECT_TRUE(String::strictEquals(*rt, appended.getString(*rt), String::createFromUtf8(*rt, utf8)));
+}
+
+TEST(QuickJSIStrings, Latin1FastPathsMatchTheGeneralCase)
+{
+    // Prefixing 'Ā' makes the same text a 16-bit string, which takes the general paths.
+    auto rt = quickjs::makeQuickJSRuntime({});
+    auto result = rt->evaluateJavaScript(std::make_unique<StringBuffer>(R"(
+        var s = 'Hello, World! \xc0\xc9\xce\xf5\xfc \xd7\xf7 '.repeat(5) + 'abcXYZ'.repeat(10);
+        function wide(f) { return f('Ā' + s).slice(1); }
+        var lower = s.toLowerCase(), upper = s.toUpperCase();
+        var text = 'x'.repeat(100) + 'needle' + 'y'.repeat(100) + 'needle';
+        [
+            lower === wide(function (t) { return t.toLowerCase(); }),
+            upper === wide(function (t) { return t.toUpperCase(); }),
+            lower.slice(0, 20), upper.slice(0, 20),
+            'stra\xdfe \xff\xb5'.toUpperCase(), 'abc'.toLowerCase() === 'abc',
+            'caf\xe9'.normalize('NFD').length, 'caf\xe9'.normalize() === 'caf\xe9', '\xbd'.normalize('NFKC'), 'abc'.normalize('NFKD'),
+            text.indexOf('needle'), text.indexOf('needle', 107), text.lastIndexOf('needle'), text.indexOf('needlf'),
+            text.includes('xneedley'), text.includes('needle', 207), text.split('needle').length, ('Ā' + text).indexOf('needle'),
+        ].join()
+    )"), "");
+    EXPECT_EQ(result.getString(*rt).utf8(*rt),
+        "true,true,hello, world! \xc3\xa0\xc3\xa9\xc3\xae\xc3\xb5\xc3\xbc ,HELLO, WORLD! \xc3\x80\xc3\x89\xc3\x8e\xc3\x95\xc3\x9c ,"
+        "STRASSE \xc5\xb8\xce\x9c,true,5,true,1\xe2\x81\x84" "2,abc,100,206,206,-1,true,false,3,101");
+}
+
+TEST(QuickJSIPropNameID, BatchCreatesTheSameNamesAsForUtf8)
+{
+    auto rt = quickjs::makeQuickJSRuntime({});
+    auto obj = rt->evaluateJavaScript(std::make_unique<StringBuffer>(R"(
+        // The UTF-8 bytes of 'é' read as Latin-1 characters.
+        ({ 'Ã©': 'latin1', 'é': 'utf8', length: 3 })
+    )"), "").getObject(*rt);
+
+    std::vector<std::string_view> names { "alpha", "beta", "", "42", "\xc3\xa9", "alpha", "\xf0\x9f\x98\x80", "length" };
+    auto ids = quickjs::createPropNameIDs(*rt, names);
+    ASSERT_EQ(ids.size(), names.size());
+    for (size_t i = 0; i < names.size(); ++i)
+    {
+        std::string name { names[i] };
+        EXPECT_EQ(ids[i].utf8(*rt), name);
+        EXPECT_TRUE(PropNameID::compare(*rt, ids[i], PropNameID::forUtf8(*rt, name)));
+    }
+
+    EXPECT_EQ(obj.getProperty(*rt, ids[4]).getString(*rt).utf8(*rt), "utf8");
+    EXPECT_EQ(obj.getProperty(*rt, PropNameID::forUtf8(*rt, "\xc3\xa9")).getString(*rt).utf8(*rt), "utf8");
+    EXPECT_EQ(obj.getProperty(*rt, ids[7]).getNumber(), 3);
+}
+
+TEST(QuickJSIPropertyPlan, ReadsAndWritesLikeSingleProperties)
+{
+    auto rt = quickjs::makeQuickJSRuntime({});
+    auto objects = rt->evaluateJavaScript(std::make_unique<StringBuffer>(R"(
+        Object.prototype.inherited = 'proto';
+        var log = [];
+        var objects = [
+            { id: 1, name: 'a', value: 10 },
+            { id: 2, name: 'b', value: 20 },
+            { name: 'c', id: 3, value: 30, extra: true },
+            { id: 4, get name() { delete this.value; return 'getter'; }, value: 40 },
+            { id: 5, set name(v) { log.push(v); this.added = v; }, value: 50 },
+            Object.freeze({ id: 6, name: 'frozen', value: 60 }),
+            new Proxy({ id: 7 }, { get: (t, k) => k in t ? t[k] : 'proxy:' + String(k) }),
+            [8],
+        ];
+        objects
+    )"), "").getObject(*rt).getArray(*rt);
+
+    auto plan = quickjs::createPropertyPlan(*rt, { "id", "name", "value", "inherited", "length" });
+    ASSERT_EQ(plan->size(), 5u);
+
+    std::vector<std::string> read;
+    Value values[5];
+    for (size_t i = 0; i < objects.size(*rt); ++i)
+    {
+        quickjs::getProperties(*rt, objects.getValueAtIndex(*rt, i).getObject(*rt), *plan, values);
+        std::string row;
+        for (const auto& value : values)
+        {
+            row += (row.empty() ? "" : ",") + (value.isUndefined() ? "-" : value.toString(*rt).utf8(*rt));
+        }
+        read.push_back(row);
+    }
+    EXPECT_EQ(read, (std::vector<std::string> {
+        "1,a,10,proto,-", "2,b,20,proto,-", "3,c,30,proto,-", "4,getter,-,proto,-", "5,-,50,proto,-",
+        "6,frozen,60,proto,-", "7,proxy:name,proxy:value,proto,proxy:length", "-,-,-,proto,1" }));
+
+    // The getter changed the shape of the fourth object in the middle of the read.
+    auto getter = objects.getValueAtIndex(*rt, 3).getObject(*rt);
+    quickjs::getProperties(*rt, getter, *plan, values);
+    EXPECT_EQ(values[1].getString(*rt).utf8(*rt), "getter");
+    EXPECT_TRUE(values[2].isUndefined());
+
+    const Value written[] { Value(100), String::createFromAscii(*rt, "w"), Value(true), Value(), Value(2) };
+    for (size_t i : { 0, 1, 2, 4 })
+    {
+        auto obj = objects.getValueAtIndex(*rt, i).getObject(*rt);
+        quickjs::setProperties(*rt, obj, *plan, written);
+    }
+    auto frozen = objects.getValueAtIndex(*rt, 5).getObject(*rt);
+    EXPECT_THROW(quickjs::setProperties(*rt, frozen, *plan, written), JSError);
+
+    auto result = rt->evaluateJavaScript(std::make_unique<StringBuffer>(R"(
+        const [a, , c, , e, f] = objects;
+        [a, c, e, f].map(o => JSON.stringify(o)).concat(log, Object.keys(Object.prototype)).join(' ')
+    )"), "");
+    EXPECT_EQ(result.getString(*rt).utf8(*rt),
+        R"({"id":100,"name":"w","value":true,"length":2} {"name":"w","id":100,"value":true,"extra":true,"length":2} )"
+        R"({"id":100,"value":true,"added":"w","length":2} {"id":6,"name":"frozen","value":60} w inherited)");
+
+    // Objects built from a plan share one shape; duplicate names keep the last value, as in a literal.
+    auto duplicates = quickjs::createPropertyPlan(*rt, { "x", "y", "x" });
+    const Value coordinates[] { Value(1), Value(2), Value(3) };
+    rt->global().setProperty(*rt, "built", Array::createWithElements(*rt,
+        quickjs::createObjectFromPlan(*rt, *plan, written), quickjs::createObjectFromPlan(*rt, *plan, written),
+        quickjs::createObjectFromPlan(*rt, *duplicates, coordinates), quickjs::createObjectFromPlan(*rt, *duplicates, coordinates)));
+    result = rt->evaluateJavaScript(std::make_unique<StringBuffer>(R"(
+        built[1].id++;
+        built.map(o => JSON.stringify(o)).concat(Object.getPrototypeOf(built[0]) === Object.prototype).join(' ')
+    )"), "");
+    EXPECT_EQ(result.getString(*rt).utf8(*rt),
+        R"({"id":100,"name":"w","value":true,"length":2} {"id":101,"name":"w","value":true,"length":2} {"x":3,"y":2} {"x":3,"y":2} true)");
+}
+
+TEST(QuickJSILazyCompilation, LazyFunctionsBehaveLikeCompiledOnes)
+{
+    // Top-level functions are compiled on their first call when lazy compilation is enabled.
+    const char* script = R"(
+        function add(a, b) { return a + b; }
+        var named = function fact(n) { return n <= 1 ? 1 : n * fact(n - 1); };
+        let counter = 0;
+        function bump(step = 1) { counter += step; return counter; }
+        function* numbers() { yield 1; yield 2; }
+        function reassigned() { return typeof reassigned; }
+        var saved = reassigned;
+        reassigned = 0;
+        function thrower() {
+            throw new Error('boom');
+        }
+        function neverCalled(x, y) { return x; }
+        function secret() { class Box { #value = 'private'; get() { return this.#value; } } return new Box().get(); }
+        var line;
+        try { thrower(); } catch (e) { line = e.stack.split('\n')[0]; }
+        [add(1, 2), named(5), bump(), bump(2), [...numbers()], saved(), add.name, add.length, named.name,
+         String(neverCalled), neverCalled.length, line, (function () { return 'iife'; })(), secret()].join()
+    )";
+
+    std::string results[2];
+    for (bool lazy : { false, true })
+    {
+        quickjs::QuickJSRuntimeArgs args;
+        args.enableLazyCompilation = lazy;
+        auto rt = quickjs::makeQuickJSRuntime(std::move(args));
+        results[lazy] = rt->evaluateJavaScript(std::make_unique<StringBuffer>(script), "lazy.js").getString(*rt).utf8(*rt);
+
+        // Function bodies are still parsed when the script is evaluated.
+        EXPECT_THROW(rt->evaluateJavaScript(std::make_unique<StringBuffer>("function broken() { return ) }"), "broken.js"), JSError);
+        // So are undeclared private names, which are only found when the variables are resolved.
+        EXPECT_THROW(rt->evaluateJavaScript(std::make_unique<StringBuffer>("function f() { class A { m() { return this.#x; } } }"), "private.js"), JSError);
+        EXPECT_TRUE(rt->global().getProperty(*rt, "f").isUndefined());
+    }
+
+    EXPECT_EQ(results[1], results[0]);
+    EXPECT_EQ(results[1], "3,120,1,3,1,2,number,add,2,fact,function neverCalled(x, y) { return x; },2,    at thrower (lazy.js:11),iife,private");
+}
+
+TEST(QuickJSIDebugInfo, StripsSourceAndDebugInfoPerScript)
+{
+    quickjs::QuickJSRuntimeArgs args;
+    args.scriptDebugInfo = [](const std::string& sourceURL)
+    {
+        return sourceURL == "nosource.js" ? quickjs::ScriptDebugInfo::NoSource
+            : sourceURL == "none.js" ? quickjs::ScriptDebugInfo::None : quickjs::ScriptDebugInfo::Full;
+    };
+    auto rt = quickjs::makeQuickJSRuntime(std::move(args));
+
+    const char* script = R"(
+        (function () {
+            function f() {
+                throw new Error('boom');
+            }
+            try { f(); } catch (e) { return String(f).includes('boom') + ' ' + e.stack.split('\n')[0]; }
+        })()
+    )";
+    auto run = [&](const char* sourceURL) { return rt->evaluateJavaScript(std::make_unique<StringBuffer>(script), sourceURL).getString(*rt).utf8(*rt); };
+    EXPECT_EQ(run("full.js"), "true     at f (full.js:4)");
+    EXPECT_EQ(run("nosource.js"), "false     at f (nosource.js:4)");
+    EXPECT_EQ(run("none.js"), "false     at f");
+
+    auto prepared = rt->prepareJavaScript(std::make_unique<StringBuffer>(script), "nosource.js");
+    EXPECT_EQ(rt->evaluatePreparedJavaScript(prepared).getString(*rt).utf8(*rt), "false     at f (nosource.js:4)");
+}
+
+TEST(QuickJSIErrors, StackIsFormattedWhenReadAndConvertedToJSError)
+{
+    auto rt = quickjs::makeQuickJSRuntime(quickjs::QuickJSRuntimeArgs {});
+    auto eval = [&](const char* code) { return rt->evaluateJavaScript(std::make_unique<StringBuffer>(code), "errors.js"); };
+
+    // The frames are captured when the error is created, so later changes do not show up in the stack.
+    EXPECT_EQ(eval(R"(
+        function inner() {
+            return new Error('lazy');
+        }
+        function outer() {
+            return inner();
+        }
+        var e = outer();
+        Object.defineProperty(inner, 'name', { value: 'renamed' });
+        var d = Object.getOwnPropertyDescriptor(e, 'stack');
+        [e.stack, d.writable, d.enumerable, d.configurable].join('|')
+    )").getString(*rt).utf8(*rt), "    at inner (errors.js:3)\n    at outer (errors.js:6)\n    at <eval> (errors.js:8)\n|true|false|true");
+
+    EXPECT_EQ(eval(R"(
+        var a = new Error('a'); a.stack = 'custom';
+        var b = new Error('b'); delete b.stack;
+        var c = new Error('c'); Object.freeze(c);
+        [a.stack, 'stack' in b, c.stack.split('\n')[0]].join('|')
+    )").getString(*rt).utf8(*rt), "custom|false|    at <eval> (errors.js:4)");
+
+    try
+    {
+        eval("function thrower() {\n    null.x;\n}\nthrower()");
+        FAIL();
+    }
+    catch (const JSError& e)
+    {
+        EXPECT_EQ(e.getMessage(), "value has no property");
+        EXPECT_EQ(e.getStack(), "    at thrower (errors.js:2)\n    at <eval> (errors.js:4)\n");
+    }
+
+    try
+    {
+        eval("throw 'plain string'");
+        FAIL();
+    }
+    catch (const JSError& e)
+    {
+        EXPECT_EQ(e.getMessage(), "plain string");
+    }
+}
+
+TEST(QuickJSIParser, ScansAsciiRunsUpToTheEndOfTheSource)
+{
+    auto rt = quickjs::makeQuickJSRuntime(quickjs::QuickJSRuntimeArgs {});
+    auto eval = [&](const std::string& code) { return rt->evaluateJavaScript(std::make_unique<StringBuffer>(code), "lexer.js"); };
+    auto str = [&](const std::string& code) { return eval(code).getString(*rt).utf8(*rt); };
+    auto error = [&](const std::string& code)
+    {
+        try
+        {
+            eval(code);
+            return std::string("no error");
+        }
+        catch (const JSError& e)
+        {
+            return e.getMessage() + "|" + e.getStack();
+        }
+    };
+
+    // Runs around the 16 and 32 byte vector widths, ending exactly at the end of the source.
+    for (size_t n : { 15, 16, 17, 31, 32, 33 })
+    {
+        SCOPED_TRACE(n);
+        std::string run;
+        for (size_t i = 0; i < n; ++i)
+        {
+            run += "aZ_$09"[i % 6];
+        }
+
+        std::string ident = "x" + run.substr(1);
+        EXPECT_EQ(str("var " + ident + " = '" + run + "';\n" + ident), run);
+        EXPECT_EQ(str("`" + run + "`"), run);
+        EXPECT_EQ(eval("1 + 2;\n//" + run).getNumber(), 3);
+        EXPECT_EQ(eval("/*" + run + "*/4").getNumber(), 4);
+        EXPECT_EQ(eval("5;" + std::string(n, ' ')).getNumber(), 5);
+
+        EXPECT_EQ(error("\n\n'" + run), "unexpected end of string|    at lexer.js:3\n");
+        EXPECT_EQ(error("\n`" + run), "unexpected end of string|    at lexer.js:2\n");
+        EXPECT_EQ(error("\n\n\n/*" + run), "unexpected end of comment|    at lexer.js:4\n");
+
+        // A non-ASCII character right after a run goes through the UTF-8 decoder.
+        EXPECT_EQ(str("var " + ident + "\xc3\xa9 = '" + run + "\xc3\xa9';\n" + ident + "\xc3\xa9"), run + "\xc3\xa9");
+        EXPECT_EQ(str("`" + run + "\xe2\x82\xac`"), run + "\xe2\x82\xac");
+        EXPECT_EQ(eval("//" + run + "\xe2\x80\xa8" + "6").getNumber(), 6);
+        EXPECT_EQ(error("\n'" + run + "\xc3\xa9"), "unexpected end of string|    at lexer.js:2\n");
+        EXPECT_EQ(error("/*" + run + "\xc3\xa9\n*/\n" + run + "\xc3\xa9"), run + "\xc3\xa9 is not defined|    at <eval> (lexer.js:3)\n");
+    }
+}
+
+// Formats the shortest round-trip digits of a finite number with the Number::toString rules.
+static std::string NumberToString(double d)
+{
+    if (d == 0)
+    {
+        return "0";
+    }
+
+    char buf[64];
+    char* end = std::to_chars(buf, buf + sizeof(buf), std::abs(d), std::chars_format::scientific).ptr;
+    char* e = std::find(buf, end, 'e');
+    std::string digits { buf, e };
+    digits.erase(std::remove(digits.begin(), digits.end(), '.'), digits.end());
+    int k = static_cast<int>(digits.size());
+    int n = std::atoi(std::string(e + 1, end).c_str()) + 1;
+
+    std::string result = d < 0 ? "-" : "";
+    if (k <= n && n <= 21)
+    {
+        result += digits + std::string(n - k, '0');
+    }
+    else if (0 < n && n <= 21)
+    {
+        result += digits.substr(0, n) + "." + digits.substr(n);
+    }
+    else if (-6 < n && n <= 0)
+    {
+        result += "0." + std::string(-n, '0') + digits;
+    }
+    else
+    {
+        result += digits.substr(0, 1) + (k > 1 ? "." + digits.substr(1) : "") + (n - 1 >= 0 ? "e+" : "e-") + std::to_string(std::abs(n - 1));
+    }
+
+    return result;
+}
+
+TEST(QuickJSINumbers, FormatsShortestRoundTripDigitsAndParsesCorrectlyRounded)
+{
+    auto rt = quickjs::makeQuickJSRuntime({});
+    auto toString = rt->evaluateJavaScript(std::make_unique<StringBuffer>("(x) => String(x)"), "").getObject(*rt).getFunction(*rt);
+    auto toNumber = rt->evaluateJavaScript(std::make_unique<StringBuffer>("(s) => Number(s)"), "").getObject(*rt).getFunction(*rt);
+
+    std::vector<double> numbers { 0.1, 0.3, 1.0 / 3, 5e-324, 2.2250738585072009e-308, 2.2250738585072014e-308, 1.7976931348623157e308,
+        9007199254740993.0, 1e21, 1e-7, 123456789012345680000.0, 4.35, 0.000001, 1e23, 5e-310 };
+    for (int e = -1074; e <= 1023; ++e)
+    {
+        numbers.push_back(std::ldexp(1.0, e));
+    }
+
+    std::mt19937_64 random { 41 };
+    for (int i = 0; i < 20000; ++i)
+    {
+        uint64_t bits = random();
+        double d;
+        std::memcpy(&d, &bits, sizeof(d));
+        if (std::isfinite(d))
+        {
+            numbers.push_back(d);
+        }
+    }
+
+    for (double d : numbers)
+    {
+        auto shortest = NumberToString(d);
+        ASSERT_EQ(toString.call(*rt, d).getString(*rt).utf8(*rt), shortest) << shortest;
+
+        char precise[64];
+        std::snprintf(precise, sizeof(precise), "%.17g", d);
+        for (const char* s : { shortest.c_str(), static_cast<const char*>(precise) })
+        {
+            EXPECT_EQ(toNumber.call(*rt, String::createFromAscii(*rt, s)).getNumber(), d) << s;
+        }
+    }
+
+    // Long decimals are rounded once, whatever the number of digits beyond the 19 that fit in a 64-bit mantissa.
+    std::uniform_int_distribution<int> digit { 0, 9 }, exponent { -340, 310 }, length { 1, 40 };
+    for (int i = 0; i < 20000; ++i)
+    {
+        std::string s = std::to_string(digit(random)) + ".";
+        for (int n = length(random); n > 0; --n)
+        {
+            s += static_cast<char>('0' + digit(random));
+        }
+
+        s += "e" + std::to_string(exponent(random));
+        double expected = std::strtod(s.c_str(), nullptr);
+        double actual = toNumber.call(*rt, String::createFromAscii(*rt, s)).getNumber();
+        ASSERT_EQ(std::memcmp(&actual, &expected, sizeof(double)), 0) << s;
+    }
+
+    EXPECT_EQ(rt->evaluateJavaScript(std::make_unique<StringBuffer>(R"(
+        [Number('123456789012345678901234567890'), Number('9007199254740993'), 0.1 + 0.2, -1e-7, 2 ** 70,
+         Number('2.4703282292062328e-324'), Number('1e-400'), Number('1.7976931348623159e308'), JSON.stringify([1.5e300, -0.1])].join()
+    )"), "").getString(*rt).utf8(*rt), "1.2345678901234568e+29,9007199254740992,0.30000000000000004,-1e-7,1.1805916207174113e+21,5e-324,0,Infinity,[1.5e+300,-0.1]");
+}
+
+TEST(QuickJSIJson, ParsesFromBuffersAndStringifiesToBytes)
+{
+    auto rt = quickjs::makeQuickJSRuntime({});
+    auto eval = [&](const char* code) { return rt->evaluateJavaScript(std::make_unique<StringBuffer>(code), "json.js"); };
+
+    // More distinct keys than the parser caches, repeated in every record.
+    std::string json = "[";
+    for (int i = 0; i < 3; ++i)
+    {
+        json += i ? ",{" : "{";
+        for (int key = 0; key < 100; ++key)
+        {
+            json += (key ? ",\"k" : "\"k") + std::to_string(key) + "\":" + std::to_string(i * key);
+        }
+
+        json += ",\"7\":\"caf\\u00e9 \xe2\x82\xac\",\"\\u00e9t\xc3\xa9\":[true,false,null,-0,1.5e-3]}";
+    }
+
+    json += "]";
+    auto parsed = quickjs::parseJson(*rt, StringBuffer(json));
+    rt->global().setProperty(*rt, "parsed", parsed);
+    EXPECT_EQ(eval("parsed[2].k99 + parsed[1].k50 + parsed.length").getNumber(), 198 + 50 + 3);
+    EXPECT_EQ(eval("Object.keys(parsed[0]).slice(0, 2).join() + '|' + parsed[0][7] + '|' + Object.keys(parsed[0]).pop()").getString(*rt).utf8(*rt),
+        "7,k0|café €|été");
+    EXPECT_EQ(eval("Object.is(parsed[1]['été'][3], -0)").getBool(), true);
+    EXPECT_EQ(Value::createFromJsonUtf8(*rt, reinterpret_cast<const uint8_t*>("{\"a\":[1]}"), 9).getObject(*rt).getProperty(*rt, "a").getObject(*rt).getArray(*rt).size(*rt), 1u);
+
+    for (const char* invalid : { "[1,]", "{'a':1}", "01", "\"\\x41\"", "[1] x", "\"tab\there\"", "{\"a\":1" })
+    {
+        EXPECT_THROW(quickjs::parseJson(*rt, StringBuffer(invalid)), JSError) << invalid;
+    }
+
+    std::vector<uint8_t> output { '>' };
+    EXPECT_TRUE(quickjs::stringifyJson(*rt, eval("({ s: 'caf\\u00e9 \\u20ac \\ud83d\\ude00 \\ud800', n: [1, 0.1, -0, NaN], d: { toJSON() { return 'D'; } }, u: undefined })"), output));
+    EXPECT_EQ(std::string(output.begin(), output.end()),
+        ">{\"s\":\"caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80 \\ud800\",\"n\":[1,0.1,0,null],\"d\":\"D\"}");
+
+    output.clear();
+    EXPECT_TRUE(quickjs::stringifyJson(*rt, parsed, output));
+    EXPECT_EQ(std::string(output.begin(), output.end()), eval("JSON.stringify(parsed)").getString(*rt).utf8(*rt));
+
+    output.clear();
+    EXPECT_FALSE(quickjs::stringifyJson(*rt, eval("(function () {})"), output));
+    EXPECT_THROW(quickjs::stringifyJson(*rt, eval("({ get a() { throw new Error('no'); } })"), output), JSError);
+    EXPECT_TRUE(output.empty());
+}
+
+TEST(QuickJSIRegExp, CachedAndPrefilteredRegExpsMatchLikeBacktracking)
+{
+    auto rt = quickjs::makeQuickJSRuntime(quickjs::QuickJSRuntimeArgs {});
+    auto eval = [&](const char* code) { return rt->evaluateJavaScript(std::make_unique<StringBuffer>(code), "regexp.js").getString(*rt).utf8(*rt); };
+
+    // Literal prefixes, required characters and '^' anchors in narrow and wide strings.
+    EXPECT_EQ(eval(R"(
+        [
+            'xxabcxxabc'.replace(/abc/g, '<$&>'),
+            '一xabcxabc'.replace(/abc/g, '<$&>'),
+            JSON.stringify(/a(b)?c/.exec('zzacabc')),
+            JSON.stringify('12 34ERROR 5ERROR'.match(/\d+ERROR/g)),
+            String(/\d+QUIT/.test('12 34 QUI')),
+            String(/^abc/g.test('abcabc')) + String(/^abc/g.test('xabc')) + String(/^b/m.test('a\nb')),
+            JSON.stringify('foobaz foobar'.match(/foo(?=bar)/)),
+            JSON.stringify('😀é'.match(/é/u).index),
+            JSON.stringify('😀'.match(/\ude00/u)),
+            String(/ERROR/i.test('an error')),
+        ].join(' ')
+    )"), "xx<abc>xx<abc> \xe4\xb8\x80x<abc>x<abc> [\"ac\",null] [\"34ERROR\",\"5ERROR\"] false truefalsetrue [\"foo\"] 2 null true");
+
+    // Compiled patterns are shared, the RegExp objects are not.
+    EXPECT_EQ(eval(R"(
+        var results = [];
+        for (var i = 0; i < 200; ++i) {
+            var re = new RegExp('k' + (i % 70) + '(v)', 'g');
+            re.lastIndex = 1;
+            results.push(re.exec('k' + (i % 70) + 'v k' + (i % 70) + 'v').index);
+        }
+        var a = new RegExp('q(\\d)'), b = new RegExp('q(\\d)', 'y');
+        results.every(function (index) { return index > 1; }) + ' ' + a.exec('xq5')[1] + ' ' + b.exec('xq6') + ' ' + a.flags + b.flags;
+    )"), "true 5 null y");
+}
+
+TEST(QuickJSIRegExp, PathologicalRegExpsRunInLinearTime)
+{
+    auto rt = quickjs::makeQuickJSRuntime(quickjs::QuickJSRuntimeArgs {});
+    auto eval = [&](const char* code) { return rt->evaluateJavaScript(std::make_unique<StringBuffer>(code), "regexp.js").getString(*rt).utf8(*rt); };
+
+    // These take minutes to years with backtracking alone.
+    EXPECT_EQ(eval(R"(
+        [
+            JSON.stringify(/(a|a)*b/.exec('a'.repeat(40))),
+            /(x+x+)+y/.exec('x'.repeat(40) + 'y' + 'x'.repeat(40))[1].length,
+            String(/^(\w+\s?)+$/.test('word '.repeat(30) + '!')),
+            /(a|aa)+c|(a+)+d/.exec('a'.repeat(40) + 'd')[2].length,
+            JSON.stringify(/([ab]|)+?c/.exec('abababX ababc')),
+            /(a|a)*[bc]/.exec('a'.repeat(100000) + 'c')[0].length,
+        ].join(' ')
+    )"), "null 40 false 40 [\"ababc\",\"b\"] 100001");
+
+    // Empty iterations keep their captures as with backtracking.
+    EXPECT_EQ(eval(R"(
+        [8, 40].map(function (n) {
+            return [
+                JSON.stringify(/(?:(a|a)*c|(b|)+)+$/.exec('a'.repeat(n) + 'c' + 'a'.repeat(n) + 'bb')),
+                JSON.stringify(/(a|a)*(?:(x)|(b)|)+$/.exec('a'.repeat(n) + 'b').slice(1)),
+                JSON.stringify(/(a\1|b)*c/.exec('abc')),
+            ].join(' ');
+        }).join('\n')
+    )"), "[\"bb\",null,\"\"] [\"a\",null,\"b\"] [\"abc\",\"b\"]\n[\"bb\",null,\"\"] [\"a\",null,\"b\"] [\"abc\",\"b\"]");
+}
+
+TEST(QuickJSITypedArrays, TypedKernelsMatchTheGenericPaths)
+{
+    auto rt = quickjs::makeQuickJSRuntime(quickjs::QuickJSRuntimeArgs {});
+    auto eval = [&](const char* code) { return rt->evaluateJavaScript(std::make_unique<StringBuffer>(code), "typedarray.js").getString(*rt).utf8(*rt); };
+
+    // -0 sorts before +0 and NaNs last, with or without a radix sort.
+    EXPECT_EQ(eval(R"(
+        [8, 1000].map(function (n) {
+            var a = new Float64Array(n).fill(7);
+            a.set([3, NaN, -0, 0, -Infinity, 1, -NaN, -2.5]);
+            a.sort();
+            return [a[0], a[1], Object.is(a[2], -0), Object.is(a[3], 0), a[a.length - 1], a[a.length - 3]].join();
+        }).join(' ') + ' ' + Int8Array.of(-74, 5).lastIndexOf(-74) + ' ' + Float32Array.of(1, -0, 2).indexOf(0)
+    )"), "-Infinity,-2.5,true,true,NaN,3 -Infinity,-2.5,true,true,NaN,7 0 1");
+
+    // The default sort, fill, search and cross-type set agree with a comparison function,
+    // per-element loops and a set from a plain array.
+    EXPECT_EQ(eval(R"(
+        var seed = 1;
+        function random() { seed = (seed * 1103515245 + 12345) & 0x7fffffff; return seed / 0x80000000; }
+        function value(T) {
+            var r = random();
+            if (T === BigInt64Array || T === BigUint64Array)
+                return BigInt(Math.floor((random() - 0.5) * 1e12));
+            return r < 0.05 ? NaN : r < 0.1 ? -0 : r < 0.5 ? Math.floor((random() - 0.5) * 600) : (random() - 0.5) * 1e6;
+        }
+        function compare(x, y) {
+            if (x !== x || y !== y) return (x !== x) - (y !== y);
+            return x < y ? -1 : x > y ? 1 : x === 0 ? Object.is(y, -0) - Object.is(x, -0) : 0;
+        }
+        function same(a, b) { return a.length === b.length && a.every(function (x, i) { return Object.is(x, b[i]); }); }
+        var types = [Int8Array, Uint8Array, Uint8ClampedArray, Int16Array, Uint16Array, Int32Array, Uint32Array,
+                     Float32Array, Float64Array, BigInt64Array, BigUint64Array];
+        var failures = [];
+        types.forEach(function (T) {
+            var big = T === BigInt64Array || T === BigUint64Array;
+            [10, 200, 3000].forEach(function (n) {
+                var a = new T(n);
+                for (var i = 0; i < n; i++) a[i] = value(T);
+                if (!same(a.slice().sort(), a.slice().sort(compare))) failures.push('sort ' + T.name + n);
+                for (var t = 0; t < 20; t++) {
+                    var v = random() < 0.7 ? a[Math.floor(random() * n)] : value(T), from = Math.floor((random() - 0.3) * n);
+                    var first = -1, last = -1, start = from < 0 ? Math.max(0, n + from) : from;
+                    for (var i = start; i < n && first < 0; i++) if (a[i] === v) first = i;
+                    for (var i = from < 0 ? n + from : Math.min(from, n - 1); i >= 0 && last < 0; i--) if (a[i] === v) last = i;
+                    if (a.indexOf(v, from) !== first || a.lastIndexOf(v, from) !== last || a.includes(v, from) !== (first >= 0 || (v !== v && a.slice(start).some(function (x) { return x !== x; }))))
+                        failures.push('search ' + T.name + n + ' ' + v);
+                }
+                var f = a.slice(), g = a.slice(), v = value(T), s = Math.floor(random() * n);
+                f.fill(v, s, n - 1);
+                for (var i = s; i < n - 1; i++) g[i] = v;
+                if (!same(f, g)) failures.push('fill ' + T.name + n);
+                types.forEach(function (S) {
+                    if (big !== (S === BigInt64Array || S === BigUint64Array)) return;
+                    var src = new S(n >> 1), d = a.slice(), e = a.slice();
+                    for (var i = 0; i < src.length; i++) src[i] = value(S);
+                    d.set(src, 3);
+                    e.set(Array.from(src), 3);
+                    if (!same(d, e)) failures.push('set ' + S.name + ' ' + T.name + n);
+                });
+            });
+        });
+        var buffer = new Float64Array(64).map(function (x, i) { return i * 1.5 - 20; }).buffer;
+        var expected = Array.from(new Float64Array(buffer, 0, 30), function (x) { return x | 0; });
+        new Int32Array(buffer, 8, 40).set(new Float64Array(buffer, 0, 30), 2);
+        if (!same(new Int32Array(buffer, 16, 30), expected)) failures.push('overlapping set');
+        failures.join() || 'ok';
+    )"), "ok");
+}
+
+TEST(QuickJSIArrays, FastArrayPathsSeeMutationsDuringIteration)
+{
+    auto rt = quickjs::makeQuickJSRuntime(quickjs::QuickJSRuntimeArgs {});
+    auto eval = [&](const char* code) { return rt->evaluateJavaScript(std::make_unique<StringBuffer>(code), "array.js").getString(*rt).utf8(*rt); };
+
+    // Callbacks shrink, grow, punch holes in and add getters to the arrays being iterated.
+    EXPECT_EQ(eval(R"(
+        var r = [
+            [1, 2, 3, 4].map(function (v, i, a) { if (i === 1) a.pop(); return v * 2; }),
+            [1, 2, 3, 4].filter(function (v, i, a) { if (i === 0) a.push(5); return v & 1; }),
+            [1, 2, 3, 4, 5].reduce(function (s, v, i, a) { if (i === 1) delete a[3]; return s + v; }, 0),
+            [1, 2, 3].some(function (v, i, a) { if (i === 0) Object.defineProperty(a, 2, { get: function () { return 9; } }); return v === 9; }),
+            (function () { var a = [1, 2, 3], seen = []; for (var e of a.entries()) { seen.push(e); if (e[0] === 0) a.length = 2; } return seen; })(),
+            (function () { var a = [1, 2, 3], seen = []; a.forEach(function (v, i) { seen.push(v); if (i === 0) a.shift(); }); return seen; })(),
+            [0, ...[1, 2], ...'ab', ...new Set([3])],
+            Array.from([1, 2, 3], function (v, i) { return v + i; }),
+            [1, 2, 3].filter(function () { return false; }),
+        ];
+        var h = [1, , 3]; h.length = 4;
+        r.push([...h].length, Object.keys([...h]).length, Array.from({ length: 2, 0: 'a' }));
+        JSON.stringify(r);
+    )"), R"([[2,4,6,null],[1,3],11,true,[[0,1],[1,2]],[1,3],[0,1,2,"a","b",3],[1,3,5],[],4,4,["a",null]])");
+}
+
+TEST(QuickJSIMaps, CompactTableKeepsOrderAndIteratorSemantics)
+{
+    auto rt = quickjs::makeQuickJSRuntime(quickjs::QuickJSRuntimeArgs {});
+    auto eval = [&](const char* code) { return rt->evaluateJavaScript(std::make_unique<StringBuffer>(code), "map.js").getString(*rt).utf8(*rt); };
+
+    // Iterators skip the entries deleted and see the entries added while they run, even across table rebuilds.
+    EXPECT_EQ(eval(R"(
+        var r = [];
+        var m = new Map([[1, 'a'], [2, 'b'], [3, 'c'], [4, 'd']]), seen = [];
+        for (var [k] of m) { seen.push(k); if (k === 2) { m.delete(1); m.delete(3); m.set(5, 'e'); } }
+        r.push(seen);
+        var big = new Map(), keys = [];
+        for (var i = 0; i < 500; ++i) big.set('k' + i, i);
+        for (var k of big.keys()) { keys.push(k); if (k === 'k1') { for (var i = 2; i < 498; ++i) big.delete('k' + i); for (var i = 0; i < 300; ++i) big.set(i, i); } }
+        r.push(keys.length, keys.slice(0, 4), big.size);
+        var s = new Set([1, 2, 3]), order = [];
+        s.forEach(function (v) { order.push(v); if (v < 7) s.add(v + 3); s.delete(v); });
+        r.push(order, s.size);
+        var c = new Set([1, 2, 3]), cleared = [];
+        for (var v of c) { cleared.push(v); if (v === 1) { c.clear(); c.add(9); } }
+        r.push(cleared);
+        var o = {}, kinds = new Map([[-0, 'zero'], [NaN, 'nan'], ['ab', 'str'], [o, 'obj'], [1n, 'big']]);
+        r.push([kinds.get(0), kinds.get(NaN), kinds.get('a' + 'b'), kinds.get(o), kinds.get(1n), Object.is(kinds.keys().next().value, 0)]);
+        var w = new WeakMap(), held = [];
+        for (var i = 0; i < 100; ++i) { var key = { i: i }; if (i % 10 === 0) held.push(key); w.set(key, i); }
+        r.push(held.map(function (k) { return w.get(k); }).join(), w.delete(held[1]), w.has(held[1]));
+        JSON.stringify(r);
+    )"), R"([[1,2,4,5],304,["k0","k1","k498","k499"],304,[1,2,3,4,5,6,7,8,9],0,[1,9],["zero","nan","str","obj","big",true],"0,10,20,30,40,50,60,70,80,90",true,false])");
+
+    // The entries live in one array instead of one allocation each.
+    auto& instrumentation = rt->instrumentation();
+    instrumentation.collectGarbage();
+    auto before = instrumentation.getHeapInfo(true)["quickjs_mallocSize"];
+    eval("var large = new Map(); for (var i = 0; i < 250000; ++i) large.set(i, i); ''");
+    auto bytesPerEntry = (instrumentation.getHeapInfo(true)["quickjs_mallocSize"] - before) / 250000;
+    EXPECT_LT(bytesPerEntry, 64);
+}
+
+#ifdef QUICKJSI_FOLLY
+TEST(QuickJSIDynamic, DirectConversionMatchesTheJSIConversion)
+{
+    auto rt = quickjs::makeQuickJSRuntime(quickjs::QuickJSRuntimeArgs {});
+    // Built again for every conversion, as its getters change it.
+    auto makePayload = rt->evaluateJavaScript(std::make_unique<StringBuffer>(R"((function () {
+        var rope = '';
+        for (let i = 0; i < 200; ++i) rope += 'r' + i;
+        var holes = [1, , 3]; holes.length = 5;
+        var deleted = { a: 1, b: 2, c: 3 }; delete deleted.b;
+        var hidden = { shown: 1, [Symbol('s')]: 3 }; Object.defineProperty(hidden, 'hidden', { value: 2 });
+        var bare = Object.create(null); bare.x = 'bare';
+        var inherited = Object.create({ fromProto: 'p' }); inherited.own = 'o';
+        class Point { constructor() { this.x = 1; this.y = 2; } get sum() { return this.x + this.y; } }
+        // Getters that change the array and the object being converted.
+        var shrinking = [0, { get g() { shrinking.pop(); shrinking.pop(); return 'g'; } }, 2, 3];
+        var reshaped = { a: { get g() { delete reshaped.b; reshaped.z = 1; return 'g'; } }, b: 2, c: 3 };
+        var rows = [];
+        for (let i = 0; i < 100; ++i) rows.push({ id: i, name: 'row' + i, tags: ['a', i], nested: { ok: i % 2 === 0 } });
+        return { numbers: [0, -0, 1.5, 2 ** 53, -Infinity, -1e308, 7n], strings: ['', 'ünïcødé €', rope, 'a\0b'],
+           flags: [true, false, null, undefined], holes: holes, sparse: [, , 'x'], deleted: deleted, hidden: hidden, bare: bare,
+           inherited: inherited, point: new Point(), date: new Date(0), 1: 'one', '': 'empty', skipped: undefined,
+           method() {}, shrinking: shrinking, reshaped: reshaped, rows: rows };
+    }))"), "dynamic.js").getObject(*rt).getFunction(*rt);
+
+    auto direct = quickjs::dynamicFromValue(*rt, makePayload.call(*rt));
+    EXPECT_EQ(direct, facebook::jsi::dynamicFromValue(*rt, makePayload.call(*rt)));
+    EXPECT_EQ(direct["strings"][2].getString().size(), 690);
+    EXPECT_THROW(quickjs::dynamicFromValue(*rt, rt->evaluateJavaScript(std::make_unique<StringBuffer>("[1, function () {}]"), "")), JSError);
+
+    folly::dynamic keys = folly::dynamic::object();
+    keys.insert(1, "one");
+    keys.insert("two", 2);
+    keys.insert("", folly::dynamic::array());
+    direct["keys"] = keys;
+    auto stringify = rt->global().getPropertyAsObject(*rt, "JSON").getPropertyAsFunction(*rt, "stringify");
+    auto roundTrip = quickjs::valueFromDynamic(*rt, direct);
+    EXPECT_EQ(stringify.call(*rt, roundTrip).getString(*rt).utf8(*rt), stringify.call(*rt, facebook::jsi::valueFromDynamic(*rt, direct)).getString(*rt).utf8(*rt));
+    EXPECT_EQ(quickjs::dynamicFromValue(*rt, roundTrip), facebook::jsi::dynamicFromValue(*rt, roundTrip));
+}
+#endif
@@ -0,0 +1,20 @@
+#pragma once
+#include <jsi/jsi.h>
+#include <quickjs.h>
+
+namespace quickjs {
+
+// Direct access to the QuickJS values behind a runtime, for the converters built into QuickJSI that read
+// and build JS data with the QuickJS API instead of one JSI call per property (see QuickJSDynamic.cpp).
+// The public QuickJSRuntime.h does not expose the QuickJS headers, so these stay internal.
+
+// Returns nullptr when the runtime is not a QuickJS runtime, for example a decorator.
+JSContext* GetJSContext(facebook::jsi::Runtime& runtime) noexcept;
+
+// The value is not duplicated and stays valid as long as the JSI value.
+JSValueConst GetJSValue(facebook::jsi::Runtime& runtime, const facebook::jsi::Value& value);
+
+// Takes ownership of the value. JS_EXCEPTION throws the pending exception as a jsi::JSError.
+facebook::jsi::Value CreateJSIValue(facebook::jsi::Runtime& runtime, JSValue&& value);
+
+}
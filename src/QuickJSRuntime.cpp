@@ -1,14 +1,25 @@
 #include <iostream>
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <iterator>
 #include <memory>
 #include <string>
 #include <mutex>
+#include <optional>
 #include <sstream>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include <quickjspp.hpp>
+#include <jsi/instrumentation.h>
 
 #include "QuickJSRuntime.h"
+#include "QuickJSNative.h"
+#include "EventLoop.h"
+#include "ScriptCompiler.h"
 
 #ifdef TRACE_FUNCTION_CALLS
 #define WIN32_LEAN_AND_MEAN
@@ -46,6 +57,129 @@ JSClassDef g_hostObjectClassDef;
 std::once_flag g_hostFunctionClassOnceFlag;
 JSClassID g_hostFunctionClassId {};
 JSClassDef g_hostFunctionClassDef;
+
+// Multi-producer, single-consumer queue of async host function completions.
+// Worker threads push, the runtime thread takes the whole batch at once.
+class AsyncCompletionQueue
+{
+public:
+    struct Completion
+    {
+        uint64_t callId;
+        bool isRejection;
+        AsyncHostFunctionResolver::ValueFactory valueFactory;
+        std::string message;
+    };
+
+    void Push(Completion&& completion)
+    {
+        std::shared_ptr<EventLoopWaiter> waiter;
+        {
+            std::lock_guard<std::mutex> lock { _mutex };
+            if (_closed)
+            {
+                return;
+            }
+
+            _completions.push_back(std::move(completion));
+            waiter = _waiter;
+        }
+
+        if (waiter)
+        {
+            waiter->Wake();
+        }
+    }
+
+    // Wakes the event loop whenever a completion arrives.
+    void SetWaiter(std::shared_ptr<EventLoopWaiter> waiter)
+    {
+        std::lock_guard<std::mutex> lock { _mutex };
+        _waiter = std::move(waiter);
+    }
+
+    std::vector<Completion> TakeAll()
+    {
+        std::vector<Completion> result;
+        std::lock_guard<std::mutex> lock { _mutex };
+        result.swap(_completions);
+        return result;
+    }
+
+    // Returns completions taken but not processed ahead of the ones pushed since, and wakes the
+    // event loop so that they are taken again.
+    void PutBack(std::vector<Completion>&& completions)
+    {
+        std::shared_ptr<EventLoopWaiter> waiter;
+        {
+            std::lock_guard<std::mutex> lock { _mutex };
+            if (_closed)
+            {
+                return;
+            }
+
+            completions.insert(completions.end(), std::make_move_iterator(_completions.begin()),
+                std::make_move_iterator(_completions.end()));
+            _completions.swap(completions);
+            waiter = _waiter;
+        }
+
+        if (waiter)
+        {
+            waiter->Wake();
+        }
+    }
+
+    // Called when the runtime goes away. Later completions are dropped.
+    void Close()
+    {
+        std::lock_guard<std::mutex> lock { _mutex };
+        _closed = true;
+        _completions.clear();
+        _waiter.reset();
+    }
+
+private:
+    std::mutex _mutex;
+    std::vector<Completion> _completions;
+    std::shared_ptr<EventLoopWaiter> _waiter;
+    bool _closed { false };
+};
+
+class AsyncHostFunctionResolverImpl final : public AsyncHostFunctionResolver
+{
+public:
+    AsyncHostFunctionResolverImpl(std::shared_ptr<AsyncCompletionQueue> queue, uint64_t callId) noexcept
+        : _queue { std::move(queue) }, _callId { callId }
+    {
+    }
+
+    ~AsyncHostFunctionResolverImpl() override
+    {
+        reject("Async host function completed without settling its promise");
+    }
+
+    void resolve(ValueFactory&& valueFactory) override
+    {
+        if (!_settled.exchange(true))
+        {
+            _queue->Push({ _callId, false, std::move(valueFactory), {} });
+        }
+    }
+
+    void reject(std::string message) override
+    {
+        if (!_settled.exchange(true))
+        {
+            _queue->Push({ _callId, true, nullptr, std::move(message) });
+        }
+    }
+
+private:
+    std::shared_ptr<AsyncCompletionQueue> _queue;
+    uint64_t _callId;
+    std::atomic<bool> _settled { false };
+};
 } // namespace
 
 static constexpr size_t MaxCallArgCount = 32;
@@ -180,6 +314,61 @@ private:
         std::thread::id _threadId{std::this_thread::get_id()};
     };
 
+    class QuickJSPropertyPlan final : public PropertyPlan
+    {
+    public:
+        QuickJSPropertyPlan(QuickJSRuntime& owner, JSPropertyPlan* plan, size_t size) noexcept :
+            _owner(owner), _plan(plan), _size(size)
+        {
+        }
+
+        ~QuickJSPropertyPlan() override
+        {
+            assert(_threadId == std::this_thread::get_id());
+            JS_FreePropertyPlan(_owner._runtime.rt, _plan);
+        }
+
+        size_t size() const noexcept override
+        {
+            return _size;
+        }
+
+        QuickJSRuntime& owner() const noexcept
+        {
+            return _owner;
+        }
+
+        JSPropertyPlan* get() const noexcept
+        {
+            return _plan;
+        }
+
+    private:
+        QuickJSRuntime& _owner;
+        JSPropertyPlan* _plan;
+        size_t _size;
+        std::thread::id _threadId{std::this_thread::get_id()};
+    };
+
+    // The QuickJS values of a property plan call, kept on the stack for the usual record sizes.
+    class PlanValues
+    {
+    public:
+        explicit PlanValues(size_t size) :
+            _heap(size > std::size(_stack) ? std::make_unique<JSValue[]>(size) : nullptr)
+        {
+        }
+
+        JSValue* data() noexcept
+        {
+            return _heap ? _heap.get() : _stack;
+        }
+
+    private:
+        JSValue _stack[16];
+        std::unique_ptr<JSValue[]> _heap;
+    };
+
     template <typename T>
     T createPointerValue(qjs::Value&& val)
     {
@@ -205,7 +394,7 @@ private:
         }
         else if (value.isNull())
         {
-            return qjs::Value { nullptr, JS_NULL };
+            return qjs::Value { _context.ctx, JS_NULL };
         }
         else if (value.isBool())
         {
@@ -238,12 +427,33 @@ private:
 
     jsi::Value createValue(JSValue&& jsValue)
     {
-        if (JS_IsException(jsValue))
+        // Numbers, booleans, undefined and null need no reference, so they skip the qjs::Value wrapper.
+        int tag = JS_VALUE_GET_TAG(jsValue);
+        switch (tag)
         {
-            ThrowJSError();
-        }
+            case JS_TAG_INT:
+                return jsi::Value(JS_VALUE_GET_INT(jsValue));
+
+            case JS_TAG_BOOL:
+                return jsi::Value(JS_VALUE_GET_BOOL(jsValue) != 0);
+
+            case JS_TAG_UNDEFINED:
+                return jsi::Value();
+
+            case JS_TAG_NULL:
+                return jsi::Value(nullptr);
+
+            case JS_TAG_EXCEPTION:
+                ThrowJSError();
+
+            default:
+                if (JS_TAG_IS_FLOAT64(tag))
+                {
+                    return jsi::Value(JS_VALUE_GET_FLOAT64(jsValue));
+                }
 
-        return createValue(_context.newValue(std::move(jsValue)));
+                return createValue(_context.newValue(std::move(jsValue)));
+        }
     }
 
     jsi::Value createValue(qjs::Value&& val)
@@ -267,6 +477,7 @@ private:
                 return jsi::Value(nullptr);
 
             case JS_TAG_STRING:
+            case JS_TAG_STRING_ROPE:
                 return createPointerValue<jsi::String>(std::move(val));
 
             case JS_TAG_OBJECT:
@@ -288,217 +499,1099 @@ private:
         }
     }
 
-    static JSAtom AsJSAtomConst(const jsi::PropNameID& propertyId) noexcept
+    static JSAtom AsJSAtomConst(const jsi::PropNameID& propertyId) noexcept
+    {
+        return QuickJSAtomPointerValue::GetJSAtom(getPointerValue(propertyId));
+    }
+
+    template <typename T>
+    static JSValue AsJSValue(const T& obj) noexcept
+    {
+        return QuickJSPointerValue::GetJSValue(getPointerValue(obj));
+    }
+
+    JSValue AsJSValue(const jsi::Value& value) noexcept
+    {
+        return fromJSIValue(value).v;
+    }
+
+    JSValueConst AsJSValueConst(const jsi::Value& value) const noexcept
+    {
+        if (value.isUndefined())
+        {
+            return JS_UNDEFINED;
+        }
+        else if (value.isNull())
+        {
+            return JS_NULL;
+        }
+        else if (value.isBool())
+        {
+            return value.getBool() ? JS_TRUE : JS_FALSE;
+        }
+        else if (value.isNumber())
+        {
+            return JS_NewFloat64(_context.ctx, value.getNumber());
+        }
+        else if (value.isSymbol())
+        {
+            return QuickJSPointerValue::GetJSValue(getPointerValue(value));
+        }
+        else if (value.isString())
+        {
+            return QuickJSPointerValue::GetJSValue(getPointerValue(value));
+        }
+        else if (value.isObject())
+        {
+            return QuickJSPointerValue::GetJSValue(getPointerValue(value));
+        }
+        else
+        {
+            QJS_VERIFY_ELSE_CRASH_MSG(false, "Unknown JSI Value kind");
+        }
+    }
+
+    JSValueConst AsJSValueConst(const jsi::Pointer& ptr) const noexcept
+    {
+        return QuickJSPointerValue::GetJSValue(getPointerValue(ptr));
+    }
+
+    template <typename T>
+    static qjs::Value AsValue(const T& obj) noexcept
+    {
+        return QuickJSPointerValue::GetValue(getPointerValue(obj));
+    }
+
+    JSValue CloneJSValue(const jsi::Value& value) noexcept
+    {
+        return JS_DupValue(_context.ctx, AsJSValueConst(value));
+    }
+
+    // Converts the value to a string, or returns an empty string if the conversion throws.
+    std::string ToStdString(JSValueConst value) const
+    {
+        std::string result;
+        size_t length;
+        if (const char* str = JS_ToCStringLen(_context.ctx, &length, value))
+        {
+            result.assign(str, length);
+            JS_FreeCString(_context.ctx, str);
+        }
+        else
+        {
+            JS_FreeValue(_context.ctx, JS_GetException(_context.ctx));
+        }
+
+        return result;
+    }
+
+    // Reads a property of the exception object as a string, or returns an empty string if it is undefined.
+    // Reading 'stack' is what formats the frames captured by the error.
+    std::string GetExceptionProperty(JSValueConst exception, const Atom& atom) const
+    {
+        std::string result;
+        JSValue value = JS_GetProperty(_context.ctx, exception, atom.a);
+        if (JS_IsException(value))
+        {
+            JS_FreeValue(_context.ctx, JS_GetException(_context.ctx));
+        }
+        else if (!JS_IsUndefined(value))
+        {
+            result = ToStdString(value);
+        }
+
+        JS_FreeValue(_context.ctx, value);
+        return result;
+    }
+
+    std::string getExceptionDetails()
+    {
+        JSValue exception = JS_GetException(_context.ctx);
+
+        std::string details = ToStdString(exception);
+        details += '\n';
+        if (JS_IsObject(exception))
+        {
+            std::string stack = GetExceptionProperty(exception, _stackAtom);
+            if (!stack.empty())
+            {
+                details += stack;
+                details += '\n';
+            }
+        }
+
+        JS_FreeValue(_context.ctx, exception);
+        return details;
+    }
+
+    // Set while ThrowJSError creates the jsi::JSError.
+    mutable bool _raisingJSError { false };
+
+    [[noreturn]]
+    void ThrowJSError() const
+    {
+        auto self = const_cast<QuickJSRuntime*>(this);
+        JSValue exception = JS_GetException(_context.ctx);
+        bool timedOut = _budget && _budget->exceeded && JS_IsUncatchableError(_context.ctx, exception);
+        std::string message;
+        std::string stack;
+        if (JS_IsObject(exception))
+        {
+            message = GetExceptionProperty(exception, _messageAtom);
+            stack = GetExceptionProperty(exception, _stackAtom);
+        }
+        else
+        {
+            // A thrown primitive is its own message.
+            message = ToStdString(exception);
+        }
+
+        JS_FreeValue(_context.ctx, exception);
+
+        if (timedOut)
+        {
+            ThrowExecutionTimeout(std::move(stack));
+        }
+
+        // Creating the jsi::JSError allocates JS values. When that fails too, for example out of
+        // memory, the nested error is reported without them instead of recursing.
+        if (_raisingJSError)
+        {
+            throw jsi::JSINativeException(std::move(message));
+        }
+
+        _raisingJSError = true;
+        std::optional<jsi::JSError> error;
+        try
+        {
+            error.emplace(*self, std::move(message), std::move(stack));
+        }
+        catch (...)
+        {
+            _raisingJSError = false;
+            throw;
+        }
+
+        _raisingJSError = false;
+        throw *error;
+    }
+
+    [[noreturn]]
+    void ThrowExecutionTimeout(std::string stack) const
+    {
+        _budget->exceeded = false;
+        throw ExecutionTimeoutError(*const_cast<QuickJSRuntime*>(this), "JavaScript execution exceeded its time budget", std::move(stack));
+    }
+
+    // Throw if value is negative. It indicates an error. 
+    int CheckBool(int value)
+    {
+        if (value < 0)
+        {
+            ThrowJSError();
+        }
+
+        return value;
+    }
+
+    JSValue CheckJSValue(JSValue&& value)
+    {
+        if (JS_IsException(value))
+        {
+            ThrowJSError();
+        }
+
+        return std::move(value);
+    }
+
+    static QuickJSRuntime* FromContext(JSContext* ctx)
+    {
+        return static_cast<QuickJSRuntime*>(JS_GetContextOpaque(ctx));
+    }
+
+    // Returns a new Error object, or JS_NULL if it cannot be allocated.
+    static JSValue NewError(JSContext* ctx, const char* message, const char* stack)
+    {
+        JSValue errorObj = JS_NewError(ctx);
+        if (JS_IsException(errorObj))
+        {
+            errorObj = JS_NULL;
+        }
+        else
+        {
+            if (!message)
+            {
+                message = "Unknown error";
+            }
+
+            const QuickJSRuntime* self = FromContext(ctx);
+            JS_DefinePropertyValue(ctx, errorObj, self->_messageAtom.a,
+                JS_NewString(ctx, message),
+                JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE);
+
+            if (stack)
+            {
+                JS_DefinePropertyValue(ctx, errorObj, self->_stackAtom.a,
+                    JS_NewString(ctx, stack),
+                    JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE);
+            }
+        }
+
+        return errorObj;
+    }
+
+    static int SetException(JSContext* ctx, const char* message, const char* stack)
+    {
+        JSValue errorObj = NewError(ctx, message, stack);
+
+        // A host function must not turn a budget interruption into an error that script code can catch.
+        const auto& budget = FromContext(ctx)->_budget;
+        if (budget && budget->exceeded)
+        {
+            JS_SetUncatchableError(ctx, errorObj, true);
+        }
+
+        JS_Throw(ctx, errorObj);
+        return -1;
+    }
+
+    // Time budgets from QuickJSRuntimeArgs, enforced by the interrupt handler.
+    struct ExecutionBudget
+    {
+        using Clock = std::chrono::steady_clock;
+
+        // QuickJS calls the interrupt handler every JS_INTERRUPT_COUNTER_INIT operations.
+        // Reading the clock only on every Nth call keeps the check cheap enough to leave on.
+        static constexpr int PollsPerClockCheck = 8;
+
+        Clock::duration callBudget;
+        Clock::duration runtimeBudget;
+        Clock::duration used {};
+        Clock::time_point start {};
+        Clock::time_point deadline { Clock::time_point::max() };
+        int pollsUntilClockCheck { PollsPerClockCheck };
+        bool exceeded { false };
+    };
+
+    std::unique_ptr<ExecutionBudget> _budget;
+
+    static int InterruptHandler(JSRuntime* /*rt*/, void* opaque) noexcept
+    {
+        auto& budget = *static_cast<ExecutionBudget*>(opaque);
+        if (budget.exceeded)
+        {
+            return 1;
+        }
+
+        if (--budget.pollsUntilClockCheck > 0)
+        {
+            return 0;
+        }
+
+        budget.pollsUntilClockCheck = ExecutionBudget::PollsPerClockCheck;
+        budget.exceeded = ExecutionBudget::Clock::now() >= budget.deadline;
+        return budget.exceeded ? 1 : 0;
+    }
+
+    // Starts the clock when entering JS from the host. Nested calls from host functions
+    // run under the budget of the outermost call.
+    struct ExecutionBudgetScope
+    {
+        ExecutionBudgetScope(QuickJSRuntime& rt)
+            : _budget{rt._dontExecutePending ? nullptr : rt._budget.get()}
+        {
+            if (!_budget)
+                return;
+
+            using Clock = ExecutionBudget::Clock;
+            _budget->exceeded = false;
+            _budget->pollsUntilClockCheck = ExecutionBudget::PollsPerClockCheck;
+            _budget->start = Clock::now();
+            _budget->deadline = Clock::time_point::max();
+
+            if (_budget->callBudget > Clock::duration::zero())
+            {
+                _budget->deadline = _budget->start + _budget->callBudget;
+            }
+
+            if (_budget->runtimeBudget > Clock::duration::zero())
+            {
+                if (_budget->used >= _budget->runtimeBudget)
+                {
+                    // Creating the error calls into JS, which must not come back through this check.
+                    bool dontExecutePending = std::exchange(rt._dontExecutePending, true);
+                    ExecutionTimeoutError error(rt, "The runtime has used up its JavaScript execution time budget");
+                    rt._dontExecutePending = dontExecutePending;
+                    throw error;
+                }
+
+                _budget->deadline = std::min(_budget->deadline, _budget->start + (_budget->runtimeBudget - _budget->used));
+            }
+        }
+
+        ~ExecutionBudgetScope()
+        {
+            if (!_budget)
+                return;
+
+            _budget->used += ExecutionBudget::Clock::now() - _budget->start;
+            _budget->deadline = ExecutionBudget::Clock::time_point::max();
+        }
+
+    private:
+        ExecutionBudget* _budget;
+    };
+
+    bool _dontExecutePending{false};
+
+    // Entered by every call from the host into JS. The promise jobs and microtasks queued by the call
+    // run when it calls ExecutePendingJobs after getting its result, rather than from the destructor,
+    // because a job that throws reports its exception to the host.
+    struct PendingExecutionScope
+    {
+        PendingExecutionScope(QuickJSRuntime& rt)
+            : _budgetScope{rt}
+            , _pushedScope{std::exchange(rt._dontExecutePending, true)}
+            , _rt(rt)
+        {
+        }
+
+        ~PendingExecutionScope()
+        {
+            _rt._dontExecutePending = _pushedScope;
+        }
+
+        // Only the outermost scope runs the jobs. The first one that throws stops the draining and
+        // its exception is thrown; the jobs left are run by the next call from the host. So does
+        // running out of time, even if a builtin caught the interruption.
+        void ExecutePendingJobs()
+        {
+            if (_pushedScope)
+                return;
+
+            _rt.DrainAsyncCompletions();
+
+            JSContext *ctx1{nullptr};
+            int err;
+            while ((err = JS_ExecutePendingJob(_rt._runtime.rt, &ctx1)) != 0)
+            {
+                if (err < 0)
+                {
+                    _rt.ThrowJSError();
+                }
+
+                if (_rt._budget && _rt._budget->exceeded)
+                {
+                    _rt.ThrowExecutionTimeout({});
+                }
+            }
+        }
+
+    private:
+        // Declared first so that the pending jobs run within the budget.
+        ExecutionBudgetScope _budgetScope;
+        bool _pushedScope;
+        QuickJSRuntime &_rt;
+    };
+
+    // Resolving functions of promises returned by async host functions, keyed by call id.
+    // They are only touched on the runtime thread; resolvers refer to them by id.
+    struct PendingAsyncCall
+    {
+        qjs::Value resolve;
+        qjs::Value reject;
+    };
+
+    std::shared_ptr<AsyncCompletionQueue> _asyncCompletions{std::make_shared<AsyncCompletionQueue>()};
+    std::unordered_map<uint64_t, PendingAsyncCall> _pendingAsyncCalls;
+    uint64_t _nextAsyncCallId{0};
+
+    static JSValue SettlePromiseJob(JSContext* ctx, int argc, JSValueConst* argv)
+    {
+        return JS_Call(ctx, argv[0], JS_UNDEFINED, 1, argv + 1);
+    }
+
+    // Turns queued completions into promise jobs. Must run on the runtime thread.
+    // Settling a completion only throws when QuickJS runs out of memory. The completions not settled
+    // yet then go back to the queue, so that their promises still settle on a later drain.
+    void DrainAsyncCompletions()
+    {
+        auto completions = _asyncCompletions->TakeAll();
+        size_t next = 0;
+        try
+        {
+            for (; next < completions.size(); ++next)
+            {
+                SettleAsyncCompletion(completions[next]);
+            }
+        }
+        catch (...)
+        {
+            completions.erase(completions.begin(), completions.begin() + next);
+            _asyncCompletions->PutBack(std::move(completions));
+            throw;
+        }
+    }
+
+    void SettleAsyncCompletion(AsyncCompletionQueue::Completion& completion)
+    {
+        auto it = _pendingAsyncCalls.find(completion.callId);
+        if (it == _pendingAsyncCalls.end())
+        {
+            return;
+        }
+
+        bool isRejection = completion.isRejection;
+        qjs::Value result { nullptr, JS_UNDEFINED };
+        if (!isRejection)
+        {
+            // The value factory runs once. If settling fails after it ran, the completion is put back
+            // as a rejection.
+            auto valueFactory = std::move(completion.valueFactory);
+            completion.isRejection = true;
+            completion.message = "Async host function result could not be delivered";
+            try
+            {
+                result = fromJSIValue(valueFactory(*this));
+            }
+            catch (const jsi::JSError& jsError)
+            {
+                isRejection = true;
+                result = _context.newValue(NewError(_context.ctx, jsError.getMessage().c_str(), jsError.getStack().c_str()));
+            }
+            catch (const std::exception& ex)
+            {
+                isRejection = true;
+                result = _context.newValue(NewError(_context.ctx, ex.what(), nullptr));
+            }
+            catch (const qjs::exception&)
+            {
+                // Out of memory while converting the value.
+                throw;
+            }
+            catch (...)
+            {
+                isRejection = true;
+                result = _context.newValue(NewError(_context.ctx, "Async host function threw an unknown exception", nullptr));
+            }
+        }
+        else
+        {
+            result = _context.newValue(NewError(_context.ctx, completion.message.c_str(), nullptr));
+        }
+
+        std::array<JSValueConst, 2> jobArgs { isRejection ? it->second.reject.v : it->second.resolve.v, result.v };
+        CheckBool(JS_EnqueueJob(_context.ctx, SettlePromiseJob, static_cast<int>(jobArgs.size()), jobArgs.data()));
+        _pendingAsyncCalls.erase(it);
+    }
+
+    // A callback registered with setTimeout, setInterval or setImmediate.
+    struct TimerCallback
+    {
+        qjs::Value function;
+        std::vector<qjs::Value> args;
+        uint64_t interval;
+        bool repeat;
+    };
+
+    // Timers are kept in a TimerWheel keyed by id; the wheel tick is one millisecond
+    // since the event loop was created.
+    struct EventLoopState
+    {
+        TimerWheel timers;
+        std::shared_ptr<EventLoopWaiter> waiter { std::make_shared<EventLoopWaiter>() };
+        std::unordered_map<uint64_t, TimerCallback> timerCallbacks;
+        std::unordered_map<uint64_t, TimerCallback> immediateCallbacks;
+        std::vector<uint64_t> immediateQueue;
+        uint64_t nextId { 1 };
+        std::chrono::steady_clock::time_point epoch { std::chrono::steady_clock::now() };
+    };
+
+    std::unique_ptr<EventLoopState> _eventLoop;
+
+    enum class TimerKind { Timeout, Interval, Immediate };
+
+    uint64_t EventLoopNow() const
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - _eventLoop->epoch).count());
+    }
+
+    static JSValue SetTimer(JSContext* ctx, JSValueConst /*this_val*/, int argc, JSValueConst* argv, int magic) noexcept try
+    {
+        QuickJSRuntime* runtime = QuickJSRuntime::FromContext(ctx);
+        EventLoopState& loop = *runtime->_eventLoop;
+        auto kind = static_cast<TimerKind>(magic);
+
+        if (argc < 1 || !JS_IsFunction(ctx, argv[0]))
+        {
+            return JS_ThrowTypeError(ctx, "The callback must be a function");
+        }
+
+        int firstArg = 1;
+        double delay = 0;
+        if (kind != TimerKind::Immediate)
+        {
+            firstArg = 2;
+            if (argc > 1 && JS_ToFloat64(ctx, &delay, argv[1]) < 0)
+            {
+                return JS_EXCEPTION;
+            }
+
+            // NaN, negative and huge delays are clamped like in browsers.
+            delay = (delay >= 1 && delay <= 2147483647.0) ? delay : (delay > 2147483647.0 ? 2147483647.0 : 1);
+        }
+
+        TimerCallback callback { runtime->_context.newValue(JS_DupValue(ctx, argv[0])), {}, static_cast<uint64_t>(delay), kind == TimerKind::Interval };
+        for (int i = firstArg; i < argc; ++i)
+        {
+            callback.args.push_back(runtime->_context.newValue(JS_DupValue(ctx, argv[i])));
+        }
+
+        uint64_t id = loop.nextId++;
+        if (kind == TimerKind::Immediate)
+        {
+            loop.immediateCallbacks.emplace(id, std::move(callback));
+            loop.immediateQueue.push_back(id);
+        }
+        else
+        {
+            loop.timers.Schedule(id, runtime->EventLoopNow() + callback.interval);
+            loop.timerCallbacks.emplace(id, std::move(callback));
+        }
+
+        return JS_NewInt64(ctx, static_cast<int64_t>(id));
+    }
+    catch (...)
+    {
+        return JS_ThrowOutOfMemory(ctx);
+    }
+
+    static JSValue ClearTimer(JSContext* ctx, JSValueConst /*this_val*/, int argc, JSValueConst* argv, int magic) noexcept
+    {
+        EventLoopState& loop = *QuickJSRuntime::FromContext(ctx)->_eventLoop;
+        int64_t id = 0;
+        if (argc < 1 || !JS_IsNumber(argv[0]) || JS_ToInt64(ctx, &id, argv[0]) < 0 || id <= 0)
+        {
+            return JS_UNDEFINED;
+        }
+
+        if (static_cast<TimerKind>(magic) == TimerKind::Immediate)
+        {
+            loop.immediateCallbacks.erase(static_cast<uint64_t>(id));
+        }
+        else if (loop.timerCallbacks.erase(static_cast<uint64_t>(id)))
+        {
+            loop.timers.Cancel(static_cast<uint64_t>(id));
+        }
+
+        return JS_UNDEFINED;
+    }
+
+    static JSValue MicrotaskJob(JSContext* ctx, int /*argc*/, JSValueConst* argv)
+    {
+        return JS_Call(ctx, argv[0], JS_UNDEFINED, 0, nullptr);
+    }
+
+    static JSValue QueueMicrotask(JSContext* ctx, JSValueConst /*this_val*/, int argc, JSValueConst* argv) noexcept
+    {
+        if (argc < 1 || !JS_IsFunction(ctx, argv[0]))
+        {
+            return JS_ThrowTypeError(ctx, "The callback must be a function");
+        }
+
+        if (JS_EnqueueJob(ctx, MicrotaskJob, 1, argv) < 0)
+        {
+            return JS_EXCEPTION;
+        }
+
+        return JS_UNDEFINED;
+    }
+
+    void InstallEventLoop()
+    {
+        _eventLoop = std::make_unique<EventLoopState>();
+        _asyncCompletions->SetWaiter(_eventLoop->waiter);
+
+        auto global = _context.global();
+        auto addFunction = [&](const char* name, JSValue func)
+        {
+            CheckBool(JS_SetPropertyStr(_context.ctx, global.v, name, CheckJSValue(std::move(func))));
+        };
+
+        addFunction("setTimeout", JS_NewCFunctionMagic(_context.ctx, SetTimer, "setTimeout", 2, JS_CFUNC_generic_magic, static_cast<int>(TimerKind::Timeout)));
+        addFunction("setInterval", JS_NewCFunctionMagic(_context.ctx, SetTimer, "setInterval", 2, JS_CFUNC_generic_magic, static_cast<int>(TimerKind::Interval)));
+        addFunction("setImmediate", JS_NewCFunctionMagic(_context.ctx, SetTimer, "setImmediate", 1, JS_CFUNC_generic_magic, static_cast<int>(TimerKind::Immediate)));
+        addFunction("clearTimeout", JS_NewCFunctionMagic(_context.ctx, ClearTimer, "clearTimeout", 1, JS_CFUNC_generic_magic, static_cast<int>(TimerKind::Timeout)));
+        addFunction("clearInterval", JS_NewCFunctionMagic(_context.ctx, ClearTimer, "clearInterval", 1, JS_CFUNC_generic_magic, static_cast<int>(TimerKind::Interval)));
+        addFunction("clearImmediate", JS_NewCFunctionMagic(_context.ctx, ClearTimer, "clearImmediate", 1, JS_CFUNC_generic_magic, static_cast<int>(TimerKind::Immediate)));
+        addFunction("queueMicrotask", JS_NewCFunction(_context.ctx, QueueMicrotask, "queueMicrotask", 1));
+    }
+
+    EventLoopState& RequireEventLoop()
+    {
+        if (!_eventLoop)
+        {
+            throw jsi::JSINativeException("The event loop is not enabled for this runtime");
+        }
+
+        return *_eventLoop;
+    }
+
+    void InvokeTimerCallback(const TimerCallback& callback)
+    {
+        std::vector<JSValueConst> args;
+        args.reserve(callback.args.size());
+        for (const auto& arg : callback.args)
+        {
+            args.push_back(arg.v);
+        }
+
+        // Each callback is a separate task, followed by its microtasks.
+        PendingExecutionScope scope(*this);
+        CheckJSValue(JS_Call(_context.ctx, callback.function.v, JS_UNDEFINED, static_cast<int>(args.size()), args.data()));
+        scope.ExecutePendingJobs();
+    }
+
+    // getHeapInfo walks the whole heap with JS_ComputeMemoryUsage, so it is always "expensive".
+    class QuickJSInstrumentation final : public jsi::Instrumentation
+    {
+    public:
+        explicit QuickJSInstrumentation(JSRuntime* rt) noexcept : _rt { rt }
+        {
+        }
+
+        std::string getRecordedGCStats() override
+        {
+            return "";
+        }
+
+        std::unordered_map<std::string, int64_t> getHeapInfo(bool /*includeExpensive*/) override
+        {
+            JSMemoryUsage usage;
+            JS_ComputeMemoryUsage(_rt, &usage);
+            return {
+                { "quickjs_mallocSize", usage.malloc_size },
+                { "quickjs_mallocCount", usage.malloc_count },
+                { "quickjs_externalSize", static_cast<int64_t>(JS_GetExternalMemory(_rt)) },
+                { "quickjs_objectCount", usage.obj_count },
+                { "quickjs_objectSize", usage.obj_size },
+                { "quickjs_propertyCount", usage.prop_count },
+                { "quickjs_propertySize", usage.prop_size },
+                { "quickjs_shapeCount", usage.shape_count },
+                { "quickjs_shapeSize", usage.shape_size },
+                { "quickjs_stringCount", usage.str_count },
+                { "quickjs_stringSize", usage.str_size },
+                { "quickjs_atomCount", usage.atom_count },
+                { "quickjs_atomSize", usage.atom_size },
+            };
+        }
+
+        void collectGarbage() override
+        {
+            JS_RunGC(_rt);
+        }
+
+        void createSnapshotToFile(const std::string&) override
+        {
+            throw jsi::JSINativeException("QuickJS cannot create a heap snapshot");
+        }
+
+        void createSnapshotToStream(std::ostream&) override
+        {
+            throw jsi::JSINativeException("QuickJS cannot create a heap snapshot");
+        }
+
+        std::string flushAndDisableBridgeTrafficTrace() override
+        {
+            return "";
+        }
+
+        void writeBasicBlockProfileTraceToFile(const std::string&) const override
+        {
+        }
+
+        void dumpProfilerSymbolsToFile(const std::string&) const override
+        {
+        }
+
+    private:
+        JSRuntime* _rt;
+    };
+
+    QuickJSInstrumentation _instrumentation { _runtime.rt };
+
+    // The Error properties read and written when converting exceptions, interned once.
+    const Atom _messageAtom { _context.ctx, "message" };
+    const Atom _stackAtom { _context.ctx, "stack" };
+
+    // Compilation options from QuickJSRuntimeArgs.
+    bool _lazyCompilation;
+    std::function<ScriptDebugInfo(const std::string&)> _scriptDebugInfo;
+
+    ScriptDebugInfo GetScriptDebugInfo(const std::string& sourceURL) const
+    {
+        return _scriptDebugInfo ? _scriptDebugInfo(sourceURL) : ScriptDebugInfo::Full;
+    }
+
+public:
+    QuickJSRuntime(QuickJSRuntimeArgs&& args) :
+        _runtime(), _context(_runtime),
+        _lazyCompilation { args.enableLazyCompilation }, _scriptDebugInfo { std::move(args.scriptDebugInfo) }
+    {
+        JS_SetContextOpaque(_context.ctx, this);
+
+        if (args.enableEventLoop)
+        {
+            InstallEventLoop();
+        }
+
+        if (args.callTimeBudget.count() > 0 || args.runtimeTimeBudget.count() > 0)
+        {
+            _budget = std::make_unique<ExecutionBudget>();
+            _budget->callBudget = args.callTimeBudget;
+            _budget->runtimeBudget = args.runtimeTimeBudget;
+            JS_SetInterruptHandler(_runtime.rt, InterruptHandler, _budget.get());
+        }
+    }
+
+    ~QuickJSRuntime()
+    {
+        _asyncCompletions->Close();
+    }
+
+    static QuickJSRuntime& FromRuntime(jsi::Runtime& runtime)
+    {
+        auto quickJSRuntime = dynamic_cast<QuickJSRuntime*>(&runtime);
+        if (!quickJSRuntime)
+        {
+            throw jsi::JSINativeException("The runtime is not a QuickJS runtime");
+        }
+
+        return *quickJSRuntime;
+    }
+
+    // Property plans are used in loops over many objects, so their runtime is found without a dynamic_cast.
+    static QuickJSRuntime& FromPropertyPlan(jsi::Runtime& runtime, PropertyPlan& plan)
+    {
+        auto& owner = static_cast<QuickJSPropertyPlan&>(plan).owner();
+        if (&runtime != &owner)
+        {
+            throw jsi::JSINativeException("The property plan belongs to another runtime");
+        }
+
+        return owner;
+    }
+
+    jsi::Function createAsyncFunction(const jsi::PropNameID& name, unsigned int paramCount, AsyncHostFunctionType func)
     {
-        return QuickJSAtomPointerValue::GetJSAtom(getPointerValue(propertyId));
+        return createFunctionFromHostFunction(name, paramCount,
+            [func = std::move(func)](jsi::Runtime& rt, const jsi::Value& thisValue, const jsi::Value* args, size_t count) -> jsi::Value
+            {
+                auto& self = static_cast<QuickJSRuntime&>(rt);
+
+                std::array<JSValue, 2> resolvingFuncs;
+                qjs::Value promise = self._context.newValue(self.CheckJSValue(JS_NewPromiseCapability(self._context.ctx, resolvingFuncs.data())));
+                uint64_t callId = self._nextAsyncCallId++;
+                self._pendingAsyncCalls.emplace(callId, PendingAsyncCall {
+                    self._context.newValue(std::move(resolvingFuncs[0])),
+                    self._context.newValue(std::move(resolvingFuncs[1])) });
+
+                try
+                {
+                    func(rt, thisValue, args, count, std::make_shared<AsyncHostFunctionResolverImpl>(self._asyncCompletions, callId));
+                }
+                catch (...)
+                {
+                    // The host function failed synchronously: report it as a regular exception.
+                    self._pendingAsyncCalls.erase(callId);
+                    throw;
+                }
+
+                return self.createValue(std::move(promise));
+            });
     }
 
-    template <typename T>
-    static JSValue AsJSValue(const T& obj) noexcept
+    void drainAsyncCompletions()
     {
-        return QuickJSPointerValue::GetJSValue(getPointerValue(obj));
+        // The outermost scope drains the completion queue and runs the promise jobs.
+        PendingExecutionScope scope(*this);
+        scope.ExecutePendingJobs();
     }
 
-    JSValue AsJSValue(const jsi::Value& value) noexcept
+    bool hasPendingEventLoopWork()
     {
-        return fromJSIValue(value).v;
+        EventLoopState& loop = RequireEventLoop();
+        return !loop.timerCallbacks.empty() || !loop.immediateQueue.empty()
+            || !_pendingAsyncCalls.empty() || JS_IsJobPending(_runtime.rt);
     }
 
-    JSValueConst AsJSValueConst(const jsi::Value& value) const noexcept
+    void runEventLoopOnce()
     {
-        if (value.isUndefined())
+        EventLoopState& loop = RequireEventLoop();
+        loop.waiter->Acknowledge();
+        drainAsyncCompletions();
+
+        // Keep going after a callback throws so that no other due timer is lost,
+        // then report the first error to the caller.
+        std::exception_ptr firstError;
+        auto invoke = [&](const TimerCallback& callback)
         {
-            return JS_UNDEFINED;
-        }
-        else if (value.isNull())
+            try
+            {
+                InvokeTimerCallback(callback);
+            }
+            catch (...)
+            {
+                if (!firstError)
+                {
+                    firstError = std::current_exception();
+                }
+            }
+        };
+
+        std::vector<uint64_t> expired;
+        loop.timers.Advance(EventLoopNow(), expired);
+        for (uint64_t id : expired)
         {
-            return JS_NULL;
+            auto it = loop.timerCallbacks.find(id);
+            if (it == loop.timerCallbacks.end())
+            {
+                continue;
+            }
+
+            if (it->second.repeat)
+            {
+                loop.timers.Schedule(id, loop.timers.Now() + it->second.interval);
+                TimerCallback callback = it->second;
+                invoke(callback);
+            }
+            else
+            {
+                TimerCallback callback = std::move(it->second);
+                loop.timerCallbacks.erase(it);
+                invoke(callback);
+            }
         }
-        else if (value.isBool())
+
+        // Immediates scheduled by these callbacks run on the next iteration.
+        std::vector<uint64_t> immediates;
+        immediates.swap(loop.immediateQueue);
+        for (uint64_t id : immediates)
         {
-            return value.getBool() ? JS_TRUE : JS_FALSE;
+            auto it = loop.immediateCallbacks.find(id);
+            if (it == loop.immediateCallbacks.end())
+            {
+                continue;
+            }
+
+            TimerCallback callback = std::move(it->second);
+            loop.immediateCallbacks.erase(it);
+            invoke(callback);
         }
-        else if (value.isNumber())
+
+        if (!loop.immediateQueue.empty() || JS_IsJobPending(_runtime.rt))
         {
-            return JS_NewFloat64(_context.ctx, value.getNumber());
+            loop.waiter->Wake();
         }
-        else if (value.isSymbol())
+        else if (auto next = loop.timers.NextExpiry())
         {
-            return QuickJSPointerValue::GetJSValue(getPointerValue(value));
+            uint64_t now = EventLoopNow();
+            loop.waiter->ArmTimer(*next > now ? *next - now : 0);
         }
-        else if (value.isString())
+        else
         {
-            return QuickJSPointerValue::GetJSValue(getPointerValue(value));
+            loop.waiter->ArmTimer(std::nullopt);
         }
-        else if (value.isObject())
+
+        if (firstError)
         {
-            return QuickJSPointerValue::GetJSValue(getPointerValue(value));
+            std::rethrow_exception(firstError);
         }
-        else
+    }
+
+    void runEventLoop()
+    {
+        EventLoopState& loop = RequireEventLoop();
+        for (;;)
         {
-            QJS_VERIFY_ELSE_CRASH_MSG(false, "Unknown JSI Value kind");
+            runEventLoopOnce();
+            if (!hasPendingEventLoopWork())
+            {
+                break;
+            }
+
+            loop.waiter->Wait();
         }
     }
 
-    JSValueConst AsJSValueConst(const jsi::Pointer& ptr) const noexcept
+    int getEventLoopFd()
     {
-        return QuickJSPointerValue::GetJSValue(getPointerValue(ptr));
+        return RequireEventLoop().waiter->fd();
     }
 
-    template <typename T>
-    static qjs::Value AsValue(const T& obj) noexcept
+    InlineCacheStats getInlineCacheStats() noexcept
     {
-        return QuickJSPointerValue::GetValue(getPointerValue(obj));
+        JSInlineCacheStats stats;
+        JS_GetInlineCacheStats(_runtime.rt, &stats);
+        return { static_cast<uint64_t>(stats.get_hits), static_cast<uint64_t>(stats.get_misses),
+            static_cast<uint64_t>(stats.put_hits), static_cast<uint64_t>(stats.put_misses) };
     }
 
-    JSValue CloneJSValue(const jsi::Value& value) noexcept
+    void resetInlineCacheStats() noexcept
     {
-        return JS_DupValue(_context.ctx, AsJSValueConst(value));
+        JS_ResetInlineCacheStats(_runtime.rt);
     }
 
-    std::string getExceptionDetails()
+    std::vector<jsi::PropNameID> createPropNameIDs(const std::vector<std::string_view>& names)
     {
-        auto exc = _context.getException();
-
-        std::stringstream strstream;
-        strstream << (std::string) exc << std::endl;
-
-        if (JS_HasProperty(_context.ctx, exc.v, Atom{_context.ctx, "stack"}.a))
+        std::vector<const char*> strs;
+        std::vector<size_t> lengths;
+        strs.reserve(names.size());
+        lengths.reserve(names.size());
+        for (const auto& name : names)
         {
-            strstream << (std::string) exc["stack"] << std::endl;
+            strs.push_back(name.data());
+            lengths.push_back(name.size());
         }
 
-        return strstream.str();
-    }
-
-    [[noreturn]]
-    void ThrowJSError() const
-    {
-        auto self = const_cast<QuickJSRuntime*>(this);
-        auto exc = self->_context.getException();
-        std::string message;
-        std::string stack;
-        if (JS_HasProperty(_context.ctx, exc.v, Atom{_context.ctx, "message"}.a))
+        std::vector<JSAtom> atoms(names.size());
+        if (JS_NewAtoms(_context.ctx, atoms.data(), strs.data(), lengths.data(), static_cast<uint32_t>(names.size())) < 0)
         {
-            message = (std::string)exc["message"];
+            ThrowJSError();
         }
-        if (JS_HasProperty(_context.ctx, exc.v, Atom{_context.ctx, "stack"}.a))
+
+        std::vector<jsi::PropNameID> result;
+        result.reserve(atoms.size());
+        for (auto& atom : atoms)
         {
-            stack = (std::string)exc["stack"];
+            result.push_back(createPropNameID(std::move(atom)));
         }
 
-        throw jsi::JSError(*self, std::move(message), std::move(stack));
+        return result;
     }
 
-    // Throw if value is negative. It indicates an error. 
-    int CheckBool(int value)
+    std::unique_ptr<PropertyPlan> createPropertyPlan(const std::vector<std::string_view>& names)
     {
-        if (value < 0)
+        // The plan keeps its own references to the atoms.
+        std::vector<jsi::PropNameID> propNameIDs = createPropNameIDs(names);
+        std::vector<JSAtom> atoms;
+        atoms.reserve(propNameIDs.size());
+        for (const auto& propNameID : propNameIDs)
         {
-            ThrowJSError();
+            atoms.push_back(AsJSAtomConst(propNameID));
         }
 
-        return value;
-    }
-
-    JSValue CheckJSValue(JSValue&& value)
-    {
-        if (JS_IsException(value))
+        JSPropertyPlan* plan = JS_NewPropertyPlan(_context.ctx, atoms.data(), static_cast<uint32_t>(atoms.size()));
+        if (!plan)
         {
             ThrowJSError();
         }
 
-        return std::move(value);
-    }
-
-    static QuickJSRuntime* FromContext(JSContext* ctx)
-    {
-        return static_cast<QuickJSRuntime*>(JS_GetContextOpaque(ctx));
+        return std::make_unique<QuickJSPropertyPlan>(*this, plan, atoms.size());
     }
 
-    static int SetException(JSContext* ctx, const char* message, const char* stack)
+    void getProperties(const jsi::Object& obj, PropertyPlan& plan, jsi::Value* values)
     {
-        JSValue errorObj = JS_NewError(ctx);
-        if (JS_IsException(errorObj))
+        auto& quickJSPlan = static_cast<QuickJSPropertyPlan&>(plan);
+        PlanValues jsValues(plan.size());
+        if (JS_GetPropertiesByPlan(_context.ctx, AsJSValueConst(obj), quickJSPlan.get(), jsValues.data()) < 0)
         {
-            errorObj = JS_NULL;
+            ThrowJSError();
         }
-        else
+
+        // The values are built in place, as jsi::Value has no inline move assignment.
+        size_t size = plan.size();
+        for (size_t i = 0; i < size; ++i)
         {
-            if (!message)
+            values[i].~Value();
+            try
             {
-                message = "Unknown error";
+                new (&values[i]) jsi::Value(createValue(std::move(jsValues.data()[i])));
             }
-
-            JS_DefinePropertyValue(ctx, errorObj, Atom{ctx, "message"}.a,
-                JS_NewString(ctx, message),
-                JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE);
-
-            if (stack)
+            catch (...)
             {
-                JS_DefinePropertyValue(ctx, errorObj, Atom{ctx, "stack"}.a,
-                    JS_NewString(ctx, stack),
-                    JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE);
+                new (&values[i]) jsi::Value();
+                while (++i < size)
+                {
+                    JS_FreeValue(_context.ctx, jsValues.data()[i]);
+                }
+
+                throw;
             }
         }
-
-        JS_Throw(ctx, errorObj);
-        return -1;
     }
 
-    bool _dontExecutePending{false};
-    struct PendingExecutionScope
+    void setProperties(const jsi::Object& obj, PropertyPlan& plan, const jsi::Value* values)
     {
-        PendingExecutionScope(QuickJSRuntime& rt)
-            : _pushedScope{std::exchange(rt._dontExecutePending, true)} 
-            , _rt(rt)
+        auto& quickJSPlan = static_cast<QuickJSPropertyPlan&>(plan);
+        PlanValues jsValues(plan.size());
+        for (size_t i = 0; i < plan.size(); ++i)
         {
+            jsValues.data()[i] = JS_DupValue(_context.ctx, AsJSValueConst(values[i]));
         }
 
-        ~PendingExecutionScope()
+        if (JS_SetPropertiesByPlan(_context.ctx, AsJSValueConst(obj), quickJSPlan.get(), jsValues.data()) < 0)
         {
-            _rt._dontExecutePending = _pushedScope;
-            // Do not run if there is a new exception in the scope
-            if (_uncaughtExceptions == std::uncaught_exceptions())
-            {
-                ExecutePendingJobs();
-            }
+            ThrowJSError();
         }
+    }
 
-    private:
-        void ExecutePendingJobs()
+    jsi::Object createObjectFromPlan(PropertyPlan& plan, const jsi::Value* values)
+    {
+        auto& quickJSPlan = static_cast<QuickJSPropertyPlan&>(plan);
+        PlanValues jsValues(plan.size());
+        for (size_t i = 0; i < plan.size(); ++i)
         {
-            if (_rt._dontExecutePending)
-                return;
+            jsValues.data()[i] = JS_DupValue(_context.ctx, AsJSValueConst(values[i]));
+        }
 
-            JSContext *ctx1{nullptr};
-            int err{1};
-            while (err > 0)
+        return createValue(JS_NewObjectFromPlan(_context.ctx, quickJSPlan.get(), jsValues.data())).getObject(*this);
+    }
+
+    bool stringifyJson(const jsi::Value& value, std::vector<uint8_t>& output)
+    {
+        auto append = [](void* opaque, const uint8_t* buf, size_t len) noexcept -> int
+        {
+            try
             {
-                err = JS_ExecutePendingJob(_rt._runtime.rt, &ctx1);
-                if (err < 0) {
-                    // TODO: throw exception details from ctx1
-                    _rt.ThrowJSError();
-                }
+                auto& bytes = *static_cast<std::vector<uint8_t>*>(opaque);
+                bytes.insert(bytes.end(), buf, buf + len);
+                return 0;
+            }
+            catch (const std::bad_alloc&)
+            {
+                return -1;
             }
+        };
 
-            // JS_RunGC(_rt._runtime.rt);
+        // toJSON methods and getters run JavaScript.
+        PendingExecutionScope scope(*this);
+        size_t size = output.size();
+        int result = JS_JSONStringifyUTF8(_context.ctx, AsJSValueConst(value), JS_UNDEFINED, JS_UNDEFINED, append, &output);
+        if (result < 0)
+        {
+            output.resize(size);
+            ThrowJSError();
         }
 
-        bool _pushedScope;
-        QuickJSRuntime &_rt;
-        int _uncaughtExceptions{std::uncaught_exceptions()};
-    };
+        scope.ExecutePendingJobs();
+        return result > 0;
+    }
 
-public:
-    QuickJSRuntime(QuickJSRuntimeArgs&& args) :
-        _runtime(), _context(_runtime)
+    JSContext* context() const noexcept
     {
-        JS_SetContextOpaque(_context.ctx, this);
+        return _context.ctx;
     }
 
-    ~QuickJSRuntime()
+    JSValueConst getJSValue(const jsi::Value& value) const noexcept
+    {
+        return AsJSValueConst(value);
+    }
+
+    jsi::Value createJSIValue(JSValue&& value)
     {
+        return createValue(std::move(value));
     }
 
     virtual jsi::Value evaluateJavaScript(const std::shared_ptr<const jsi::Buffer>& buffer, const std::string& sourceURL) override try
@@ -507,8 +1600,10 @@ public:
         {
             PendingExecutionScope scope(*this);
 
-            auto val = _context.eval(reinterpret_cast<const char *>(buffer->data()), sourceURL.c_str(), JS_EVAL_TYPE_GLOBAL);
+            int flags = JS_EVAL_TYPE_GLOBAL | DebugInfoEvalFlags(GetScriptDebugInfo(sourceURL)) | (_lazyCompilation ? JS_EVAL_FLAG_LAZY : 0);
+            auto val = _context.eval(reinterpret_cast<const char *>(buffer->data()), sourceURL.c_str(), flags);
             result = createValue(std::move(val));
+            scope.ExecutePendingJobs();
         }
 
         return result;
@@ -520,9 +1615,13 @@ public:
 
     virtual std::shared_ptr<const jsi::PreparedJavaScript> prepareJavaScript(const std::shared_ptr<const jsi::Buffer>& buffer, std::string sourceURL) override try
     {
-        // TODO: NYI
-        //std::abort();
-        return nullptr;
+        auto prepared = CompileToBytecode(_context.ctx, *buffer, sourceURL, GetScriptDebugInfo(sourceURL));
+        if (!prepared)
+        {
+            ThrowJSError();
+        }
+
+        return prepared;
     }
     catch (qjs::exception&)
     {
@@ -531,9 +1630,22 @@ public:
 
     virtual jsi::Value evaluatePreparedJavaScript(const std::shared_ptr<const jsi::PreparedJavaScript>& js) override try
     {
-        // TODO: NYI
-        //std::abort();
-        return jsi::Value();
+        auto prepared = std::dynamic_pointer_cast<const QuickJSPreparedJavaScript>(js);
+        if (!prepared)
+        {
+            throw jsi::JSINativeException("The prepared JavaScript was not created by a QuickJS runtime");
+        }
+
+        jsi::Value result;
+        {
+            PendingExecutionScope scope(*this);
+
+            JSValue func = CheckJSValue(JS_ReadObject(_context.ctx, prepared->bytecode.data(), prepared->bytecode.size(), JS_READ_OBJ_BYTECODE));
+            result = createValue(JS_EvalFunction(_context.ctx, func));
+            scope.ExecutePendingJobs();
+        }
+
+        return result;
     }
     catch (qjs::exception&)
     {
@@ -559,6 +1671,11 @@ public:
         return false;
     }
 
+    virtual jsi::Instrumentation& instrumentation() override
+    {
+        return _instrumentation;
+    }
+
     virtual PointerValue* cloneSymbol(const Runtime::PointerValue* pv) override try
     {
         return new QuickJSPointerValue(QuickJSPointerValue::GetValue(pv));
@@ -686,6 +1803,15 @@ public:
         ThrowJSError();
     }
 
+    virtual jsi::Value createValueFromJsonUtf8(const uint8_t* json, size_t length) override try
+    {
+        return createValue(JS_ParseJSON(_context.ctx, reinterpret_cast<const char*>(json), length, "<input>"));
+    }
+    catch (qjs::exception&)
+    {
+        ThrowJSError();
+    }
+
     virtual std::string utf8(const jsi::String& str) override try
     {
         return AsValue(str).as<std::string>();
@@ -712,6 +1838,7 @@ public:
         }
 
         std::shared_ptr<jsi::HostObject> _hostObject;
+        size_t _externalMemory { 0 };
     };
 
     virtual jsi::Object createObject(std::shared_ptr<jsi::HostObject> hostObject) override try
@@ -815,6 +1942,7 @@ public:
             {
                 // Take ownership of proxy object to delete it
                 std::unique_ptr<HostObjectProxy> proxy { GetProxy(val) };
+                JS_AdjustExternalMemory(rt, -static_cast<int64_t>(proxy->_externalMemory));
             }
 
             static HostObjectProxy* GetProxy(JSValue obj)
@@ -878,6 +2006,29 @@ public:
         ThrowJSError();
     }
 
+    void setExternalMemoryPressure(const jsi::Object& obj, size_t amount)
+    {
+        JSValueConst value = AsJSValueConst(obj);
+        size_t* reported;
+        if (auto hostObject = static_cast<HostObjectProxyBase*>(JS_GetOpaque(value, g_hostObjectClassId)))
+        {
+            reported = &hostObject->_externalMemory;
+        }
+        else if (auto hostFunction = static_cast<HostFunctionProxyBase*>(JS_GetOpaque(value, g_hostFunctionClassId)))
+        {
+            reported = &hostFunction->_externalMemory;
+        }
+        else
+        {
+            throw jsi::JSINativeException("External memory can only be reported for HostObjects and HostFunctions");
+        }
+
+        // The GC threshold is checked on the next allocation, so a large report makes the
+        // collector run soon without collecting from inside the caller.
+        JS_AdjustExternalMemory(_runtime.rt, static_cast<int64_t>(amount) - static_cast<int64_t>(*reported));
+        *reported = amount;
+    }
+
     virtual jsi::Value getProperty(const jsi::Object& obj, const jsi::PropNameID& name) override try
     {
         return createValue(JS_GetProperty(_context.ctx, AsJSValue(obj), AsJSAtomConst(name)));
@@ -1130,6 +2281,7 @@ public:
         }
 
         jsi::HostFunctionType _hostFunction;
+        size_t _externalMemory { 0 };
     };
 
     virtual jsi::Function createFunctionFromHostFunction(const jsi::PropNameID& name, unsigned int paramCount, jsi::HostFunctionType func) override try
@@ -1182,6 +2334,7 @@ public:
             {
                 // Take ownership of proxy object to delete it
                 std::unique_ptr<HostFunctionProxy> proxy { GetProxy(val) };
+                JS_AdjustExternalMemory(rt, -static_cast<int64_t>(proxy->_externalMemory));
             }
 
             static HostFunctionProxy* GetProxy(JSValue obj)
@@ -1294,6 +2447,7 @@ public:
             }
 
             result = createValue(std::move(jsResult));
+            scope.ExecutePendingJobs();
         }
 
         return result;
@@ -1328,6 +2482,7 @@ public:
             }
 
             result = createValue(std::move(jsResult));
+            scope.ExecutePendingJobs();
         }
 
         return result;
@@ -1379,4 +2534,101 @@ std::unique_ptr<jsi::Runtime> __cdecl makeQuickJSRuntime(QuickJSRuntimeArgs&& ar
     return std::make_unique<QuickJSRuntime>(std::move(args));
 }
 
+jsi::Function __cdecl createAsyncFunctionFromHostFunction(jsi::Runtime& runtime,
+    const jsi::PropNameID& name, unsigned int paramCount, AsyncHostFunctionType func)
+{
+    return QuickJSRuntime::FromRuntime(runtime).createAsyncFunction(name, paramCount, std::move(func));
+}
+
+void __cdecl drainAsyncCompletions(jsi::Runtime& runtime)
+{
+    QuickJSRuntime::FromRuntime(runtime).drainAsyncCompletions();
+}
+
+void __cdecl runEventLoopOnce(jsi::Runtime& runtime)
+{
+    QuickJSRuntime::FromRuntime(runtime).runEventLoopOnce();
+}
+
+void __cdecl runEventLoop(jsi::Runtime& runtime)
+{
+    QuickJSRuntime::FromRuntime(runtime).runEventLoop();
+}
+
+bool __cdecl hasPendingEventLoopWork(jsi::Runtime& runtime)
+{
+    return QuickJSRuntime::FromRuntime(runtime).hasPendingEventLoopWork();
+}
+
+int __cdecl getEventLoopFd(jsi::Runtime& runtime)
+{
+    return QuickJSRuntime::FromRuntime(runtime).getEventLoopFd();
+}
+
+void __cdecl setExternalMemoryPressure(jsi::Runtime& runtime, const jsi::Object& obj, size_t amount)
+{
+    QuickJSRuntime::FromRuntime(runtime).setExternalMemoryPressure(obj, amount);
+}
+
+std::unique_ptr<PropertyPlan> __cdecl createPropertyPlan(jsi::Runtime& runtime, const std::vector<std::string_view>& names)
+{
+    return QuickJSRuntime::FromRuntime(runtime).createPropertyPlan(names);
+}
+
+void __cdecl getProperties(jsi::Runtime& runtime, const jsi::Object& obj, PropertyPlan& plan, jsi::Value* values)
+{
+    QuickJSRuntime::FromPropertyPlan(runtime, plan).getProperties(obj, plan, values);
+}
+
+void __cdecl setProperties(jsi::Runtime& runtime, jsi::Object& obj, PropertyPlan& plan, const jsi::Value* values)
+{
+    QuickJSRuntime::FromPropertyPlan(runtime, plan).setProperties(obj, plan, values);
+}
+
+jsi::Object __cdecl createObjectFromPlan(jsi::Runtime& runtime, PropertyPlan& plan, const jsi::Value* values)
+{
+    return QuickJSRuntime::FromPropertyPlan(runtime, plan).createObjectFromPlan(plan, values);
+}
+
+InlineCacheStats __cdecl getInlineCacheStats(jsi::Runtime& runtime)
+{
+    return QuickJSRuntime::FromRuntime(runtime).getInlineCacheStats();
+}
+
+void __cdecl resetInlineCacheStats(jsi::Runtime& runtime)
+{
+    QuickJSRuntime::FromRuntime(runtime).resetInlineCacheStats();
+}
+
+std::vector<jsi::PropNameID> __cdecl createPropNameIDs(jsi::Runtime& runtime, const std::vector<std::string_view>& names)
+{
+    return QuickJSRuntime::FromRuntime(runtime).createPropNameIDs(names);
+}
+
+jsi::Value __cdecl parseJson(jsi::Runtime& runtime, const jsi::Buffer& json)
+{
+    return jsi::Value::createFromJsonUtf8(runtime, json.data(), json.size());
+}
+
+bool __cdecl stringifyJson(jsi::Runtime& runtime, const jsi::Value& value, std::vector<uint8_t>& output)
+{
+    return QuickJSRuntime::FromRuntime(runtime).stringifyJson(value, output);
+}
+
+JSContext* GetJSContext(jsi::Runtime& runtime) noexcept
+{
+    auto quickJSRuntime = dynamic_cast<QuickJSRuntime*>(&runtime);
+    return quickJSRuntime ? quickJSRuntime->context() : nullptr;
+}
+
+JSValueConst GetJSValue(jsi::Runtime& runtime, const jsi::Value& value)
+{
+    return QuickJSRuntime::FromRuntime(runtime).getJSValue(value);
+}
+
+jsi::Value CreateJSIValue(jsi::Runtime& runtime, JSValue&& value)
+{
+    return QuickJSRuntime::FromRuntime(runtime).createJSIValue(std::move(value));
+}
+
 }
@@ -1,13 +1,181 @@
 #pragma once
 #include <jsi/jsi.h>
 
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
 namespace quickjs {
 
+// The debug information kept for the functions of a script.
+enum class ScriptDebugInfo
+{
+	// Line numbers for stack traces and the source text for Function.prototype.toString.
+	Full,
+	// Line numbers only. Function.prototype.toString returns a placeholder body.
+	NoSource,
+	// Neither: stack frames have no location and the variable names are dropped too.
+	None,
+};
+
 struct QuickJSRuntimeArgs
 {
 	bool enableTracing { false };
+
+	// Installs setTimeout/setInterval/setImmediate/queueMicrotask and their clear functions.
+	// The host drives the loop with runEventLoop or runEventLoopOnce.
+	bool enableEventLoop { false };
+
+	// Time budgets for running JavaScript, measured with a monotonic clock. Zero means unlimited.
+	// callTimeBudget applies to every top-level entry into JS (evaluation, call, event loop task)
+	// including the microtasks it queues; runtimeTimeBudget applies to the total time spent in JS
+	// over the lifetime of the runtime. They are checked from the QuickJS interrupt handler, so
+	// time spent inside a single native builtin or host function is not interrupted.
+	std::chrono::milliseconds callTimeBudget { 0 };
+	std::chrono::milliseconds runtimeTimeBudget { 0 };
+
+	// Compiles the top-level functions of a script run by evaluateJavaScript on their first call,
+	// so the functions of a bundle that never run cost neither compile time nor memory. They are
+	// still parsed up front and syntax errors are reported by evaluateJavaScript as before.
+	// Compiling needs the source text, so it does not apply to scripts without it, nor to
+	// prepareJavaScript, whose bytecode must be complete.
+	bool enableLazyCompilation { false };
+
+	// Chooses the debug information kept for each script of evaluateJavaScript and prepareJavaScript,
+	// for example to drop it from large production bundles. Scripts keep all of it when unset.
+	std::function<ScriptDebugInfo(const std::string& sourceURL)> scriptDebugInfo;
+};
+
+// Thrown when JavaScript execution is interrupted because it exceeded a time budget.
+// Script code cannot catch the interruption, and the runtime stays usable afterwards.
+class ExecutionTimeoutError : public facebook::jsi::JSError
+{
+public:
+	using facebook::jsi::JSError::JSError;
 };
 
 std::unique_ptr<facebook::jsi::Runtime> __cdecl makeQuickJSRuntime(QuickJSRuntimeArgs&& args);
 
+// Settles the promise returned by an async host function.
+// Both methods may be called from any thread. The completion is queued and applied
+// on the runtime thread the next time it drains pending jobs, so no JS state is
+// touched off-thread. Only the first call has an effect. A resolver that is destroyed
+// without being settled rejects its promise.
+class AsyncHostFunctionResolver
+{
+public:
+	// Invoked on the runtime thread to produce the resolution value.
+	using ValueFactory = std::function<facebook::jsi::Value(facebook::jsi::Runtime&)>;
+
+	virtual ~AsyncHostFunctionResolver() = default;
+
+	virtual void resolve(ValueFactory&& valueFactory) = 0;
+	virtual void reject(std::string message) = 0;
+};
+
+using AsyncHostFunctionType = std::function<void(facebook::jsi::Runtime& runtime, const facebook::jsi::Value& thisValue,
+	const facebook::jsi::Value* args, size_t count, std::shared_ptr<AsyncHostFunctionResolver> resolver)>;
+
+// Creates a function that returns a Promise. The host function runs synchronously on the
+// runtime thread and may hand the resolver to a worker thread to complete the work.
+facebook::jsi::Function __cdecl createAsyncFunctionFromHostFunction(facebook::jsi::Runtime& runtime,
+	const facebook::jsi::PropNameID& name, unsigned int paramCount, AsyncHostFunctionType func);
+
+// Applies queued async completions and runs the resulting promise jobs.
+// Completions are also drained automatically whenever a call into JS returns.
+void __cdecl drainAsyncCompletions(facebook::jsi::Runtime& runtime);
+
+struct ScriptSource
+{
+	std::shared_ptr<const facebook::jsi::Buffer> buffer;
+	std::string sourceURL;
+	ScriptDebugInfo debugInfo { ScriptDebugInfo::Full };
+};
+
+// Compiles the scripts to bytecode concurrently on a shared thread pool. Every pool thread
+// parses with its own scratch JSRuntime, so no runtime is blocked while compiling.
+// The results can be run with jsi::Runtime::evaluatePreparedJavaScript on any QuickJS runtime.
+// A script that fails to compile makes its future throw jsi::JSINativeException.
+std::vector<std::future<std::shared_ptr<const facebook::jsi::PreparedJavaScript>>> __cdecl prepareJavaScriptConcurrently(
+	std::vector<ScriptSource> sources);
+
+// Event loop functions. They require QuickJSRuntimeArgs::enableEventLoop.
+
+// Runs due timers, immediates, async completions and microtasks without blocking.
+void __cdecl runEventLoopOnce(facebook::jsi::Runtime& runtime);
+
+// Runs the event loop until there are no timers, immediates or pending async calls left.
+void __cdecl runEventLoop(facebook::jsi::Runtime& runtime);
+
+bool __cdecl hasPendingEventLoopWork(facebook::jsi::Runtime& runtime);
+
+// Returns a file descriptor that becomes readable when runEventLoopOnce has work to do,
+// so the loop can be driven from an external epoll/poll reactor. Returns -1 on platforms
+// without epoll, where runEventLoop must be used instead.
+int __cdecl getEventLoopFd(facebook::jsi::Runtime& runtime);
+
+// Reports the native memory kept alive by a HostObject or HostFunction, replacing the amount
+// reported before. It counts toward the GC threshold together with the JS heap, so the GC runs
+// when host objects hold large native buffers, and it is credited back when the object is finalized.
+void __cdecl setExternalMemoryPressure(facebook::jsi::Runtime& runtime, const facebook::jsi::Object& obj, size_t amount);
+
+// Executions of the property access opcodes (obj.name reads and writes) that were served by
+// their inline cache or needed a full property lookup, since the runtime was created or reset.
+struct InlineCacheStats
+{
+	uint64_t getHits { 0 };
+	uint64_t getMisses { 0 };
+	uint64_t putHits { 0 };
+	uint64_t putMisses { 0 };
+};
+
+InlineCacheStats __cdecl getInlineCacheStats(facebook::jsi::Runtime& runtime);
+void __cdecl resetInlineCacheStats(facebook::jsi::Runtime& runtime);
+
+// Creates the PropNameIDs of a table of UTF-8 names, growing the runtime's atom table once for the
+// whole batch instead of rehashing it as it fills up. Meant for native module registration.
+std::vector<facebook::jsi::PropNameID> __cdecl createPropNameIDs(facebook::jsi::Runtime& runtime,
+	const std::vector<std::string_view>& names);
+
+// A fixed list of property names that native code reads or writes together, for example the fields of
+// the records exchanged with a bridge. The plan remembers where its properties are stored for the last
+// object shapes it has seen, so objects created the same way are accessed without looking the names up.
+// Like a PropNameID, it belongs to the runtime that created it and must be destroyed before it.
+class PropertyPlan
+{
+public:
+	virtual ~PropertyPlan() = default;
+
+	virtual size_t size() const noexcept = 0;
+};
+
+std::unique_ptr<PropertyPlan> __cdecl createPropertyPlan(facebook::jsi::Runtime& runtime,
+	const std::vector<std::string_view>& names);
+
+// Reads the properties of the plan into values[0] to values[plan.size() - 1], as getProperty does
+// for each of them, including getters and inherited properties.
+void __cdecl getProperties(facebook::jsi::Runtime& runtime, const facebook::jsi::Object& obj,
+	PropertyPlan& plan, facebook::jsi::Value* values);
+
+// Writes values[0] to values[plan.size() - 1] to the properties of the plan, as setProperty does
+// for each of them. A setter that throws leaves the following properties unchanged.
+void __cdecl setProperties(facebook::jsi::Runtime& runtime, facebook::jsi::Object& obj,
+	PropertyPlan& plan, const facebook::jsi::Value* values);
+
+// Creates a plain object with the properties of the plan set to the values, like an object literal.
+facebook::jsi::Object __cdecl createObjectFromPlan(facebook::jsi::Runtime& runtime, PropertyPlan& plan,
+	const facebook::jsi::Value* values);
+
+// Parses UTF-8 JSON like JSON.parse, reading the buffer directly instead of copying it into a JS string.
+facebook::jsi::Value __cdecl parseJson(facebook::jsi::Runtime& runtime, const facebook::jsi::Buffer& json);
+
+// Appends the UTF-8 result of JSON.stringify(value) to output without creating a JS string.
+// Returns false and appends nothing when JSON.stringify returns undefined, for example for a function.
+bool __cdecl stringifyJson(facebook::jsi::Runtime& runtime, const facebook::jsi::Value& value, std::vector<uint8_t>& output);
+
 }
@@ -0,0 +1,216 @@
+#include "ScriptCompiler.h"
+#include "QuickJSRuntime.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+using namespace facebook;
+
+namespace quickjs {
+
+int DebugInfoEvalFlags(ScriptDebugInfo debugInfo) noexcept
+{
+    switch (debugInfo)
+    {
+    case ScriptDebugInfo::NoSource:
+        return JS_EVAL_FLAG_STRIP_SOURCE;
+    case ScriptDebugInfo::None:
+        return JS_EVAL_FLAG_STRIP;
+    default:
+        return 0;
+    }
+}
+
+std::shared_ptr<const QuickJSPreparedJavaScript> CompileToBytecode(JSContext* ctx,
+    const jsi::Buffer& buffer, const std::string& sourceURL, ScriptDebugInfo debugInfo)
+{
+    JSValue func = JS_Eval(ctx, reinterpret_cast<const char*>(buffer.data()), buffer.size(), sourceURL.c_str(),
+        JS_EVAL_TYPE_GLOBAL | JS_EVAL_FLAG_COMPILE_ONLY | DebugInfoEvalFlags(debugInfo));
+    if (JS_IsException(func))
+    {
+        return nullptr;
+    }
+
+    size_t size;
+    uint8_t* data = JS_WriteObject(ctx, &size, func, JS_WRITE_OBJ_BYTECODE);
+    JS_FreeValue(ctx, func);
+    if (!data)
+    {
+        return nullptr;
+    }
+
+    std::vector<uint8_t> bytecode { data, data + size };
+    js_free(ctx, data);
+    return std::make_shared<QuickJSPreparedJavaScript>(std::move(bytecode), sourceURL);
+}
+
+namespace {
+
+// Process-wide pool of compiler threads. Each thread lazily creates a scratch runtime
+// that lives as long as the thread, so the runtimes that evaluate the bytecode are
+// never touched off their own thread.
+class CompilerThreadPool
+{
+public:
+    static CompilerThreadPool& Instance()
+    {
+        static CompilerThreadPool pool { std::max(1u, std::thread::hardware_concurrency()) };
+        return pool;
+    }
+
+    void Post(std::function<void()>&& task)
+    {
+        {
+            std::lock_guard<std::mutex> lock { _mutex };
+            _tasks.push_back(std::move(task));
+        }
+
+        _condition.notify_one();
+    }
+
+    ~CompilerThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock { _mutex };
+            _stopping = true;
+        }
+
+        _condition.notify_all();
+        for (auto& thread : _threads)
+        {
+            thread.join();
+        }
+    }
+
+private:
+    explicit CompilerThreadPool(unsigned threadCount)
+    {
+        for (unsigned i = 0; i < threadCount; ++i)
+        {
+            _threads.emplace_back([this]() { Run(); });
+        }
+    }
+
+    void Run()
+    {
+        for (;;)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock { _mutex };
+                _condition.wait(lock, [this]() { return _stopping || !_tasks.empty(); });
+                if (_tasks.empty())
+                {
+                    return;
+                }
+
+                task = std::move(_tasks.front());
+                _tasks.pop_front();
+            }
+
+            task();
+        }
+    }
+
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    std::deque<std::function<void()>> _tasks;
+    std::vector<std::thread> _threads;
+    bool _stopping { false };
+};
+
+struct ScratchRuntime
+{
+    ScratchRuntime() : rt { JS_NewRuntime() }, ctx { rt ? JS_NewContext(rt) : nullptr }
+    {
+        if (!ctx)
+        {
+            throw jsi::JSINativeException("Cannot create a scratch QuickJS runtime");
+        }
+    }
+
+    ~ScratchRuntime()
+    {
+        JS_FreeContext(ctx);
+        JS_FreeRuntime(rt);
+    }
+
+    JSRuntime* rt;
+    JSContext* ctx;
+};
+
+std::string TakeExceptionMessage(JSContext* ctx)
+{
+    JSValue exception = JS_GetException(ctx);
+    std::string message;
+    if (const char* str = JS_ToCString(ctx, exception))
+    {
+        message = str;
+        JS_FreeCString(ctx, str);
+    }
+
+    if (JS_IsError(ctx, exception))
+    {
+        JSValue stack = JS_GetPropertyStr(ctx, exception, "stack");
+        if (const char* str = JS_IsUndefined(stack) ? nullptr : JS_ToCString(ctx, stack))
+        {
+            message += "\n";
+            message += str;
+            JS_FreeCString(ctx, str);
+        }
+
+        JS_FreeValue(ctx, stack);
+    }
+
+    JS_FreeValue(ctx, exception);
+    return message;
+}
+
+std::shared_ptr<const jsi::PreparedJavaScript> CompileOnScratchRuntime(const ScriptSource& source)
+{
+    thread_local ScratchRuntime scratch;
+
+    auto prepared = CompileToBytecode(scratch.ctx, *source.buffer, source.sourceURL, source.debugInfo);
+    if (!prepared)
+    {
+        throw jsi::JSINativeException(TakeExceptionMessage(scratch.ctx));
+    }
+
+    // Parsing leaves atoms and shapes behind; collect them so the scratch runtime stays small.
+    JS_RunGC(scratch.rt);
+    return prepared;
+}
+
+} // namespace
+
+std::vector<std::future<std::shared_ptr<const jsi::PreparedJavaScript>>> __cdecl prepareJavaScriptConcurrently(std::vector<ScriptSource> sources)
+{
+    std::vector<std::future<std::shared_ptr<const jsi::PreparedJavaScript>>> results;
+    results.reserve(sources.size());
+
+    auto& pool = CompilerThreadPool::Instance();
+    for (auto& source : sources)
+    {
+        auto promise = std::make_shared<std::promise<std::shared_ptr<const jsi::PreparedJavaScript>>>();
+        results.push_back(promise->get_future());
+        pool.Post([promise, source = std::move(source)]()
+        {
+            try
+            {
+                promise->set_value(CompileOnScratchRuntime(source));
+            }
+            catch (...)
+            {
+                promise->set_exception(std::current_exception());
+            }
+        });
+    }
+
+    return results;
+}
+
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include "QuickJSRuntime.h"
+
+#include <jsi/jsi.h>
+#include <quickjs.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace quickjs {
+
+// Serialized QuickJS bytecode of a global script.
+// It does not refer to the runtime it was compiled in and can be evaluated by any QuickJS runtime.
+struct QuickJSPreparedJavaScript final : public facebook::jsi::PreparedJavaScript
+{
+    QuickJSPreparedJavaScript(std::vector<uint8_t>&& bytecode, std::string sourceURL) noexcept
+        : bytecode { std::move(bytecode) }, sourceURL { std::move(sourceURL) }
+    {
+    }
+
+    std::vector<uint8_t> bytecode;
+    std::string sourceURL;
+};
+
+// The JS_Eval flags that strip the debug information a script should not keep.
+int DebugInfoEvalFlags(ScriptDebugInfo debugInfo) noexcept;
+
+// Compiles the source into bytecode with the given context.
+// Returns nullptr and leaves the exception pending in the context on failure.
+std::shared_ptr<const QuickJSPreparedJavaScript> CompileToBytecode(JSContext* ctx,
+    const facebook::jsi::Buffer& buffer, const std::string& sourceURL, ScriptDebugInfo debugInfo = ScriptDebugInfo::Full);
+
+}